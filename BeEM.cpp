@@ -1,5 +1,5 @@
 /* Compile this program by: 
- * $ g++ -O3 BeEM.cpp -o BeEM
+ * $ g++ -O3 BeEM.cpp -o BeEM -pthread
  */
 
 const char* docstring=""
@@ -7,9 +7,17 @@ const char* docstring=""
 "    convert PDBx/mmCIF format input file 'input.cif' to Best Effort/Minimal\n"
 "    PDB files. Output results to *-pdb-bundle*\n"
 "\n"
+"BeEM -list=list.txt\n"
+"BeEM folder/\n"
+"    batch mode: convert every mmCIF file listed in 'list.txt' (one file\n"
+"    per line) or every *.cif and *.cif.gz file under 'folder/'. of the\n"
+"    files with the same PDB ID, e.g., 1abc.cif and 1abc.cif.gz, only the\n"
+"    first one is converted and the others are reported as failed\n"
+"\n"
 "option:\n"
 "    -p=xxxx          prefix of output file.\n"
 "                     default is the PDB ID read from the input\n"
+"                     cannot be used in batch mode\n"
 "    -seqres={0,1}    whether to convert SEQRES record\n"
 "                     0 - (default) do not convert SEQRES\n"
 "                     1 - convert SEQRES\n"
@@ -18,7 +26,7 @@ const char* docstring=""
 "                     1 - convert DBREF\n"
 "    -gzip={0,1}      whether to perform gzip compression\n"
 "                     0 - (default) do not perform compression\n"
-"                     1 - perform compression if tar and gzip are available\n"
+"                     1 - perform compression\n"
 "    -upper={0,1,2}   whether to convert PDB header text to upper case\n"
 "                     0 - do not convert to upper case\n"
 "                     1 - (default) only convert header text of single PDB\n"
@@ -44,6 +52,28 @@ const char* docstring=""
 "                            chemical component IDs: 01 - 99, DRG, INH, LIG\n"
 "                     trim - trim the residue name to keep only the first three\n"
 "                            characters\n"
+"    -list=list.txt   list of input files for batch mode\n"
+"    -thread=0        number of threads. in batch mode, input files are\n"
+"                     converted in parallel; otherwise, a large _atom_site\n"
+"                     loop is read in parallel. default is 0, i.e., use all\n"
+"                     available CPU cores\n"
+"    -mem-limit=0     memory in MB that conversions running in parallel in\n"
+"                     batch mode may use, as estimated from input sizes.\n"
+"                     an input that does not fit waits for others to finish;\n"
+"                     one larger than the limit is converted alone with one\n"
+"                     thread. default is 0, i.e., no limit\n"
+"    -shard=i/N       only convert shard i of N (1<=i<=N) of the inputs of\n"
+"                     batch mode. inputs are assigned to shards by a hash of\n"
+"                     the PDB ID in the filename, bounded so that shards\n"
+"                     hold about the same total file size. all nodes must\n"
+"                     list the same files of the same size. a manifest of\n"
+"                     the inputs and output files of the shard is written\n"
+"                     to BeEM-shard-i-of-N.tsv\n"
+"    -uring={0,1}     whether to write output files of batch mode through\n"
+"                     Linux io_uring, which needs fewer system calls\n"
+"                     0 - (default) write files one by one\n"
+"                     1 - use io_uring if the kernel supports it; otherwise\n"
+"                         write files one by one\n"
 ;
 
 #include <vector>
@@ -53,10 +83,22 @@ const char* docstring=""
 #include <fstream>
 #include <sstream>
 #include <map>
+#include <deque>
+#include <unordered_map>
 #include <algorithm>
 #include <iomanip>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <chrono>
+#include <sys/stat.h>
+#include <dirent.h>
 using namespace std;
 
 /* StringTools START */
@@ -88,7 +130,7 @@ string Join(const string sep, const vector<string>& string_vec,
  * line          - input string
  * line_vec      - output vector 
  * delimiter     - delimiter */
-void Split(const string &line, vector<string> &line_vec,
+void Split(const string_view line, vector<string> &line_vec,
     const char delimiter=' ',const bool ignore_quotation=false)
 {
     bool within_word = false;
@@ -171,2385 +213,3672 @@ string rstrip(const string &inputString,const string &char_list=" \n\r\t")
     return result;
 }
 
-inline bool StartsWith(const string &longString, const string &shortString)
+inline bool StartsWith(const string_view longString,
+    const string_view shortString)
 {
     return (longString.size()>=shortString.size() &&
             longString.substr(0,shortString.size())==shortString);
 }
 
-inline bool EndsWith(const string &longString, const string &shortString)
+inline bool EndsWith(const string_view longString,
+    const string_view shortString)
 {
     return (longString.size()>=shortString.size() &&
             longString.substr(longString.size()-shortString.size(),
                 shortString.size())==shortString);
 }
 
-inline string formatString(const string &inputString,const int width=8, 
+/* reformat decimal number text into exactly width characters of buf, with
+ * digit decimal places: surrounding spaces are trimmed, decimals are zero
+ * padded or rounded, "-0.000" loses its sign, and the result is right
+ * aligned or cut to width. text is not copied to the heap unless it is
+ * longer than 60 characters. */
+void formatNumber(const string_view text, char *buf, const int width=8, 
     const int digit=3)
 {
-    string result=Trim(inputString," ");
-    if (StartsWith(result,"00")) result='0'+lstrip(result,"0");
-    size_t found=result.find_first_of('.');
-    int i;
-    if (found==string::npos)
+    size_t begin=text.find_first_not_of(' ');
+    string_view s;
+    if (begin!=string_view::npos)
+        s=text.substr(begin,text.find_last_not_of(' ')+1-begin);
+    size_t n=s.size();
+
+    /* text that already has digit decimals only needs alignment */
+    if (n<=width && n>digit+1 && s[n-digit-1]=='.' && s[0]!='.' &&
+        memchr(s.data(),'.',n-digit-1)==NULL && (s[0]!='0' || s[1]!='0') &&
+        (s[0]!='-' || s[1]!='0' || s[2]!='.'))
     {
-        result+='.';
-        found=result.find_first_of('.');
+        memset(buf,' ',width-n);
+        memcpy(buf+width-n,s.data(),n);
+        return;
     }
-    int curWidth=result.size();
-    if (curWidth<found+digit+1)
-        for (i=0;i<((found+digit+1)-curWidth);i++) result+='0';
-    else if (curWidth>found+digit+1)
+
+    char stack[64];
+    string heap;
+    char *r=stack;
+    size_t cap=sizeof(stack);
+    if (n+digit+3>cap)
     {
-        long int extra_prod=1;
-        for (i=0;i+found+1<curWidth;i++) extra_prod*=10;
-        long int first=atoi((result.substr(0,found)).c_str())*extra_prod;
-        long int second=atoi((lstrip(result.substr(found+1),"0")).c_str());
-        if (result[0]=='-') second=-second;
-        stringstream buf;
-        buf<<fixed<<setprecision(digit)<<(first+second+.5)/extra_prod;
-        result=buf.str();
-        buf.str(string());
+        heap.resize(n+digit+3);
+        r=&heap[0];
+        cap=heap.size();
     }
-    // -0.000
-    if (StartsWith(result,"-0."))
+    size_t i;
+    n=0;
+    if (s.size()>=2 && s[0]=='0' && s[1]=='0')
+    {
+        for (i=0;i<s.size() && s[i]=='0';i++);
+        r[n++]='0';
+        s=s.substr(i);
+    }
+    if (s.size()) memcpy(r+n,s.data(),s.size());
+    n+=s.size();
+    const char *dot=(const char *)memchr(r,'.',n);
+    if (dot==NULL) r[n++]='.';
+    size_t found=(dot==NULL)?n-1:dot-r;
+    if (n<found+digit+1)
+    {
+        memset(r+n,'0',found+digit+1-n);
+        n=found+digit+1;
+    }
+    else if (n>found+digit+1)
     {
-        bool allzero=true;
-        for (i=found+1;i<result.size();i++)
+        long int extra_prod=1;
+        for (i=0;i+found+1<n;i++) extra_prod*=10;
+        r[n]=0;
+        r[found]=0;
+        long int first=atoi(r)*extra_prod;
+        r[found]='.';
+        for (i=found+1;i<n && r[i]=='0';i++);
+        long int second=atoi(r+i);
+        if (r[0]=='-') second=-second;
+        double value=(first+second+.5)/extra_prod;
+        n=snprintf(r,cap,"%.*f",digit,value);
+        if (n>=cap)
         {
-            if (result[i]!='0')
-            {
-                allzero=false;
-                break;
-            }
+            heap.resize(n+1);
+            r=&heap[0];
+            snprintf(r,n+1,"%.*f",digit,value);
         }
-        if (allzero) result=result.substr(1);
     }
-    if (width)
+    // -0.000
+    if (n>=3 && r[0]=='-' && r[1]=='0' && r[2]=='.')
     {
-        curWidth=result.size();
-        if (curWidth>width)
+        for (i=found+1;i<n && r[i]=='0';i++);
+        if (i>=n)
         {
-            result=result.substr(0,width);
-            //result=result.substr(result.size()-width);
+            r++;
+            n--;
         }
-        else if (curWidth<width)
-            for (i=0;i<width-curWidth;i++) result=' '+result;
     }
+    if (n>=width) memcpy(buf,r,width);
+    else
+    {
+        memset(buf,' ',width-n);
+        memcpy(buf+width-n,r,n);
+    }
+}
+
+inline string formatString(const string_view inputString,const int width=8, 
+    const int digit=3)
+{
+    string result(width,' ');
+    formatNumber(inputString,&result[0],width,digit);
     return result;
 }
 
 /* StringTools END */
-/* pstream START */
-
-// PStreams - POSIX Process I/O for C++
-
-//        Copyright (C) 2001 - 2017 Jonathan Wakely
-// Distributed under the Boost Software License, Version 1.0.
-//    (See accompanying file LICENSE_1_0.txt or copy at
-//          http://www.boost.org/LICENSE_1_0.txt)
-//
-
-/* do not compile on windows, which does not have cygwin */
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) && !defined(__CYGWIN__)
-#define NO_PSTREAM
-#else
-
-#ifndef REDI_PSTREAM_H_SEEN
-#define REDI_PSTREAM_H_SEEN
-
-#include <ios>
-#include <streambuf>
-#include <istream>
-#include <ostream>
-#include <string>
-#include <vector>
-#include <algorithm>    // for min()
-#include <cerrno>       // for errno
-#include <cstddef>      // for size_t, NULL
-#include <cstdlib>      // for exit()
-#include <sys/types.h>  // for pid_t
-#include <sys/wait.h>   // for waitpid()
-#include <sys/ioctl.h>  // for ioctl() and FIONREAD
-#if defined(__sun)
-# include <sys/filio.h> // for FIONREAD on Solaris 2.5
-#endif
-#include <unistd.h>     // for pipe() fork() exec() and filedes functions
-#include <signal.h>     // for kill()
-#include <fcntl.h>      // for fcntl()
-#if REDI_EVISCERATE_PSTREAMS
-# include <stdio.h>     // for FILE, fdopen()
-#endif
+/* inflate START */
 
+/* gzip decompression (RFC 1951 and RFC 1952) without external gunzip */
 
-/// The library version.
-#define PSTREAMS_VERSION 0x0101   // 1.0.1
-
-/**
- *  @namespace redi
- *  @brief  All PStreams classes are declared in namespace redi.
- *
- *  Like the standard iostreams, PStreams is a set of class templates,
- *  taking a character type and traits type. As with the standard streams
- *  they are most likely to be used with @c char and the default
- *  traits type, so typedefs for this most common case are provided.
- *
- *  The @c pstream_common class template is not intended to be used directly,
- *  it is used internally to provide the common functionality for the
- *  other stream classes.
- */
-namespace redi
-{
-  /// Common base class providing constants and typenames.
-  struct pstreams
-  {
-    /// Type used to specify how to connect to the process.
-    typedef std::ios_base::openmode           pmode;
-
-    /// Type used to hold the arguments for a command.
-    typedef std::vector<std::string>          argv_type;
-
-    /// Type used for file descriptors.
-    typedef int                               fd_type;
-
-    static const pmode pstdin  = std::ios_base::out; ///< Write to stdin
-    static const pmode pstdout = std::ios_base::in;  ///< Read from stdout
-    static const pmode pstderr = std::ios_base::app; ///< Read from stderr
-
-    /// Create a new process group for the child process.
-    static const pmode newpg   = std::ios_base::trunc;
-
-  protected:
-    enum { bufsz = 32 };  ///< Size of pstreambuf buffers.
-    enum { pbsz  = 2 };   ///< Number of putback characters kept.
-  };
-
-  /// Class template for stream buffer.
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_pstreambuf
-    : public std::basic_streambuf<CharT, Traits>
-    , public pstreams
-    {
-    public:
-      // Type definitions for dependent types
-      typedef CharT                             char_type;
-      typedef Traits                            traits_type;
-      typedef typename traits_type::int_type    int_type;
-      typedef typename traits_type::off_type    off_type;
-      typedef typename traits_type::pos_type    pos_type;
-      /** @deprecated use pstreams::fd_type instead. */
-      typedef fd_type                           fd_t;
-
-      /// Default constructor.
-      basic_pstreambuf();
-
-      /// Constructor that initialises the buffer with @a cmd.
-      basic_pstreambuf(const std::string& cmd, pmode mode);
-
-      /// Constructor that initialises the buffer with @a file and @a argv.
-      basic_pstreambuf( const std::string& file,
-                        const argv_type& argv,
-                        pmode mode );
-
-      /// Destructor.
-      ~basic_pstreambuf();
-
-      /// Initialise the stream buffer with @a cmd.
-      basic_pstreambuf*
-      open(const std::string& cmd, pmode mode);
-
-      /// Initialise the stream buffer with @a file and @a argv.
-      basic_pstreambuf*
-      open(const std::string& file, const argv_type& argv, pmode mode);
-
-      /// Close the stream buffer and wait for the process to exit.
-      basic_pstreambuf*
-      close();
-
-      /// Send a signal to the process.
-      basic_pstreambuf*
-      kill(int signal = SIGTERM);
-
-      /// Send a signal to the process' process group.
-      basic_pstreambuf*
-      killpg(int signal = SIGTERM);
-
-      /// Close the pipe connected to the process' stdin.
-      void
-      peof();
-
-      /// Change active input source.
-      bool
-      read_err(bool readerr = true);
-
-      /// Report whether the stream buffer has been initialised.
-      bool
-      is_open() const;
-
-      /// Report whether the process has exited.
-      bool
-      exited();
-
-#if REDI_EVISCERATE_PSTREAMS
-      /// Obtain FILE pointers for each of the process' standard streams.
-      std::size_t
-      fopen(FILE*& in, FILE*& out, FILE*& err);
-#endif
-
-      /// Return the exit status of the process.
-      int
-      status() const;
-
-      /// Return the error number (errno) for the most recent failed operation.
-      int
-      error() const;
-
-    protected:
-      /// Transfer characters to the pipe when character buffer overflows.
-      int_type
-      overflow(int_type c);
-
-      /// Transfer characters from the pipe when the character buffer is empty.
-      int_type
-      underflow();
-
-      /// Make a character available to be returned by the next extraction.
-      int_type
-      pbackfail(int_type c = traits_type::eof());
-
-      /// Write any buffered characters to the stream.
-      int
-      sync();
-
-      /// Insert multiple characters into the pipe.
-      std::streamsize
-      xsputn(const char_type* s, std::streamsize n);
-
-      /// Insert a sequence of characters into the pipe.
-      std::streamsize
-      write(const char_type* s, std::streamsize n);
-
-      /// Extract a sequence of characters from the pipe.
-      std::streamsize
-      read(char_type* s, std::streamsize n);
-
-      /// Report how many characters can be read from active input without blocking.
-      std::streamsize
-      showmanyc();
-
-    protected:
-      /// Enumerated type to indicate whether stdout or stderr is to be read.
-      enum buf_read_src { rsrc_out = 0, rsrc_err = 1 };
-
-      /// Initialise pipes and fork process.
-      pid_t
-      fork(pmode mode);
-
-      /// Wait for the child process to exit.
-      int
-      wait(bool nohang = false);
-
-      /// Return the file descriptor for the output pipe.
-      fd_type&
-      wpipe();
-
-      /// Return the file descriptor for the active input pipe.
-      fd_type&
-      rpipe();
-
-      /// Return the file descriptor for the specified input pipe.
-      fd_type&
-      rpipe(buf_read_src which);
-
-      void
-      create_buffers(pmode mode);
-
-      void
-      destroy_buffers(pmode mode);
-
-      /// Writes buffered characters to the process' stdin pipe.
-      bool
-      empty_buffer();
-
-      bool
-      fill_buffer(bool non_blocking = false);
-
-      /// Return the active input buffer.
-      char_type*
-      rbuffer();
-
-      buf_read_src
-      switch_read_buffer(buf_read_src);
-
-    private:
-      basic_pstreambuf(const basic_pstreambuf&);
-      basic_pstreambuf& operator=(const basic_pstreambuf&);
-
-      void
-      init_rbuffers();
-
-      pid_t         ppid_;        // pid of process
-      fd_type       wpipe_;       // pipe used to write to process' stdin
-      fd_type       rpipe_[2];    // two pipes to read from, stdout and stderr
-      char_type*    wbuffer_;
-      char_type*    rbuffer_[2];
-      char_type*    rbufstate_[3];
-      /// Index into rpipe_[] to indicate active source for read operations.
-      buf_read_src  rsrc_;
-      int           status_;      // hold exit status of child process
-      int           error_;       // hold errno if fork() or exec() fails
-    };
-
-  /// Class template for common base class.
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class pstream_common
-    : virtual public std::basic_ios<CharT, Traits>
-    , virtual public pstreams
+struct CRC32Table
+{
+    unsigned int t[4][256];
+    CRC32Table()
     {
-    protected:
-      typedef basic_pstreambuf<CharT, Traits>       streambuf_type;
-
-      typedef pstreams::pmode                       pmode;
-      typedef pstreams::argv_type                   argv_type;
-
-      /// Default constructor.
-      pstream_common();
-
-      /// Constructor that initialises the stream by starting a process.
-      pstream_common(const std::string& cmd, pmode mode);
-
-      /// Constructor that initialises the stream by starting a process.
-      pstream_common(const std::string& file, const argv_type& argv, pmode mode);
+        unsigned int c;
+        int n,k;
+        for (n=0;n<256;n++)
+        {
+            c=n;
+            for (k=0;k<8;k++) c=(c&1)?(0xedb88320U^(c>>1)):(c>>1);
+            t[0][n]=c;
+        }
+        for (n=0;n<256;n++) for (k=1;k<4;k++)
+            t[k][n]=(t[k-1][n]>>8)^t[0][t[k-1][n]&0xff];
+    }
+};
 
-      /// Pure virtual destructor.
-      virtual
-      ~pstream_common() = 0;
+unsigned int crc32_update(unsigned int crc, const unsigned char *buf,
+    size_t len)
+{
+    static const CRC32Table table;
+    const unsigned int (*t)[256]=table.t;
+    crc=~crc;
+    while (len>=4)
+    {
+        crc^=buf[0]|(buf[1]<<8)|(buf[2]<<16)|((unsigned int)buf[3]<<24);
+        crc=t[3][crc&0xff]^t[2][(crc>>8)&0xff]^
+            t[1][(crc>>16)&0xff]^t[0][crc>>24];
+        buf+=4;
+        len-=4;
+    }
+    while (len--) crc=t[0][(crc^*buf++)&0xff]^(crc>>8);
+    return ~crc;
+}
 
-      /// Start a process.
-      void
-      do_open(const std::string& cmd, pmode mode);
+const int INFLATE_FAST_BITS=10;
 
-      /// Start a process.
-      void
-      do_open(const std::string& file, const argv_type& argv, pmode mode);
+/* canonical Huffman code. codes up to INFLATE_FAST_BITS long are decoded
+ * by a single lookup of (length<<9|symbol); longer codes are decoded bit
+ * by bit from count[] and symbol[] */
+struct InflateHuffman
+{
+    unsigned short fast[1<<INFLATE_FAST_BITS];
+    unsigned short count[16];
+    unsigned short symbol[288];
+};
 
-    public:
-      /// Close the pipe.
-      void
-      close();
+struct InflateState
+{
+    const unsigned char *in;
+    size_t inpos;
+    size_t insize;
+    unsigned long long bitbuf;
+    int bitcnt;
+    size_t pad;     // number of zero bytes fed after the end of input
+    string *out;
+    size_t outpos;
+};
+
+bool inflate_build(InflateHuffman &h, const unsigned char *length, int n)
+{
+    int len,sym,i;
+    unsigned short offs[16];
+    unsigned int next_code[16];
+    unsigned int code,r;
+    int left=1;
+
+    memset(h.count,0,sizeof(h.count));
+    for (sym=0;sym<n;sym++) h.count[length[sym]]++;
+    h.count[0]=0;
+    for (len=1;len<16;len++)
+    {
+        left<<=1;
+        left-=h.count[len];
+        if (left<0) return false; // over-subscribed
+    }
 
-      /// Report whether the stream's buffer has been initialised.
-      bool
-      is_open() const;
+    offs[1]=0;
+    for (len=1;len<15;len++) offs[len+1]=offs[len]+h.count[len];
+    for (sym=0;sym<n;sym++)
+        if (length[sym]) h.symbol[offs[length[sym]]++]=sym;
 
-      /// Return the command used to initialise the stream.
-      const std::string&
-      command() const;
+    memset(h.fast,0,sizeof(h.fast));
+    code=0;
+    next_code[0]=0;
+    for (len=1;len<16;len++)
+    {
+        code=(code+h.count[len-1])<<1;
+        next_code[len]=code;
+    }
+    for (sym=0;sym<n;sym++)
+    {
+        len=length[sym];
+        if (len==0) continue;
+        code=next_code[len]++;
+        if (len>INFLATE_FAST_BITS) continue;
+        for (r=0,i=0;i<len;i++) r=(r<<1)|((code>>i)&1);
+        for (;r<(1U<<INFLATE_FAST_BITS);r+=(1U<<len))
+            h.fast[r]=(len<<9)|sym;
+    }
+    return true;
+}
 
-      /// Return a pointer to the stream buffer.
-      streambuf_type*
-      rdbuf() const;
+inline void inflate_refill(InflateState &s)
+{
+    while (s.bitcnt<=56)
+    {
+        if (s.inpos<s.insize)
+            s.bitbuf|=(unsigned long long)s.in[s.inpos++]<<s.bitcnt;
+        else s.pad++;
+        s.bitcnt+=8;
+    }
+}
 
-#if REDI_EVISCERATE_PSTREAMS
-      /// Obtain FILE pointers for each of the process' standard streams.
-      std::size_t
-      fopen(FILE*& in, FILE*& out, FILE*& err);
-#endif
+inline unsigned int inflate_bits(InflateState &s, int need)
+{
+    if (s.bitcnt<need) inflate_refill(s);
+    unsigned int val=s.bitbuf&((1ULL<<need)-1);
+    s.bitbuf>>=need;
+    s.bitcnt-=need;
+    return val;
+}
 
-    protected:
-      std::string       command_; ///< The command used to start the process.
-      streambuf_type    buf_;     ///< The stream buffer.
-    };
+/* decode one symbol. return -1 for invalid code */
+inline int inflate_decode(InflateState &s, const InflateHuffman &h)
+{
+    if (s.bitcnt<15) inflate_refill(s);
+    unsigned short entry=h.fast[s.bitbuf&((1<<INFLATE_FAST_BITS)-1)];
+    if (entry)
+    {
+        s.bitbuf>>=(entry>>9);
+        s.bitcnt-=(entry>>9);
+        return entry&511;
+    }
+    int code=0,first=0,index=0,count,len;
+    for (len=1;len<16;len++)
+    {
+        code|=(s.bitbuf>>(len-1))&1;
+        count=h.count[len];
+        if (code-count<first)
+        {
+            s.bitbuf>>=len;
+            s.bitcnt-=len;
+            return h.symbol[index+(code-first)];
+        }
+        index+=count;
+        first+=count;
+        first<<=1;
+        code<<=1;
+    }
+    return -1;
+}
 
+/* discard bits up to the next byte boundary and return unused whole bytes
+ * in bitbuf to the input. return false if more bits were consumed than
+ * available in the input */
+bool inflate_align(InflateState &s)
+{
+    s.bitbuf>>=(s.bitcnt&7);
+    s.bitcnt-=(s.bitcnt&7);
+    size_t bytes=s.bitcnt/8;
+    if (bytes<s.pad) return false;
+    s.inpos-=bytes-s.pad;
+    s.bitbuf=0;
+    s.bitcnt=0;
+    s.pad=0;
+    return true;
+}
 
-  /**
-   * @class basic_ipstream
-   * @brief Class template for Input PStreams.
-   *
-   * Reading from an ipstream reads the command's standard output and/or
-   * standard error (depending on how the ipstream is opened)
-   * and the command's standard input is the same as that of the process
-   * that created the object, unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_ipstream
-    : public std::basic_istream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_istream<CharT, Traits>     istream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-      // Ensure a basic_ipstream will read from at least one pipe
-      pmode readable(pmode mode)
-      {
-        if (!(mode & (pstdout|pstderr)))
-          mode |= pstdout;
-        return mode;
-      }
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_ipstream()
-      : istream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_ipstream(const std::string& cmd, pmode mode = pstdout)
-      : istream_type(NULL), pbase_type(cmd, readable(mode))
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_ipstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdout )
-      : istream_type(NULL), pbase_type(file, argv, readable(mode))
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode|pstdout)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_ipstream(const argv_type& argv, pmode mode = pstdout)
-      : istream_type(NULL), pbase_type(argv.at(0), argv, readable(mode))
-      { }
-
-#if __cplusplus >= 201103L
-      template<typename T>
-        explicit
-        basic_ipstream(std::initializer_list<T> args, pmode mode = pstdout)
-        : basic_ipstream(argv_type(args.begin(), args.end()), mode)
-        { }
-#endif
+inline void inflate_reserve(InflateState &s, size_t need)
+{
+    if (s.outpos+need<=s.out->size()) return;
+    size_t newsize=s.out->size()*2;
+    if (newsize<s.outpos+need) newsize=s.outpos+need+65536;
+    s.out->resize(newsize);
+}
 
-      /**
-       * @brief Destructor.
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_ipstream()
-      { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode|pstdout ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout)
-      {
-        this->do_open(cmd, readable(mode));
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode|pstdout ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout )
-      {
-        this->do_open(file, argv, readable(mode));
-      }
-
-      /**
-       * @brief Set streambuf to read from process' @c stdout.
-       * @return  @c *this
-       */
-      basic_ipstream&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
+bool inflate_codes(InflateState &s, const InflateHuffman &lencode,
+    const InflateHuffman &distcode)
+{
+    static const unsigned short len_base[29]={3,4,5,6,7,8,9,10,11,13,15,
+        17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static const unsigned char len_extra[29]={0,0,0,0,0,0,0,0,1,1,1,1,2,2,
+        2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+    static const unsigned short dist_base[30]={1,2,3,4,5,7,9,13,17,25,33,
+        49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,
+        8193,12289,16385,24577};
+    static const unsigned char dist_extra[30]={0,0,0,0,1,1,2,2,3,3,4,4,5,5,
+        6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+    int sym;
+    size_t len,dist;
+    char *p;
+    while (true)
+    {
+        sym=inflate_decode(s,lencode);
+        if (sym<0 || s.pad*8>s.bitcnt) return false; // truncated input
+        if (sym<256)
+        {
+            inflate_reserve(s,1);
+            (*s.out)[s.outpos++]=sym;
+            continue;
+        }
+        if (sym==256) return s.pad<=s.bitcnt/8;
+        sym-=257;
+        if (sym>=29) return false;
+        len=len_base[sym]+inflate_bits(s,len_extra[sym]);
+        sym=inflate_decode(s,distcode);
+        if (sym<0 || sym>=30) return false;
+        dist=dist_base[sym]+inflate_bits(s,dist_extra[sym]);
+        if (dist>s.outpos) return false;
+        inflate_reserve(s,len);
+        p=&(*s.out)[s.outpos];
+        s.outpos+=len;
+        if (dist>=len) memcpy(p,p-dist,len);
+        else for (;len;len--,p++) *p=*(p-dist);
+    }
+    return true;
+}
 
-    };
+/* fixed Huffman codes of block type 1 */
+struct InflateFixed
+{
+    InflateHuffman lencode;
+    InflateHuffman distcode;
+    InflateFixed()
+    {
+        unsigned char length[288];
+        int sym;
+        for (sym=0;sym<144;sym++) length[sym]=8;
+        for (;sym<256;sym++)      length[sym]=9;
+        for (;sym<280;sym++)      length[sym]=7;
+        for (;sym<288;sym++)      length[sym]=8;
+        inflate_build(lencode,length,288);
+        for (sym=0;sym<30;sym++)  length[sym]=5;
+        inflate_build(distcode,length,30);
+    }
+};
 
+/* decompress one raw deflate stream starting at s.inpos */
+bool inflate_raw(InflateState &s)
+{
+    static const unsigned char order[19]={16,17,18,0,8,7,9,6,10,5,11,4,
+        12,3,13,2,14,1,15};
+    InflateHuffman lencode;
+    InflateHuffman distcode;
+    unsigned char length[320];
+    int last,type,nlen,ndist,ncode,index,sym,i;
+    unsigned int len;
+
+    s.bitbuf=0;
+    s.bitcnt=0;
+    s.pad=0;
+    do
+    {
+        last=inflate_bits(s,1);
+        type=inflate_bits(s,2);
+        if (type==0) // stored block
+        {
+            if (!inflate_align(s) || s.inpos+4>s.insize) return false;
+            len=s.in[s.inpos]|(s.in[s.inpos+1]<<8);
+            if ((s.in[s.inpos+2]|(s.in[s.inpos+3]<<8))!=(~len&0xffff))
+                return false;
+            s.inpos+=4;
+            if (s.inpos+len>s.insize) return false;
+            inflate_reserve(s,len);
+            memcpy(&(*s.out)[s.outpos],s.in+s.inpos,len);
+            s.outpos+=len;
+            s.inpos+=len;
+        }
+        else if (type==1) // fixed Huffman codes
+        {
+            static const InflateFixed fixed;
+            if (!inflate_codes(s,fixed.lencode,fixed.distcode)) return false;
+        }
+        else if (type==2) // dynamic Huffman codes
+        {
+            nlen =inflate_bits(s,5)+257;
+            ndist=inflate_bits(s,5)+1;
+            ncode=inflate_bits(s,4)+4;
+            if (nlen>286 || ndist>30) return false;
+            for (index=0;index<ncode;index++)
+                length[order[index]]=inflate_bits(s,3);
+            for (;index<19;index++) length[order[index]]=0;
+            if (!inflate_build(lencode,length,19)) return false;
+
+            index=0;
+            while (index<nlen+ndist)
+            {
+                sym=inflate_decode(s,lencode);
+                if (sym<0) return false;
+                if (sym<16) length[index++]=sym;
+                else
+                {
+                    len=0;
+                    if (sym==16)
+                    {
+                        if (index==0) return false;
+                        len=length[index-1];
+                        sym=3+inflate_bits(s,2);
+                    }
+                    else if (sym==17) sym=3+inflate_bits(s,3);
+                    else sym=11+inflate_bits(s,7);
+                    if (index+sym>nlen+ndist) return false;
+                    for (i=0;i<sym;i++) length[index++]=len;
+                }
+            }
+            if (length[256]==0) return false;
+            if (!inflate_build(lencode,length,nlen) ||
+                !inflate_build(distcode,length+nlen,ndist)) return false;
+            if (!inflate_codes(s,lencode,distcode)) return false;
+        }
+        else return false;
+    } while (!last);
+    return inflate_align(s);
+}
 
-  /**
-   * @class basic_opstream
-   * @brief Class template for Output PStreams.
-   *
-   * Writing to an open opstream writes to the standard input of the command;
-   * the command's standard output is the same as that of the process that
-   * created the pstream object, unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_opstream
-    : public std::basic_ostream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_ostream<CharT, Traits>     ostream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_opstream()
-      : ostream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_opstream(const std::string& cmd, pmode mode = pstdin)
-      : ostream_type(NULL), pbase_type(cmd, mode|pstdin)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_opstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdin )
-      : ostream_type(NULL), pbase_type(file, argv, mode|pstdin)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode|pstdin)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_opstream(const argv_type& argv, pmode mode = pstdin)
-      : ostream_type(NULL), pbase_type(argv.at(0), argv, mode|pstdin)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param args  a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_opstream(std::initializer_list<T> args, pmode mode = pstdin)
-        : basic_opstream(argv_type(args.begin(), args.end()), mode)
-        { }
-#endif
+inline bool IsGzip(const char *data, size_t size)
+{
+    return size>=2 && (unsigned char)data[0]==0x1f &&
+                      (unsigned char)data[1]==0x8b;
+}
 
-      /**
-       * @brief Destructor
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_opstream() { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode|pstdin ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdin)
-      {
-        this->do_open(cmd, mode|pstdin);
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode|pstdin ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdin)
-      {
-        this->do_open(file, argv, mode|pstdin);
-      }
-    };
+/* decompress all gzip members in data[0:size] into out.
+ * return false for corrupted or truncated input. the whole text is
+ * inflated into one buffer rather than streamed, because tokens are
+ * views into the text and must stay valid until the entry is converted */
+bool gunzip(const char *data, size_t size, string &out)
+{
+    const unsigned char *in=(const unsigned char *)data;
+    InflateState s;
+    s.in=in;
+    s.insize=size;
+    s.inpos=0;
+    s.out=&out;
+    s.outpos=0;
+    size_t isize_hint=0; // uncompressed size of the last member
+    if (size>=4) isize_hint=in[size-4]|(in[size-3]<<8)|(in[size-2]<<16)|
+        ((size_t)in[size-1]<<24);
+    if (isize_hint<=size*1032) out.resize(isize_hint); // max deflate ratio
+
+    size_t pos=0;
+    size_t start;
+    int flg;
+    unsigned int crc,isize;
+    while (IsGzip(data+pos,size-pos))
+    {
+        if (pos+10>size || in[pos+2]!=8) return false;
+        flg=in[pos+3];
+        pos+=10;
+        if (flg&4 && pos+2<=size) pos+=2+(in[pos]|(in[pos+1]<<8)); // FEXTRA
+        if (flg&8)  while (pos<size && in[pos++]);                // FNAME
+        if (flg&16) while (pos<size && in[pos++]);                // FCOMMENT
+        if (flg&2) pos+=2;                                         // FHCRC
+        if (pos>=size) return false;
+
+        start=s.outpos;
+        s.inpos=pos;
+        if (!inflate_raw(s) || s.inpos+8>size) return false;
+        pos=s.inpos;
+        crc  =in[pos]  |(in[pos+1]<<8)|(in[pos+2]<<16)|((unsigned int)in[pos+3]<<24);
+        isize=in[pos+4]|(in[pos+5]<<8)|(in[pos+6]<<16)|((unsigned int)in[pos+7]<<24);
+        pos+=8;
+        if (crc!=crc32_update(0,(const unsigned char *)out.data()+start,
+            s.outpos-start) || isize!=(unsigned int)(s.outpos-start))
+            return false;
+    }
+    out.resize(s.outpos);
+    return pos>0;
+}
 
+/* inflate END */
+/* input START */
 
-  /**
-   * @class basic_pstream
-   * @brief Class template for Bidirectional PStreams.
-   *
-   * Writing to a pstream opened with @c pmode @c pstdin writes to the
-   * standard input of the command.
-   * Reading from a pstream opened with @c pmode @c pstdout and/or @c pstderr
-   * reads the command's standard output and/or standard error.
-   * Any of the process' @c stdin, @c stdout or @c stderr that is not
-   * connected to the pstream (as specified by the @c pmode)
-   * will be the same as the process that created the pstream object,
-   * unless altered by the command itself.
-   */
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_pstream
-    : public std::basic_iostream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_iostream<CharT, Traits>    iostream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_pstream()
-      : iostream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_pstream(const std::string& cmd, pmode mode = pstdout|pstdin)
-      : iostream_type(NULL), pbase_type(cmd, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_pstream( const std::string& file,
-                     const argv_type& argv,
-                     pmode mode = pstdout|pstdin )
-      : iostream_type(NULL), pbase_type(file, argv, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_pstream(const argv_type& argv, pmode mode = pstdout|pstdin)
-      : iostream_type(NULL), pbase_type(argv.at(0), argv, mode)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param l     a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_pstream(std::initializer_list<T> l, pmode mode = pstdout|pstdin)
-        : basic_pstream(argv_type(l.begin(), l.end()), mode)
-        { }
+/* POSIX file I/O is not available on windows, which does not have cygwin */
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__) && !defined(__CYGWIN__))
+#define HAVE_POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
-      /**
-       * @brief Destructor
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_pstream() { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cnd , @a mode ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout|pstdin)
-      {
-        this->do_open(cmd, mode);
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout|pstdin )
-      {
-        this->do_open(file, argv, mode);
-      }
-
-      /**
-       * @brief Set streambuf to read from process' @c stdout.
-       * @return  @c *this
-       */
-      basic_pstream&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
-    };
+/* read-only content of an input file. regular files are memory mapped so
+ * that the parser can take tokens as views into the file without copying.
+ * stdin and gzip compressed files are read into an owned buffer. */
+struct InputFile
+{
+    const char *data;
+    size_t size;
+    string owned;
+    void *map_addr;
+    size_t map_size;
 
+    InputFile(): data(NULL), size(0), map_addr(NULL), map_size(0) {}
+    ~InputFile();
+};
 
-  /**
-   * @class basic_rpstream
-   * @brief Class template for Restricted PStreams.
-   *
-   * Writing to an rpstream opened with @c pmode @c pstdin writes to the
-   * standard input of the command.
-   * It is not possible to read directly from an rpstream object, to use
-   * an rpstream as in istream you must call either basic_rpstream::out()
-   * or basic_rpstream::err(). This is to prevent accidental reads from
-   * the wrong input source. If the rpstream was not opened with @c pmode
-   * @c pstderr then the class cannot read the process' @c stderr, and
-   * basic_rpstream::err() will return an istream that reads from the
-   * process' @c stdout, and vice versa.
-   * Reading from an rpstream opened with @c pmode @c pstdout and/or
-   * @c pstderr reads the command's standard output and/or standard error.
-   * Any of the process' @c stdin, @c stdout or @c stderr that is not
-   * connected to the pstream (as specified by the @c pmode)
-   * will be the same as the process that created the pstream object,
-   * unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_rpstream
-    : public std::basic_ostream<CharT, Traits>
-    , private std::basic_istream<CharT, Traits>
-    , private pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_ostream<CharT, Traits>     ostream_type;
-      typedef std::basic_istream<CharT, Traits>     istream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_rpstream()
-      : ostream_type(NULL), istream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief  Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_rpstream(const std::string& cmd, pmode mode = pstdout|pstdin)
-      : ostream_type(NULL) , istream_type(NULL) , pbase_type(cmd, mode)
-      { }
-
-      /**
-       * @brief  Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file a string containing the pathname of a program to execute.
-       * @param argv a vector of argument strings passed to the new program.
-       * @param mode the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_rpstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdout|pstdin )
-      : ostream_type(NULL), istream_type(NULL), pbase_type(file, argv, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_rpstream(const argv_type& argv, pmode mode = pstdout|pstdin)
-      : ostream_type(NULL), istream_type(NULL),
-        pbase_type(argv.at(0), argv, mode)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param l     a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_rpstream(std::initializer_list<T> l, pmode mode = pstdout|pstdin)
-        : basic_rpstream(argv_type(l.begin(), l.end()), mode)
-        { }
+void close_input(InputFile &input)
+{
+#if defined(HAVE_POSIX)
+    if (input.map_addr) munmap(input.map_addr,input.map_size);
 #endif
+    input.map_addr=NULL;
+    input.map_size=0;
+    string().swap(input.owned);
+    input.data=NULL;
+    input.size=0;
+}
 
-      /// Destructor
-      ~basic_rpstream() { }
-
-      /**
-       * @brief  Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout|pstdin)
-      {
-        this->do_open(cmd, mode);
-      }
-
-      /**
-       * @brief  Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode ).
-       *
-       * @param file a string containing the pathname of a program to execute.
-       * @param argv a vector of argument strings passed to the new program.
-       * @param mode the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout|pstdin )
-      {
-        this->do_open(file, argv, mode);
-      }
-
-      /**
-       * @brief  Obtain a reference to the istream that reads
-       *         the process' @c stdout.
-       * @return @c *this
-       */
-      istream_type&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
-    };
-
+InputFile::~InputFile()
+{
+    close_input(*this);
+}
 
-  /// Type definition for common template specialisation.
-  typedef basic_pstreambuf<char> pstreambuf;
-  /// Type definition for common template specialisation.
-  typedef basic_ipstream<char> ipstream;
-  /// Type definition for common template specialisation.
-  typedef basic_opstream<char> opstream;
-  /// Type definition for common template specialisation.
-  typedef basic_pstream<char> pstream;
-  /// Type definition for common template specialisation.
-  typedef basic_rpstream<char> rpstream;
-
-
-  /**
-   * When inserted into an output pstream the manipulator calls
-   * basic_pstreambuf<C,T>::peof() to close the output pipe,
-   * causing the child process to receive the end-of-file indicator
-   * on subsequent reads from its @c stdin stream.
-   *
-   * @brief   Manipulator to close the pipe connected to the process' stdin.
-   * @param   s  An output PStream class.
-   * @return  The stream object the manipulator was invoked on.
-   * @see     basic_pstreambuf<C,T>::peof()
-   * @relates basic_opstream basic_pstream basic_rpstream
-   */
-  template <typename C, typename T>
-    inline std::basic_ostream<C,T>&
-    peof(std::basic_ostream<C,T>& s)
-    {
-      typedef basic_pstreambuf<C,T> pstreambuf_type;
-      if (pstreambuf_type* p = dynamic_cast<pstreambuf_type*>(s.rdbuf()))
-        p->peof();
-      return s;
-    }
-
-
-  /*
-   * member definitions for pstreambuf
-   */
-
-
-  /**
-   * @class basic_pstreambuf
-   * Provides underlying streambuf functionality for the PStreams classes.
-   */
-
-  /** Creates an uninitialised stream buffer. */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf()
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
-    {
-      init_rbuffers();
-    }
-
-  /**
-   * Initialises the stream buffer by calling open() with the supplied
-   * arguments.
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   open()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf(const std::string& cmd, pmode mode)
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
-    {
-      init_rbuffers();
-      open(cmd, mode);
-    }
-
-  /**
-   * Initialises the stream buffer by calling open() with the supplied
-   * arguments.
-   *
-   * @param file  a string containing the name of a program to execute.
-   * @param argv  a vector of argument strings passsed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   open()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf( const std::string& file,
-                                             const argv_type& argv,
-                                             pmode mode )
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
-    {
-      init_rbuffers();
-      open(file, argv, mode);
-    }
-
-  /**
-   * Closes the stream by calling close().
-   * @see close()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::~basic_pstreambuf()
-    {
-      close();
-    }
-
-  /**
-   * Starts a new process by passing @a command to the shell (/bin/sh)
-   * and opens pipes to the process with the specified @a mode.
-   *
-   * If @a mode contains @c pstdout the initial read source will be
-   * the child process' stdout, otherwise if @a mode  contains @c pstderr
-   * the initial read source will be the child's stderr.
-   *
-   * Will duplicate the actions of  the  shell  in searching for an
-   * executable file if the specified file name does not contain a slash (/)
-   * character.
-   *
-   * @warning
-   * There is no way to tell whether the shell command succeeded, this
-   * function will always succeed unless resource limits (such as
-   * memory usage, or number of processes or open files) are exceeded.
-   * This means is_open() will return true even if @a command cannot
-   * be executed.
-   * Use pstreambuf::open(const std::string&, const argv_type&, pmode)
-   * if you need to know whether the command failed to execute.
-   *
-   * @param   command  a string containing a shell command.
-   * @param   mode     a bitwise OR of one or more of @c out, @c in, @c err.
-   * @return  NULL if the shell could not be started or the
-   *          pipes could not be opened, @c this otherwise.
-   * @see     <b>execl</b>(3)
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::open(const std::string& command, pmode mode)
-    {
-      const char * shell_path = "/bin/sh";
-#if 0
-      const std::string argv[] = { "sh", "-c", command };
-      return this->open(shell_path, argv_type(argv, argv+3), mode);
-#else
-      basic_pstreambuf<C,T>* ret = NULL;
+void read_stream(istream &fp, string &owned)
+{
+    char chunk[65536];
+    while (fp.read(chunk,sizeof(chunk)) || fp.gcount())
+        owned.append(chunk,fp.gcount());
+}
 
-      if (!is_open())
-      {
-        switch(fork(mode))
+/* read infile ("-" for stdin) into input. gzip compression is detected
+ * by the magic number rather than the filename */
+bool open_input(const string &infile, InputFile &input)
+{
+    close_input(input);
+    if (infile=="-") read_stream(cin,input.owned);
+    else
+    {
+#if defined(HAVE_POSIX)
+        int fd=open(infile.c_str(),O_RDONLY);
+        if (fd<0) return false;
+        struct stat st;
+        if (fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
         {
-        case 0 :
-          // this is the new process, exec command
-          ::execl(shell_path, "sh", "-c", command.c_str(), (char*)NULL);
-
-          // can only reach this point if exec() failed
-
-          // parent can get exit code from waitpid()
-          ::_exit(errno);
-          // using std::exit() would make static dtors run twice
-
-        case -1 :
-          // couldn't fork, error already handled in pstreambuf::fork()
-          break;
-
-        default :
-          // this is the parent process
-          // activate buffers
-          create_buffers(mode);
-          ret = this;
+            void *addr=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if (addr!=MAP_FAILED)
+            {
+                madvise(addr,st.st_size,MADV_SEQUENTIAL);
+                input.map_addr=addr;
+                input.map_size=st.st_size;
+            }
         }
-      }
-      return ret;
+        close(fd);
 #endif
+        if (input.map_addr==NULL)
+        {
+            ifstream fp;
+            fp.open(infile.c_str(),ios::in|ios::binary);
+            read_stream(fp,input.owned);
+            fp.close();
+        }
+    }
+    if (input.map_addr)
+    {
+        input.data=(const char *)input.map_addr;
+        input.size=input.map_size;
+    }
+    else
+    {
+        input.data=input.owned.data();
+        input.size=input.owned.size();
     }
 
-  /**
-   * @brief  Helper function to close a file descriptor.
-   *
-   * Inspects @a fd and calls <b>close</b>(3) if it has a non-negative value.
-   *
-   * @param   fd  a file descriptor.
-   * @relates basic_pstreambuf
-   */
-  inline void
-  close_fd(pstreams::fd_type& fd)
-  {
-    if (fd >= 0 && ::close(fd) == 0)
-      fd = -1;
-  }
-
-  /**
-   * @brief  Helper function to close an array of file descriptors.
-   *
-   * Calls @c close_fd() on each member of the array.
-   * The length of the array is determined automatically by
-   * template argument deduction to avoid errors.
-   *
-   * @param   fds  an array of file descriptors.
-   * @relates basic_pstreambuf
-   */
-  template <int N>
-    inline void
-    close_fd_array(pstreams::fd_type (&fds)[N])
-    {
-      for (std::size_t i = 0; i < N; ++i)
-        close_fd(fds[i]);
-    }
-
-  /**
-   * Starts a new process by executing @a file with the arguments in
-   * @a argv and opens pipes to the process with the specified @a mode.
-   *
-   * By convention @c argv[0] should be the file name of the file being
-   * executed.
-   *
-   * If @a mode contains @c pstdout the initial read source will be
-   * the child process' stdout, otherwise if @a mode  contains @c pstderr
-   * the initial read source will be the child's stderr.
-   *
-   * Will duplicate the actions of  the  shell  in searching for an
-   * executable file if the specified file name does not contain a slash (/)
-   * character.
-   *
-   * Iff @a file is successfully executed then is_open() will return true.
-   * Otherwise, pstreambuf::error() can be used to obtain the value of
-   * @c errno that was set by <b>execvp</b>(3) in the child process.
-   *
-   * The exit status of the new process will be returned by
-   * pstreambuf::status() after pstreambuf::exited() returns true.
-   *
-   * @param   file  a string containing the pathname of a program to execute.
-   * @param   argv  a vector of argument strings passed to the new program.
-   * @param   mode  a bitwise OR of one or more of @c out, @c in and @c err.
-   * @return  NULL if a pipe could not be opened or if the program could
-   *          not be executed, @c this otherwise.
-   * @see     <b>execvp</b>(3)
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::open( const std::string& file,
-                                 const argv_type& argv,
-                                 pmode mode )
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-
-      if (!is_open())
-      {
-        // constants for read/write ends of pipe
-        enum { RD, WR };
-
-        // open another pipe and set close-on-exec
-        fd_type ck_exec[] = { -1, -1 };
-        if (-1 == ::pipe(ck_exec)
-            || -1 == ::fcntl(ck_exec[RD], F_SETFD, FD_CLOEXEC)
-            || -1 == ::fcntl(ck_exec[WR], F_SETFD, FD_CLOEXEC))
+    if (IsGzip(input.data,input.size))
+    {
+        string text;
+        bool success=gunzip(input.data,input.size,text);
+        close_input(input);
+        if (!success)
         {
-          error_ = errno;
-          close_fd_array(ck_exec);
+            cerr<<"ERROR! Corrupted gzip file "<<infile<<endl;
+            return false;
         }
-        else
-        {
-          switch(fork(mode))
-          {
-          case 0 :
-            // this is the new process, exec command
-            {
-              char** arg_v = new char*[argv.size()+1];
-              for (std::size_t i = 0; i < argv.size(); ++i)
-              {
-                const std::string& src = argv[i];
-                char*& dest = arg_v[i];
-                dest = new char[src.size()+1];
-                dest[ src.copy(dest, src.size()) ] = '\0';
-              }
-              arg_v[argv.size()] = NULL;
-
-              ::execvp(file.c_str(), arg_v);
-
-              // can only reach this point if exec() failed
+        input.owned.swap(text);
+        input.data=input.owned.data();
+        input.size=input.owned.size();
+    }
+    return input.size>0;
+}
 
-              // parent can get error code from ck_exec pipe
-              error_ = errno;
+/* number of non-empty lines in text, counting at most max_num lines */
+size_t CountLines(const string_view text, const size_t max_num)
+{
+    const char *p=text.data();
+    const char *end=p+text.size();
+    const char *q;
+    size_t num=0;
+    while (p<end && num<max_num)
+    {
+        q=(const char *)memchr(p,'\n',end-p);
+        if (q==NULL) q=end;
+        num+=(q>p);
+        p=q+1;
+    }
+    return num;
+}
 
-              while (::write(ck_exec[WR], &error_, sizeof(error_)) == -1
-                  && errno == EINTR)
-              { }
+/* split text into non-empty lines without copying */
+void SplitLines(const string_view text, vector<string_view> &lines)
+{
+    const char *p=text.data();
+    const char *end=p+text.size();
+    const char *q;
+    while (p<end)
+    {
+        q=(const char *)memchr(p,'\n',end-p);
+        if (q==NULL) q=end;
+        if (q>p) lines.push_back(string_view(p,q-p));
+        p=q+1;
+    }
+}
 
-              ::close(ck_exec[WR]);
-              ::close(ck_exec[RD]);
+/* input END */
+/* cif START */
 
-              ::_exit(error_);
-              // using std::exit() would make static dtors run twice
-            }
+/* tokens of CIF syntax, and records assembled from the tokens */
+enum CifType
+{
+    CIF_END,   // end of input
+    CIF_NAME,  // data name, e.g. _atom_site.id. as a record: a loop column
+    CIF_VALUE, // data value
+    CIF_LOOP,  // loop_
+    CIF_DATA,  // data block header data_xxxx; token is xxxx
+    CIF_PAIR,  // record: data name and its value outside a loop
+    CIF_ROW,   // record: one row of loop values
+    CIF_STOP   // record: end of the current category
+};
+
+/* tokenizer of CIF text. each token is a view into the text: quotation
+ * marks of quoted strings and the ';' delimiters of text fields are
+ * excluded, and comments are skipped. nothing is copied. */
+struct CifTokenizer
+{
+    const char *begin;
+    const char *p;
+    const char *end;
+};
 
-          case -1 :
-            // couldn't fork, error already handled in pstreambuf::fork()
-            close_fd_array(ck_exec);
-            break;
+inline bool cif_space(const char c)
+{
+    return c==' ' || c=='\t' || c=='\n' || c=='\r';
+}
 
-          default :
-            // this is the parent process
+/* case insensitive check whether token starts with lower case word */
+inline bool cif_keyword(const string_view token, const char *word)
+{
+    size_t i;
+    for (i=0;word[i];i++)
+        if (i>=token.size() || tolower(token[i])!=word[i]) return false;
+    return true;
+}
 
-            // check child called exec() successfully
-            ::close(ck_exec[WR]);
-            switch (::read(ck_exec[RD], &error_, sizeof(error_)))
-            {
-            case 0:
-              // activate buffers
-              create_buffers(mode);
-              ret = this;
-              break;
-            case -1:
-              error_ = errno;
-              break;
-            default:
-              // error_ contains error code from child
-              // call wait() to clean up and set ppid_ to 0
-              this->wait();
-              break;
-            }
-            ::close(ck_exec[RD]);
-          }
+int cif_token(CifTokenizer &t, string_view &token)
+{
+    const char *q;
+    const char *s;
+    char c;
+    while (t.p<t.end)
+    {
+        c=*t.p;
+        if (cif_space(c))
+        {
+            t.p++;
+            continue;
         }
-      }
-      return ret;
-    }
-
-  /**
-   * Creates pipes as specified by @a mode and calls @c fork() to create
-   * a new process. If the fork is successful the parent process stores
-   * the child's PID and the opened pipes and the child process replaces
-   * its standard streams with the opened pipes.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c pipe() or @c fork().
-   * See your system's documentation for these error codes.
-   *
-   * @param   mode  an OR of pmodes specifying which of the child's
-   *                standard streams to connect to.
-   * @return  On success the PID of the child is returned in the parent's
-   *          context and zero is returned in the child's context.
-   *          On error -1 is returned and the error code is set appropriately.
-   */
-  template <typename C, typename T>
-    pid_t
-    basic_pstreambuf<C,T>::fork(pmode mode)
-    {
-      pid_t pid = -1;
-
-      // Three pairs of file descriptors, for pipes connected to the
-      // process' stdin, stdout and stderr
-      // (stored in a single array so close_fd_array() can close all at once)
-      fd_type fd[] = { -1, -1, -1, -1, -1, -1 };
-      fd_type* const pin = fd;
-      fd_type* const pout = fd+2;
-      fd_type* const perr = fd+4;
-
-      // constants for read/write ends of pipe
-      enum { RD, WR };
-
-      // N.B.
-      // For the pstreambuf pin is an output stream and
-      // pout and perr are input streams.
-
-      if (!error_ && mode&pstdin && ::pipe(pin))
-        error_ = errno;
-
-      if (!error_ && mode&pstdout && ::pipe(pout))
-        error_ = errno;
-
-      if (!error_ && mode&pstderr && ::pipe(perr))
-        error_ = errno;
-
-      if (!error_)
-      {
-        pid = ::fork();
-        switch (pid)
+        if (c=='#')
         {
-          case 0 :
-          {
-            // this is the new process
-
-            // for each open pipe close one end and redirect the
-            // respective standard stream to the other end
+            q=(const char *)memchr(t.p,'\n',t.end-t.p);
+            t.p=(q==NULL)?t.end:q+1;
+            continue;
+        }
+        if (c==';' && (t.p==t.begin || t.p[-1]=='\n' || t.p[-1]=='\r'))
+        {
+            /* text field ends at the next line starting with ';' */
+            s=q=t.p+1;
+            while ((q=(const char *)memchr(q,'\n',t.end-q)) &&
+                (q+1==t.end || q[1]!=';')) q++;
+            if (q==NULL) q=t.end;
+            t.p=(q==t.end)?t.end:q+2;
+            if (q>s && q[-1]=='\r') q--;
+            token=string_view(s,q-s);
+            return CIF_VALUE;
+        }
+        if (c=='\'' || c=='"')
+        {
+            /* a quote only closes a string if followed by white space */
+            s=t.p+1;
+            for (q=s;q<t.end && *q!='\n' && *q!='\r';q++)
+                if (*q==c && (q+1==t.end || cif_space(q[1]))) break;
+            token=string_view(s,q-s);
+            t.p=(q<t.end && *q==c)?q+1:q;
+            return CIF_VALUE;
+        }
+        for (q=t.p+1;q<t.end && !cif_space(*q);q++);
+        token=string_view(t.p,q-t.p);
+        t.p=q;
+        if (c=='_') return CIF_NAME;
+        if (token.size()<5 || token[4]!='_') return CIF_VALUE;
+        if (token.size()==5 && cif_keyword(token,"loop_")) return CIF_LOOP;
+        if (cif_keyword(token,"data_"))
+        {
+            token=token.substr(5);
+            return CIF_DATA;
+        }
+        if (cif_keyword(token,"save_") || cif_keyword(token,"stop_")) continue;
+        return CIF_VALUE;
+    }
+    token=string_view();
+    return CIF_END;
+}
 
-            if (*pin >= 0)
-            {
-              ::close(pin[WR]);
-              ::dup2(pin[RD], STDIN_FILENO);
-              ::close(pin[RD]);
-            }
-            if (*pout >= 0)
-            {
-              ::close(pout[RD]);
-              ::dup2(pout[WR], STDOUT_FILENO);
-              ::close(pout[WR]);
-            }
-            if (*perr >= 0)
-            {
-              ::close(perr[RD]);
-              ::dup2(perr[WR], STDERR_FILENO);
-              ::close(perr[WR]);
-            }
+/* reader that groups CIF tokens into records: CIF_DATA, CIF_LOOP,
+ * CIF_NAME for each loop column, CIF_ROW for each loop row, CIF_PAIR for
+ * each data item outside loops, and CIF_STOP whenever a category ends */
+struct CifReader
+{
+    CifTokenizer tok;
+    int type;            // look-ahead token
+    string_view token;
+    size_t ncol;         // number of loop columns
+    bool in_loop;
+    bool in_header;      // reading loop column names
+    bool stopped;        // no item since the last CIF_STOP
+    string_view category;
+};
+
+void cif_open(CifReader &r, const string_view text)
+{
+    r.tok.begin=r.tok.p=text.data();
+    r.tok.end=text.data()+text.size();
+    r.type=cif_token(r.tok,r.token);
+    r.ncol=0;
+    r.in_loop=r.in_header=false;
+    r.stopped=true;
+    r.category=string_view();
+}
 
-#ifdef _POSIX_JOB_CONTROL
-            if (mode&newpg)
-              ::setpgid(0, 0); // Change to a new process group
-#endif
+inline string_view cif_category(const string_view name)
+{
+    return name.substr(0,name.find('.'));
+}
 
-            break;
-          }
-          case -1 :
-          {
-            // couldn't fork for some reason
-            error_ = errno;
-            // close any open pipes
-            close_fd_array(fd);
-            break;
-          }
-          default :
-          {
-            // this is the parent process, store process' pid
-            ppid_ = pid;
-
-            // store one end of open pipes and close other end
-            if (*pin >= 0)
-            {
-              wpipe_ = pin[WR];
-              ::close(pin[RD]);
-            }
-            if (*pout >= 0)
-            {
-              rpipe_[rsrc_out] = pout[RD];
-              ::close(pout[WR]);
-            }
-            if (*perr >= 0)
+/* read the next record into item_vec and return its type */
+int cif_record(CifReader &r, vector<string_view> &item_vec)
+{
+    string_view category;
+    item_vec.clear();
+    while (true)
+    {
+        if (r.type==CIF_END || r.type==CIF_LOOP || r.type==CIF_DATA ||
+           (r.type==CIF_NAME && !r.in_header && (r.in_loop ||
+            cif_category(r.token)!=r.category)))
+        {
+            r.in_loop=r.in_header=false;
+            if (!r.stopped)
             {
-              rpipe_[rsrc_err] = perr[RD];
-              ::close(perr[WR]);
+                r.stopped=true;
+                return CIF_STOP;
             }
-          }
         }
-      }
-      else
-      {
-        // close any pipes we opened before failure
-        close_fd_array(fd);
-      }
-      return pid;
-    }
-
-  /**
-   * Closes all pipes and calls wait() to wait for the process to finish.
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c waitpid().
-   * See your system's documentation for these errors.
-   *
-   * @return  @c this on successful close or @c NULL if there is no
-   *          process to close or if an error occurs.
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::close()
-    {
-      const bool running = is_open();
-
-      sync(); // this might call wait() and reap the child process
-
-      // rather than trying to work out whether or not we need to clean up
-      // just do it anyway, all cleanup functions are safe to call twice.
-
-      destroy_buffers(pstdin|pstdout|pstderr);
-
-      // close pipes before wait() so child gets EOF/SIGPIPE
-      close_fd(wpipe_);
-      close_fd_array(rpipe_);
-
-      do
-      {
-        error_ = 0;
-      } while (wait() == -1 && error() == EINTR);
-
-      return running ? this : NULL;
-    }
-
-  /**
-   *  Called on construction to initialise the arrays used for reading.
-   */
-  template <typename C, typename T>
-    inline void
-    basic_pstreambuf<C,T>::init_rbuffers()
-    {
-      rpipe_[rsrc_out] = rpipe_[rsrc_err] = -1;
-      rbuffer_[rsrc_out] = rbuffer_[rsrc_err] = NULL;
-      rbufstate_[0] = rbufstate_[1] = rbufstate_[2] = NULL;
-    }
-
-  template <typename C, typename T>
-    void
-    basic_pstreambuf<C,T>::create_buffers(pmode mode)
-    {
-      if (mode & pstdin)
-      {
-        delete[] wbuffer_;
-        wbuffer_ = new char_type[bufsz];
-        this->setp(wbuffer_, wbuffer_ + bufsz);
-      }
-      if (mode & pstdout)
-      {
-        delete[] rbuffer_[rsrc_out];
-        rbuffer_[rsrc_out] = new char_type[bufsz];
-        rsrc_ = rsrc_out;
-        this->setg(rbuffer_[rsrc_out] + pbsz, rbuffer_[rsrc_out] + pbsz,
-            rbuffer_[rsrc_out] + pbsz);
-      }
-      if (mode & pstderr)
-      {
-        delete[] rbuffer_[rsrc_err];
-        rbuffer_[rsrc_err] = new char_type[bufsz];
-        if (!(mode & pstdout))
+        if (r.type==CIF_END) return CIF_END;
+        if (r.type==CIF_LOOP)
         {
-          rsrc_ = rsrc_err;
-          this->setg(rbuffer_[rsrc_err] + pbsz, rbuffer_[rsrc_err] + pbsz,
-              rbuffer_[rsrc_err] + pbsz);
+            r.type=cif_token(r.tok,r.token);
+            r.in_loop=r.in_header=true;
+            r.ncol=0;
+            r.stopped=false;
+            return CIF_LOOP;
         }
-      }
-    }
-
-  template <typename C, typename T>
-    void
-    basic_pstreambuf<C,T>::destroy_buffers(pmode mode)
-    {
-      if (mode & pstdin)
-      {
-        this->setp(NULL, NULL);
-        delete[] wbuffer_;
-        wbuffer_ = NULL;
-      }
-      if (mode & pstdout)
-      {
-        if (rsrc_ == rsrc_out)
-          this->setg(NULL, NULL, NULL);
-        delete[] rbuffer_[rsrc_out];
-        rbuffer_[rsrc_out] = NULL;
-      }
-      if (mode & pstderr)
-      {
-        if (rsrc_ == rsrc_err)
-          this->setg(NULL, NULL, NULL);
-        delete[] rbuffer_[rsrc_err];
-        rbuffer_[rsrc_err] = NULL;
-      }
-    }
-
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::buf_read_src
-    basic_pstreambuf<C,T>::switch_read_buffer(buf_read_src src)
-    {
-      if (rsrc_ != src)
-      {
-        char_type* tmpbufstate[] = {this->eback(), this->gptr(), this->egptr()};
-        this->setg(rbufstate_[0], rbufstate_[1], rbufstate_[2]);
-        for (std::size_t i = 0; i < 3; ++i)
-          rbufstate_[i] = tmpbufstate[i];
-        rsrc_ = src;
-      }
-      return rsrc_;
-    }
-
-  /**
-   * Suspends execution and waits for the associated process to exit, or
-   * until a signal is delivered whose action is to terminate the current
-   * process or to call a signal handling function. If the process has
-   * already exited (i.e. it is a "zombie" process) then wait() returns
-   * immediately.  Waiting for the child process causes all its system
-   * resources to be freed.
-   *
-   * error() will return EINTR if wait() is interrupted by a signal.
-   *
-   * @param   nohang  true to return immediately if the process has not exited.
-   * @return  1 if the process has exited and wait() has not yet been called.
-   *          0 if @a nohang is true and the process has not exited yet.
-   *          -1 if no process has been started or if an error occurs,
-   *          in which case the error can be found using error().
-   */
-  template <typename C, typename T>
-    int
-    basic_pstreambuf<C,T>::wait(bool nohang)
-    {
-      int child_exited = -1;
-      if (is_open())
-      {
-        int exit_status;
-        switch(::waitpid(ppid_, &exit_status, nohang ? WNOHANG : 0))
+        if (r.type==CIF_DATA)
         {
-          case 0 :
-            // nohang was true and process has not exited
-            child_exited = 0;
-            break;
-          case -1 :
-            error_ = errno;
-            break;
-          default :
-            // process has exited
-            ppid_ = 0;
-            status_ = exit_status;
-            child_exited = 1;
-            // Close wpipe, would get SIGPIPE if we used it.
-            destroy_buffers(pstdin);
-            close_fd(wpipe_);
-            // Must free read buffers and pipes on destruction
-            // or next call to open()/close()
-            break;
+            item_vec.push_back(r.token);
+            r.type=cif_token(r.tok,r.token);
+            r.category=string_view();
+            return CIF_DATA;
         }
-      }
-      return child_exited;
-    }
-
-  /**
-   * Sends the specified signal to the process.  A signal can be used to
-   * terminate a child process that would not exit otherwise.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c kill().  See your system's documentation for these errors.
-   *
-   * @param   signal  A signal to send to the child process.
-   * @return  @c this or @c NULL if @c kill() fails.
-   */
-  template <typename C, typename T>
-    inline basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::kill(int signal)
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-      if (is_open())
-      {
-        if (::kill(ppid_, signal))
-          error_ = errno;
-        else
+        if (r.type==CIF_NAME)
         {
-#if 0
-          // TODO call exited() to check for exit and clean up? leave to user?
-          if (signal==SIGTERM || signal==SIGKILL)
-            this->exited();
-#endif
-          ret = this;
+            item_vec.push_back(r.token);
+            r.category=cif_category(r.token);
+            r.stopped=false;
+            r.type=cif_token(r.tok,r.token);
+            if (r.in_header)
+            {
+                r.ncol++;
+                return CIF_NAME;
+            }
+            if (r.type==CIF_VALUE)
+            {
+                item_vec.push_back(r.token);
+                r.type=cif_token(r.tok,r.token);
+            }
+            else item_vec.push_back("?");
+            return CIF_PAIR;
         }
-      }
-      return ret;
-    }
-
-  /**
-   * Sends the specified signal to the process group of the child process.
-   * A signal can be used to terminate a child process that would not exit
-   * otherwise, or to kill the process and its own children.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c getpgid() or @c kill().  See your system's documentation
-   * for these errors. If the child is in the current process group then
-   * NULL will be returned and the error code set to EPERM.
-   *
-   * @param   signal  A signal to send to the child process.
-   * @return  @c this on success or @c NULL on failure.
-   */
-  template <typename C, typename T>
-    inline basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::killpg(int signal)
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-#ifdef _POSIX_JOB_CONTROL
-      if (is_open())
-      {
-        pid_t pgid = ::getpgid(ppid_);
-        if (pgid == -1)
-          error_ = errno;
-        else if (pgid == ::getpgrp())
-          error_ = EPERM;  // Don't commit suicide
-        else if (::killpg(pgid, signal))
-          error_ = errno;
-        else
-          ret = this;
-      }
-#else
-      error_ = ENOTSUP;
-#endif
-      return ret;
-    }
-
-  /**
-   *  This function can call pstreambuf::wait() and so may change the
-   *  object's state if the child process has already exited.
-   *
-   *  @return  True if the associated process has exited, false otherwise.
-   *  @see     basic_pstreambuf<C,T>::wait()
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::exited()
-    {
-      return ppid_ == 0 || wait(true)==1;
-    }
-
-  /**
-   *  @return  The error code of the most recently failed operation, or zero.
-   */
-  template <typename C, typename T>
-    inline int
-    basic_pstreambuf<C,T>::error() const
-    {
-      return error_;
-    }
-
-  /**
-   *  Closes the output pipe, causing the child process to receive the
-   *  end-of-file indicator on subsequent reads from its @c stdin stream.
-   */
-  template <typename C, typename T>
-    inline void
-    basic_pstreambuf<C,T>::peof()
-    {
-      sync();
-      destroy_buffers(pstdin);
-      close_fd(wpipe_);
-    }
-
-  /**
-   * Unlike pstreambuf::exited(), this function will not call wait() and
-   * so will not change the object's state.  This means that once a child
-   * process is executed successfully this function will continue to
-   * return true even after the process exits (until wait() is called.)
-   *
-   * @return  true if a previous call to open() succeeded and wait() has
-   *          not been called and determined that the process has exited,
-   *          false otherwise.
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::is_open() const
-    {
-      return ppid_ > 0;
-    }
-
-  /**
-   * Toggle the stream used for reading. If @a readerr is @c true then the
-   * process' @c stderr output will be used for subsequent extractions, if
-   * @a readerr is false the the process' stdout will be used.
-   * @param   readerr  @c true to read @c stderr, @c false to read @c stdout.
-   * @return  @c true if the requested stream is open and will be used for
-   *          subsequent extractions, @c false otherwise.
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::read_err(bool readerr)
-    {
-      buf_read_src src = readerr ? rsrc_err : rsrc_out;
-      if (rpipe_[src]>=0)
-      {
-        switch_read_buffer(src);
-        return true;
-      }
-      return false;
-    }
-
-  /**
-   * Called when the internal character buffer is not present or is full,
-   * to transfer the buffer contents to the pipe.
-   *
-   * @param   c  a character to be written to the pipe.
-   * @return  @c traits_type::eof() if an error occurs, otherwise if @a c
-   *          is not equal to @c traits_type::eof() it will be buffered and
-   *          a value other than @c traits_type::eof() returned to indicate
-   *          success.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::overflow(int_type c)
-    {
-      if (!empty_buffer())
-        return traits_type::eof();
-      else if (!traits_type::eq_int_type(c, traits_type::eof()))
-        return this->sputc(c);
-      else
-        return traits_type::not_eof(c);
-    }
-
-
-  template <typename C, typename T>
-    int
-    basic_pstreambuf<C,T>::sync()
-    {
-      return !exited() && empty_buffer() ? 0 : -1;
-    }
-
-  /**
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters written.
-   */
-  template <typename C, typename T>
-    std::streamsize
-    basic_pstreambuf<C,T>::xsputn(const char_type* s, std::streamsize n)
-    {
-      std::streamsize done = 0;
-      while (done < n)
-      {
-        if (std::streamsize nbuf = this->epptr() - this->pptr())
+        /* CIF_VALUE */
+        if (!r.in_loop || r.ncol==0)
         {
-          nbuf = std::min(nbuf, n - done);
-          traits_type::copy(this->pptr(), s + done, nbuf);
-          this->pbump(nbuf);
-          done += nbuf;
+            r.type=cif_token(r.tok,r.token); // value without data name
+            continue;
         }
-        else if (!empty_buffer())
-          break;
-      }
-      return done;
-    }
-
-  /**
-   * @return  true if the buffer was emptied, false otherwise.
-   */
-  template <typename C, typename T>
-    bool
-    basic_pstreambuf<C,T>::empty_buffer()
-    {
-      const std::streamsize count = this->pptr() - this->pbase();
-      if (count > 0)
-      {
-        const std::streamsize written = this->write(this->wbuffer_, count);
-        if (written > 0)
+        r.in_header=false;
+        while (r.type==CIF_VALUE && item_vec.size()<r.ncol)
         {
-          if (const std::streamsize unwritten = count - written)
-            traits_type::move(this->pbase(), this->pbase()+written, unwritten);
-          this->pbump(-written);
-          return true;
+            item_vec.push_back(r.token);
+            r.type=cif_token(r.tok,r.token);
         }
-      }
-      return false;
-    }
-
-  /**
-   * Called when the internal character buffer is is empty, to re-fill it
-   * from the pipe.
-   *
-   * @return The first available character in the buffer,
-   * or @c traits_type::eof() in case of failure.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::underflow()
-    {
-      if (this->gptr() < this->egptr() || fill_buffer())
-        return traits_type::to_int_type(*this->gptr());
-      else
-        return traits_type::eof();
-    }
-
-  /**
-   * Attempts to make @a c available as the next character to be read by
-   * @c sgetc().
-   *
-   * @param   c   a character to make available for extraction.
-   * @return  @a c if the character can be made available,
-   *          @c traits_type::eof() otherwise.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::pbackfail(int_type c)
-    {
-      if (this->gptr() != this->eback())
-      {
-        this->gbump(-1);
-        if (!traits_type::eq_int_type(c, traits_type::eof()))
-          *this->gptr() = traits_type::to_char_type(c);
-        return traits_type::not_eof(c);
-      }
-      else
-         return traits_type::eof();
-    }
-
-  template <typename C, typename T>
-    std::streamsize
-    basic_pstreambuf<C,T>::showmanyc()
-    {
-      int avail = 0;
-      if (sizeof(char_type) == 1)
-        avail = fill_buffer(true) ? this->egptr() - this->gptr() : -1;
-#ifdef FIONREAD
-      else
-      {
-        if (::ioctl(rpipe(), FIONREAD, &avail) == -1)
-          avail = -1;
-        else if (avail)
-          avail /= sizeof(char_type);
-      }
-#endif
-      return std::streamsize(avail);
+        if (item_vec.size()==r.ncol) return CIF_ROW;
+        item_vec.clear(); // incomplete row at the end of a loop
     }
+    return CIF_END;
+}
 
-  /**
-   * @return  true if the buffer was filled, false otherwise.
-   */
-  template <typename C, typename T>
-    bool
-    basic_pstreambuf<C,T>::fill_buffer(bool non_blocking)
+/* skip the rest of the current category, e.g. a loop that is not needed.
+ * whole lines are passed over with memchr() until a line that starts a
+ * data name of another category, a comment such as the # terminator of
+ * mmCIF files, or loop_, data_ and similar keywords. lines within text
+ * fields do not count. the next record is CIF_STOP */
+void cif_skip(CifReader &r)
+{
+    string_view category=r.category;
+    const char *p;
+    const char *q;
+    const char *end=r.tok.end;
+    /* tokens after the look-ahead token on the same line are read one by
+     * one, so that skipping starts at a line start */
+    while (r.type==CIF_VALUE ||
+          (r.type==CIF_NAME && cif_category(r.token)==category))
     {
-      const std::streamsize pb1 = this->gptr() - this->eback();
-      const std::streamsize pb2 = pbsz;
-      const std::streamsize npb = std::min(pb1, pb2);
-
-      char_type* const rbuf = rbuffer();
-
-      if (npb)
-        traits_type::move(rbuf + pbsz - npb, this->gptr() - npb, npb);
-
-      std::streamsize rc = -1;
-
-      if (non_blocking)
-      {
-        const int flags = ::fcntl(rpipe(), F_GETFL);
-        if (flags != -1)
-        {
-          const bool blocking = !(flags & O_NONBLOCK);
-          if (blocking)
-            ::fcntl(rpipe(), F_SETFL, flags | O_NONBLOCK);  // set non-blocking
-
-          error_ = 0;
-          rc = read(rbuf + pbsz, bufsz - pbsz);
-
-          if (rc == -1 && error_ == EAGAIN)  // nothing available
-            rc = 0;
-          else if (rc == 0)  // EOF
-            rc = -1;
-
-          if (blocking)
-            ::fcntl(rpipe(), F_SETFL, flags); // restore
-        }
-      }
-      else
-        rc = read(rbuf + pbsz, bufsz - pbsz);
-
-      if (rc > 0 || (rc == 0 && non_blocking))
-      {
-        this->setg( rbuf + pbsz - npb,
-                    rbuf + pbsz,
-                    rbuf + pbsz + rc );
-        return true;
-      }
-      else
-      {
-        this->setg(NULL, NULL, NULL);
-        return false;
-      }
-    }
-
-  /**
-   * Writes up to @a n characters to the pipe from the buffer @a s.
-   *
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters written.
-   */
-  template <typename C, typename T>
-    inline std::streamsize
-    basic_pstreambuf<C,T>::write(const char_type* s, std::streamsize n)
-    {
-      std::streamsize nwritten = 0;
-      if (wpipe() >= 0)
-      {
-        nwritten = ::write(wpipe(), s, n * sizeof(char_type));
-        if (nwritten == -1)
-          error_ = errno;
-        else
-          nwritten /= sizeof(char_type);
-      }
-      return nwritten;
-    }
-
-  /**
-   * Reads up to @a n characters from the pipe to the buffer @a s.
-   *
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters read.
-   */
-  template <typename C, typename T>
-    inline std::streamsize
-    basic_pstreambuf<C,T>::read(char_type* s, std::streamsize n)
-    {
-      std::streamsize nread = 0;
-      if (rpipe() >= 0)
-      {
-        nread = ::read(rpipe(), s, n * sizeof(char_type));
-        if (nread == -1)
-          error_ = errno;
-        else
-          nread /= sizeof(char_type);
-      }
-      return nread;
+        for (p=r.tok.p;p<end && (*p==' ' || *p=='\t');p++);
+        if (p==end || *p=='\n' || *p=='\r' || *p=='#') break;
+        r.type=cif_token(r.tok,r.token);
     }
+    if (r.type!=CIF_VALUE && (r.type!=CIF_NAME ||
+        cif_category(r.token)!=category)) return;
 
-  /** @return a reference to the output file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::wpipe()
-    {
-      return wpipe_;
-    }
-
-  /** @return a reference to the active input file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::rpipe()
+    p=(const char *)memchr(r.tok.p,'\n',end-r.tok.p);
+    while (p!=NULL && ++p<end)
     {
-      return rpipe_[rsrc_];
-    }
-
-  /** @return a reference to the specified input file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::rpipe(buf_read_src which)
-    {
-      return rpipe_[which];
-    }
-
-  /** @return a pointer to the start of the active input buffer area. */
-  template <typename C, typename T>
-    inline typename basic_pstreambuf<C,T>::char_type*
-    basic_pstreambuf<C,T>::rbuffer()
-    {
-      return rbuffer_[rsrc_];
-    }
-
-
-  /*
-   * member definitions for pstream_common
-   */
-
-  /**
-   * @class pstream_common
-   * Abstract Base Class providing common functionality for basic_ipstream,
-   * basic_opstream and basic_pstream.
-   * pstream_common manages the basic_pstreambuf stream buffer that is used
-   * by the derived classes to initialise an iostream class.
-   */
-
-  /** Creates an uninitialised stream. */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common()
-    : std::basic_ios<C,T>(NULL)
-    , command_()
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
-    }
-
-  /**
-   * Initialises the stream buffer by calling
-   * do_open( @a command , @a mode )
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   do_open(const std::string&, pmode)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common(const std::string& cmd, pmode mode)
-    : std::basic_ios<C,T>(NULL)
-    , command_(cmd)
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
-      do_open(cmd, mode);
-    }
-
-  /**
-   * Initialises the stream buffer by calling
-   * do_open( @a file , @a argv , @a mode )
-   *
-   * @param file  a string containing the pathname of a program to execute.
-   * @param argv  a vector of argument strings passed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see do_open(const std::string&, const argv_type&, pmode)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common( const std::string& file,
-                                         const argv_type& argv,
-                                         pmode mode )
-    : std::basic_ios<C,T>(NULL)
-    , command_(file)
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
-      do_open(file, argv, mode);
-    }
-
-  /**
-   * This is a pure virtual function to make @c pstream_common abstract.
-   * Because it is the destructor it will be called by derived classes
-   * and so must be defined.  It is also protected, to discourage use of
-   * the PStreams classes through pointers or references to the base class.
-   *
-   * @sa If defining a pure virtual seems odd you should read
-   * http://www.gotw.ca/gotw/031.htm (and the rest of the site as well!)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::~pstream_common()
-    {
-    }
-
-  /**
-   * Calls rdbuf()->open( @a command , @a mode )
-   * and sets @c failbit on error.
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   basic_pstreambuf::open(const std::string&, pmode)
-   */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::do_open(const std::string& cmd, pmode mode)
-    {
-      if (!buf_.open((command_=cmd), mode))
-        this->setstate(std::ios_base::failbit);
-    }
-
-  /**
-   * Calls rdbuf()->open( @a file, @a  argv, @a mode )
-   * and sets @c failbit on error.
-   *
-   * @param file  a string containing the pathname of a program to execute.
-   * @param argv  a vector of argument strings passed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   basic_pstreambuf::open(const std::string&, const argv_type&, pmode)
-   */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::do_open( const std::string& file,
-                                  const argv_type& argv,
-                                  pmode mode )
-    {
-      if (!buf_.open((command_=file), argv, mode))
-        this->setstate(std::ios_base::failbit);
-    }
-
-  /** Calls rdbuf->close() and sets @c failbit on error. */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::close()
-    {
-      if (!buf_.close())
-        this->setstate(std::ios_base::failbit);
-    }
-
-  /**
-   * @return  rdbuf()->is_open().
-   * @see     basic_pstreambuf::is_open()
-   */
-  template <typename C, typename T>
-    inline bool
-    pstream_common<C,T>::is_open() const
-    {
-      return buf_.is_open();
-    }
-
-  /** @return a pointer to the private stream buffer member. */
-  // TODO  document behaviour if buffer replaced.
-  template <typename C, typename T>
-    inline typename pstream_common<C,T>::streambuf_type*
-    pstream_common<C,T>::rdbuf() const
-    {
-      return const_cast<streambuf_type*>(&buf_);
-    }
-
-
-#if REDI_EVISCERATE_PSTREAMS
-  /**
-   * @def REDI_EVISCERATE_PSTREAMS
-   * If this macro has a non-zero value then certain internals of the
-   * @c basic_pstreambuf template class are exposed. In general this is
-   * a Bad Thing, as the internal implementation is largely undocumented
-   * and may be subject to change at any time, so this feature is only
-   * provided because it might make PStreams useful in situations where
-   * it is necessary to do Bad Things.
-   */
-
-  /**
-   * @warning  This function exposes the internals of the stream buffer and
-   *           should be used with caution. It is the caller's responsibility
-   *           to flush streams etc. in order to clear any buffered data.
-   *           The POSIX.1 function <b>fdopen</b>(3) is used to obtain the
-   *           @c FILE pointers from the streambuf's private file descriptor
-   *           members so consult your system's documentation for
-   *           <b>fdopen</b>(3).
-   *
-   * @param   in    A FILE* that will refer to the process' stdin.
-   * @param   out   A FILE* that will refer to the process' stdout.
-   * @param   err   A FILE* that will refer to the process' stderr.
-   * @return  An OR of zero or more of @c pstdin, @c pstdout, @c pstderr.
-   *
-   * For each open stream shared with the child process a @c FILE* is
-   * obtained and assigned to the corresponding parameter. For closed
-   * streams @c NULL is assigned to the parameter.
-   * The return value can be tested to see which parameters should be
-   * @c !NULL by masking with the corresponding @c pmode value.
-   *
-   * @see <b>fdopen</b>(3)
-   */
-  template <typename C, typename T>
-    std::size_t
-    basic_pstreambuf<C,T>::fopen(FILE*& in, FILE*& out, FILE*& err)
-    {
-      in = out = err = NULL;
-      std::size_t open_files = 0;
-      if (wpipe() > -1)
-      {
-        if ((in = ::fdopen(wpipe(), "w")))
+        if (*p==';')
         {
-            open_files |= pstdin;
+            /* text field ends at the next line starting with ';' */
+            q=p;
+            while ((q=(const char *)memchr(q+1,'\n',end-q-1)) &&
+                (q+1==end || q[1]!=';'));
+            if (q==NULL) break;
+            p=(const char *)memchr(q+1,'\n',end-q-1);
+            continue;
         }
-      }
-      if (rpipe(rsrc_out) > -1)
-      {
-        if ((out = ::fdopen(rpipe(rsrc_out), "r")))
+        for (q=p;q<end && (*q==' ' || *q=='\t');q++);
+        if (q<end && (*q=='#' || (*q=='_' && cif_category(string_view(q,
+            find_if(q,end,cif_space)-q))!=category) ||
+            cif_keyword(string_view(q,end-q),"loop_") ||
+            cif_keyword(string_view(q,end-q),"data_") ||
+            cif_keyword(string_view(q,end-q),"save_") ||
+            cif_keyword(string_view(q,end-q),"global_") ||
+            cif_keyword(string_view(q,end-q),"stop_")))
         {
-            open_files |= pstdout;
+            r.tok.p=p;
+            r.type=cif_token(r.tok,r.token);
+            r.in_loop=r.in_header=false;
+            return;
+        }
+        p=(const char *)memchr(p,'\n',end-p);
+    }
+    r.tok.p=end;
+    r.type=cif_token(r.tok,r.token);
+    r.in_loop=r.in_header=false;
+}
+
+/* rows of the loop being read, from the look-ahead token up to the line
+ * that ends the loop as in cif_skip(). false if the rows include a text
+ * field, within which lines may look like anything */
+bool cif_rows(const CifReader &r, const char *&begin, const char *&end)
+{
+    const char *p;
+    const char *q;
+    const char *text_end=r.tok.end;
+    if (r.type!=CIF_VALUE || !r.in_loop) return false;
+    begin=r.token.data();
+    if (begin>r.tok.begin && begin[-1]==';') return false;
+    if (begin>r.tok.begin && (begin[-1]=='\'' || begin[-1]=='"')) begin--;
+
+    p=(const char *)memchr(begin,'\n',text_end-begin);
+    while (p!=NULL && ++p<text_end)
+    {
+        if (*p==';') return false;
+        for (q=p;q<text_end && (*q==' ' || *q=='\t');q++);
+        if (q<text_end && (*q=='#' || *q=='_' ||
+            cif_keyword(string_view(q,text_end-q),"loop_") ||
+            cif_keyword(string_view(q,text_end-q),"data_") ||
+            cif_keyword(string_view(q,text_end-q),"save_") ||
+            cif_keyword(string_view(q,text_end-q),"global_") ||
+            cif_keyword(string_view(q,text_end-q),"stop_")))
+        {
+            end=p;
+            return true;
+        }
+        p=(const char *)memchr(p,'\n',text_end-p);
+    }
+    end=text_end;
+    return true;
+}
+
+/* value of a text field as a single line: non-empty lines joined by sep */
+string Unfold(const string_view value, const string &sep="")
+{
+    if (value.find('\n')==string_view::npos) return string(value);
+    string result;
+    vector<string_view> lines;
+    SplitLines(value,lines);
+    for (size_t l=0;l<lines.size();l++)
+    {
+        if (l) result+=sep;
+        if (lines[l].size() && lines[l].back()=='\r')
+             result+=lines[l].substr(0,lines[l].size()-1);
+        else result+=lines[l];
+    }
+    return result;
+}
+
+/* cif END */
+/* deflate START */
+
+/* gzip compression (RFC 1951 and RFC 1952) without external gzip or tar */
+
+const int DEFLATE_WSIZE    =32768; // sliding window
+const int DEFLATE_HASH_BITS=15;
+const int DEFLATE_MAX_CHAIN=32;    // match candidates tried per position
+const int DEFLATE_LAZY_LEN =32;    // try a longer match at next position
+const int DEFLATE_NICE_LEN =128;   // stop searching at this match length
+const int DEFLATE_BLOCK    =65536; // symbols per block
+
+struct DeflateWriter
+{
+    string *out;
+    unsigned long long bitbuf;
+    int bitcnt;
+};
+
+inline void deflate_put(DeflateWriter &w, unsigned int val, int n)
+{
+    w.bitbuf|=(unsigned long long)val<<w.bitcnt;
+    w.bitcnt+=n;
+    if (w.bitcnt>=32)
+    {
+        char b[4]={(char)w.bitbuf,(char)(w.bitbuf>>8),
+                   (char)(w.bitbuf>>16),(char)(w.bitbuf>>24)};
+        w.out->append(b,4);
+        w.bitbuf>>=32;
+        w.bitcnt-=32;
+    }
+}
+
+/* pad with zero bits to the next byte boundary */
+void deflate_align(DeflateWriter &w)
+{
+    while (w.bitcnt>0)
+    {
+        w.out->push_back((char)(w.bitbuf&0xff));
+        w.bitbuf>>=8;
+        w.bitcnt-=8;
+    }
+    w.bitbuf=0;
+    w.bitcnt=0;
+}
+
+/* lengths of Huffman codes no longer than max_len for freq[0:n]. at least
+ * two codes are assigned so that the code is complete */
+void deflate_lengths(const unsigned int *freq, const int n,
+    const int max_len, unsigned char *length)
+{
+    vector<unsigned int> weight(freq,freq+n);
+    vector<int> parent(2*n);
+    vector<int> depth(2*n);
+    vector<pair<unsigned int,int> > heap;
+    int sym,node,used,max_depth;
+    pair<unsigned int,int> a,b;
+
+    memset(length,0,n);
+    used=0;
+    for (sym=0;sym<n;sym++) used+=(freq[sym]>0);
+    if (used<2)
+    {
+        for (sym=0;sym<n && used<2;sym++)
+            if (weight[sym]==0) weight[sym]=1,used++;
+    }
+
+    while (true)
+    {
+        heap.clear();
+        for (sym=0;sym<n;sym++)
+            if (weight[sym]) heap.push_back(make_pair(~weight[sym],sym));
+        make_heap(heap.begin(),heap.end());
+        node=n;
+        while (heap.size()>1)
+        {
+            pop_heap(heap.begin(),heap.end());
+            a=heap.back();
+            heap.pop_back();
+            pop_heap(heap.begin(),heap.end());
+            b=heap.back();
+            heap.pop_back();
+            parent[a.second]=parent[b.second]=node;
+            heap.push_back(make_pair(~(~a.first+~b.first),node++));
+            push_heap(heap.begin(),heap.end());
+        }
+        depth[node-1]=0;
+        max_depth=0;
+        for (sym=node-2;sym>=0;sym--)
+        {
+            if (sym<n && weight[sym]==0) continue;
+            depth[sym]=depth[parent[sym]]+1;
+            if (sym<n && depth[sym]>max_depth) max_depth=depth[sym];
+        }
+        if (max_depth<=max_len) break;
+
+        /* flatten the frequency distribution until the tree is short enough */
+        for (sym=0;sym<n;sym++)
+            if (weight[sym]) weight[sym]=(weight[sym]>>1)|1;
+    }
+    for (sym=0;sym<n;sym++) if (weight[sym]) length[sym]=depth[sym];
+}
+
+/* bit-reversed canonical Huffman codes for the given code lengths */
+void deflate_codes(const unsigned char *length, const int n,
+    unsigned short *code)
+{
+    unsigned short count[16];
+    unsigned int next_code[16];
+    unsigned int c,r;
+    int sym,len,i;
+    memset(count,0,sizeof(count));
+    for (sym=0;sym<n;sym++) count[length[sym]]++;
+    count[0]=0;
+    c=0;
+    for (len=1;len<16;len++)
+    {
+        c=(c+count[len-1])<<1;
+        next_code[len]=c;
+    }
+    for (sym=0;sym<n;sym++)
+    {
+        len=length[sym];
+        code[sym]=0;
+        if (len==0) continue;
+        c=next_code[len]++;
+        for (r=0,i=0;i<len;i++) r=(r<<1)|((c>>i)&1);
+        code[sym]=r;
+    }
+}
+
+static const unsigned short deflate_len_base[29]={3,4,5,6,7,8,9,10,11,13,
+    15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned char deflate_len_extra[29]={0,0,0,0,0,0,0,0,1,1,1,1,
+    2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const unsigned short deflate_dist_base[30]={1,2,3,4,5,7,9,13,17,25,
+    33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,
+    12289,16385,24577};
+static const unsigned char deflate_dist_extra[30]={0,0,0,0,1,1,2,2,3,3,4,4,
+    5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+/* length (3..258) and distance (1..32768) to deflate symbol */
+struct DeflateSymbolTable
+{
+    unsigned char len_code[259];
+    unsigned char dist_code[512];
+    DeflateSymbolTable()
+    {
+        int code,i;
+        for (code=0;code<29;code++)
+            for (i=deflate_len_base[code];i<259 && (code==28 ||
+                i<deflate_len_base[code+1]);i++) len_code[i]=code;
+        for (code=0;code<30;code++)
+        {
+            for (i=deflate_dist_base[code];i<=256 && (code==29 ||
+                i<deflate_dist_base[code+1]);i++) dist_code[i-1]=code;
+            if (deflate_dist_base[code]<=256) continue;
+            for (i=((deflate_dist_base[code]-1)>>7);i<256 && (code==29 ||
+                (i<<7)<deflate_dist_base[code+1]-1);i++) dist_code[256+i]=code;
+        }
+    }
+    inline int dcode(const int dist) const
+    {
+        return (dist<=256)?dist_code[dist-1]:dist_code[256+((dist-1)>>7)];
+    }
+};
+
+/* emit symbols litlen_vec/dist_vec covering raw[0:raw_size] as one dynamic
+ * Huffman block, or as stored blocks if that is smaller. a literal has
+ * dist 0; a match stores its length in litlen */
+void deflate_block(DeflateWriter &w, const vector<unsigned short> &litlen_vec,
+    const vector<unsigned short> &dist_vec, const char *raw,
+    const size_t raw_size, const bool last)
+{
+    static const DeflateSymbolTable table;
+    static const unsigned char order[19]={16,17,18,0,8,7,9,6,10,5,11,4,
+        12,3,13,2,14,1,15};
+    unsigned int ll_freq[286],d_freq[30],cl_freq[19];
+    unsigned char ll_len[286],d_len[30],cl_len[19],all_len[316];
+    unsigned short ll_code[286],d_code[30],cl_code[19];
+    vector<unsigned char> cl_sym;
+    vector<unsigned char> cl_extra;
+    size_t i,s;
+    int hlit,hdist,hclen,code,n,run,r;
+
+    if (raw_size==0) // empty fixed Huffman block
+    {
+        deflate_put(w,last,1);
+        deflate_put(w,1,2);
+        deflate_put(w,0,7);
+        return;
+    }
+
+    memset(ll_freq,0,sizeof(ll_freq));
+    memset(d_freq,0,sizeof(d_freq));
+    for (s=0;s<litlen_vec.size();s++)
+    {
+        if (dist_vec[s]==0) ll_freq[litlen_vec[s]]++;
+        else
+        {
+            ll_freq[257+table.len_code[litlen_vec[s]]]++;
+            d_freq[table.dcode(dist_vec[s])]++;
+        }
+    }
+    ll_freq[256]=1;
+    deflate_lengths(ll_freq,286,15,ll_len);
+    deflate_lengths(d_freq,30,15,d_len);
+    for (hlit=286;hlit>257 && ll_len[hlit-1]==0;hlit--);
+    for (hdist=30;hdist>1 && d_len[hdist-1]==0;hdist--);
+
+    /* run length encoding of code lengths */
+    memcpy(all_len,ll_len,hlit);
+    memcpy(all_len+hlit,d_len,hdist);
+    n=hlit+hdist;
+    for (i=0;i<n;i+=run)
+    {
+        for (run=1;i+run<n && all_len[i+run]==all_len[i];run++);
+        r=run;
+        if (all_len[i]==0)
+        {
+            for (;r>=11;r-=min(r,138))
+            {
+                cl_sym.push_back(18);
+                cl_extra.push_back(min(r,138)-11);
+            }
+            if (r>=3)
+            {
+                cl_sym.push_back(17);
+                cl_extra.push_back(r-3);
+                r=0;
+            }
+        }
+        else
+        {
+            cl_sym.push_back(all_len[i]);
+            cl_extra.push_back(0);
+            for (r--;r>=3;r-=min(r,6))
+            {
+                cl_sym.push_back(16);
+                cl_extra.push_back(min(r,6)-3);
+            }
+        }
+        for (;r>0;r--)
+        {
+            cl_sym.push_back(all_len[i]);
+            cl_extra.push_back(0);
+        }
+    }
+    memset(cl_freq,0,sizeof(cl_freq));
+    for (s=0;s<cl_sym.size();s++) cl_freq[cl_sym[s]]++;
+    deflate_lengths(cl_freq,19,7,cl_len);
+    for (hclen=19;hclen>4 && cl_len[order[hclen-1]]==0;hclen--);
+
+    /* compare with the size of stored blocks */
+    size_t dynamic_bits=17+3*hclen;
+    for (s=0;s<cl_sym.size();s++) dynamic_bits+=cl_len[cl_sym[s]]+
+        (cl_sym[s]==16?2:(cl_sym[s]==17?3:(cl_sym[s]==18?7:0)));
+    for (code=0;code<286;code++) dynamic_bits+=(size_t)ll_freq[code]*
+        (ll_len[code]+(code>=257?deflate_len_extra[code-257]:0));
+    for (code=0;code<30;code++) dynamic_bits+=(size_t)d_freq[code]*
+        (d_len[code]+deflate_dist_extra[code]);
+    if (dynamic_bits>raw_size*8+(raw_size/65535+1)*40)
+    {
+        for (i=0;i<raw_size;i+=n)
+        {
+            n=min(raw_size-i,(size_t)65535);
+            deflate_put(w,last && i+n==raw_size,1);
+            deflate_put(w,0,2);
+            deflate_align(w);
+            deflate_put(w,n,16);
+            deflate_put(w,~n&0xffff,16);
+            deflate_align(w);
+            w.out->append(raw+i,n);
+        }
+        return;
+    }
+
+    deflate_codes(ll_len,286,ll_code);
+    deflate_codes(d_len,30,d_code);
+    deflate_codes(cl_len,19,cl_code);
+    deflate_put(w,last,1);
+    deflate_put(w,2,2);
+    deflate_put(w,hlit-257,5);
+    deflate_put(w,hdist-1,5);
+    deflate_put(w,hclen-4,4);
+    for (code=0;code<hclen;code++) deflate_put(w,cl_len[order[code]],3);
+    for (s=0;s<cl_sym.size();s++)
+    {
+        deflate_put(w,cl_code[cl_sym[s]],cl_len[cl_sym[s]]);
+        if      (cl_sym[s]==16) deflate_put(w,cl_extra[s],2);
+        else if (cl_sym[s]==17) deflate_put(w,cl_extra[s],3);
+        else if (cl_sym[s]==18) deflate_put(w,cl_extra[s],7);
+    }
+    for (s=0;s<litlen_vec.size();s++)
+    {
+        if (dist_vec[s]==0)
+        {
+            deflate_put(w,ll_code[litlen_vec[s]],ll_len[litlen_vec[s]]);
+            continue;
+        }
+        code=table.len_code[litlen_vec[s]];
+        deflate_put(w,ll_code[257+code],ll_len[257+code]);
+        deflate_put(w,litlen_vec[s]-deflate_len_base[code],
+            deflate_len_extra[code]);
+        code=table.dcode(dist_vec[s]);
+        deflate_put(w,d_code[code],d_len[code]);
+        deflate_put(w,dist_vec[s]-deflate_dist_base[code],
+            deflate_dist_extra[code]);
+    }
+    deflate_put(w,ll_code[256],ll_len[256]);
+}
+
+/* LZ77 matcher with hash chains over the whole input buffer */
+struct DeflateMatcher
+{
+    const unsigned char *data;
+    size_t size;
+    vector<size_t> head; // last position+1 with the same hash
+    vector<size_t> prev; // previous position+1 in the chain, by pos%WSIZE
+
+    inline unsigned int hash(const size_t pos) const
+    {
+        unsigned int v=data[pos]|(data[pos+1]<<8)|(data[pos+2]<<16);
+        return (v*2654435761U)>>(32-DEFLATE_HASH_BITS);
+    }
+
+    inline void insert(const size_t pos)
+    {
+        if (pos+3>size) return;
+        unsigned int h=hash(pos);
+        prev[pos&(DEFLATE_WSIZE-1)]=head[h];
+        head[h]=pos+1;
+    }
+
+    /* insert pos and return the longest earlier match at pos */
+    inline int find(const size_t pos, int &best_dist)
+    {
+        if (pos+3>size) return 0;
+        unsigned int h=hash(pos);
+        size_t cand=head[h];
+        prev[pos&(DEFLATE_WSIZE-1)]=cand;
+        head[h]=pos+1;
+
+        int max_len=min(size-pos,(size_t)258);
+        int best_len=0,len,chain;
+        size_t p;
+        const unsigned char *a,*b;
+        unsigned long long x,y;
+        for (chain=DEFLATE_MAX_CHAIN;cand && chain>0;chain--)
+        {
+            p=cand-1;
+            if (pos-p>DEFLATE_WSIZE) break;
+            a=data+p;
+            b=data+pos;
+            if (a[best_len]==b[best_len] && a[0]==b[0] && a[1]==b[1])
+            {
+                len=2;
+                while (len+8<=max_len)
+                {
+                    memcpy(&x,a+len,8);
+                    memcpy(&y,b+len,8);
+                    if (x!=y) break;
+                    len+=8;
+                }
+                while (len<max_len && a[len]==b[len]) len++;
+                if (len>best_len)
+                {
+                    best_len=len;
+                    best_dist=pos-p;
+                    if (len>=DEFLATE_NICE_LEN || len==max_len) break;
+                }
+            }
+            cand=prev[p&(DEFLATE_WSIZE-1)];
+            if (cand>p) break; // overwritten by a newer position
+        }
+        return (best_len>=3)?best_len:0;
+    }
+};
+
+/* append raw deflate stream of data[0:size] to out */
+void deflate_compress(const char *data, const size_t size, string &out)
+{
+    DeflateWriter w;
+    w.out=&out;
+    w.bitbuf=0;
+    w.bitcnt=0;
+
+    DeflateMatcher m;
+    m.data=(const unsigned char *)data;
+    m.size=size;
+    m.head.assign(1<<DEFLATE_HASH_BITS,0);
+    m.prev.assign(DEFLATE_WSIZE,0);
+
+    vector<unsigned short> litlen_vec;
+    vector<unsigned short> dist_vec;
+    litlen_vec.reserve(DEFLATE_BLOCK);
+    dist_vec.reserve(DEFLATE_BLOCK);
+
+    size_t pos=0;
+    size_t block_start=0;
+    size_t k;
+    int len,dist=0,next_len,next_dist=0;
+    len=m.find(pos,dist);
+    while (pos<size)
+    {
+        if (len && len<DEFLATE_LAZY_LEN && pos+1<size)
+        {
+            next_len=m.find(pos+1,next_dist);
+            if (next_len>len)
+            {
+                litlen_vec.push_back((unsigned char)data[pos]);
+                dist_vec.push_back(0);
+                pos++;
+                len=next_len;
+                dist=next_dist;
+            }
+            else
+            {
+                litlen_vec.push_back(len);
+                dist_vec.push_back(dist);
+                for (k=pos+2;k<pos+len;k++) m.insert(k);
+                pos+=len;
+                len=m.find(pos,dist);
+            }
+        }
+        else if (len)
+        {
+            litlen_vec.push_back(len);
+            dist_vec.push_back(dist);
+            for (k=pos+1;k<pos+len;k++) m.insert(k);
+            pos+=len;
+            len=m.find(pos,dist);
+        }
+        else
+        {
+            litlen_vec.push_back((unsigned char)data[pos]);
+            dist_vec.push_back(0);
+            pos++;
+            len=m.find(pos,dist);
+        }
+        if (litlen_vec.size()>=DEFLATE_BLOCK)
+        {
+            deflate_block(w,litlen_vec,dist_vec,data+block_start,
+                pos-block_start,false);
+            litlen_vec.clear();
+            dist_vec.clear();
+            block_start=pos;
+        }
+    }
+    deflate_block(w,litlen_vec,dist_vec,data+block_start,
+        pos-block_start,true);
+    deflate_align(w);
+}
+
+/* gzip file content of data[0:size] */
+void gzip_compress(const char *data, const size_t size, string &out)
+{
+    static const char header[10]={0x1f,(char)0x8b,8,0,0,0,0,0,0,3};
+    out.reserve(out.size()+size/4+64);
+    out.append(header,10);
+    deflate_compress(data,size,out);
+    unsigned int crc=crc32_update(0,(const unsigned char *)data,size);
+    unsigned int isize=size;
+    char trailer[8]={(char)crc,(char)(crc>>8),(char)(crc>>16),
+        (char)(crc>>24),(char)isize,(char)(isize>>8),(char)(isize>>16),
+        (char)(isize>>24)};
+    out.append(trailer,8);
+}
+
+/* deflate END */
+/* output START */
+
+/* write text to filename, or gzip compressed text to filename.gz if do_gzip.
+ * return false if the file cannot be written */
+bool write_file(const string &filename, const string &text, const int do_gzip=0)
+{
+    ofstream fout;
+    if (do_gzip)
+    {
+        string gz;
+        gzip_compress(text.data(),text.size(),gz);
+        fout.open((filename+".gz").c_str(),ofstream::out|ofstream::binary);
+        fout.write(gz.data(),gz.size());
+    }
+    else
+    {
+        fout.open(filename.c_str(),ofstream::out);
+        fout.write(text.data(),text.size());
+    }
+    fout.close();
+    if (fout.fail())
+    {
+        cerr<<"ERROR! Cannot write "<<filename<<(do_gzip?".gz":"")<<endl;
+        return false;
+    }
+    return true;
+}
+
+/* append text as regular file filename to in-memory ustar archive */
+void tar_append(string &tar, const string &filename, const string &text)
+{
+    char header[512];
+    memset(header,0,512);
+    string name=filename;
+    while (name.size() && name[0]=='/') name=name.substr(1);
+    size_t split=string::npos;
+    if (name.size()>100)
+    {
+        /* ustar stores long names as prefix/name */
+        split=name.rfind('/',155);
+        if (split!=string::npos && name.size()-split-1>100)
+            split=string::npos;
+    }
+    if (split==string::npos) memcpy(header,name.data(),min(name.size(),(size_t)100));
+    else
+    {
+        memcpy(header,name.data()+split+1,name.size()-split-1);
+        memcpy(header+345,name.data(),split);
+    }
+    snprintf(header+100,8,"%07o",0644);
+    snprintf(header+108,8,"%07o",0);
+    snprintf(header+116,8,"%07o",0);
+    snprintf(header+124,12,"%011llo",(unsigned long long)text.size());
+    snprintf(header+136,12,"%011llo",(unsigned long long)time(NULL));
+    header[156]='0';
+    memcpy(header+257,"ustar",6);
+    memcpy(header+263,"00",2);
+    memset(header+148,' ',8);
+    unsigned int chksum=0;
+    for (int i=0;i<512;i++) chksum+=(unsigned char)header[i];
+    snprintf(header+148,7,"%06o",chksum);
+    tar.append(header,512);
+    tar+=text;
+    tar.append((512-text.size()%512)%512,'\0');
+}
+
+/* end of archive: two zero blocks, padded to the default tar record size */
+void tar_finish(string &tar)
+{
+    tar.append(1024,'\0');
+    tar.append((10240-tar.size()%10240)%10240,'\0');
+}
+
+/* bounded queue of items passed between threads without locks, after
+ * D. Vyukov's multi-producer multi-consumer ring. each cell carries a
+ * sequence number that tells whether it is free for the push of round
+ * pos, or holds the item for the pop of round pos */
+template <class T> struct BoundedQueue
+{
+    struct Cell
+    {
+        atomic<size_t> seq;
+        T item;
+    };
+    Cell *cell;
+    size_t mask;             // capacity-1, capacity is a power of 2
+    atomic<size_t> push_pos;
+    atomic<size_t> pop_pos;
+
+    BoundedQueue(size_t capacity)
+    {
+        size_t size=2;
+        while (size<capacity) size*=2;
+        cell=new Cell[size];
+        mask=size-1;
+        for (size_t i=0;i<size;i++) cell[i].seq.store(i,memory_order_relaxed);
+        push_pos.store(0,memory_order_relaxed);
+        pop_pos.store(0,memory_order_relaxed);
+    }
+    ~BoundedQueue() { delete [] cell; }
+
+    bool try_push(const T &item)
+    {
+        size_t pos=push_pos.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &c=cell[pos&mask];
+            size_t seq=c.seq.load(memory_order_acquire);
+            if (seq==pos)
+            {
+                if (push_pos.compare_exchange_weak(pos,pos+1,
+                    memory_order_relaxed))
+                {
+                    c.item=item;
+                    c.seq.store(pos+1,memory_order_release);
+                    return true;
+                }
+            }
+            else if (seq<pos) return false; // full
+            else pos=push_pos.load(memory_order_relaxed);
+        }
+    }
+
+    bool try_pop(T &item)
+    {
+        size_t pos=pop_pos.load(memory_order_relaxed);
+        while (true)
+        {
+            Cell &c=cell[pos&mask];
+            size_t seq=c.seq.load(memory_order_acquire);
+            if (seq==pos+1)
+            {
+                if (pop_pos.compare_exchange_weak(pos,pos+1,
+                    memory_order_relaxed))
+                {
+                    item=c.item;
+                    c.seq.store(pos+mask+1,memory_order_release);
+                    return true;
+                }
+            }
+            else if (seq<pos+1) return false; // empty
+            else pos=pop_pos.load(memory_order_relaxed);
+        }
+    }
+
+    /* push and pop wait while the queue is full or empty, which is what
+     * holds back a stage that runs ahead of the next one */
+    void push(const T &item)
+    {
+        for (int wait=0;!try_push(item);wait++) queue_wait(wait);
+    }
+
+    T pop()
+    {
+        T item;
+        for (int wait=0;!try_pop(item);wait++) queue_wait(wait);
+        return item;
+    }
+
+    static void queue_wait(const int wait)
+    {
+        if (wait<64) this_thread::yield();
+        else this_thread::sleep_for(chrono::microseconds(200));
+    }
+};
+
+/* output file passed to the writer thread of a batch. a task without
+ * filename marks that all output of input is queued */
+struct WriteTask
+{
+    string filename;
+    string text;
+    size_t input;
+    int status;  // return value of the conversion of input, for the marker
+};
+
+/* output of one input of a batch, which is queued for the writer thread
+ * instead of being written by the thread that converts the input */
+struct WriteStage
+{
+    BoundedQueue<WriteTask *> *queue;
+    size_t input;
+};
+
+/* write text to filename as write_file() does, or, if writer is not NULL,
+ * queue it for the writer thread. gzip compression is done here either
+ * way, so that the writer thread only does I/O. text is left empty */
+bool output_file(const WriteStage *writer, const string &filename,
+    string &text, const int do_gzip=0)
+{
+    bool success=true;
+    if (writer==NULL) success=write_file(filename,text,do_gzip);
+    else
+    {
+        WriteTask *task=new WriteTask;
+        task->input=writer->input;
+        task->status=0;
+        if (do_gzip)
+        {
+            task->filename=filename+".gz";
+            gzip_compress(text.data(),text.size(),task->text);
+        }
+        else
+        {
+            task->filename=filename;
+            task->text.swap(text);
+        }
+        writer->queue->push(task);
+    }
+    string().swap(text);
+    return success;
+}
+
+/* output END */
+/* parallel START */
+
+/* a parallel loop of one input, which idle threads of a batch may join */
+struct HelpJob
+{
+    function<void()> run; // the loop, which returns once nothing is left
+    int slot;             // number of threads that may still join
+    atomic<int> active;   // number of threads that joined and still run
+};
+
+/* parallel loops of the inputs being converted by a batch */
+struct HelpPool
+{
+    mutex lock;
+    vector<HelpJob *> job_vec;
+};
+
+/* join one loop of pool, if any has a free slot. return false if none */
+bool help_pool(HelpPool &pool)
+{
+    HelpJob *job=NULL;
+    {
+        lock_guard<mutex> lock(pool.lock);
+        for (size_t j=0;j<pool.job_vec.size() && job==NULL;j++)
+        {
+            if (pool.job_vec[j]->slot<=0) continue;
+            job=pool.job_vec[j];
+            job->slot--;
+            job->active++;
+        }
+    }
+    if (job==NULL) return false;
+    job->run();
+    job->active.fetch_sub(1,memory_order_release);
+    return true;
+}
+
+/* run worker(job) on thread_num threads. worker must take its items from
+ * job until none is left. without a pool, thread_num-1 threads are
+ * started; with a pool, the loop is offered to idle threads of the batch
+ * instead, so that a large input can use the threads that have no input
+ * left to convert */
+template <class Job>
+void run_parallel(void (*worker)(Job *), Job *job, const int thread_num,
+    HelpPool *pool)
+{
+    int t;
+    if (pool==NULL)
+    {
+        vector<thread> thread_vec;
+        for (t=1;t<thread_num;t++) thread_vec.push_back(thread(worker,job));
+        worker(job);
+        for (t=0;t<thread_vec.size();t++) thread_vec[t].join();
+        return;
+    }
+
+    HelpJob help;
+    help.run=[worker,job]() { worker(job); };
+    help.slot=thread_num-1;
+    help.active=0;
+    {
+        lock_guard<mutex> lock(pool->lock);
+        pool->job_vec.push_back(&help);
+    }
+    worker(job);
+    {
+        lock_guard<mutex> lock(pool->lock);
+        pool->job_vec.erase(find(pool->job_vec.begin(),
+            pool->job_vec.end(),&help));
+    }
+    for (t=0;help.active.load(memory_order_acquire);t++)
+        BoundedQueue<int>::queue_wait(t);
+}
+
+/* parallel END */
+/* uring START */
+
+/* output files of a batch can be written through Linux io_uring, which
+ * opens a batch of files with one system call, then writes and closes
+ * them with another, instead of three blocking calls per file. the ring
+ * is set up with raw system calls, so liburing is not needed */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+/* IORING_OP_OPENAT, IORING_OP_WRITE and IORING_OP_CLOSE are only in the
+ * headers of Linux 5.6 or later, as is IORING_FEAT_RW_CUR_POS */
+#if defined(IORING_FEAT_RW_CUR_POS)
+#define HAVE_IO_URING
+#include <sys/syscall.h>
+#include <climits>
+#endif
+#endif
+#endif
+#include <cerrno>
+
+/* number of files written with one pair of submissions */
+const size_t URING_BATCH=32;
+
+/* bytes of a file written by one io_uring write. the rest of a larger
+ * file is written synchronously */
+const size_t URING_WRITE=1<<30;
+
+struct Uring
+{
+    int fd;                  // -1 if io_uring is not used
+#if defined(HAVE_IO_URING)
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    void *ring_addr;         // submission and completion rings
+    size_t ring_size;
+    size_t sqe_size;
+    unsigned pending;        // entries filled but not submitted
+#endif
+};
+
+#if defined(HAVE_IO_URING)
+/* whether the kernel of ring supports the operations used by
+ * write_files(). kernels before 5.6 have io_uring without them */
+bool uring_probe(const int fd)
+{
+    const unsigned nop=256;
+    vector<unsigned long long> buf((sizeof(struct io_uring_probe)+
+        nop*sizeof(struct io_uring_probe_op))/sizeof(unsigned long long)+1,0);
+    struct io_uring_probe *probe=(struct io_uring_probe *)buf.data();
+    if (syscall(__NR_io_uring_register,fd,IORING_REGISTER_PROBE,probe,nop)<0)
+        return false;
+    const int op_vec[3]={IORING_OP_OPENAT,IORING_OP_WRITE,IORING_OP_CLOSE};
+    for (int i=0;i<3;i++)
+        if (op_vec[i]>probe->last_op ||
+            !(probe->ops[op_vec[i]].flags & IO_URING_OP_SUPPORTED))
+            return false;
+    return true;
+}
+
+/* set up ring with room for entries submissions. return false if the
+ * kernel does not support io_uring, does not allow it, or lacks the
+ * operations used by write_files() */
+bool uring_setup(Uring &ring, const unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p,0,sizeof(p));
+    ring.fd=syscall(__NR_io_uring_setup,entries,&p);
+    if (ring.fd<0) return false;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !uring_probe(ring.fd))
+    {
+        close(ring.fd);
+        ring.fd=-1;
+        return false;
+    }
+    ring.ring_size=max(p.sq_off.array+p.sq_entries*sizeof(unsigned),
+        p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe));
+    ring.sqe_size=p.sq_entries*sizeof(struct io_uring_sqe);
+    ring.ring_addr=mmap(NULL,ring.ring_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,ring.fd,IORING_OFF_SQ_RING);
+    void *sqe_addr=mmap(NULL,ring.sqe_size,PROT_READ|PROT_WRITE,
+        MAP_SHARED|MAP_POPULATE,ring.fd,IORING_OFF_SQES);
+    if (ring.ring_addr==MAP_FAILED || sqe_addr==MAP_FAILED)
+    {
+        if (ring.ring_addr!=MAP_FAILED) munmap(ring.ring_addr,ring.ring_size);
+        if (sqe_addr!=MAP_FAILED) munmap(sqe_addr,ring.sqe_size);
+        close(ring.fd);
+        ring.fd=-1;
+        return false;
+    }
+    char *addr=(char *)ring.ring_addr;
+    ring.sq_head =(unsigned *)(addr+p.sq_off.head);
+    ring.sq_tail =(unsigned *)(addr+p.sq_off.tail);
+    ring.sq_mask =(unsigned *)(addr+p.sq_off.ring_mask);
+    ring.sq_array=(unsigned *)(addr+p.sq_off.array);
+    ring.cq_head =(unsigned *)(addr+p.cq_off.head);
+    ring.cq_tail =(unsigned *)(addr+p.cq_off.tail);
+    ring.cq_mask =(unsigned *)(addr+p.cq_off.ring_mask);
+    ring.cqe=(struct io_uring_cqe *)(addr+p.cq_off.cqes);
+    ring.sqe=(struct io_uring_sqe *)sqe_addr;
+    ring.pending=0;
+    return true;
+}
+
+void uring_exit(Uring &ring)
+{
+    if (ring.fd<0) return;
+    munmap(ring.sqe,ring.sqe_size);
+    munmap(ring.ring_addr,ring.ring_size);
+    close(ring.fd);
+    ring.fd=-1;
+}
+
+/* next free submission entry, cleared. the caller leaves room for it */
+struct io_uring_sqe *uring_get(Uring &ring)
+{
+    unsigned tail=*ring.sq_tail+ring.pending;
+    unsigned i=tail & *ring.sq_mask;
+    struct io_uring_sqe *sqe=&ring.sqe[i];
+    memset(sqe,0,sizeof(*sqe));
+    ring.sq_array[i]=i;
+    ring.pending++;
+    return sqe;
+}
+
+/* result of an entry that was not run */
+const int URING_NOT_RUN=INT_MIN;
+
+/* submit all pending entries and wait for their completion. res_vec
+ * [user_data] is set to the result of each entry that was run. return
+ * false if not all entries could be submitted */
+bool uring_run(Uring &ring, vector<int> &res_vec)
+{
+    unsigned submit=ring.pending;
+    unsigned submitted=0,done=0;
+    int ret;
+    __atomic_store_n(ring.sq_tail,*ring.sq_tail+submit,__ATOMIC_RELEASE);
+    ring.pending=0;
+    while (done<submitted || submitted<submit)
+    {
+        ret=syscall(__NR_io_uring_enter,ring.fd,submit-submitted,
+            (done<submitted)?1:0,IORING_ENTER_GETEVENTS,NULL,0);
+        if (ret>=0) submitted+=ret;
+        else if (errno!=EINTR && errno!=EAGAIN && errno!=EBUSY)
+        {
+            /* take back entries not submitted, then wait for the rest */
+            __atomic_store_n(ring.sq_tail,*ring.sq_tail-(submit-submitted),
+                __ATOMIC_RELEASE);
+            submit=submitted;
+            if (done==submitted) break;
+        }
+        unsigned head=*ring.cq_head;
+        unsigned tail=__atomic_load_n(ring.cq_tail,__ATOMIC_ACQUIRE);
+        for (;head!=tail;head++,done++)
+        {
+            struct io_uring_cqe *cqe=&ring.cqe[head & *ring.cq_mask];
+            res_vec[cqe->user_data]=cqe->res;
+        }
+        __atomic_store_n(ring.cq_head,head,__ATOMIC_RELEASE);
+    }
+    return submitted==submit;
+}
+#else
+bool uring_setup(Uring &ring, const unsigned entries)
+{
+    ring.fd=-1;
+    return false;
+}
+
+void uring_exit(Uring &ring) {}
+#endif
+
+/* write text from byte done on to an open file and close it */
+bool write_fd(const int fd, const string &text, size_t done)
+{
+    bool success=true;
+#if defined(HAVE_POSIX)
+    ssize_t n;
+    while (success && done<text.size())
+    {
+        n=pwrite(fd,text.data()+done,text.size()-done,done);
+        if (n>0) done+=n;
+        else success=(n<0 && errno==EINTR);
+    }
+    success=(close(fd)==0) && success;
+#endif
+    return success;
+}
+
+/* write each file of task_vec, through ring if it is set up. success_vec
+ * is set to whether each file is written */
+void write_files(Uring &ring, const vector<WriteTask *> &task_vec,
+    vector<bool> &success_vec)
+{
+    size_t i,n=task_vec.size();
+    success_vec.assign(n,false);
+#if defined(HAVE_IO_URING)
+    vector<int> fd_vec(n,URING_NOT_RUN);
+    vector<int> res_vec(2*n,URING_NOT_RUN);
+    bool run=true;
+    if (ring.fd>=0 && n)
+    {
+        /* open all files */
+        for (i=0;i<n;i++)
+        {
+            struct io_uring_sqe *sqe=uring_get(ring);
+            sqe->opcode=IORING_OP_OPENAT;
+            sqe->fd=AT_FDCWD;
+            sqe->addr=(unsigned long long)task_vec[i]->filename.c_str();
+            sqe->len=0666;
+            sqe->open_flags=O_WRONLY|O_CREAT|O_TRUNC;
+            sqe->user_data=i;
+        }
+        run=uring_run(ring,res_vec);
+
+        /* an open the kernel cannot do is done by write_file() instead */
+        for (i=0;i<n;i++) fd_vec[i]=(res_vec[i]==-EINVAL ||
+            res_vec[i]==-EOPNOTSUPP)?URING_NOT_RUN:res_vec[i];
+
+        /* write each file and close it once written */
+        res_vec.assign(2*n,URING_NOT_RUN);
+        for (i=0;i<n && run;i++)
+        {
+            if (fd_vec[i]<0) continue;
+            const string &text=task_vec[i]->text;
+            struct io_uring_sqe *sqe=uring_get(ring);
+            sqe->opcode=IORING_OP_WRITE;
+            sqe->fd=fd_vec[i];
+            sqe->addr=(unsigned long long)text.data();
+            sqe->len=min(text.size(),URING_WRITE);
+            sqe->off=0;
+            sqe->flags=IOSQE_IO_LINK;
+            sqe->user_data=2*i;
+            sqe=uring_get(ring);
+            sqe->opcode=IORING_OP_CLOSE;
+            sqe->fd=fd_vec[i];
+            sqe->user_data=2*i+1;
+        }
+        if (run) run=uring_run(ring,res_vec);
+
+        /* a short or failed write cancels the close, and files that were
+         * not opened or written through ring are written synchronously */
+        for (i=0;i<n;i++)
+        {
+            if (fd_vec[i]==URING_NOT_RUN) success_vec[i]=
+                write_file(task_vec[i]->filename,task_vec[i]->text);
+            else if (fd_vec[i]<0)
+                cerr<<"ERROR! Cannot write "<<task_vec[i]->filename<<endl;
+            else if (res_vec[2*i+1]==0) success_vec[i]=true;
+            else
+            {
+                if (res_vec[2*i+1]==-ECANCELED ||
+                    res_vec[2*i+1]==URING_NOT_RUN) success_vec[i]=write_fd(
+                    fd_vec[i],task_vec[i]->text,max(res_vec[2*i],0));
+                if (!success_vec[i])
+                    cerr<<"ERROR! Cannot write "<<task_vec[i]->filename<<endl;
+            }
+        }
+        return;
+    }
+#endif
+    for (i=0;i<n;i++)
+        success_vec[i]=write_file(task_vec[i]->filename,task_vec[i]->text);
+}
+
+/* uring END */
+/* pdb record START */
+
+/* column layout of a field of a PDB record: first and last column,
+ * counted from 1 as in the PDB format description, and justification */
+struct PdbColumn
+{
+    int first;
+    int last;
+    bool right;
+};
+
+const int PDB_WIDTH=80;
+
+/* ATOM, HETATM, ANISOU and TER */
+constexpr PdbColumn PDB_record ={ 1, 6,false};
+constexpr PdbColumn PDB_serial ={ 7,11,true };
+constexpr PdbColumn PDB_name   ={13,20,false}; // name, altLoc, resName
+constexpr PdbColumn PDB_resName={18,20,false};
+constexpr PdbColumn PDB_chainID={21,22,true }; // column 21 for 2 letter IDs
+constexpr PdbColumn PDB_resSeq ={23,27,false}; // resSeq, iCode
+constexpr PdbColumn PDB_xyz    ={31,66,false}; // x, y, z, occupancy, B
+constexpr PdbColumn PDB_U      ={29,70,false}; // U(1,1) ... U(2,3)
+constexpr PdbColumn PDB_element={77,80,false}; // element, charge
+/* MODEL */
+constexpr PdbColumn MODEL_serial={11,14,true};
+/* DBREF */
+constexpr PdbColumn DBREF_idCode      ={ 8,11,true };
+constexpr PdbColumn DBREF_chainID     ={12,13,true };
+constexpr PdbColumn DBREF_seqBegin    ={15,18,true };
+constexpr PdbColumn DBREF_insertBegin ={19,19,false};
+constexpr PdbColumn DBREF_seqEnd      ={21,24,true };
+constexpr PdbColumn DBREF_insertEnd   ={25,25,false};
+constexpr PdbColumn DBREF_database    ={27,32,false};
+constexpr PdbColumn DBREF_dbAccession ={34,41,false};
+constexpr PdbColumn DBREF_dbIdCode    ={43,54,false};
+constexpr PdbColumn DBREF_dbseqBegin  ={56,60,true };
+constexpr PdbColumn DBREF_idbnsBeg    ={61,61,false};
+constexpr PdbColumn DBREF_dbseqEnd    ={63,67,true };
+constexpr PdbColumn DBREF_dbinsEnd    ={68,68,false};
+/* SEQRES. residue n, counting from 0, is at SEQRES_resName+4*n */
+constexpr PdbColumn SEQRES_serNum ={ 7,10,true };
+constexpr PdbColumn SEQRES_chainID={11,12,true };
+constexpr PdbColumn SEQRES_numRes ={13,17,true };
+constexpr PdbColumn SEQRES_resName={20,22,false};
+/* CRYST1 */
+constexpr PdbColumn CRYST1_a    ={ 7,15,true };
+constexpr PdbColumn CRYST1_b    ={16,24,true };
+constexpr PdbColumn CRYST1_c    ={25,33,true };
+constexpr PdbColumn CRYST1_alpha={34,40,true };
+constexpr PdbColumn CRYST1_beta ={41,47,true };
+constexpr PdbColumn CRYST1_gamma={48,54,true };
+constexpr PdbColumn CRYST1_sGroup={56,66,false};
+constexpr PdbColumn CRYST1_z    ={67,70,true };
+/* MASTER. the 12 counts numRemark, "0", numHet, numHelix, numSheet,
+ * numTurn, numSite, numXform, numCoord, numTer, numConect and numSeq are
+ * every 5 columns from MASTER_num */
+constexpr PdbColumn MASTER_num={11,15,true};
+/* blank columns at the end of CRYST1 and MASTER. they move to the right
+ * together with the fields before them */
+constexpr PdbColumn PDB_tail={71,80,false};
+
+constexpr PdbColumn pdb_shift(const PdbColumn &col, const int n)
+{
+    return PdbColumn{col.first+n,col.last+n,col.right};
+}
+
+/* one PDB record being filled field by field. a value wider than its
+ * columns moves the rest of the record to the right, as setw() does. the
+ * text is reused for every record, so writing a record allocates nothing */
+struct PdbLine
+{
+    string text; // at least PDB_WIDTH blank filled characters
+    int shift;   // number of characters the fields are moved by
+    int end;     // end of the last field, counted with the shift
+};
+
+/* blank record with record name */
+inline void pdb_start(PdbLine &line, const string_view record)
+{
+    line.text.assign(PDB_WIDTH,' ');
+    line.shift=0;
+    line.end=0;
+    memcpy(&line.text[0],record.data(),min(record.size(),(size_t)6));
+}
+
+void pdb_put(PdbLine &line, const PdbColumn &col, const string_view value)
+{
+    int width=col.last-col.first+1;
+    int n=value.size();
+    int pad=(n<width)?width-n:0;
+    size_t pos=col.first-1+line.shift;
+    if (pos+n+pad>line.text.size()) line.text.resize(pos+n+pad,' ');
+    if (col.right)
+    {
+        memset(&line.text[pos],' ',pad);
+        pos+=pad;
+    }
+    else memset(&line.text[pos+n],' ',pad);
+    if (n) memcpy(&line.text[pos],value.data(),n);
+    if (n>width) line.shift+=n-width;
+    line.end=col.last+line.shift;
+}
+
+void pdb_put(PdbLine &line, const PdbColumn &col, const long int value)
+{
+    char buf[24];
+    int i=sizeof(buf);
+    unsigned long int v=(value<0)?-(unsigned long int)value:value;
+    do
+    {
+        buf[--i]='0'+v%10;
+        v/=10;
+    } while (v);
+    if (value<0) buf[--i]='-';
+    pdb_put(line,col,string_view(buf+i,sizeof(buf)-i));
+}
+
+/* append the record to out: PDB_WIDTH columns, or up to the end of the
+ * last field if it is moved beyond */
+inline void pdb_finish(const PdbLine &line, string &out)
+{
+    out.append(line.text.data(),max(line.end,PDB_WIDTH));
+    out+='\n';
+}
+
+/* record of a single text, e.g. END or JRNL text, padded to PDB_WIDTH */
+inline void pdb_text(const string_view text, string &out)
+{
+    out+=text;
+    if (text.size()<PDB_WIDTH) out.append(PDB_WIDTH-text.size(),' ');
+    out+='\n';
+}
+
+/* leading blanks and width of atom name in columns 13-16, by the length
+ * of the name and by whether the element symbol has two letters. names of
+ * one letter elements start at column 14 unless they take all four */
+const int atom_name_lead[2][5]= {{0,1,1,1,0},{0,0,0,0,0}};
+const int atom_name_width[2][5]={{0,4,4,4,4},{4,4,4,4,4}};
+
+void align_atom_name(string &atom_id, const bool two_letter)
+{
+    size_t n=min(atom_id.size(),(size_t)4);
+    char buf[4];
+    int lead=atom_name_lead[two_letter][n];
+    int width=atom_name_width[two_letter][n];
+    memset(buf,' ',4);
+    memcpy(buf+lead,atom_id.data(),n);
+    atom_id.assign(buf,width);
+}
+
+/* columns 79-80 of formal charge, with the sign after the digit, e.g. 2-
+ * for -2. charge of a single digit is positive */
+void align_charge(string &charge)
+{
+    if (charge=="." || charge=="?") charge="  ";
+    else if (charge.size()==1)
+        charge+=('1'<=charge[0] && charge[0]<='9')?'+':' ';
+    else if (charge.size()>2) charge.resize(2);
+    if (charge.size() && (charge[0]=='+' || charge[0]=='-'))
+        swap(charge[0],charge[1]);
+}
+
+/* pdb record END */
+/* main START */
+
+/* ANISOU value, i.e., U*10000 as integer, in exactly 7 characters of buf.
+ * more than 4 decimals are rounded, except that a 5th decimal of exactly 5
+ * after an even 4th decimal is truncated */
+void formatANISOU(const string_view text, char *buf)
+{
+    size_t begin=text.find_first_not_of(' ');
+    string_view s;
+    if (begin!=string_view::npos)
+        s=text.substr(begin,text.find_last_not_of(' ')+1-begin);
+
+    char stack[64];
+    string heap;
+    char *r=stack;
+    if (s.size()+6>sizeof(stack))
+    {
+        heap.resize(s.size()+6);
+        r=&heap[0];
+    }
+    size_t n=s.size();
+    if (n) memcpy(r,s.data(),n);
+    const char *dot=(const char *)memchr(r,'.',n);
+    if (dot==NULL)
+    {
+        memcpy(r+n,".0000",5);
+        n+=5;
+    }
+    size_t found=(dot==NULL)?n-5:dot-r;
+    r[n]=0;
+    const char *post_decimal=r+found+1;
+    size_t post_size=n-found-1;
+    long int second=atoi(post_decimal);
+    if (r[0]=='-') second=-second;
+    long int anisou_int;
+    size_t i;
+    if (post_size>4)
+    {
+        double anisou_dbl=atof(r)*10000;
+        anisou_int=round(anisou_dbl);
+        for (i=n;i>found+5 && r[i-1]=='0';i--);
+        if (i==found+6 && r[found+5]=='5' &&
+            (post_decimal[3]-'0') % 2 ==0)  anisou_int=(long int)(anisou_dbl);
+    }
+    else
+    {
+        for (i=post_size;i<4;i++) second*=10;
+        r[found]=0;
+        long int first=atoi(r);
+        anisou_int=first*10000+second;
+    }
+    char num[32];
+    snprintf(num,sizeof(num),"%7ld",anisou_int);
+    memcpy(buf,num,7);
+}
+
+inline string formatANISOU(const string_view inputString)
+{
+    string result(7,' ');
+    formatANISOU(inputString,&result[0]);
+    return result;
+}
+
+/* mmCIF categories read by BeEM(). all others are CATEGORY_OTHER */
+enum CifCategory
+{
+    CATEGORY_OTHER,
+    CATEGORY_ENTRY,
+    CATEGORY_STRUCT_KEYWORDS,
+    CATEGORY_PDBX_DATABASE_STATUS,
+    CATEGORY_STRUCT_REF,
+    CATEGORY_STRUCT_REF_SEQ,
+    CATEGORY_ENTITY_POLY,
+    CATEGORY_ENTITY_POLY_SEQ,
+    CATEGORY_PDBX_AUDIT_REVISION_HISTORY,
+    CATEGORY_CITATION,
+    CATEGORY_CELL,
+    CATEGORY_SYMMETRY,
+    CATEGORY_ATOM_SITES,
+    CATEGORY_AUDIT_AUTHOR,
+    CATEGORY_CITATION_AUTHOR,
+    CATEGORY_ATOM_SITE,
+    CATEGORY_ATOM_SITE_ANISOTROP,
+    CATEGORY_NUM
+};
+
+constexpr const char *category_name[CATEGORY_NUM]={"",
+    "_entry",
+    "_struct_keywords",
+    "_pdbx_database_status",
+    "_struct_ref",
+    "_struct_ref_seq",
+    "_entity_poly",
+    "_entity_poly_seq",
+    "_pdbx_audit_revision_history",
+    "_citation",
+    "_cell",
+    "_symmetry",
+    "_atom_sites",
+    "_audit_author",
+    "_citation_author",
+    "_atom_site",
+    "_atom_site_anisotrop"
+};
+
+/* perfect hash of the names above, i.e., different for every category */
+const int CATEGORY_HASH_SIZE=32;
+constexpr unsigned int category_hash(const string_view name)
+{
+    return (name.size()+3*(unsigned char)name[1]+
+        (unsigned char)name[name.size()-1])%CATEGORY_HASH_SIZE;
+}
+
+/* category of each hash value */
+struct CategoryTable
+{
+    int slot[CATEGORY_HASH_SIZE];
+};
+
+constexpr CategoryTable make_category_table()
+{
+    CategoryTable table={};
+    for (int c=1;c<CATEGORY_NUM;c++)
+        table.slot[category_hash(category_name[c])]=c;
+    return table;
+}
+
+constexpr CategoryTable category_table=make_category_table();
+
+constexpr bool category_hash_is_perfect()
+{
+    for (int c=1;c<CATEGORY_NUM;c++)
+        if (category_table.slot[category_hash(category_name[c])]!=c)
+            return false;
+    return true;
+}
+static_assert(category_hash_is_perfect(),"category_hash() has collisions");
+
+/* category id of category name, e.g. _atom_site */
+inline int category_id(const string_view category)
+{
+    if (category.size()<2) return CATEGORY_OTHER;
+    int c=category_table.slot[category_hash(category)];
+    return (c && category==category_name[c])?c:CATEGORY_OTHER;
+}
+
+/* column indices of an _atom_site or _atom_site_anisotrop loop, -1 for
+ * absent columns. the auth/label/pdbx alternatives are resolved once per
+ * loop header, so that atom rows only need indexed access. *_long is the
+ * label column used when the auth name is too long for PDB format. */
+struct AtomSiteColumns
+{
+    int id;
+    int group_PDB;
+    int type_symbol;
+    int atom_id,atom_id_long;
+    int alt_id;
+    int comp_id,comp_id_long;
+    int asym_id;
+    int seq_id;
+    int label_seq_id;
+    int pdbx_PDB_ins_code;
+    int Cartn_x,Cartn_y,Cartn_z;
+    int U11,U12,U13,U22,U23,U33;
+    int occupancy;
+    int B_iso_or_equiv;
+    int pdbx_formal_charge;
+    int pdbx_PDB_model_num;
+};
+
+inline int column_index(const map<string,int> &loop_map, const string &key)
+{
+    map<string,int>::const_iterator it=loop_map.find(key);
+    return (it==loop_map.end())?-1:it->second;
+}
+
+/* first present column among auth_item, label_item, pdbx_auth_item and
+ * pdbx_label_item. col_long is the matching label column, if any */
+void resolve_column(const map<string,int> &loop_map, const string &item,
+    int &col, int &col_long)
+{
+    col_long=-1;
+    if ((col=column_index(loop_map,"auth_"+item))>=0)
+        col_long=column_index(loop_map,"label_"+item);
+    else if ((col=column_index(loop_map,"label_"+item))>=0);
+    else if ((col=column_index(loop_map,"pdbx_auth_"+item))>=0)
+        col_long=column_index(loop_map,"pdbx_label_"+item);
+    else col=column_index(loop_map,"pdbx_label_"+item);
+}
+
+void compile_atom_site(const map<string,int> &_atom_site, AtomSiteColumns &col)
+{
+    int unused;
+    col.id                =column_index(_atom_site,"id");
+    col.group_PDB         =column_index(_atom_site,"group_PDB");
+    col.type_symbol       =column_index(_atom_site,"type_symbol");
+    resolve_column(_atom_site,"atom_id",col.atom_id,col.atom_id_long);
+    resolve_column(_atom_site,"alt_id",col.alt_id,unused);
+    resolve_column(_atom_site,"comp_id",col.comp_id,col.comp_id_long);
+    resolve_column(_atom_site,"asym_id",col.asym_id,unused);
+    resolve_column(_atom_site,"seq_id",col.seq_id,unused);
+    col.label_seq_id      =column_index(_atom_site,"label_seq_id");
+    col.pdbx_PDB_ins_code =column_index(_atom_site,"pdbx_PDB_ins_code");
+    col.Cartn_x           =column_index(_atom_site,"Cartn_x");
+    col.Cartn_y           =column_index(_atom_site,"Cartn_y");
+    col.Cartn_z           =column_index(_atom_site,"Cartn_z");
+    if (col.Cartn_x<0 || col.Cartn_y<0) col.Cartn_z=-1;
+    string U=(_atom_site.count("aniso_U[3][3]"))?"aniso_U":"U";
+    col.U11               =column_index(_atom_site,U+"[1][1]");
+    col.U12               =column_index(_atom_site,U+"[1][2]");
+    col.U13               =column_index(_atom_site,U+"[1][3]");
+    col.U22               =column_index(_atom_site,U+"[2][2]");
+    col.U23               =column_index(_atom_site,U+"[2][3]");
+    col.U33               =column_index(_atom_site,U+"[3][3]");
+    if (col.U11<0 || col.U12<0 || col.U13<0 || col.U22<0 || col.U23<0)
+        col.U33=-1;
+    col.occupancy         =column_index(_atom_site,"occupancy");
+    col.B_iso_or_equiv    =column_index(_atom_site,"B_iso_or_equiv");
+    col.pdbx_formal_charge=column_index(_atom_site,"pdbx_formal_charge");
+    col.pdbx_PDB_model_num=column_index(_atom_site,"pdbx_PDB_model_num");
+}
+
+/* bump allocator for the text of one entry. allocations are cut from
+ * large blocks and are all released at once by arena_reset(), which keeps
+ * the last block for the next entry */
+struct Arena
+{
+    vector<char *> block_vec;
+    vector<size_t> size_vec;
+    size_t used;  // bytes used in the last block
+    Arena():used(0){}
+    ~Arena();
+};
+
+const size_t ARENA_BLOCK=1<<16;    // size of the first block
+const size_t ARENA_KEEP =1<<24;    // largest block kept by arena_reset()
+
+char *arena_alloc(Arena &arena, const size_t n)
+{
+    if (arena.block_vec.size()==0 || arena.used+n>arena.size_vec.back())
+    {
+        size_t size=arena.size_vec.size()?2*arena.size_vec.back():ARENA_BLOCK;
+        if (size<n) size=n;
+        arena.block_vec.push_back(new char[size]);
+        arena.size_vec.push_back(size);
+        arena.used=0;
+    }
+    char *p=arena.block_vec.back()+arena.used;
+    arena.used+=n;
+    return p;
+}
+
+/* copy of str that lives until arena_reset() */
+string_view arena_copy(Arena &arena, const string_view str)
+{
+    if (str.size()==0) return string_view();
+    char *p=arena_alloc(arena,str.size());
+    memcpy(p,str.data(),str.size());
+    return string_view(p,str.size());
+}
+
+void arena_reset(Arena &arena)
+{
+    size_t b,keep=arena.block_vec.size();
+    if (keep && arena.size_vec.back()<=ARENA_KEEP) keep--;
+    for (b=0;b<arena.block_vec.size();b++)
+        if (b!=keep) delete [] arena.block_vec[b];
+    if (keep<arena.block_vec.size())
+    {
+        arena.block_vec[0]=arena.block_vec[keep];
+        arena.size_vec[0]=arena.size_vec[keep];
+        arena.block_vec.resize(1);
+        arena.size_vec.resize(1);
+    }
+    else
+    {
+        arena.block_vec.clear();
+        arena.size_vec.clear();
+    }
+    arena.used=0;
+}
+
+Arena::~Arena()
+{
+    for (size_t b=0;b<block_vec.size();b++) delete [] block_vec[b];
+}
+
+/* interned strings: each distinct string gets a dense integer id. the
+ * text of the strings is kept in an arena */
+struct SymbolTable
+{
+    vector<string_view> str_vec;
+    unordered_map<string_view,int> id_map;
+};
+
+inline int intern(Arena &arena, SymbolTable &table, const string_view str)
+{
+    unordered_map<string_view,int>::iterator it=table.id_map.find(str);
+    if (it!=table.id_map.end()) return it->second;
+    table.str_vec.push_back(arena_copy(arena,str));
+    table.id_map[table.str_vec.back()]=table.str_vec.size()-1;
+    return table.str_vec.size()-1;
+}
+
+/* id of str, or -1 if str is not in table */
+inline int find_id(const SymbolTable &table, const string_view str)
+{
+    unordered_map<string_view,int>::const_iterator it=table.id_map.find(str);
+    return (it==table.id_map.end())?-1:it->second;
+}
+
+/* bytes of a column kept by clear_column(), so that the tables of a
+ * batch worker do not stay sized for the largest input it converted */
+const size_t COLUMN_KEEP=1<<18;
+
+/* empty vec, keeping its memory unless that is more than COLUMN_KEEP */
+template <class T> void clear_column(T &vec)
+{
+    if (vec.capacity()*sizeof(vec[0])>COLUMN_KEEP) T().swap(vec);
+    else vec.clear();
+}
+
+/* forget all strings, keeping the memory of the table unless large */
+void clear_symbols(SymbolTable &table)
+{
+    clear_column(table.str_vec);
+    if (table.id_map.bucket_count()*sizeof(void *)>COLUMN_KEEP)
+        unordered_map<string_view,int>().swap(table.id_map);
+    else table.id_map.clear();
+}
+
+/* text of width characters with digit decimals for fixed point value,
+ * right aligned as by formatNumber() */
+void format_fixed(const int value, char *buf, const int width, const int digit)
+{
+    unsigned int v=(value<0)?-(unsigned int)value:value;
+    int i=width;
+    int d;
+    for (d=0;d<digit && i>0;d++)
+    {
+        buf[--i]='0'+v%10;
+        v/=10;
+    }
+    if (i>0) buf[--i]='.';
+    do
+    {
+        if (i>0) buf[--i]='0'+v%10;
+        v/=10;
+    } while (v && i>0);
+    if (value<0 && i>0) buf[--i]='-';
+    while (i>0) buf[--i]=' ';
+}
+
+/* fixed point value of text written by formatNumber(). false if text is
+ * not a number that format_fixed() reproduces exactly */
+bool parse_fixed(const char *text, const int width, const int digit, int &value)
+{
+    int i=0;
+    long int v=0;
+    while (i<width && text[i]==' ') i++;
+    bool negative=(i<width && text[i]=='-');
+    if (negative) i++;
+    if (i>=width-digit-1) return false;
+    for (;i<width-digit-1;i++)
+    {
+        if (text[i]<'0' || text[i]>'9') return false;
+        v=v*10+text[i]-'0';
+    }
+    if (text[i++]!='.') return false;
+    for (;i<width;i++)
+    {
+        if (text[i]<'0' || text[i]>'9') return false;
+        v=v*10+text[i]-'0';
+    }
+    value=negative?-v:v;
+    char buf[16];
+    format_fixed(value,buf,width,digit);
+    return memcmp(buf,text,width)==0;
+}
+
+/* kind of atom record, and flags of the atom */
+enum AtomFlag
+{
+    ATOM_POLYMER=0,
+    ATOM_LIGAND =1,
+    ATOM_WATER  =2,
+    ATOM_KIND   =3, // mask of the kinds above
+    ATOM_TER    =4, // last polymer atom of a chain in a model
+    ATOM_TEXT   =8  // coordinates are kept as text in text_map
+};
+
+/* atom records of one entry, one vector per column, in input order.
+ * record name, atom name (with altLoc and residue name), residue number
+ * (with insertion code), chain and element (with charge) are interned;
+ * coordinates, occupancy and B-factor are fixed point numbers; model is
+ * an index into model_num_vec. PDB text is made by atom_line() at output.
+ * text is kept in arena. clear_atom_table() empties the table for the next
+ * entry without giving back its memory */
+struct AtomTable
+{
+    Arena arena;
+    SymbolTable group;   // columns 1-6
+    SymbolTable name;    // columns 13-20
+    SymbolTable res;     // columns 23-27
+    SymbolTable chain;   // original chain ID
+    SymbolTable element; // columns 77-80
+    vector<int> group_vec;
+    vector<int> model_vec;
+    vector<int> name_vec;
+    vector<int> res_vec;
+    vector<int> chain_vec;
+    vector<int> element_vec;
+    vector<int> x_vec;   // 1/1000 Angstrom
+    vector<int> y_vec;
+    vector<int> z_vec;
+    vector<int> occupancy_vec; // 1/100
+    vector<int> B_vec;         // 1/100
+    vector<unsigned char> flag_vec;
+    map<size_t,string_view> text_map; // columns 31-66 of ATOM_TEXT atoms
+    vector<long long> id_vec;    // atom_id_key() of _atom_site.id
+    vector<int> anisou_vec;      // index of ANISOU values in anisou_text
+    string anisou_text;          // columns 29-70 of ANISOU, 42 per atom
+};
+
+/* _atom_site.id as a number. ids that are not plain numbers are hashed */
+long long atom_id_key(const string_view id)
+{
+    long long key=0;
+    size_t i;
+    for (i=0;i<id.size() && '0'<=id[i] && id[i]<='9' && key<(1LL<<58);i++)
+        key=key*10+id[i]-'0';
+    if (i==id.size() && i) return key;
+    key=1469598103934665603LL;
+    for (i=0;i<id.size();i++) key=(key^(unsigned char)id[i])*1099511628211LL;
+    return (key&0x3fffffffffffffffLL)|(1LL<<60);
+}
+
+void add_atom(AtomTable &table, const long long id,
+    const string &group_PDB, const int model,
+    const string &name, const string &res, const string &asym_id,
+    const string &element, const string &Cartn_x, const string &Cartn_y,
+    const string &Cartn_z, const string &occupancy,
+    const string &B_iso_or_equiv, const int kind)
+{
+    int x,y,z,o,b;
+    unsigned char flag=kind;
+    if (!parse_fixed(Cartn_x.data(),8,3,x) ||
+        !parse_fixed(Cartn_y.data(),8,3,y) ||
+        !parse_fixed(Cartn_z.data(),8,3,z) ||
+        !parse_fixed(occupancy.data(),6,2,o) ||
+        !parse_fixed(B_iso_or_equiv.data(),6,2,b))
+    {
+        x=y=z=o=b=0;
+        flag|=ATOM_TEXT;
+        const string *text[5]={&Cartn_x,&Cartn_y,&Cartn_z,&occupancy,
+            &B_iso_or_equiv};
+        size_t i,n=0;
+        for (i=0;i<5;i++) n+=text[i]->size();
+        char *p=arena_alloc(table.arena,n);
+        table.text_map[table.flag_vec.size()]=string_view(p,n);
+        for (i=0;i<5;i++)
+        {
+            if (text[i]->size()) memcpy(p,text[i]->data(),text[i]->size());
+            p+=text[i]->size();
+        }
+    }
+    table.group_vec.push_back(intern(table.arena,table.group,group_PDB));
+    table.model_vec.push_back(model);
+    table.name_vec.push_back(intern(table.arena,table.name,name));
+    table.res_vec.push_back(intern(table.arena,table.res,res));
+    table.chain_vec.push_back(intern(table.arena,table.chain,asym_id));
+    table.element_vec.push_back(intern(table.arena,table.element,element));
+    table.x_vec.push_back(x);
+    table.y_vec.push_back(y);
+    table.z_vec.push_back(z);
+    table.occupancy_vec.push_back(o);
+    table.B_vec.push_back(b);
+    table.flag_vec.push_back(flag);
+    table.id_vec.push_back(id);
+    table.anisou_vec.push_back(-1);
+}
+
+void clear_atom_table(AtomTable &table)
+{
+    clear_symbols(table.group);
+    clear_symbols(table.name);
+    clear_symbols(table.res);
+    clear_symbols(table.chain);
+    clear_symbols(table.element);
+    clear_column(table.group_vec);
+    clear_column(table.model_vec);
+    clear_column(table.name_vec);
+    clear_column(table.res_vec);
+    clear_column(table.chain_vec);
+    clear_column(table.element_vec);
+    clear_column(table.x_vec);
+    clear_column(table.y_vec);
+    clear_column(table.z_vec);
+    clear_column(table.occupancy_vec);
+    clear_column(table.B_vec);
+    clear_column(table.flag_vec);
+    table.text_map.clear();
+    clear_column(table.id_vec);
+    clear_column(table.anisou_vec);
+    clear_column(table.anisou_text);
+    arena_reset(table.arena);
+}
+
+/* set the 42 characters of U values for ANISOU of atom a */
+void set_anisou(AtomTable &table, const size_t a, const string &anisou)
+{
+    if (table.anisou_vec[a]<0)
+    {
+        table.anisou_vec[a]=table.anisou_text.size()/42;
+        table.anisou_text+=anisou;
+    }
+    else table.anisou_text.replace(42*table.anisou_vec[a],42,anisou);
+}
+
+/* key of atom a to match _atom_site_anisotrop rows with: the id, or atom
+ * name, residue and chain if ids are not available */
+inline long long anisou_key(const AtomTable &table, const size_t a,
+    const bool by_id)
+{
+    if (by_id) return table.id_vec[a];
+    return ((long long)table.chain_vec[a]<<42)|
+           ((long long)table.res_vec[a]<<21)|table.name_vec[a];
+}
+
+/* attach U values of an _atom_site_anisotrop row to the atom with the same
+ * key. rows normally follow atom order, so the atom after the previous
+ * match (cursor) is tried first; key_map, which is built on the first
+ * miss, finds atoms of rows out of order. false if there is no such atom */
+bool add_anisou(AtomTable &table, const long long key, const bool by_id,
+    const string &anisou, size_t &cursor,
+    unordered_map<long long,size_t> &key_map)
+{
+    size_t a;
+    if (cursor<table.flag_vec.size() && anisou_key(table,cursor,by_id)==key)
+        a=cursor;
+    else
+    {
+        if (key_map.size()==0)
+            for (a=table.flag_vec.size();a>0;a--)
+                key_map[anisou_key(table,a-1,by_id)]=a-1;
+        unordered_map<long long,size_t>::iterator it=key_map.find(key);
+        if (it==key_map.end()) return false;
+        a=it->second;
+    }
+    set_anisou(table,a,anisou);
+    cursor=a+1;
+    return true;
+}
+
+/* fields of the last _atom_site row read. columns absent from the loop
+ * keep the value of the previous row */
+struct AtomSiteRow
+{
+    string group_PDB  ="ATOM"; // (ATOM/HETATM)
+    string type_symbol="C";    // (element symbol)
+    string atom_id    ="CA";   // auth_atom_id, label_atom_id (atom name)
+    string alt_id     =" ";    // auth_alt_id, label_alt_id
+                               // (alternative location indicator)
+    string comp_id    ="UNK";  // auth_comp_id, label_comp_id (residue name)
+    string asym_id    ="A"; // auth_asym_id, label_asym_id (chain ID)
+    string seq_id     ="   1"; // label_seq_id, auth_seq_id (residue index)
+    string pdbx_PDB_ins_code=" ";// (insertion code)
+    string Cartn_x    ="   0.000"; 
+    string Cartn_y    ="   0.000"; 
+    string Cartn_z    ="   0.000"; 
+    string occupancy  ="  1.00";
+    string B_iso_or_equiv="  0.00";   // Bfactor
+    string pdbx_formal_charge="  ";
+    string pdbx_PDB_model_num="   1"; // model index
+    string U11="  10000";
+    string U12="      0";
+    string U13="      0";
+    string U22="  10000";
+    string U23="      0";
+    string U33="  10000";
+    string filter_asym_id;   // last chain checked against outputChain_vec
+    bool filter_pass=true;
+};
+
+/* models and chains of the atoms read so far */
+struct AtomSiteState
+{
+    vector<string> model_num_vec=vector<string>(1,"   1");
+    int model=0; // index of pdbx_PDB_model_num in model_num_vec
+    /* per chain state is indexed by chain id in the chain table */
+    vector<size_t> chainAtomNum_vec;
+    vector<size_t> chainHydrNum_vec;
+    vector<int> chainID_vec; // chains with atoms in the first model
+    size_t anisou_cursor=0; // atom after the last _atom_site_anisotrop match
+    unordered_map<long long,size_t> anisou_key_map;
+};
+
+/* read one row of an _atom_site or _atom_site_anisotrop loop into table.
+ * long residue names are mapped through ccd5_map; false if that is needed
+ * but ccd5_map is NULL */
+bool read_atom_site(AtomSiteRow &r, AtomSiteState &s, AtomTable &table,
+    const vector<string_view> &item_vec, const AtomSiteColumns &atom_col,
+    const vector<string> &ccd3_vec, map<string,string> *ccd5_map,
+    vector<string> *ccd5_vec, const vector<string> &outputChain_vec)
+{
+    int kind;
+    int chain; // chain id in table.chain
+    long long anisou_id; // key of an _atom_site_anisotrop row
+    if (atom_col.group_PDB>=0)
+        r.group_PDB=item_vec[atom_col.group_PDB];
+    if (r.group_PDB=="ATOM") r.group_PDB="ATOM  ";
+    
+    if (atom_col.atom_id>=0)
+    {
+        r.atom_id=item_vec[atom_col.atom_id];
+        if (r.atom_id.size()>4 && atom_col.atom_id_long>=0)
+            r.atom_id=item_vec[atom_col.atom_id_long];
+    }
+    r.atom_id=r.atom_id.substr(0,4);
+    
+    if (atom_col.type_symbol>=0)
+        r.type_symbol=item_vec[atom_col.type_symbol].substr(0,2);
+    else r.type_symbol=lstrip(r.atom_id,"1234567890 ")[0];
+
+    align_atom_name(r.atom_id,r.type_symbol.size()==2);
+    if (r.type_symbol.size()==1) r.type_symbol=' '+r.type_symbol;
+
+    if (atom_col.alt_id>=0) r.alt_id=item_vec[atom_col.alt_id];
+    if (r.alt_id=="." || r.alt_id=="?") r.alt_id=" ";
+    else r.alt_id=r.alt_id[0];
+
+    if (atom_col.comp_id>=0)
+    {
+        r.comp_id=item_vec[atom_col.comp_id];
+        if (r.comp_id.size()>3 && atom_col.comp_id_long>=0)
+            r.comp_id=item_vec[atom_col.comp_id_long];
+    }
+    if      (r.comp_id.size()==1) r.comp_id="  "+r.comp_id;
+    else if (r.comp_id.size()==2) r.comp_id=" "+r.comp_id;
+    if (r.comp_id.size()>3)
+    {
+        if (ccd3_vec.size()==0) r.comp_id=r.comp_id.substr(0,3);
+        else
+        {
+            if (ccd5_map==NULL) return false;
+            if (ccd5_map->count(r.comp_id)==0)
+            {
+                (*ccd5_map)[r.comp_id]=ccd3_vec[ccd5_vec->size() % ccd3_vec.size()];
+                ccd5_vec->push_back(r.comp_id);
+            }
+            r.comp_id=(*ccd5_map)[r.comp_id];
+        }
+    }
+
+    if (atom_col.asym_id>=0) r.asym_id=item_vec[atom_col.asym_id];
+    if (r.asym_id=="." || r.asym_id=="?") r.asym_id="_";
+    if (outputChain_vec.size())
+    {
+        if (r.asym_id!=r.filter_asym_id)
+        {
+            r.filter_asym_id=r.asym_id;
+            r.filter_pass=(find(outputChain_vec.begin(),
+                outputChain_vec.end(), r.asym_id)!=outputChain_vec.end());
+        }
+        if (!r.filter_pass) return true;
+    }
+    if (r.asym_id=="_") r.asym_id=" ";
+
+    if (atom_col.seq_id>=0) r.seq_id=item_vec[atom_col.seq_id];
+    if (r.seq_id.size()>=2) r.seq_id=lstrip(r.seq_id,"0");
+    if (r.seq_id.size()==3) r.seq_id=" "+r.seq_id;
+    else if (r.seq_id.size()==2) r.seq_id="  "+r.seq_id;
+    else if (r.seq_id.size()==1) r.seq_id="   "+r.seq_id;
+    //else if (r.seq_id.size()>4) r.seq_id=r.seq_id.substr(r.seq_id.size()-4);
+
+    if (atom_col.pdbx_PDB_ins_code>=0)
+        r.pdbx_PDB_ins_code=item_vec[atom_col.pdbx_PDB_ins_code];
+    if (r.pdbx_PDB_ins_code=="." || r.pdbx_PDB_ins_code=="?")
+        r.pdbx_PDB_ins_code=" ";
+    else r.pdbx_PDB_ins_code=r.pdbx_PDB_ins_code[0];
+    r.seq_id+=r.pdbx_PDB_ins_code;
+    if (r.seq_id.size()>5) r.seq_id=r.seq_id.substr(0,5);
+
+    if (atom_col.Cartn_z>=0)
+    {
+        formatNumber(item_vec[atom_col.Cartn_x],&r.Cartn_x[0],8,3);
+        formatNumber(item_vec[atom_col.Cartn_y],&r.Cartn_y[0],8,3);
+        formatNumber(item_vec[atom_col.Cartn_z],&r.Cartn_z[0],8,3);
+    }
+
+    if (atom_col.U33>=0)
+    {
+        formatANISOU(item_vec[atom_col.U11],&r.U11[0]);
+        formatANISOU(item_vec[atom_col.U12],&r.U12[0]);
+        formatANISOU(item_vec[atom_col.U13],&r.U13[0]);
+        formatANISOU(item_vec[atom_col.U22],&r.U22[0]);
+        formatANISOU(item_vec[atom_col.U23],&r.U23[0]);
+        formatANISOU(item_vec[atom_col.U33],&r.U33[0]);
+    }
+
+    if (atom_col.occupancy>=0)
+        formatNumber(item_vec[atom_col.occupancy],&r.occupancy[0],6,2);
+
+    if (atom_col.B_iso_or_equiv>=0)
+        formatNumber(item_vec[atom_col.B_iso_or_equiv],&r.B_iso_or_equiv[0],6,2);
+
+    if (atom_col.pdbx_formal_charge>=0)
+        r.pdbx_formal_charge=item_vec[atom_col.pdbx_formal_charge];
+    align_charge(r.pdbx_formal_charge);
+
+    if (atom_col.pdbx_PDB_model_num>=0)
+        r.pdbx_PDB_model_num=item_vec[atom_col.pdbx_PDB_model_num];
+    if (r.pdbx_PDB_model_num=="." || r.pdbx_PDB_model_num=="?")
+        r.pdbx_PDB_model_num="   1";
+    else if (r.pdbx_PDB_model_num.size()==1) 
+        r.pdbx_PDB_model_num="   "+r.pdbx_PDB_model_num;
+    else if (r.pdbx_PDB_model_num.size()==2) 
+        r.pdbx_PDB_model_num="  "+r.pdbx_PDB_model_num;
+    else if (r.pdbx_PDB_model_num.size()==3) 
+        r.pdbx_PDB_model_num=" "+r.pdbx_PDB_model_num;
+    if (r.pdbx_PDB_model_num!=s.model_num_vec[s.model])
+    {
+        s.model=find(s.model_num_vec.begin(),s.model_num_vec.end(),
+            r.pdbx_PDB_model_num)-s.model_num_vec.begin();
+        if (s.model==s.model_num_vec.size())
+            s.model_num_vec.push_back(r.pdbx_PDB_model_num);
+    }
+
+    if (atom_col.Cartn_z>=0)
+    {
+/*
+COLUMNS        DATA  TYPE    FIELD        DEFINITION
+-------------------------------------------------------------------------------------
+ 1 -  6        Record name   "ATOM  "
+ 7 - 11        Integer       serial       Atom  serial number.
+13 - 16        Atom          name         Atom name.
+17             Character     altLoc       Alternate location indicator.
+18 - 20        Residue name  resName      Residue name.
+22             Character     chainID      Chain identifier.
+23 - 26        Integer       resSeq       Residue sequence number.
+27             AChar         iCode        Code for insertion of residues.
+31 - 38        Real(8.3)     x            Orthogonal coordinates for X in Angstroms.
+39 - 46        Real(8.3)     y            Orthogonal coordinates for Y in Angstroms.
+47 - 54        Real(8.3)     z            Orthogonal coordinates for Z in Angstroms.
+55 - 60        Real(6.2)     r.occupancy    Occupancy.
+61 - 66        Real(6.2)     tempFactor   Temperature  factor.
+77 - 78        LString(2)    element      Element symbol, right-justified.
+79 - 80        LString(2)    charge       Charge  on the atom.
+*/
+        kind=ATOM_POLYMER;
+        if (atom_col.label_seq_id>=0 && 
+            item_vec[atom_col.label_seq_id]==".")
+            kind=(r.comp_id=="HOH")?ATOM_WATER:ATOM_LIGAND;
+        add_atom(table,(atom_col.id<0)?-1:
+            atom_id_key(item_vec[atom_col.id]),
+            r.group_PDB,s.model,r.atom_id+r.alt_id+r.comp_id,
+            r.seq_id,r.asym_id,r.type_symbol+r.pdbx_formal_charge,r.Cartn_x,
+            r.Cartn_y,r.Cartn_z,r.occupancy,r.B_iso_or_equiv,kind);
+        if (r.pdbx_PDB_model_num=="   1")
+        {
+            chain=table.chain_vec.back();
+            if (chain>=s.chainAtomNum_vec.size())
+            {
+                s.chainAtomNum_vec.resize(chain+1,0);
+                s.chainHydrNum_vec.resize(chain+1,0);
+            }
+            if (s.chainAtomNum_vec[chain]==0) s.chainID_vec.push_back(chain);
+            s.chainAtomNum_vec[chain]++;
+            s.chainHydrNum_vec[chain]+=(r.type_symbol==" H");
+        }
+    }
+    if (atom_col.U33>=0)
+    {
+        /*
+COLUMNS       DATA  TYPE    FIELD          DEFINITION
+-----------------------------------------------------------------
+ 1 - 6        Record name   "ANISOU"
+ 7 - 11       Integer       serial         Atom serial number.
+13 - 16       Atom          name           Atom name.
+17            Character     altLoc         Alternate location indicator
+18 - 20       Residue name  resName        Residue name.
+22            Character     chainID        Chain identifier.
+23 - 26       Integer       resSeq         Residue sequence number.
+27            AChar         iCode          Insertion code.
+29 - 35       Integer       u[0][0]        U(1,1)
+36 - 42       Integer       u[1][1]        U(2,2)
+43 - 49       Integer       u[2][2]        U(3,3)
+50 - 56       Integer       u[0][1]        U(1,2)
+57 - 63       Integer       u[0][2]        U(1,3)
+64 - 70       Integer       u[1][2]        U(2,3)
+77 - 78       LString(2)    element        Element symbol, right-justified.
+79 - 80       LString(2)    charge         Charge on the atom.
+         */
+        if (atom_col.Cartn_z>=0) set_anisou(table,
+            table.flag_vec.size()-1,r.U11+r.U22+r.U33+r.U12+r.U13+r.U23);
+        else if (table.flag_vec.size())
+        {
+            /* separate _atom_site_anisotrop loop */
+            bool by_id=(atom_col.id>=0 && table.id_vec[0]>=0);
+            if (by_id) anisou_id=atom_id_key(item_vec[atom_col.id]);
+            else
+            {
+                anisou_id=-1;
+                unordered_map<string_view,int>::iterator name_it,
+                    res_it,chain_it;
+                name_it=table.name.id_map.find(
+                    r.atom_id+r.alt_id+r.comp_id);
+                res_it=table.res.id_map.find(r.seq_id);
+                chain_it=table.chain.id_map.find(r.asym_id);
+                if (name_it!=table.name.id_map.end() &&
+                    res_it!=table.res.id_map.end() &&
+                    chain_it!=table.chain.id_map.end())
+                    anisou_id=((long long)chain_it->second<<42)|
+                        ((long long)res_it->second<<21)|name_it->second;
+            }
+            if (anisou_id>=0) add_anisou(table,anisou_id,by_id,
+                r.U11+r.U22+r.U33+r.U12+r.U13+r.U23,s.anisou_cursor,s.anisou_key_map);
+        }
+    }
+    return true;
+}
+
+/* bytes of _atom_site rows below which a chunk is not worth a thread */
+const size_t ATOM_SITE_CHUNK=1<<20;
+
+/* rows of an _atom_site loop read by one thread into a table of its own */
+struct AtomSiteChunk
+{
+    const char *begin;
+    const char *end;
+    AtomSiteRow row;
+    AtomSiteState state;
+    AtomTable table;
+    bool ok; // false if the rows must be read by read_atom_site() instead
+};
+
+void read_atom_site_chunk(AtomSiteChunk *chunk, const size_t ncol,
+    const AtomSiteColumns *atom_col, const vector<string> *ccd3_vec,
+    const vector<string> *outputChain_vec)
+{
+    CifTokenizer t;
+    t.begin=t.p=chunk->begin;
+    t.end=chunk->end;
+    vector<string_view> item_vec;
+    string_view token;
+    int type;
+    chunk->ok=true;
+    while (chunk->ok && (type=cif_token(t,token))!=CIF_END)
+    {
+        if (type!=CIF_VALUE) chunk->ok=false;
+        item_vec.push_back(token);
+        if (item_vec.size()<ncol) continue;
+        chunk->ok=chunk->ok && read_atom_site(chunk->row,chunk->state,
+            chunk->table,item_vec,*atom_col,*ccd3_vec,NULL,NULL,
+            *outputChain_vec);
+        item_vec.clear();
+    }
+    /* a chunk that does not end with a whole row is cut inside a row */
+    if (item_vec.size()) chunk->ok=false;
+}
+
+/* chunks of an _atom_site loop shared by the threads of
+ * read_atom_site_parallel() */
+struct AtomSiteJob
+{
+    vector<AtomSiteChunk> chunk_vec;
+    atomic<size_t> next; // index of next chunk to read
+    size_t ncol;
+    const AtomSiteColumns *atom_col;
+    const vector<string> *ccd3_vec;
+    const vector<string> *outputChain_vec;
+};
+
+void atom_site_worker(AtomSiteJob *job)
+{
+    size_t c;
+    while ((c=job->next++)<job->chunk_vec.size())
+        read_atom_site_chunk(&job->chunk_vec[c],job->ncol,job->atom_col,
+            job->ccd3_vec,job->outputChain_vec);
+}
+
+/* ids in table of the strings of from, which are added to table if new */
+void merge_symbols(Arena &arena, SymbolTable &table, const SymbolTable &from,
+    vector<int> &id_vec)
+{
+    id_vec.resize(from.str_vec.size());
+    for (size_t i=0;i<from.str_vec.size();i++)
+        id_vec[i]=intern(arena,table,from.str_vec[i]);
+}
+
+/* append the atoms of chunk to table, as if its rows were read after the
+ * atoms already in table. strings, models and chains new to table get ids
+ * in order of their first appearance in chunk, as read_atom_site() would
+ * have given them */
+void merge_atom_site(AtomSiteRow &r, AtomSiteState &s, AtomTable &table,
+    AtomSiteChunk &chunk)
+{
+    AtomTable &from=chunk.table;
+    vector<int> group_map,name_map,res_map,chain_map,element_map,model_map;
+    merge_symbols(table.arena,table.group,from.group,group_map);
+    merge_symbols(table.arena,table.name,from.name,name_map);
+    merge_symbols(table.arena,table.res,from.res,res_map);
+    merge_symbols(table.arena,table.chain,from.chain,chain_map);
+    merge_symbols(table.arena,table.element,from.element,element_map);
+    size_t m,a,c;
+    for (m=0;m<chunk.state.model_num_vec.size();m++)
+    {
+        model_map.push_back(find(s.model_num_vec.begin(),s.model_num_vec.end(),
+            chunk.state.model_num_vec[m])-s.model_num_vec.begin());
+        if (model_map.back()==s.model_num_vec.size())
+            s.model_num_vec.push_back(chunk.state.model_num_vec[m]);
+    }
+
+    size_t offset=table.flag_vec.size();
+    int anisou_offset=table.anisou_text.size()/42;
+    for (a=0;a<from.flag_vec.size();a++)
+    {
+        table.group_vec.push_back(group_map[from.group_vec[a]]);
+        table.model_vec.push_back(model_map[from.model_vec[a]]);
+        table.name_vec.push_back(name_map[from.name_vec[a]]);
+        table.res_vec.push_back(res_map[from.res_vec[a]]);
+        table.chain_vec.push_back(chain_map[from.chain_vec[a]]);
+        table.element_vec.push_back(element_map[from.element_vec[a]]);
+        table.anisou_vec.push_back((from.anisou_vec[a]<0)?-1:
+            from.anisou_vec[a]+anisou_offset);
+    }
+    table.x_vec.insert(table.x_vec.end(),from.x_vec.begin(),from.x_vec.end());
+    table.y_vec.insert(table.y_vec.end(),from.y_vec.begin(),from.y_vec.end());
+    table.z_vec.insert(table.z_vec.end(),from.z_vec.begin(),from.z_vec.end());
+    table.occupancy_vec.insert(table.occupancy_vec.end(),
+        from.occupancy_vec.begin(),from.occupancy_vec.end());
+    table.B_vec.insert(table.B_vec.end(),from.B_vec.begin(),from.B_vec.end());
+    table.flag_vec.insert(table.flag_vec.end(),
+        from.flag_vec.begin(),from.flag_vec.end());
+    table.id_vec.insert(table.id_vec.end(),
+        from.id_vec.begin(),from.id_vec.end());
+    for (map<size_t,string_view>::iterator it=from.text_map.begin();
+        it!=from.text_map.end();it++)
+        table.text_map[offset+it->first]=arena_copy(table.arena,it->second);
+    table.anisou_text+=from.anisou_text;
+
+    for (c=0;c<chunk.state.chainID_vec.size();c++)
+    {
+        int chain=chain_map[chunk.state.chainID_vec[c]];
+        if (chain>=s.chainAtomNum_vec.size())
+        {
+            s.chainAtomNum_vec.resize(chain+1,0);
+            s.chainHydrNum_vec.resize(chain+1,0);
+        }
+        if (s.chainAtomNum_vec[chain]==0) s.chainID_vec.push_back(chain);
+        s.chainAtomNum_vec[chain]+=
+            chunk.state.chainAtomNum_vec[chunk.state.chainID_vec[c]];
+        s.chainHydrNum_vec[chain]+=
+            chunk.state.chainHydrNum_vec[chunk.state.chainID_vec[c]];
+    }
+
+    /* rows after the chunk continue from its last row */
+    r=chunk.row;
+    s.model=model_map[chunk.state.model];
+}
+
+/* read the rows of an _atom_site loop, whose header reader has just read,
+ * with thread_num threads. the rows are cut into chunks at line ends, each
+ * chunk is read into a table of its own, and the tables are appended in
+ * order. false, with nothing read, if the loop is too small, if its rows
+ * cannot be cut safely, or if a row depends on the row before it through
+ * an absent column; the caller then reads the rows one by one */
+bool read_atom_site_parallel(CifReader &reader, AtomSiteRow &r,
+    AtomSiteState &s, AtomTable &table, const AtomSiteColumns &atom_col,
+    const vector<string> &ccd3_vec, const vector<string> &outputChain_vec,
+    const int thread_num, HelpPool *pool=NULL)
+{
+    if (thread_num<=1 || reader.type!=CIF_VALUE || atom_col.Cartn_z<0 ||
+        atom_col.atom_id<0 || atom_col.seq_id<0 ||
+        reader.tok.end-reader.tok.p<2*ATOM_SITE_CHUNK) return false;
+    const char *begin;
+    const char *end;
+    if (!cif_rows(reader,begin,end)) return false;
+    size_t nchunk=min((size_t)thread_num,(size_t)(end-begin)/ATOM_SITE_CHUNK);
+    if (nchunk<=1) return false;
+
+    AtomSiteJob job;
+    job.ncol=reader.ncol;
+    job.atom_col=&atom_col;
+    job.ccd3_vec=&ccd3_vec;
+    job.outputChain_vec=&outputChain_vec;
+    job.next=0;
+    vector<AtomSiteChunk> &chunk_vec=job.chunk_vec;
+    chunk_vec.resize(nchunk);
+    size_t c;
+    const char *p=begin;
+    for (c=0;c<nchunk;c++)
+    {
+        chunk_vec[c].begin=p;
+        if (c+1<nchunk) p=(const char *)memchr(begin+(end-begin)*(c+1)/nchunk,
+            '\n',end-begin-(end-begin)*(c+1)/nchunk);
+        p=(c+1==nchunk || p==NULL)?end:p+1;
+        chunk_vec[c].end=p;
+        chunk_vec[c].row=r;
+    }
+    run_parallel(atom_site_worker,&job,nchunk,pool);
+    for (c=0;c<nchunk;c++) if (!chunk_vec[c].ok) return false;
+
+    for (c=0;c<nchunk;c++) merge_atom_site(r,s,table,chunk_vec[c]);
+    reader.tok.p=end;
+    reader.type=cif_token(reader.tok,reader.token);
+    reader.in_header=false;
+    return true;
+}
+
+/* mark the last polymer atom before a change of chain or model */
+void mark_ter(AtomTable &table)
+{
+    size_t a,prev=table.flag_vec.size();
+    for (a=0;a<table.flag_vec.size();a++)
+    {
+        if ((table.flag_vec[a]&ATOM_KIND)!=ATOM_POLYMER) continue;
+        if (prev<a && (table.chain_vec[a]!=table.chain_vec[prev] ||
+            table.model_vec[a]!=table.model_vec[prev]))
+            table.flag_vec[prev]|=ATOM_TER;
+        prev=a;
+    }
+    if (prev<table.flag_vec.size()) table.flag_vec[prev]|=ATOM_TER;
+}
+
+/* ATOM/HETATM line of atom a, with model number in place of serial number
+ * and blank chain ID */
+void atom_line(const AtomTable &table, const size_t a,
+    const vector<string> &model_num_vec, string &line)
+{
+    line.assign(table.group.str_vec[table.group_vec[a]]);
+    line+=' ';
+    line+=model_num_vec[table.model_vec[a]];
+    line+=' ';
+    line+=table.name.str_vec[table.name_vec[a]];
+    line+="  ";
+    line+=table.res.str_vec[table.res_vec[a]];
+    line+="   ";
+    if (table.flag_vec[a]&ATOM_TEXT) line+=table.text_map.at(a);
+    else
+    {
+        size_t pos=line.size();
+        line.resize(pos+36);
+        format_fixed(table.x_vec[a],&line[pos],8,3);
+        format_fixed(table.y_vec[a],&line[pos+8],8,3);
+        format_fixed(table.z_vec[a],&line[pos+16],8,3);
+        format_fixed(table.occupancy_vec[a],&line[pos+24],6,2);
+        format_fixed(table.B_vec[a],&line[pos+30],6,2);
+    }
+    line+="          ";
+    line+=table.element.str_vec[table.element_vec[a]];
+}
+
+/* ATOM/HETATM record of atom a with serial number and chain ID. false if
+ * a field of the atom is not as wide as its columns, in which case the
+ * record is cut from atom_line() instead */
+bool pdb_atom(const AtomTable &table, const size_t a,
+    const vector<string> &model_num_vec, const long int serial,
+    const string_view chainID, PdbLine &line)
+{
+    string_view group  =table.group.str_vec[table.group_vec[a]];
+    string_view name   =table.name.str_vec[table.name_vec[a]];
+    string_view res    =table.res.str_vec[table.res_vec[a]];
+    string_view element=table.element.str_vec[table.element_vec[a]];
+    if (group.size()!=6 || model_num_vec[table.model_vec[a]].size()!=4 ||
+        name.size()!=8 || res.size()!=5 || element.size()!=4 ||
+        chainID.size()!=2 || ((table.flag_vec[a]&ATOM_TEXT) &&
+        table.text_map.at(a).size()!=36)) return false;
+    pdb_start(line,group);
+    pdb_put(line,PDB_serial,serial);
+    pdb_put(line,PDB_name,name);
+    pdb_put(line,PDB_chainID,chainID);
+    pdb_put(line,PDB_resSeq,res);
+    if (table.flag_vec[a]&ATOM_TEXT) pdb_put(line,PDB_xyz,table.text_map.at(a));
+    else
+    {
+        char *xyz=&line.text[PDB_xyz.first-1];
+        format_fixed(table.x_vec[a],xyz,8,3);
+        format_fixed(table.y_vec[a],xyz+8,8,3);
+        format_fixed(table.z_vec[a],xyz+16,8,3);
+        format_fixed(table.occupancy_vec[a],xyz+24,6,2);
+        format_fixed(table.B_vec[a],xyz+30,6,2);
+    }
+    pdb_put(line,PDB_element,element);
+    return true;
+}
+
+/* MODEL ... ENDMDL block of model m of a PDB file, whose atoms are
+ * file_atom_vec[begin] ... file_atom_vec[end-1], appended to fout. serial
+ * numbers restart from 1 in each model. return the last serial number */
+long int pdb_model(const AtomTable &table, const vector<size_t> &file_atom_vec,
+    const size_t begin, const size_t end, const vector<string> &model_num_vec,
+    const size_t m, const vector<char> &chainNewID_vec, const int outfmt,
+    string &fout)
+{
+    PdbLine pdbline;
+    stringstream buf;
+    string line;
+    string chainStr="  ";
+    char waterChain[2]={' ',' '}; // chain ID of water: blank and new ID
+    string_view atomChain;  // chainStr, or waterChain for water
+    long int atomNum=0;
+    int kind;
+    int chain=0;
+    size_t l,a;
+    if (model_num_vec.size()>1)
+    {
+        pdb_start(pdbline,"MODEL");
+        pdb_put(pdbline,MODEL_serial,model_num_vec[m]);
+        pdb_finish(pdbline,fout);
+    }
+    for (l=begin;l<end;l++)
+    {
+        a=file_atom_vec[l];
+        kind=table.flag_vec[a]&ATOM_KIND;
+        if (l==begin || table.chain_vec[a]!=chain)
+        {
+            chain=table.chain_vec[a];
+            if (outfmt!=3) chainStr=chainNewID_vec[chain];
+            else chainStr=table.chain.str_vec[chain].substr(0,2);
+            if (chainStr.size()<=1) chainStr=" "+chainStr;
+        }
+        atomNum++;
+        if (kind==ATOM_WATER)
+        {
+            waterChain[1]=chainNewID_vec[chain];
+            atomChain=string_view(waterChain,2);
+        }
+        else atomChain=chainStr;
+        if (pdb_atom(table,a,model_num_vec,atomNum%100000,atomChain,pdbline))
+        {
+            pdb_finish(pdbline,fout);
+            if (table.anisou_vec[a]>=0)
+            {
+                /* ANISOU repeats columns 7-28 and 71-80 of ATOM */
+                memcpy(&pdbline.text[0],"ANISOU",6);
+                pdb_put(pdbline,PDB_chainID,chainStr);
+                pdb_put(pdbline,PDB_U,string_view(table.anisou_text).substr(
+                    42*table.anisou_vec[a],42));
+                pdb_finish(pdbline,fout);
+            }
+            if (table.flag_vec[a]&ATOM_TER)
+            {
+                string_view name=table.name.str_vec[table.name_vec[a]];
+                string_view res=table.res.str_vec[table.res_vec[a]];
+                atomNum++;
+                pdb_start(pdbline,"TER");
+                pdb_put(pdbline,PDB_serial,atomNum%100000);
+                pdb_put(pdbline,PDB_resName,name.substr(5));
+                pdb_put(pdbline,PDB_chainID,chainStr);
+                pdb_put(pdbline,PDB_resSeq,res);
+                pdb_finish(pdbline,fout);
+            }
+            continue;
         }
-      }
-      if (rpipe(rsrc_err) > -1)
-      {
-        if ((err = ::fdopen(rpipe(rsrc_err), "r")))
+
+        /* fields of unusual width are cut at the columns of the ATOM line
+         * made by atom_line() */
+        atom_line(table,a,model_num_vec,line);
+        string_view text(line);
+        buf<<text.substr(0,6)<<setw(5)<<right
+            <<atomNum%100000<<text.substr(11,9)<<atomChain
+            <<text.substr(22)<<'\n';
+        if (table.anisou_vec[a]>=0) buf<<"ANISOU"
+            <<setw(5)<<right<<atomNum%100000
+            <<text.substr(11,9)<<chainStr<<text.substr(22,6)
+            <<string_view(table.anisou_text).substr(42*table.anisou_vec[a],42)
+            <<text.substr(70)<<'\n';
+        if (table.flag_vec[a]&ATOM_TER)
         {
-            open_files |= pstderr;
+            atomNum++;
+            buf<<"TER   "<<setw(5)<<right<<atomNum%100000
+                <<"      "<<text.substr(17,3)<<chainStr
+                <<setw(58)<<left<<text.substr(22,5)<<'\n';
         }
-      }
-      return open_files;
-    }
-
-  /**
-   *  @warning This function exposes the internals of the stream buffer and
-   *  should be used with caution.
-   *
-   *  @param  in   A FILE* that will refer to the process' stdin.
-   *  @param  out  A FILE* that will refer to the process' stdout.
-   *  @param  err  A FILE* that will refer to the process' stderr.
-   *  @return A bitwise-or of zero or more of @c pstdin, @c pstdout, @c pstderr.
-   *  @see    basic_pstreambuf::fopen()
-   */
-  template <typename C, typename T>
-    inline std::size_t
-    pstream_common<C,T>::fopen(FILE*& fin, FILE*& fout, FILE*& ferr)
-    {
-      return buf_.fopen(fin, fout, ferr);
+        fout+=buf.str();
+        buf.str(string());
     }
+    if (model_num_vec.size()>1) pdb_text("ENDMDL",fout);
+    return atomNum;
+}
 
-#endif // REDI_EVISCERATE_PSTREAMS
-
-
-} // namespace redi
-
-
-#endif  // REDI_PSTREAM_H_SEEN
-#endif  // WIN32
+/* atoms of a PDB file below which its models are formatted by one thread */
+const size_t PDB_MODEL_ATOMS=1<<15;
 
-/* pstream END */
-/* main START */
+/* models of one PDB file shared by the threads of pdb_models() */
+struct PdbModelJob
+{
+    const AtomTable *table;
+    const vector<size_t> *file_atom_vec;
+    const size_t *start_vec; // atoms of model m start at start_vec[m]
+    const vector<string> *model_num_vec;
+    const vector<char> *chainNewID_vec;
+    int outfmt;
+    atomic<size_t> next;     // index of next model to format
+    vector<string> text_vec; // text of each model
+    vector<long int> serial_vec; // last serial number of each model
+};
+
+void pdb_model_worker(PdbModelJob *job)
+{
+    size_t m;
+    while ((m=job->next++)<job->text_vec.size())
+        job->serial_vec[m]=pdb_model(*(job->table),*(job->file_atom_vec),
+            job->start_vec[m],job->start_vec[m+1],*(job->model_num_vec),m,
+            *(job->chainNewID_vec),job->outfmt,job->text_vec[m]);
+}
 
-inline string formatANISOU(const string &inputString)
+/* all models of a PDB file, whose atoms of model m start at start_vec[m],
+ * appended to fout in order. with more than one model and thread, the
+ * models are formatted in parallel, each into a buffer of its own. return
+ * the last serial number of the last model */
+long int pdb_models(const AtomTable &table, const vector<size_t> &file_atom_vec,
+    const size_t *start_vec, const vector<string> &model_num_vec,
+    const vector<char> &chainNewID_vec, const int outfmt, int thread_num,
+    string &fout, HelpPool *pool=NULL)
 {
-    string result=Trim(inputString," ");
-    size_t found=result.find_first_of('.');
-    stringstream buf;
-    if (found==string::npos)
+    size_t m,modelNum=model_num_vec.size();
+    long int atomNum=0;
+    if (thread_num>modelNum) thread_num=modelNum;
+    if (thread_num<=1 || start_vec[modelNum]-start_vec[0]<PDB_MODEL_ATOMS)
     {
-        result+=".0000";
-        found=result.find_first_of('.');
+        for (m=0;m<modelNum;m++) atomNum=pdb_model(table,file_atom_vec,
+            start_vec[m],start_vec[m+1],model_num_vec,m,chainNewID_vec,
+            outfmt,fout);
+        return atomNum;
     }
-    string post_decimal=result.substr(found+1);
-    int i;
-    long int second=atoi(post_decimal.c_str());
-    if (result[0]=='-') second=-second;
-    if (post_decimal.size()>4)
+
+    PdbModelJob job;
+    job.table         =&table;
+    job.file_atom_vec =&file_atom_vec;
+    job.start_vec     =start_vec;
+    job.model_num_vec =&model_num_vec;
+    job.chainNewID_vec=&chainNewID_vec;
+    job.outfmt        =outfmt;
+    job.next=0;
+    job.text_vec.resize(modelNum);
+    job.serial_vec.assign(modelNum,0);
+    run_parallel(pdb_model_worker,&job,thread_num,pool);
+    for (m=0;m<modelNum;m++)
     {
-        double anisou_dbl=atof(result.c_str())*10000;
-        long int anisou_int=round(anisou_dbl);
-        if (rstrip(post_decimal.substr(4),"0")=="5" &&
-            (post_decimal[3]-'0') % 2 ==0)  anisou_int=(long int)(anisou_dbl);
-        buf<<right<<setw(7)<<anisou_int<<flush;
-        result=buf.str();
-        buf.str(string());
-        post_decimal.clear();
-        return result.substr(0,7);
+        fout+=job.text_vec[m];
+        string().swap(job.text_vec[m]);
     }
-    else if (post_decimal.size()<4)
-        for (i=0;i<4-post_decimal.size();i++) second*=10;
-    
-    string pre_decimal=result.substr(0,found);
-    long int first=atoi(pre_decimal.c_str());
-    buf<<right<<setw(7)<<first*10000+second<<flush;
-    result=buf.str();
-    buf.str(string());
-    //if (result.size()>7) result=result.substr(7-result.size());
-    if (result.size()>7) result=result.substr(0,7);
-    pre_decimal.clear();
-    post_decimal.clear();
-    return result;
+    return job.serial_vec[modelNum-1];
 }
 
-int read_semi_colon(vector<string> &line_vec, const int fields, int l,
-    const vector<string> &lines, vector<string> &line_append_vec, string &line,
-    const bool ignore_quotation=false,const bool add_space=false)
+/* PDB files of an entry shared by the threads of pdb_file_worker() */
+struct PdbFileJob
 {
-    int i;
-    if (line_vec.size() && StartsWith(line_vec[0],";"))
+    const AtomTable *table;
+    const vector<string> *filename_vec;
+    const string *header1;
+    const string *header2;
+    int read_dbref;
+    int outfmt;
+    int do_gzip;
+    bool do_tar;     // keep text_vec for the tar archive instead of writing
+    const WriteStage *writer; // where files go, see output_file()
+    int thread_num;  // threads of pdb_models() for each file
+    HelpPool *pool;  // idle threads of a batch, see run_parallel()
+    const vector<vector<string> > *dbref_mat;
+    const map<string,string> *accession2db_name;
+    const map<string,string> *accession2db_code;
+    const map<int,vector<string> > *seqres_mat;
+    const vector<int> *chain_entity_vec; // chain => entity of SEQRES, or -1
+    const vector<int> *chainID_vec;
+    const vector<int> *bundleID_vec;
+    const vector<char> *chainNewID_vec;
+    const vector<size_t> *file_atom_vec;
+    const vector<size_t> *file_start_vec;
+    const vector<string> *model_num_vec;
+    const vector<int> *file_terNum;
+    const vector<int> *file_hydrNum;
+    vector<char> dbref_chainID_vec; // chain ID of DBREF of each file
+
+    atomic<size_t> next;     // index of next file to write
+    vector<string> text_vec; // text of each file
+};
+
+/* text of PDB file i of job, appended to fout */
+void pdb_file(const PdbFileJob &job, const size_t i, string &fout)
+{
+    const AtomTable &atom_table=*(job.table);
+    const vector<int> &chainID_vec=*(job.chainID_vec);
+    const vector<int> &bundleID_vec=*(job.bundleID_vec);
+    const vector<char> &chainNewID_vec=*(job.chainNewID_vec);
+    const vector<string> &model_num_vec=*(job.model_num_vec);
+    const int outfmt=job.outfmt;
+    PdbLine pdbline;
+    vector<string> dbref_vec;
+    map<string,string>::const_iterator it;
+    string asym_id;
+    string chainStr;
+    int chain,entity;
+    int seqresCount=0;
+    int seqresWrap=0;
+    size_t l,j,m;
+    fout+=*(job.header1);
+    if (job.read_dbref)
     {
-        l--;
-        clear_line_vec(line_vec);
+        const vector<vector<string> > &dbref_mat=*(job.dbref_mat);
+        for (l=0;l<dbref_mat.size();l++)
+        {
+            asym_id=dbref_mat[l][1];
+            chain=find_id(atom_table.chain,asym_id);
+            if (chain<0 || bundleID_vec[chain]!=i+1) continue;
+            dbref_vec=dbref_mat[l];
+            if ((it=job.accession2db_name->find(dbref_vec[7]))!=
+                job.accession2db_name->end()) dbref_vec[6]=it->second;
+            if ((it=job.accession2db_code->find(dbref_vec[7]))!=
+                job.accession2db_code->end()) dbref_vec[8]=it->second;
+            /*
+COLUMNS       DATA TYPE     FIELD              DEFINITION
+-----------------------------------------------------------------------------------
+ 1 -  6       Record name   "DBREF "
+ 8 - 11       IDcode        idCode             ID code of this entry.
+13            Character     chainID            Chain  identifier.
+15 - 18       Integer       seqBegin           Initial sequence number of the
+                                       PDB sequence segment.
+19            AChar         insertBegin        Initial  insertion code of the
+                                       PDB  sequence segment.
+21 - 24       Integer       seqEnd             Ending sequence number of the
+                                       PDB  sequence segment.
+25            AChar         insertEnd          Ending insertion code of the
+                                       PDB  sequence segment.
+27 - 32       LString       database           Sequence database name.
+34 - 41       LString       dbAccession        Sequence database accession code.
+43 - 54       LString       dbIdCode           Sequence  database identification code.
+56 - 60       Integer       dbseqBegin         Initial sequence number of the
+                                       database seqment.
+61            AChar         idbnsBeg           Insertion code of initial residue of the
+                                       segment, if PDB is the reference.
+63 - 67       Integer       dbseqEnd           Ending sequence number of the
+                                       database segment.
+68            AChar         dbinsEnd           Insertion code of the ending residue of
+                                       the segment, if PDB is the reference.
+             */
+            if (outfmt!=3) chainStr=job.dbref_chainID_vec[i];
+            else chainStr=asym_id.substr(0,2);
+            if (chainStr.size()<=1) chainStr=" "+chainStr;
+            pdb_start(pdbline,"DBREF");
+            pdb_put(pdbline,DBREF_idCode,dbref_vec[0]);
+            pdb_put(pdbline,DBREF_chainID,chainStr);
+            pdb_put(pdbline,DBREF_seqBegin,dbref_vec[2]);
+            pdb_put(pdbline,DBREF_insertBegin,dbref_vec[3]);
+            pdb_put(pdbline,DBREF_seqEnd,dbref_vec[4]);
+            pdb_put(pdbline,DBREF_insertEnd,dbref_vec[5]);
+            pdb_put(pdbline,DBREF_database,dbref_vec[6]);
+            pdb_put(pdbline,DBREF_dbAccession,dbref_vec[7]);
+            pdb_put(pdbline,DBREF_dbIdCode,dbref_vec[8]);
+            pdb_put(pdbline,DBREF_dbseqBegin,dbref_vec[9]);
+            pdb_put(pdbline,DBREF_idbnsBeg,dbref_vec[10]);
+            pdb_put(pdbline,DBREF_dbseqEnd,dbref_vec[11]);
+            pdb_put(pdbline,DBREF_dbinsEnd,dbref_vec[12]);
+            pdb_finish(pdbline,fout);
+        }
     }
-    while (line_vec.size()<fields)
+    for (j=0;j<chainID_vec.size();j++)
     {
-        l++;
-        if (StartsWith(lines[l],";"))
+        chain=chainID_vec[j];
+        entity=(*(job.chain_entity_vec))[chain];
+        if (entity<0 || bundleID_vec[chain]!=i+1) continue;
+        const vector<string> &seqres_vec=job.seqres_mat->at(entity);
+
+        seqresCount=0;
+        if (outfmt!=3) chainStr=chainNewID_vec[chain];
+        else chainStr=atom_table.chain.str_vec[chain].substr(0,2);
+        if (chainStr.size()<=1) chainStr=" "+chainStr;
+        seqresWrap=0;
+        for (m=0;m<seqres_vec.size();m++)
         {
-            line="";
-            while (l<lines.size())
+            if (seqresWrap==0)
             {
-                if (StartsWith(lines[l],";"))
-                {
-                    if (Trim(lines[l])==";") break;
-                    else line+=lines[l].substr(1);
-                }
-                else line+=lines[l];
-                if (add_space) line+=' ';
-                l++;
+                seqresCount++;
+                pdb_start(pdbline,"SEQRES");
+                pdb_put(pdbline,SEQRES_serNum,(long int)seqresCount);
+                pdb_put(pdbline,SEQRES_chainID,chainStr);
+                pdb_put(pdbline,SEQRES_numRes,(long int)seqres_vec.size());
+            }
+            pdb_put(pdbline,pdb_shift(SEQRES_resName,4*seqresWrap),
+                seqres_vec[m]);
+            seqresWrap++;
+            if (seqresWrap==13 || m+1==seqres_vec.size())
+            {
+                pdb_finish(pdbline,fout);
+                seqresWrap=0;
             }
-            line_vec.push_back(line);
         }
-        else
+    }
+    fout+=*(job.header2);
+    int terNum=(*(job.file_terNum))[i];
+    int hydrNum=(*(job.file_hydrNum))[i];
+    long int atomNum=pdb_models(atom_table,*(job.file_atom_vec),
+        &(*(job.file_start_vec))[i*model_num_vec.size()],model_num_vec,
+        chainNewID_vec,outfmt,job.thread_num,fout,job.pool);
+    /*
+COLUMNS         DATA TYPE     FIELD          DEFINITION
+----------------------------------------------------------------------------------
+ 1 -  6         Record name   "MASTER"
+11 - 15         Integer       numRemark      Number of REMARK records
+16 - 20         Integer       "0"
+21 - 25         Integer       numHet         Number of HET records
+26 - 30         Integer       numHelix       Number of HELIX records
+31 - 35         Integer       numSheet       Number of SHEET records
+36 - 40         Integer       numTurn        deprecated
+41 - 45         Integer       numSite        Number of SITE records
+46 - 50         Integer       numXform       Number of coordinate transformation
+                                             records  (ORIGX+SCALE+MTRIX)
+51 - 55         Integer       numCoord       Number of atomic coordinate records
+                                             records (ATOM+HETATM)
+56 - 60         Integer       numTer         Number of TER records
+61 - 65         Integer       numConect      Number of CONECT records
+66 - 70         Integer       numSeq         Number of SEQRES records
+    */
+
+    long int master_vec[12]={0,0,0,0,0,0,0,3,atomNum-terNum-hydrNum,terNum,0,0};
+    pdb_start(pdbline,"MASTER");
+    for (j=0;j<12;j++)
+        pdb_put(pdbline,pdb_shift(MASTER_num,5*j),master_vec[j]);
+    pdb_put(pdbline,PDB_tail,"");
+    pdb_finish(pdbline,fout);
+    pdb_text("END",fout);
+}
+
+void pdb_file_worker(PdbFileJob *job)
+{
+    size_t i;
+    while ((i=job->next++)<job->text_vec.size())
+    {
+        pdb_file(*job,i,job->text_vec[i]);
+        if (job->do_tar) continue;
+        output_file(job->writer,(*(job->filename_vec))[i],job->text_vec[i],
+            job->do_gzip);
+    }
+}
+
+/* stable counting sort of item_vec by key_vec[item], 0<=key<nkey. items
+ * with negative keys are dropped. items of key k are written to
+ * order_vec[start_vec[k]] ... order_vec[start_vec[k+1]-1] */
+void counting_sort(const vector<size_t> &item_vec, const vector<int> &key_vec,
+    const size_t nkey, vector<size_t> &order_vec, vector<size_t> &start_vec)
+{
+    size_t l,k;
+    start_vec.assign(nkey+1,0);
+    for (l=0;l<item_vec.size();l++)
+        if (key_vec[item_vec[l]]>=0) start_vec[key_vec[item_vec[l]]+1]++;
+    for (k=0;k<nkey;k++) start_vec[k+1]+=start_vec[k];
+    order_vec.resize(start_vec[nkey]);
+    vector<size_t> pos_vec(start_vec.begin(),start_vec.end()-1);
+    for (l=0;l<item_vec.size();l++)
+        if (key_vec[item_vec[l]]>=0)
+            order_vec[pos_vec[key_vec[item_vec[l]]]++]=item_vec[l];
+}
+
+/* split a chain into pieces of at most maxatom atoms of the first model
+ * in one pass over its polymer atoms atom_vec[begin] ... atom_vec[end-1].
+ * all atoms of the residue at which a piece is full are moved to the next
+ * piece. res_split is indexed by residue id: the piece of the atom name
+ * with the greatest name_rank in that residue. tail is the number of
+ * distinct atoms in the last piece. returns the number of the last piece */
+int split_chain(const AtomTable &table, const vector<size_t> &atom_vec,
+    const size_t begin, const size_t end, const long int maxatom,
+    const vector<int> &name_rank, vector<int> &res_split, int &tail)
+{
+    /* atom key => (position of its first atom, piece) */
+    unordered_map<long long,pair<size_t,int> > key_map;
+    unordered_map<long long,pair<size_t,int> >::iterator it;
+    /* residue => (position of the last piece boundary in it, new piece) */
+    unordered_map<int,pair<size_t,int> > boundary_map;
+    unordered_map<int,pair<size_t,int> >::iterator bit;
+    int SplitNum=0;
+    long int atomNum=0;
+    size_t l;
+    int res,name,split;
+    int res_num=0;
+    for (l=begin;l<end;l++)
+    {
+        res=table.res_vec[atom_vec[l]];
+        long long key=((long long)res<<21)|table.name_vec[atom_vec[l]];
+        it=key_map.find(key);
+        if (it==key_map.end()) key_map[key]=make_pair(l,SplitNum);
+        else it->second.second=SplitNum;
+        if (res>=res_num) res_num=res+1;
+
+        atomNum++;
+        if (maxatom>1 && atomNum>=maxatom)
+        {
+            SplitNum++;
+            atomNum=0;
+            boundary_map[res]=make_pair(l,SplitNum);
+        }
+    }
+
+    /* a boundary moves every atom of its residue seen so far */
+    vector<int> res_rank(res_num,-1);
+    res_split.assign(res_num,0);
+    tail=0;
+    for (it=key_map.begin();it!=key_map.end();it++)
+    {
+        res=it->first>>21;
+        name=it->first&((1<<21)-1);
+        split=it->second.second;
+        bit=boundary_map.find(res);
+        if (bit!=boundary_map.end() && it->second.first<=bit->second.first &&
+            bit->second.second>split) split=bit->second.second;
+        if (name_rank[name]>res_rank[res])
         {
-            Split(lines[l],line_append_vec,' ',ignore_quotation);
-            for (i=0;i<line_append_vec.size();i++)
-                line_vec.push_back(line_append_vec[i]);
-            clear_line_vec(line_append_vec);
+            res_rank[res]=name_rank[name];
+            res_split[res]=split;
         }
+        tail+=(split==SplitNum);
     }
-    return l;
+    return SplitNum;
 }
 
 int BeEM(const string &infile, string &pdbid, const int read_seqres,
     const int read_dbref, const int do_gzip, const int do_upper,
     const long int maxatom, const int outfmt, const string &idmap,
-    const vector<string>&ccd3_vec, const vector<string>&outputChain_vec)
+    const vector<string>&ccd3_vec, const vector<string>&outputChain_vec,
+    ostream &listing=cout, const int thread_num=1, InputFile *prefetch=NULL,
+    const WriteStage *writer=NULL, HelpPool *pool=NULL)
 {
 
     stringstream buf;
-    if (infile=="-") buf<<cin.rdbuf();
-#if defined(REDI_PSTREAM_H_SEEN)
-    else if (EndsWith(infile,".gz"))
-    {
-        redi::ipstream fp_gz; // if file is compressed
-        fp_gz.open("gunzip -c "+infile);
-        buf<<fp_gz.rdbuf();
-        fp_gz.close();
-    }
-#endif
-    else
-    {
-        ifstream fp;
-        fp.open(infile.c_str(),ios::in); //ifstream fp(filename,ios::in);
-        buf<<fp.rdbuf();
-        fp.close();
-    }
-    vector<string> lines;
-    Split(buf.str(),lines,'\n',true); 
-    buf.str(string());
-    if (lines.size()<=1)
+    InputFile own_input; // input file, unless prefetch is already read
+    InputFile &input=(prefetch==NULL)?own_input:*prefetch;
+    if (prefetch==NULL) open_input(infile,input);
+    if (CountLines(string_view(input.data,input.size),2)<=1)
     {
         cerr<<"ERROR! Empty structure "<<infile<<endl;
-        vector<string>().swap(lines);
-        return 0;
+        return -1;
     }
 
     /* parse PDB ID
@@ -2559,7 +3888,6 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
     string pdbx_keywords="";
     string recvd_initial_deposition_date="";
     string revision_date="";
-    bool loop_=false;
 
     map<string,int> _audit_author;
     map<string,int> _citation_author;
@@ -2567,6 +3895,7 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
     map<string,int> _cell;
     map<string,int> fract_transf_;
     map<string,int> _atom_site;
+    AtomSiteColumns atom_col;
     map<string,int> _symmetry;
     map<string,int> _struct_keywords;
     map<string,int> _pdbx_database_status;
@@ -2590,37 +3919,20 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
     string mon_id="";
     string pdbx_strand_id="";
 
-    string group_PDB  ="ATOM"; // (ATOM/HETATM)
-    string type_symbol="C";    // (element symbol)
-    string atom_id    ="CA";   // auth_atom_id, label_atom_id (atom name)
-    string alt_id     =" ";    // auth_alt_id, label_alt_id
-                               // (alternative location indicator)
-    string comp_id    ="UNK";  // auth_comp_id, label_comp_id (residue name)
-    string asym_id    ="A"; // auth_asym_id, label_asym_id (chain ID)
-    string seq_id     ="   1"; // label_seq_id, auth_seq_id (residue index)
-    string pdbx_PDB_ins_code=" ";// (insertion code)
-    string Cartn_x    ="   0.000"; 
-    string Cartn_y    ="   0.000"; 
-    string Cartn_z    ="   0.000"; 
-    string occupancy  ="  1.00";
-    string B_iso_or_equiv="  0.00";   // Bfactor
-    string pdbx_formal_charge="  ";
-    string pdbx_PDB_model_num="   1"; // model index
-    vector <string> model_num_vec(1,pdbx_PDB_model_num);
-    string U11="  10000";
-    string U12="      0";
-    string U13="      0";
-    string U22="  10000";
-    string U23="      0";
-    string U33="  10000";
-
-    map<string,string> anisou_map;
-    map<string,size_t> chainAtomNum_map;
-    map<string,size_t> chainHydrNum_map;
-    vector<string> chainID_vec;
-    vector<pair<string,string> > atomLine_vec;
-    vector<pair<string,string> > ligLine_vec;
-    vector<pair<string,string> > hohLine_vec;
+    AtomSiteRow atom_row;
+    AtomSiteState atom_site;
+    vector<string> &model_num_vec=atom_site.model_num_vec;
+    vector<size_t> &chainAtomNum_vec=atom_site.chainAtomNum_vec;
+    vector<size_t> &chainHydrNum_vec=atom_site.chainHydrNum_vec;
+    vector<int> &chainID_vec=atom_site.chainID_vec;
+    string asym_id;
+    string pdbx_PDB_model_num;
+    /* atoms go to a table owned by the thread, so that the next entry
+     * reuses its memory */
+    static thread_local AtomTable atom_table;
+    clear_atom_table(atom_table);
+    int kind=ATOM_POLYMER;
+    int chain=0; // chain id in atom_table.chain
     vector<string> seqres_vec;
     map<int,vector<string> > seqres_mat;
     vector<string> entity2strand;
@@ -2652,22 +3964,46 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
     int i,j;
     string line;
     vector<string> line_vec;
-    vector<string> line_append_vec;
     vector<string> author_vec;
     vector<string> citation_author_vec;
     vector<string> cryst1_vec(8,"");
     vector<string> scale_vec(4,"");
     vector<vector<string> > scale_mat(3,scale_vec);
-    for (l=0;l<lines.size();l++)
-    {
-        line=lines[l];
-        
-        if (_atom_site.size() && !StartsWith(line,"_atom_site"))
-             Split(line,line_vec,' ',true);
-        else Split(line,line_vec,' ');
-        //cout<<"["<<l<<"] "<<line<<endl;
-        if (line_vec.size()==0) continue;
-        else if (line_vec.size()==1 && line_vec[0]=="#")
+    CifReader reader;
+    cif_open(reader,string_view(input.data,input.size));
+    vector<string_view> item_vec;
+    string_view category;
+    string key;
+    map<string,int> *loop_map;
+    /* loop columns of each category read, by category id */
+    map<string,int> *category_map[CATEGORY_NUM]={NULL};
+    category_map[CATEGORY_STRUCT_KEYWORDS]=&_struct_keywords;
+    category_map[CATEGORY_PDBX_DATABASE_STATUS]=&_pdbx_database_status;
+    if (read_dbref)
+    {
+        category_map[CATEGORY_STRUCT_REF]=&_struct_ref;
+        category_map[CATEGORY_STRUCT_REF_SEQ]=&_struct_ref_seq;
+    }
+    if (read_seqres)
+    {
+        category_map[CATEGORY_ENTITY_POLY]=&_entity_poly;
+        category_map[CATEGORY_ENTITY_POLY_SEQ]=&_entity_poly_seq;
+    }
+    category_map[CATEGORY_PDBX_AUDIT_REVISION_HISTORY]=
+        &_pdbx_audit_revision_history;
+    category_map[CATEGORY_CITATION]=&_citation;
+    category_map[CATEGORY_CELL]=&_cell;
+    category_map[CATEGORY_SYMMETRY]=&_symmetry;
+    category_map[CATEGORY_ATOM_SITES]=&fract_transf_;
+    category_map[CATEGORY_AUDIT_AUTHOR]=&_audit_author;
+    category_map[CATEGORY_CITATION_AUTHOR]=&_citation_author;
+    category_map[CATEGORY_ATOM_SITE]=&_atom_site;
+    category_map[CATEGORY_ATOM_SITE_ANISOTROP]=&_atom_site;
+    int loop_category=CATEGORY_OTHER; // category of the current loop rows
+    int record;
+    while ((record=cif_record(reader,item_vec))!=CIF_END)
+    {
+        if (record==CIF_STOP)
         {
             if (entity_id.size())
             {
@@ -2686,7 +4022,7 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
                 entity_id.clear();
             }
             pdbx_strand_id.clear();
-            
+
             if (pdbx_db_accession.size())
             {
                 if (db_name.size()) accession2db_name[pdbx_db_accession]=db_name;
@@ -2720,233 +4056,265 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
             _entity_poly.clear();
             _struct_ref.clear();
             _struct_ref_seq.clear();
-            loop_=false;
+            loop_category=CATEGORY_OTHER;
         }
-        else if (line_vec.size()==1 && line_vec[0]=="loop_")
-            loop_=true;
-        else if (pdbid.size()==0 && l==0 && StartsWith(line,"data_"))
-            pdbid=Lower(line.substr(5));
-        else if (pdbid.size()==0 && line_vec.size()>1 && line_vec[0]=="_entry.id")
-            pdbid=Lower(line_vec[1]);
-        else if (StartsWith(line,"_struct_keywords"))
+        else if (record==CIF_DATA)
         {
-            if (loop_)
+            if (pdbid.size()==0) pdbid=Lower(string(item_vec[0]));
+        }
+        else if (record==CIF_NAME)
+        {
+            /* loop columns are indexed by item name without category */
+            category=cif_category(item_vec[0]);
+            if (category.size()==item_vec[0].size()) continue;
+            key=item_vec[0].substr(category.size()+1);
+            j=category_id(category);
+            loop_map=category_map[j];
+            if (loop_map==NULL)
             {
-                j=_struct_keywords.size();
-                line=line_vec[0];
-                _struct_keywords[line]=j;
+                cif_skip(reader); // loop not needed with these options
+                continue;
             }
-            else if (line_vec.size()>1)
+            loop_category=(j==CATEGORY_ATOM_SITE_ANISOTROP)?
+                CATEGORY_ATOM_SITE:j;
+            /* columns are numbered in the order of the loop header */
+            j=reader.ncol-1;
+            (*loop_map)[key]=j;
+            if (loop_map==&_atom_site)
             {
-                if (line_vec[0]=="_struct_keywords.pdbx_keywords")
-                    pdbx_keywords+=Trim(line_vec[1],"'\"");
+                compile_atom_site(_atom_site,atom_col);
+                atom_site.anisou_cursor=0;
+                atom_site.anisou_key_map.clear();
+                read_atom_site_parallel(reader,atom_row,atom_site,atom_table,
+                    atom_col,ccd3_vec,outputChain_vec,thread_num,pool);
             }
         }
-        else if (_struct_keywords.size() && 
-            _struct_keywords.count("_struct_keywords.pdbx_keywords"))
-        {
-            pdbx_keywords+=Trim(line_vec[_struct_keywords[
-                "_struct_keywords.pdbx_keywords"]],"'\"");
-        }
-        else if (StartsWith(line,"_pdbx_database_status."))
+        else if (record==CIF_PAIR)
         {
-            if (loop_)
+            j=category_id(cif_category(item_vec[0]));
+            if (category_map[j]==NULL && j!=CATEGORY_ENTRY)
             {
-                j=_pdbx_database_status.size();
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    line=line_vec[1];
-                    _pdbx_database_status[line]=j;
-                }
-
+                cif_skip(reader);
+                continue;
             }
-            else if (line_vec.size()>1)
+            if (pdbid.size()==0 && item_vec[0]=="_entry.id")
+                pdbid=Lower(string(item_vec[1]));
+            else if (item_vec[0]=="_struct_keywords.pdbx_keywords")
+                pdbx_keywords+=Unfold(item_vec[1]," ");
+            else if (item_vec[0]=="_pdbx_database_status.recvd_initial_deposition_date")
+                recvd_initial_deposition_date=item_vec[1];
+            else if (read_dbref && j==CATEGORY_STRUCT_REF)
             {
-                if (line_vec[0]=="_pdbx_database_status.recvd_initial_deposition_date")
-                    recvd_initial_deposition_date=line_vec[1];
+                if (item_vec[0]=="_struct_ref.db_name")
+                    db_name=Unfold(item_vec[1]);
+                else if (item_vec[0]=="_struct_ref.db_code")
+                    db_code=Unfold(item_vec[1]);
+                else if (item_vec[0]=="_struct_ref.pdbx_db_accession")
+                    pdbx_db_accession=Unfold(item_vec[1]);
             }
-        }
-        else if (_pdbx_database_status.size() && 
-            _pdbx_database_status.count("recvd_initial_deposition_date"))
-        {
-            recvd_initial_deposition_date=line_vec[
-                _pdbx_database_status["recvd_initial_deposition_date"]];
-        }
-        else if (read_dbref && StartsWith(line,"_struct_ref."))
-        {
-            if (loop_)
+            else if (read_dbref && j==CATEGORY_STRUCT_REF_SEQ)
             {
-                j=_struct_ref.size();
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    line=line_vec[1];
-                    _struct_ref[line]=j;
-                }
+                key=item_vec[0].substr(16);
+                if (key=="pdbx_PDB_id_code")
+                    dbref_vec[0]=item_vec[1];
+                else if (key=="pdbx_strand_id")
+                    dbref_vec[1]=item_vec[1];
+                else if (key=="seq_align_beg" && dbref_vec[2].size()==0)
+                    dbref_vec[2]=item_vec[1];
+                else if (key=="pdbx_auth_seq_align_beg")
+                    dbref_vec[2]=item_vec[1];
+                else if (key=="pdbx_seq_align_beg_ins_code")
+                    dbref_vec[3]=item_vec[1];
+                else if (key=="seq_align_end" && dbref_vec[4].size()==0)
+                    dbref_vec[4]=item_vec[1];
+                else if (key=="pdbx_auth_seq_align_end")
+                    dbref_vec[4]=item_vec[1];
+                else if (key=="pdbx_seq_align_end_ins_code")
+                    dbref_vec[5]=item_vec[1];
+                else if (key=="pdbx_db_accession")
+                    dbref_vec[7]=Unfold(item_vec[1]);
+                else if (key=="db_align_beg")
+                    dbref_vec[9]=item_vec[1];
+                else if (key=="pdbx_db_align_beg_ins_code"
+                    && item_vec[1]!="?" && item_vec[1]!=".")
+                    dbref_vec[10]=item_vec[1];
+                else if (key=="db_align_end")
+                    dbref_vec[11]=item_vec[1];
+                else if (key=="pdbx_db_align_end_ins_code"
+                    && item_vec[1]!="?" && item_vec[1]!=".")
+                    dbref_vec[12]=item_vec[1];
             }
-            else
+            else if (read_seqres && item_vec[0]=="_entity_poly.entity_id")
+                entity_id=item_vec[1];
+            else if (read_seqres && item_vec[0]=="_entity_poly.pdbx_strand_id")
+                pdbx_strand_id=Unfold(item_vec[1]);
+            else if (item_vec[0]=="_pdbx_audit_revision_history.revision_date")
+                revision_date=item_vec[1];
+            else if (j==CATEGORY_CITATION)
             {
-                l=read_semi_colon(line_vec, 2, l, lines, line_append_vec, line);
-                if (line_vec[0]=="_struct_ref.db_name")
-                    db_name=line_vec[1];
-                else if (line_vec[0]=="_struct_ref.db_code")
-                    db_code=line_vec[1];
-                else if (line_vec[0]=="_struct_ref.pdbx_db_accession")
-                    pdbx_db_accession=line_vec[1];
+                key=item_vec[0].substr(10);
+                if      (key=="title")
+                    _citation_title=Unfold(item_vec[1]," ");
+                else if (key=="pdbx_database_id_PubMed")
+                    _citation_pdbx_database_id_PubMed=item_vec[1];
+                else if (key=="pdbx_database_id_DOI")
+                    _citation_pdbx_database_id_DOI=item_vec[1];
+                else if (key=="journal_abbrev")
+                    _citation_journal_abbrev=Unfold(item_vec[1]," ");
+                else if (key=="journal_volume")
+                    _citation_journal_volume=item_vec[1];
+                else if (key=="page_first")
+                    _citation_page_first=item_vec[1];
+                else if (key=="year")
+                    _citation_year=item_vec[1];
+                else if (key=="journal_id_ASTM")
+                    _citation_journal_id_ASTM=item_vec[1];
+                else if (key=="country")
+                    _citation_country=item_vec[1];
+                else if (key=="journal_id_ISSN")
+                    _citation_journal_id_ISSN=item_vec[1];
             }
-        }
-        else if (read_dbref && _struct_ref.count("pdbx_db_accession"))
-        {
-            l=read_semi_colon(line_vec, _struct_ref.size(),
-                l, lines, line_append_vec, line);
-            pdbx_db_accession=line_vec[_struct_ref["pdbx_db_accession"]];
-            if (_struct_ref.count("db_name")) accession2db_name[
-                pdbx_db_accession]=line_vec[_struct_ref["db_name"]];
-            if (_struct_ref.count("db_code")) accession2db_code[
-                pdbx_db_accession]=line_vec[_struct_ref["db_code"]];
-        }
-        else if (read_dbref && StartsWith(line,"_struct_ref_seq."))
-        {
-            if (loop_)
+            else if (j==CATEGORY_CELL)
+            {
+                key=item_vec[0].substr(6);
+                if      (key=="length_a")
+                    cryst1_vec[0]=formatString(item_vec[1],9,3);
+                else if (key=="length_b")
+                    cryst1_vec[1]=formatString(item_vec[1],9,3);
+                else if (key=="length_c")
+                    cryst1_vec[2]=formatString(item_vec[1],9,3);
+                else if (key=="angle_alpha")
+                    cryst1_vec[3]=formatString(item_vec[1],7,2);
+                else if (key=="angle_beta")
+                    cryst1_vec[4]=formatString(item_vec[1],7,2);
+                else if (key=="angle_gamma")
+                    cryst1_vec[5]=formatString(item_vec[1],7,2);
+                else if (key=="Z_PDB")
+                    cryst1_vec[7]=item_vec[1];
+            }
+            else if (item_vec[0]=="_symmetry.space_group_name_H-M")
+                cryst1_vec[6]=item_vec[1].substr(0,11);
+            else if (j==CATEGORY_ATOM_SITES)
             {
-                j=_struct_ref_seq.size();
-                line=line_vec[0];
+                key=item_vec[0].substr(12);
+                if      (key=="fract_transf_matrix[1][1]")
+                    scale_mat[0][0]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[1][2]")
+                    scale_mat[0][1]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[1][3]")
+                    scale_mat[0][2]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[2][1]")
+                    scale_mat[1][0]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[2][2]")
+                    scale_mat[1][1]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[2][3]")
+                    scale_mat[1][2]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[3][1]")
+                    scale_mat[2][0]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[3][2]")
+                    scale_mat[2][1]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_matrix[3][3]")
+                    scale_mat[2][2]=formatString(item_vec[1],10,6);
+                else if (key=="fract_transf_vector[1]")
+                    scale_mat[0][3]=formatString(item_vec[1],10,5);
+                else if (key=="fract_transf_vector[2]")
+                    scale_mat[1][3]=formatString(item_vec[1],10,5);
+                else if (key=="fract_transf_vector[3]")
+                    scale_mat[2][3]=formatString(item_vec[1],10,5);
+            }
+            else if (item_vec[0]=="_audit_author.name")
+            {
+                line=Unfold(item_vec[1]);
+                Split(line,line_vec,',',true);
+                if (line_vec.size()>=2) line=lstrip(line_vec[1])+line_vec[0];
                 clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    line=line_vec[1];
-                    _struct_ref_seq[line]=j;
-                }
+                author_vec.push_back(Upper(line));
             }
-            else
+            else if (item_vec[0]=="_citation_author.name")
             {
-                l=read_semi_colon(line_vec, 2, l, lines, line_append_vec, line);
-                if (line_vec[0]=="_struct_ref_seq.pdbx_PDB_id_code")
-                    dbref_vec[0]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_strand_id")
-                    dbref_vec[1]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.seq_align_beg" && 
-                    dbref_vec[2].size()==0) dbref_vec[2]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_auth_seq_align_beg")
-                    dbref_vec[2]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_seq_align_beg_ins_code")
-                    dbref_vec[3]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.seq_align_end" && 
-                    dbref_vec[4].size()==0) dbref_vec[4]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_auth_seq_align_end")
-                    dbref_vec[4]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_seq_align_end_ins_code")
-                    dbref_vec[5]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_db_accession")
-                    dbref_vec[7]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.db_align_beg")
-                    dbref_vec[9]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_db_align_beg_ins_code"
-                    && line_vec[1]!="?" && line_vec[1]!=".")
-                    dbref_vec[10]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.db_align_end")
-                    dbref_vec[11]=line_vec[1];
-                else if (line_vec[0]=="_struct_ref_seq.pdbx_db_align_end_ins_code"
-                    && line_vec[1]!="?" && line_vec[1]!=".")
-                    dbref_vec[12]=line_vec[1];
+                line=Unfold(item_vec[1]);
+                Split(line,line_vec,',',true);
+                if (line_vec.size()>=2) line=lstrip(line_vec[1])+line_vec[0];
+                clear_line_vec(line_vec);
+                citation_author_vec.push_back(line);
             }
         }
-        else if (read_dbref && _struct_ref_seq.count("pdbx_strand_id") &&
+        /* CIF_ROW, in the branch of the category of the loop. the other
+         * branches fail on the category id before any map lookup */
+        else if (loop_category==CATEGORY_STRUCT_KEYWORDS &&
+            _struct_keywords.count("pdbx_keywords"))
+        {
+            pdbx_keywords+=Unfold(item_vec[_struct_keywords["pdbx_keywords"]]," ");
+        }
+        else if (loop_category==CATEGORY_PDBX_DATABASE_STATUS &&
+            _pdbx_database_status.count("recvd_initial_deposition_date"))
+        {
+            recvd_initial_deposition_date=item_vec[
+                _pdbx_database_status["recvd_initial_deposition_date"]];
+        }
+        else if (loop_category==CATEGORY_STRUCT_REF &&
+            read_dbref && _struct_ref.count("pdbx_db_accession"))
+        {
+            pdbx_db_accession=Unfold(item_vec[_struct_ref["pdbx_db_accession"]]);
+            if (_struct_ref.count("db_name")) accession2db_name[
+                pdbx_db_accession]=Unfold(item_vec[_struct_ref["db_name"]]);
+            if (_struct_ref.count("db_code")) accession2db_code[
+                pdbx_db_accession]=Unfold(item_vec[_struct_ref["db_code"]]);
+        }
+        else if (loop_category==CATEGORY_STRUCT_REF_SEQ &&
+            read_dbref && _struct_ref_seq.count("pdbx_strand_id") &&
             _struct_ref_seq.count("pdbx_db_accession"))
         {
-            l=read_semi_colon(line_vec, _struct_ref_seq.size(),
-                l, lines, line_append_vec, line);
             if (_struct_ref_seq.count("pdbx_PDB_id_code"))
-                dbref_vec[0]=line_vec[_struct_ref_seq["pdbx_PDB_id_code"]];
+                dbref_vec[0]=item_vec[_struct_ref_seq["pdbx_PDB_id_code"]];
             else dbref_vec[0]=Upper(pdbid);
-            dbref_vec[1]=line_vec[_struct_ref_seq["pdbx_strand_id"]];
+            dbref_vec[1]=item_vec[_struct_ref_seq["pdbx_strand_id"]];
             if (_struct_ref_seq.count("pdbx_auth_seq_align_beg"))
-                dbref_vec[2]=line_vec[_struct_ref_seq["pdbx_auth_seq_align_beg"]];
+                dbref_vec[2]=item_vec[_struct_ref_seq["pdbx_auth_seq_align_beg"]];
             else if (_struct_ref_seq.count("seq_align_beg"))
-                dbref_vec[2]=line_vec[_struct_ref_seq["seq_align_beg"]];
+                dbref_vec[2]=item_vec[_struct_ref_seq["seq_align_beg"]];
             if (_struct_ref_seq.count("pdbx_seq_align_beg_ins_code"))
-                dbref_vec[3]=line_vec[_struct_ref_seq["pdbx_seq_align_beg_ins_code"]];
+                dbref_vec[3]=item_vec[_struct_ref_seq["pdbx_seq_align_beg_ins_code"]];
             if (_struct_ref_seq.count("pdbx_auth_seq_align_end"))
-                dbref_vec[4]=line_vec[_struct_ref_seq["pdbx_auth_seq_align_end"]];
+                dbref_vec[4]=item_vec[_struct_ref_seq["pdbx_auth_seq_align_end"]];
             else if (_struct_ref_seq.count("seq_align_end"))
-                dbref_vec[4]=line_vec[_struct_ref_seq["seq_align_end"]];
+                dbref_vec[4]=item_vec[_struct_ref_seq["seq_align_end"]];
             if (_struct_ref_seq.count("pdbx_seq_align_end_ins_code"))
-                dbref_vec[5]=line_vec[_struct_ref_seq["pdbx_seq_align_end_ins_code"]];
-            dbref_vec[7]=line_vec[_struct_ref_seq["pdbx_db_accession"]];
+                dbref_vec[5]=item_vec[_struct_ref_seq["pdbx_seq_align_end_ins_code"]];
+            dbref_vec[7]=Unfold(item_vec[_struct_ref_seq["pdbx_db_accession"]]);
             if (_struct_ref_seq.count("db_align_beg"))
-                dbref_vec[9]=line_vec[_struct_ref_seq["db_align_beg"]];
+                dbref_vec[9]=item_vec[_struct_ref_seq["db_align_beg"]];
             if (_struct_ref_seq.count("pdbx_db_align_beg_ins_code"))
-                dbref_vec[10]=line_vec[_struct_ref_seq["pdbx_db_align_beg_ins_code"]];
+                dbref_vec[10]=item_vec[_struct_ref_seq["pdbx_db_align_beg_ins_code"]];
             if (_struct_ref_seq.count("db_align_end"))
-                dbref_vec[11]=line_vec[_struct_ref_seq["db_align_end"]];
+                dbref_vec[11]=item_vec[_struct_ref_seq["db_align_end"]];
             if (_struct_ref_seq.count("pdbx_db_align_end_ins_code"))
-                dbref_vec[12]=line_vec[_struct_ref_seq["pdbx_db_align_end_ins_code"]];
-            
+                dbref_vec[12]=item_vec[_struct_ref_seq["pdbx_db_align_end_ins_code"]];
+
             for (i=0;i<dbref_vec.size();i++)
                 if (dbref_vec[i]=="?" || dbref_vec[i]==".") dbref_vec[i]=" ";
             dbref_mat.push_back(dbref_vec);
             for (i=0;i<dbref_vec.size();i++) dbref_vec[i]="";
             dbref_vec[3]=dbref_vec[5]=dbref_vec[10]=dbref_vec[12]=" ";
         }
-        else if (read_seqres && StartsWith(line,"_entity_poly."))
-        {
-            if (loop_)
-            {
-                j=_entity_poly.size();
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    line=line_vec[1];
-                    _entity_poly[line]=j;
-                }
-            }
-            else
-            {
-                l=read_semi_colon(line_vec, 2, l, lines, line_append_vec, line);
-                if (line_vec[0]=="_entity_poly.entity_id")
-                    entity_id=line_vec[1];
-                else if (line_vec[0]=="_entity_poly.pdbx_strand_id")
-                    pdbx_strand_id=line_vec[1];
-            }
-        }
-        else if (read_seqres && _entity_poly.count("entity_id") && 
+        else if (loop_category==CATEGORY_ENTITY_POLY &&
+            read_seqres && _entity_poly.count("entity_id") &&
             _entity_poly.count("pdbx_strand_id"))
         {
-            l=read_semi_colon(line_vec, _entity_poly.size(),
-                l, lines, line_append_vec, line);
-            entity_id=line_vec[_entity_poly["entity_id"]];
+            entity_id=item_vec[_entity_poly["entity_id"]];
             i=atoi(entity_id.c_str());
             while (entity2strand.size()<=i) entity2strand.push_back("");
-            entity2strand[i]=line_vec[_entity_poly["pdbx_strand_id"]];
-        }
-        else if (read_seqres && StartsWith(line,"_entity_poly_seq.") && loop_)
-        {
-            j=_entity_poly_seq.size();
-            line=line_vec[0];
-            clear_line_vec(line_vec);
-            Split(line,line_vec,'.');
-            if (line_vec.size()>1)
-            {
-                line=line_vec[1];
-                _entity_poly_seq[line]=j;
-            }
+            entity2strand[i]=Unfold(item_vec[_entity_poly["pdbx_strand_id"]]);
         }
-        else if (read_seqres && _entity_poly_seq.size() && 
-            _entity_poly_seq.count("entity_id") && _entity_poly_seq.count("mon_id"))
+        else if (loop_category==CATEGORY_ENTITY_POLY_SEQ &&
+            read_seqres && _entity_poly_seq.count("entity_id") &&
+            _entity_poly_seq.count("mon_id"))
         {
-            mon_id   =line_vec[_entity_poly_seq["mon_id"]];
+            mon_id   =item_vec[_entity_poly_seq["mon_id"]];
             if      (mon_id.size()==1) mon_id="  "+mon_id;
             else if (mon_id.size()==2) mon_id=" "+mon_id;
             else if (mon_id.size()>3)  mon_id=mon_id.substr(0,3);
-            if (entity_id!=line_vec[_entity_poly_seq["entity_id"]])
+            if (entity_id!=item_vec[_entity_poly_seq["entity_id"]])
             {
                 if (entity_id.size())
                 {
@@ -2954,595 +4322,134 @@ int BeEM(const string &infile, string &pdbid, const int read_seqres,
                     for (i=0;i<seqres_vec.size();i++) seqres_vec[i].clear();
                     seqres_vec.clear();
                 }
-                entity_id=line_vec[_entity_poly_seq["entity_id"]];
+                entity_id=item_vec[_entity_poly_seq["entity_id"]];
             }
             seqres_vec.push_back(mon_id);
         }
-        else if (StartsWith(line,"_pdbx_audit_revision_history."))
-        {
-            if (loop_)
-            {
-                j=_pdbx_audit_revision_history.size();
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    line=line_vec[1];
-                    _pdbx_audit_revision_history[line]=j;
-                }
-
-            }
-            else if (line_vec.size()>1)
-            {
-                if (line_vec[0]=="_pdbx_audit_revision_history.revision_date")
-                    revision_date=line_vec[1];
-            }
-        }
-        else if (_pdbx_audit_revision_history.size() && 
-            revision_date.size()==0 &&
+        else if (loop_category==CATEGORY_PDBX_AUDIT_REVISION_HISTORY &&
             _pdbx_audit_revision_history.count("revision_date"))
         {
-            revision_date=line_vec[_pdbx_audit_revision_history["revision_date"]];
-        }
-        else if (StartsWith(line,"_citation."))
-        {
-            if (loop_)
-            {
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    j=_citation.size();
-                    line=line_vec[1];
-                    _citation[line]=j;
-                }
-            }
-            else
-            {
-                l=read_semi_colon(line_vec, 2, l, lines, line_append_vec, line,false,true);
-                if      (line_vec[0]=="_citation.title")
-                    _citation_title=Trim(line_vec[1],"'\"");
-                else if (line_vec[0]=="_citation.pdbx_database_id_PubMed")
-                    _citation_pdbx_database_id_PubMed=line_vec[1];
-                else if (line_vec[0]=="_citation.pdbx_database_id_DOI")
-                    _citation_pdbx_database_id_DOI=line_vec[1];
-                else if (line_vec[0]=="_citation.journal_abbrev")
-                    _citation_journal_abbrev=Trim(line_vec[1],"'\"");
-                else if (line_vec[0]=="_citation.journal_volume")
-                    _citation_journal_volume=line_vec[1];
-                else if (line_vec[0]=="_citation.page_first")
-                    _citation_page_first=line_vec[1];
-                else if (line_vec[0]=="_citation.year")
-                    _citation_year=line_vec[1];
-                else if (line_vec[0]=="_citation.journal_id_ASTM")
-                    _citation_journal_id_ASTM=Trim(line_vec[1],"'\"");
-                else if (line_vec[0]=="_citation.country")
-                    _citation_country=Trim(line_vec[1],"'\"");
-                else if (line_vec[0]=="_citation.journal_id_ISSN")
-                    _citation_journal_id_ISSN=line_vec[1];
-            }
+            if (revision_date.size()==0) revision_date=item_vec[
+                _pdbx_audit_revision_history["revision_date"]];
         }
-        else if (_citation.size() && (_citation.count("id")==0 ||
-                 line_vec[_citation["id"]]=="primary"))
+        else if (loop_category==CATEGORY_CITATION &&
+            _citation.size())
         {
-            l=read_semi_colon(line_vec, _citation.size(),
-                l, lines, line_append_vec, line,false,true);
+            if (_citation.count("id") && item_vec[_citation["id"]]!="primary")
+                continue;
             if (_citation.count("title"))
-                _citation_title=Trim(line_vec[_citation["title"]],"'\"");
+                _citation_title=Unfold(item_vec[_citation["title"]]," ");
             if (_citation.count("pdbx_database_id_PubMed"))
-                _citation_pdbx_database_id_PubMed=line_vec[
+                _citation_pdbx_database_id_PubMed=item_vec[
                 _citation["pdbx_database_id_PubMed"]];
             if (_citation.count("pdbx_database_id_DOI"))
-                _citation_pdbx_database_id_DOI=line_vec[
+                _citation_pdbx_database_id_DOI=item_vec[
                 _citation["pdbx_database_id_DOI"]];
             if (_citation.count("journal_abbrev"))
-                _citation_journal_abbrev=Trim(line_vec[
-                _citation["journal_abbrev"]],"'\"");
+                _citation_journal_abbrev=Unfold(item_vec[
+                _citation["journal_abbrev"]]," ");
             if (_citation.count("journal_volume"))
-                _citation_journal_volume=line_vec[_citation["journal_volume"]];
+                _citation_journal_volume=item_vec[_citation["journal_volume"]];
             if (_citation.count("page_first"))
-                _citation_page_first=line_vec[_citation["page_first"]];
+                _citation_page_first=item_vec[_citation["page_first"]];
             if (_citation.count("year"))
-                _citation_year=line_vec[_citation["year"]];
+                _citation_year=item_vec[_citation["year"]];
             if (_citation.count("journal_id_ASTM"))
-                _citation_journal_id_ASTM=Trim(line_vec[
-                _citation["journal_id_ASTM"]],"'\"");
+                _citation_journal_id_ASTM=item_vec[_citation["journal_id_ASTM"]];
             if (_citation.count("country"))
-                _citation_country=Trim(line_vec[_citation["country"]],"'\"");
+                _citation_country=item_vec[_citation["country"]];
             if (_citation.count("journal_id_ISSN"))
-                _citation_journal_id_ISSN=line_vec[_citation["journal_id_ISSN"]];
-        }
-        else if (StartsWith(line,"_cell."))
-        {
-            if (loop_)
-            {
-                j=_cell.size();
-                line=line_vec[0];
-                _cell[line]=j;
-            }
-            else if (line_vec.size()>1)
-            {
-                if      (line_vec[0]=="_cell.length_a")
-                    cryst1_vec[0]=formatString(line_vec[1],9,3);
-                else if (line_vec[0]=="_cell.length_b")
-                    cryst1_vec[1]=formatString(line_vec[1],9,3);
-                else if (line_vec[0]=="_cell.length_c")
-                    cryst1_vec[2]=formatString(line_vec[1],9,3);
-                else if (line_vec[0]=="_cell.angle_alpha")
-                    cryst1_vec[3]=formatString(line_vec[1],7,2);
-                else if (line_vec[0]=="_cell.angle_beta")
-                    cryst1_vec[4]=formatString(line_vec[1],7,2);
-                else if (line_vec[0]=="_cell.angle_gamma")
-                    cryst1_vec[5]=formatString(line_vec[1],7,2);
-                else if (line_vec[0]=="_cell.Z_PDB")
-                    cryst1_vec[7]=line_vec[1];
-            }
-        }
-        else if (_cell.size())
-        {
-            if (_cell.count("_cell.length_a"))    cryst1_vec[0]=
-                formatString(line_vec[_cell["_cell.length_a"]],9,3);
-            if (_cell.count("_cell.length_b"))    cryst1_vec[1]=
-                formatString(line_vec[_cell["_cell.length_b"]],9,3);
-            if (_cell.count("_cell.length_c"))    cryst1_vec[2]=
-                formatString(line_vec[_cell["_cell.length_c"]],9,3);
-            if (_cell.count("_cell.angle_alpha")) cryst1_vec[3]=
-                formatString(line_vec[_cell["_cell.angle_alpha"]],7,2);
-            if (_cell.count("_cell.angle_beta"))  cryst1_vec[4]=
-                formatString(line_vec[_cell["_cell.angle_beta"]],7,2);
-            if (_cell.count("_cell.angle_gamma")) cryst1_vec[5]=
-                formatString(line_vec[_cell["_cell.angle_gamma"]],7,2);
-            if (_cell.count("_cell.Z_PDB"))       cryst1_vec[7]=
-                line_vec[_cell["_cell.Z_PDB"]];
-        }
-        else if (StartsWith(line,"_symmetry"))
-        {
-            if (loop_)
-            {
-                j=_symmetry.size();
-                line=line_vec[0];
-                _symmetry[line]=j;
-            }
-            else if (line_vec.size()>1)
-            {
-                if (line_vec[0]=="_symmetry.space_group_name_H-M")
-                    cryst1_vec[6]=Trim(line_vec[1],"'\"").substr(0,11);
-            }
+                _citation_journal_id_ISSN=item_vec[_citation["journal_id_ISSN"]];
         }
-        else if (_symmetry.size() && 
-             _symmetry.count("_symmetry.space_group_name_H-M"))
+        else if (loop_category==CATEGORY_CELL &&
+            _cell.size())
         {
-            cryst1_vec[6]=Trim(line_vec[_symmetry[
-                "_symmetry.space_group_name_H-M"]],"'\"").substr(0,11);
+            if (_cell.count("length_a"))    cryst1_vec[0]=
+                formatString(item_vec[_cell["length_a"]],9,3);
+            if (_cell.count("length_b"))    cryst1_vec[1]=
+                formatString(item_vec[_cell["length_b"]],9,3);
+            if (_cell.count("length_c"))    cryst1_vec[2]=
+                formatString(item_vec[_cell["length_c"]],9,3);
+            if (_cell.count("angle_alpha")) cryst1_vec[3]=
+                formatString(item_vec[_cell["angle_alpha"]],7,2);
+            if (_cell.count("angle_beta"))  cryst1_vec[4]=
+                formatString(item_vec[_cell["angle_beta"]],7,2);
+            if (_cell.count("angle_gamma")) cryst1_vec[5]=
+                formatString(item_vec[_cell["angle_gamma"]],7,2);
+            if (_cell.count("Z_PDB"))       cryst1_vec[7]=
+                item_vec[_cell["Z_PDB"]];
         }
-        else if (StartsWith(line,"_atom_sites.fract_transf_"))
+        else if (loop_category==CATEGORY_SYMMETRY &&
+            _symmetry.count("space_group_name_H-M"))
         {
-            if (loop_)
-            {
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                if (line_vec.size()>1)
-                {
-                    j=fract_transf_.size();
-                    line=line_vec[1];
-                    fract_transf_[line]=j;
-                }
-            }
-            else if (line_vec.size()>1)
-            {
-                if      (line_vec[0]=="_atom_sites.fract_transf_matrix[1][1]")
-                    scale_mat[0][0]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[1][2]")
-                    scale_mat[0][1]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[1][3]")
-                    scale_mat[0][2]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[2][1]")
-                    scale_mat[1][0]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[2][2]")
-                    scale_mat[1][1]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[2][3]")
-                    scale_mat[1][2]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[3][1]")
-                    scale_mat[2][0]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[3][2]")
-                    scale_mat[2][1]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_matrix[3][3]")
-                    scale_mat[2][2]=formatString(line_vec[1],10,6);
-                else if (line_vec[0]=="_atom_sites.fract_transf_vector[1]")
-                    scale_mat[0][3]=formatString(line_vec[1],10,5);
-                else if (line_vec[0]=="_atom_sites.fract_transf_vector[2]")
-                    scale_mat[1][3]=formatString(line_vec[1],10,5);
-                else if (line_vec[0]=="_atom_sites.fract_transf_vector[3]")
-                    scale_mat[2][3]=formatString(line_vec[1],10,5);
-            }
+            cryst1_vec[6]=item_vec[_symmetry["space_group_name_H-M"]].substr(0,11);
         }
-        else if (fract_transf_.size())
+        else if (loop_category==CATEGORY_ATOM_SITES &&
+            fract_transf_.size())
         {
             if (fract_transf_.count("fract_transf_matrix[1][1]"))
-                scale_mat[0][0]=formatString(line_vec[fract_transf_[
+                scale_mat[0][0]=formatString(item_vec[fract_transf_[
                      "fract_transf_matrix[1][1]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[1][2]"))
-                scale_mat[0][1]=formatString(line_vec[fract_transf_[
+                scale_mat[0][1]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[1][2]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[1][3]"))
-                scale_mat[0][2]=formatString(line_vec[fract_transf_[
+                scale_mat[0][2]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[1][3]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[2][1]"))
-                scale_mat[1][0]=formatString(line_vec[fract_transf_[
+                scale_mat[1][0]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[2][1]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[2][2]"))
-                scale_mat[1][1]=formatString(line_vec[fract_transf_[
+                scale_mat[1][1]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[2][2]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[2][3]"))
-                scale_mat[1][2]=formatString(line_vec[fract_transf_[
+                scale_mat[1][2]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[2][3]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[3][1]"))
-                scale_mat[2][0]=formatString(line_vec[fract_transf_[
+                scale_mat[2][0]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[3][1]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[3][2]"))
-                scale_mat[2][1]=formatString(line_vec[fract_transf_[
+                scale_mat[2][1]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[3][2]"]],10,6);
             if (fract_transf_.count("fract_transf_matrix[3][3]"))
-                scale_mat[2][2]=formatString(line_vec[fract_transf_[
+                scale_mat[2][2]=formatString(item_vec[fract_transf_[
                     "fract_transf_matrix[3][3]"]],10,6);
             if (fract_transf_.count("fract_transf_vector[1]"))
-                scale_mat[0][3]=formatString(line_vec[fract_transf_[
-                    "fract_transf_vector[1]"]],10,5);
-            if (fract_transf_.count("fract_transf_vector[2]"))
-                scale_mat[1][3]=formatString(line_vec[fract_transf_[
-                    "fract_transf_vector[2]"]],10,5);
-            if (fract_transf_.count("fract_transf_vector[3]"))
-                scale_mat[2][3]=formatString(line_vec[fract_transf_[
-                    "fract_transf_vector[3]"]],10,5);
-        }
-        else if (StartsWith(line,"_audit_author."))
-        {
-            if (loop_)
-            {
-                line=line_vec[0];
-                j=_audit_author.size();
-                _audit_author[line]=j;
-            }
-            else if (StartsWith(line,"_audit_author.name"))
-            {
-                l=read_semi_colon(line_vec, 2,
-                    l, lines, line_append_vec, line);
-                line=line_vec[1];
-                line=Trim(line,"'\"");
-                clear_line_vec(line_vec);
-                Split(line,line_vec,',',true);
-                if (line_vec.size()>=2) line=lstrip(line_vec[1])+line_vec[0];
-                author_vec.push_back(Upper(line));
-            }
+                scale_mat[0][3]=formatString(item_vec[fract_transf_[
+                    "fract_transf_vector[1]"]],10,5);
+            if (fract_transf_.count("fract_transf_vector[2]"))
+                scale_mat[1][3]=formatString(item_vec[fract_transf_[
+                    "fract_transf_vector[2]"]],10,5);
+            if (fract_transf_.count("fract_transf_vector[3]"))
+                scale_mat[2][3]=formatString(item_vec[fract_transf_[
+                    "fract_transf_vector[3]"]],10,5);
         }
-        else if (_audit_author.size() && 
-                 _audit_author.count("_audit_author.name"))
+        else if (loop_category==CATEGORY_AUDIT_AUTHOR &&
+            _audit_author.count("name"))
         {
-            l=read_semi_colon(line_vec, _audit_author.size(),
-                l, lines, line_append_vec, line);
-            line=line_vec[_audit_author["_audit_author.name"]];
-            line=Trim(line,"'\"");
-            clear_line_vec(line_vec);
+            line=Unfold(item_vec[_audit_author["name"]]);
             Split(line,line_vec,',',true);
             if (line_vec.size()>=2) line=lstrip(line_vec[1])+line_vec[0];
+            clear_line_vec(line_vec);
             author_vec.push_back(Upper(line));
         }
-        else if (StartsWith(line,"_citation_author."))
-        {
-            if (loop_)
-            {
-                line=line_vec[0];
-                clear_line_vec(line_vec);
-                Split(line,line_vec,'.');
-                line=line_vec[1];
-                j=_citation_author.size();
-                _citation_author[line]=j;
-            }
-            else if (StartsWith(line,"_citation_author.name") && line_vec.size()>1)
-            {
-                line=line_vec[1];
-                line=Trim(line,"'\"");
-                clear_line_vec(line_vec);
-                Split(line,line_vec,',',true);
-                if (line_vec.size()>=2)
-                    line=lstrip(line_vec[1])+line_vec[0];
-                citation_author_vec.push_back(line);
-            }
-        }
-        else if (_citation_author.size() && _citation_author.count("name") 
-             && (_citation_author.count("citation_id")==0 || 
-             line_vec[_citation_author["citation_id"]]=="primary"))
+        else if (loop_category==CATEGORY_CITATION_AUTHOR &&
+            _citation_author.count("name"))
         {
-            l=read_semi_colon(line_vec, _citation_author.size(),
-                l, lines, line_append_vec, line);
-            line=line_vec[_citation_author["name"]];
-            line=Trim(line,"'\"");
-            clear_line_vec(line_vec);
+            if (_citation_author.count("citation_id") &&
+                item_vec[_citation_author["citation_id"]]!="primary") continue;
+            line=Unfold(item_vec[_citation_author["name"]]);
             Split(line,line_vec,',',true);
-            if (line_vec.size()>=2)
-                line=lstrip(line_vec[1])+line_vec[0];
-            citation_author_vec.push_back(line);
-        }
-        else if (StartsWith(line,"_atom_site.") || 
-                 StartsWith(line,"_atom_site_anisotrop."))
-        {
-            line=line_vec[0];
+            if (line_vec.size()>=2) line=lstrip(line_vec[1])+line_vec[0];
             clear_line_vec(line_vec);
-            Split(line,line_vec,'.');
-            if (line_vec.size()>1)
-            {
-                line=line_vec[1];
-                j=_atom_site.size();
-                _atom_site[line]=j;
-            }
-        }
-        else if (_atom_site.size())
-        {
-            if (_atom_site.count("group_PDB"))
-                group_PDB=line_vec[_atom_site["group_PDB"]];
-            if (group_PDB=="ATOM") group_PDB="ATOM  ";
-            
-            if (_atom_site.count("auth_atom_id"))
-            {
-                atom_id=line_vec[_atom_site["auth_atom_id"]];
-                if (atom_id.size()>4 && _atom_site.count("label_atom_id"))
-                    atom_id=line_vec[_atom_site["label_atom_id"]];
-            }
-            else if (_atom_site.count("label_atom_id"))
-                atom_id=line_vec[_atom_site["label_atom_id"]];
-            else if (_atom_site.count("pdbx_auth_atom_id"))
-            {
-                atom_id=line_vec[_atom_site["pdbx_auth_atom_id"]];
-                if (atom_id.size()>4 && _atom_site.count("pdbx_label_atom_id"))
-                    atom_id=line_vec[_atom_site["pdbx_label_atom_id"]];
-            }
-            else if (_atom_site.count("pdbx_label_atom_id"))
-                atom_id=line_vec[_atom_site["pdbx_label_atom_id"]];
-            if ((atom_id[0]=='"'  && atom_id[atom_id.size()-1]=='"')||
-                (atom_id[0]=='\'' && atom_id[atom_id.size()-1]=='\''))
-                atom_id=atom_id.substr(1,atom_id.size()-2);
-            atom_id=atom_id.substr(0,4);
-            
-            if (_atom_site.count("type_symbol"))
-                type_symbol=line_vec[_atom_site["type_symbol"]].substr(0,2);
-            else type_symbol=lstrip(atom_id,"1234567890 ")[0];
-
-            if (type_symbol.size()==2) while (atom_id.size()<4) atom_id+=' ';
-            else
-            {
-                if (atom_id.size()==1) atom_id+=' ';
-                if (atom_id.size()==2) atom_id+=' ';
-                if (atom_id.size()==3) atom_id=' '+atom_id;
-            }
-            if (type_symbol.size()==1) type_symbol=' '+type_symbol;
-
-            if (_atom_site.count("auth_alt_id"))
-                alt_id=line_vec[_atom_site["auth_alt_id"]];
-            else if (_atom_site.count("label_alt_id"))
-                alt_id=line_vec[_atom_site["label_alt_id"]];
-            else if (_atom_site.count("pdbx_auth_alt_id"))
-                alt_id=line_vec[_atom_site["pdbx_auth_alt_id"]];
-            else if (_atom_site.count("pdbx_label_alt_id"))
-                alt_id=line_vec[_atom_site["pdbx_label_alt_id"]];
-            if (alt_id=="." || alt_id=="?") alt_id=" ";
-            else alt_id=alt_id[0];
-
-            if (_atom_site.count("auth_comp_id"))
-            {
-                comp_id=line_vec[_atom_site["auth_comp_id"]];
-                if (comp_id.size()>3 && _atom_site.count("label_comp_id"))
-                    comp_id=line_vec[_atom_site["label_comp_id"]];
-            }
-            else if (_atom_site.count("label_comp_id"))
-                comp_id=line_vec[_atom_site["label_comp_id"]];
-            else if (_atom_site.count("pdbx_auth_comp_id"))
-            {
-                comp_id=line_vec[_atom_site["pdbx_auth_comp_id"]];
-                if (comp_id.size()>3 && _atom_site.count("pdbx_label_comp_id"))
-                    comp_id=line_vec[_atom_site["pdbx_label_comp_id"]];
-            }
-            else if (_atom_site.count("pdbx_label_comp_id"))
-                comp_id=line_vec[_atom_site["pdbx_label_comp_id"]];
-            if      (comp_id.size()==1) comp_id="  "+comp_id;
-            else if (comp_id.size()==2) comp_id=" "+comp_id;
-            if (comp_id.size()>3)
-            {
-                if (ccd3_vec.size()==0) comp_id=comp_id.substr(0,3);
-                else
-                {
-                    if (ccd5_map.count(comp_id)==0)
-                    {
-                        ccd5_map[comp_id]=ccd3_vec[ccd5_vec.size() % ccd3_vec.size()];
-                        ccd5_vec.push_back(comp_id);
-                    }
-                    comp_id=ccd5_map[comp_id];
-                }
-            }
-
-            if (_atom_site.count("auth_asym_id"))
-                asym_id=line_vec[_atom_site["auth_asym_id"]];
-            else if (_atom_site.count("label_asym_id"))
-                asym_id=line_vec[_atom_site["label_asym_id"]];
-            else if (_atom_site.count("pdbx_auth_asym_id"))
-                asym_id=line_vec[_atom_site["pdbx_auth_asym_id"]];
-            else if (_atom_site.count("pdbx_label_asym_id"))
-                asym_id=line_vec[_atom_site["pdbx_label_asym_id"]];
-            if (asym_id=="." || asym_id=="?") asym_id="_";
-            if (outputChain_vec.size() && find(outputChain_vec.begin(),
-                outputChain_vec.end(), asym_id)==outputChain_vec.end())
-            {
-                clear_line_vec(line_vec);
-                continue;
-            }
-            if (asym_id=="_") asym_id=" ";
-
-            if (_atom_site.count("auth_seq_id"))
-                seq_id=line_vec[_atom_site["auth_seq_id"]];
-            else if (_atom_site.count("label_seq_id"))
-                seq_id=line_vec[_atom_site["label_seq_id"]];
-            else if (_atom_site.count("pdbx_auth_seq_id"))
-                seq_id=line_vec[_atom_site["pdbx_auth_seq_id"]];
-            else if (_atom_site.count("pdbx_label_seq_id"))
-                seq_id=line_vec[_atom_site["pdbx_label_seq_id"]];
-            if (seq_id.size()>=2) seq_id=lstrip(seq_id,"0");
-            if (seq_id.size()==3) seq_id=" "+seq_id;
-            else if (seq_id.size()==2) seq_id="  "+seq_id;
-            else if (seq_id.size()==1) seq_id="   "+seq_id;
-            //else if (seq_id.size()>4) seq_id=seq_id.substr(seq_id.size()-4);
-
-            if (_atom_site.count("pdbx_PDB_ins_code"))
-                pdbx_PDB_ins_code=line_vec[_atom_site["pdbx_PDB_ins_code"]];
-            if (pdbx_PDB_ins_code=="." || pdbx_PDB_ins_code=="?")
-                pdbx_PDB_ins_code=" ";
-            else pdbx_PDB_ins_code=pdbx_PDB_ins_code[0];
-            seq_id+=pdbx_PDB_ins_code;
-            if (seq_id.size()>5) seq_id=seq_id.substr(0,5);
-
-            if (_atom_site.count("Cartn_z"))
-            {
-                Cartn_x=formatString(line_vec[_atom_site["Cartn_x"]],8,3);
-                Cartn_y=formatString(line_vec[_atom_site["Cartn_y"]],8,3);
-                Cartn_z=formatString(line_vec[_atom_site["Cartn_z"]],8,3);
-            }
-
-            if (_atom_site.count("aniso_U[3][3]"))
-            {
-                U11=formatANISOU(line_vec[_atom_site["aniso_U[1][1]"]]);
-                U12=formatANISOU(line_vec[_atom_site["aniso_U[1][2]"]]);
-                U13=formatANISOU(line_vec[_atom_site["aniso_U[1][3]"]]);
-                U22=formatANISOU(line_vec[_atom_site["aniso_U[2][2]"]]);
-                U23=formatANISOU(line_vec[_atom_site["aniso_U[2][3]"]]);
-                U33=formatANISOU(line_vec[_atom_site["aniso_U[3][3]"]]);
-            }
-            else if (_atom_site.count("U[3][3]"))
-            {
-                U11=formatANISOU(line_vec[_atom_site["U[1][1]"]]);
-                U12=formatANISOU(line_vec[_atom_site["U[1][2]"]]);
-                U13=formatANISOU(line_vec[_atom_site["U[1][3]"]]);
-                U22=formatANISOU(line_vec[_atom_site["U[2][2]"]]);
-                U23=formatANISOU(line_vec[_atom_site["U[2][3]"]]);
-                U33=formatANISOU(line_vec[_atom_site["U[3][3]"]]);
-            }
-
-
-            if (_atom_site.count("occupancy"))
-                occupancy=formatString(line_vec[_atom_site["occupancy"]],6,2);
-
-            if (_atom_site.count("B_iso_or_equiv"))
-                B_iso_or_equiv=formatString(line_vec[_atom_site["B_iso_or_equiv"]],6,2);
-
-            if (_atom_site.count("pdbx_formal_charge"))
-                pdbx_formal_charge=line_vec[_atom_site["pdbx_formal_charge"]];
-            if (pdbx_formal_charge=="." || pdbx_formal_charge=="?")
-                pdbx_formal_charge="  ";
-            else if (pdbx_formal_charge.size()==1)
-            {
-                if ('1'<=pdbx_formal_charge[0] && pdbx_formal_charge[0]<='9')
-                     pdbx_formal_charge+='+';
-                else pdbx_formal_charge+=' ';
-            }
-            else if (pdbx_formal_charge.size()>2)
-                pdbx_formal_charge=pdbx_formal_charge.substr(0,2);
-            if (pdbx_formal_charge[0]=='+' || pdbx_formal_charge[0]=='-')
-                pdbx_formal_charge=pdbx_formal_charge.substr(1)+
-                                   pdbx_formal_charge[0];
-
-            if (_atom_site.count("pdbx_PDB_model_num"))
-                pdbx_PDB_model_num=line_vec[_atom_site["pdbx_PDB_model_num"]];
-            if (pdbx_PDB_model_num=="." || pdbx_PDB_model_num=="?")
-                pdbx_PDB_model_num="   1";
-            else if (pdbx_PDB_model_num.size()==1) 
-                pdbx_PDB_model_num="   "+pdbx_PDB_model_num;
-            else if (pdbx_PDB_model_num.size()==2) 
-                pdbx_PDB_model_num="  "+pdbx_PDB_model_num;
-            else if (pdbx_PDB_model_num.size()==3) 
-                pdbx_PDB_model_num=" "+pdbx_PDB_model_num;
-            if (pdbx_PDB_model_num!="   1" && find(model_num_vec.begin(),
-                model_num_vec.end(), pdbx_PDB_model_num)==model_num_vec.end())
-                model_num_vec.push_back(pdbx_PDB_model_num);
-
-            //if (pdbx_PDB_model_num=="   1" && _atom_site.count("Cartn_z"))
-            if (_atom_site.count("Cartn_z"))
-            {
-/*
-COLUMNS        DATA  TYPE    FIELD        DEFINITION
--------------------------------------------------------------------------------------
- 1 -  6        Record name   "ATOM  "
- 7 - 11        Integer       serial       Atom  serial number.
-13 - 16        Atom          name         Atom name.
-17             Character     altLoc       Alternate location indicator.
-18 - 20        Residue name  resName      Residue name.
-22             Character     chainID      Chain identifier.
-23 - 26        Integer       resSeq       Residue sequence number.
-27             AChar         iCode        Code for insertion of residues.
-31 - 38        Real(8.3)     x            Orthogonal coordinates for X in Angstroms.
-39 - 46        Real(8.3)     y            Orthogonal coordinates for Y in Angstroms.
-47 - 54        Real(8.3)     z            Orthogonal coordinates for Z in Angstroms.
-55 - 60        Real(6.2)     occupancy    Occupancy.
-61 - 66        Real(6.2)     tempFactor   Temperature  factor.
-77 - 78        LString(2)    element      Element symbol, right-justified.
-79 - 80        LString(2)    charge       Charge  on the atom.
-*/
-                line=group_PDB+' '+pdbx_PDB_model_num+' '+atom_id+alt_id
-                    +comp_id+"  "+seq_id+"   "
-                    +Cartn_x+Cartn_y+Cartn_z+occupancy+B_iso_or_equiv
-                    +"          "+type_symbol+pdbx_formal_charge;
-                if (_atom_site.count("label_seq_id") && 
-                    line_vec[_atom_site["label_seq_id"]]==".")
-                {
-                    if (comp_id=="HOH") 
-                         hohLine_vec.push_back(make_pair(line,asym_id));
-                    else ligLine_vec.push_back(make_pair(line,asym_id));
-                }
-                else atomLine_vec.push_back(make_pair(line,asym_id));
-                if (pdbx_PDB_model_num=="   1")
-                {
-                    if (chainAtomNum_map.count(asym_id)==0)
-                    {
-                        chainID_vec.push_back(asym_id);
-                        chainAtomNum_map[asym_id]=1;
-                        chainHydrNum_map[asym_id]=0;
-                    }
-                    else chainAtomNum_map[asym_id]++;
-                    chainHydrNum_map[asym_id]+=(type_symbol==" H");
-                }
-            }
-            if (pdbx_PDB_model_num=="   1" && (_atom_site.count("U[3][3]")||
-                                         _atom_site.count("aniso_U[3][3]")))
-            {
-                /*
-COLUMNS       DATA  TYPE    FIELD          DEFINITION
------------------------------------------------------------------
- 1 - 6        Record name   "ANISOU"
- 7 - 11       Integer       serial         Atom serial number.
-13 - 16       Atom          name           Atom name.
-17            Character     altLoc         Alternate location indicator
-18 - 20       Residue name  resName        Residue name.
-22            Character     chainID        Chain identifier.
-23 - 26       Integer       resSeq         Residue sequence number.
-27            AChar         iCode          Insertion code.
-29 - 35       Integer       u[0][0]        U(1,1)
-36 - 42       Integer       u[1][1]        U(2,2)
-43 - 49       Integer       u[2][2]        U(3,3)
-50 - 56       Integer       u[0][1]        U(1,2)
-57 - 63       Integer       u[0][2]        U(1,3)
-64 - 70       Integer       u[1][2]        U(2,3)
-77 - 78       LString(2)    element        Element symbol, right-justified.
-79 - 80       LString(2)    charge         Charge on the atom.
-                 */
-                anisou_map[atom_id+alt_id+comp_id+"  "+seq_id+
-                    '\t'+asym_id]=U11+U22+U33+U12+U13+U23;
-            }
+            citation_author_vec.push_back(line);
         }
-
-        /* clean up */
-        clear_line_vec(line_vec);
-        lines[l].clear();
+        else if (loop_category==CATEGORY_ATOM_SITE &&
+            _atom_site.size())
+            read_atom_site(atom_row,atom_site,atom_table,item_vec,atom_col,
+                ccd3_vec,&ccd5_map,&ccd5_vec,outputChain_vec);
     }
-    lines.clear();
+    close_input(input);
 
     if (pdbid.size()==0)
     {
@@ -3816,12 +4723,18 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
     }
     if (cryst1Count)
     {
-        buf<<"CRYST1"<<setw(9)<<cryst1_vec[0]<<setw(9)<<cryst1_vec[1]<<setw(9)
-            <<cryst1_vec[2]<<setw(7)<<cryst1_vec[3]<<setw(7)<<cryst1_vec[4]
-            <<setw(7)<<cryst1_vec[5]<<' '<<setw(11)<<left<<cryst1_vec[6]
-            <<setw(4)<<right<<cryst1_vec[7]<<"          "<<endl;
-        header2+=buf.str();
-        buf.str(string());
+        PdbLine cryst1;
+        pdb_start(cryst1,"CRYST1");
+        pdb_put(cryst1,CRYST1_a,cryst1_vec[0]);
+        pdb_put(cryst1,CRYST1_b,cryst1_vec[1]);
+        pdb_put(cryst1,CRYST1_c,cryst1_vec[2]);
+        pdb_put(cryst1,CRYST1_alpha,cryst1_vec[3]);
+        pdb_put(cryst1,CRYST1_beta,cryst1_vec[4]);
+        pdb_put(cryst1,CRYST1_gamma,cryst1_vec[5]);
+        pdb_put(cryst1,CRYST1_sGroup,cryst1_vec[6]);
+        pdb_put(cryst1,CRYST1_z,cryst1_vec[7]);
+        pdb_put(cryst1,PDB_tail,"");
+        pdb_finish(cryst1,header2);
     }
     int scaleCount=0;
     for (i=0;i<3;i++) for (j=0;j<4;j++) scaleCount+=scale_mat[i][j].size()>0;
@@ -3836,65 +4749,62 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
     /* parse extra long chain */
     int atomNum=0;
     int SplitNum;
-    string key;
-    map<string,map<string,int> > SplitChain_map; // asym_id => (atom key => SplitNum)
-    map<string,map<string,int> > SplitChainRes_map; // asym_id => (res key => SplitNum)
-    map<string,int> SplitChainNum_map; // asym_id => SplitNum
-    string res;
-    for (i=0;i<chainID_vec.size();i++)
+    size_t chainNum=atom_table.chain.str_vec.size();
+    vector<vector<int> > SplitChainRes_mat(chainNum); // chain => (res id => SplitNum)
+    vector<int> SplitChainNum_vec(chainNum,-1); // chain => SplitNum, -1 if not split
+    vector<int> SplitChainTail_vec(chainNum,0); // chain => atoms in the last split
+    mark_ter(atom_table);
+    chainAtomNum_vec.resize(atom_table.chain.str_vec.size(),0);
+    chainHydrNum_vec.resize(atom_table.chain.str_vec.size(),0);
+    if (maxatom>0 && outfmt!=3)
     {
-        asym_id=chainID_vec[i];
-        if (maxatom<=0 || outfmt==3 || (maxatom>1 && chainAtomNum_map[asym_id]<maxatom))
-            continue;
-        map<string,int> key_map; // key => SplitNum
-        map<string,int>::iterator it;
-
-        atomNum=0;
-        SplitNum=0;
-        SplitChainNum_map[asym_id]=SplitNum;
-        for (l=0;l<atomLine_vec.size();l++)
+        /* polymer atoms of the first model of each chain to split */
+        vector<int> chain_split(chainNum,0);
+        for (i=0;i<chainID_vec.size();i++)
         {
-            if (atomLine_vec[l].second!=asym_id) continue;
-            line=atomLine_vec[l].first;
-            if (line.substr(7,4)!="   1") continue;
-            key=line.substr(12,15);
-            key_map[key]=SplitNum;
-            
-            atomNum++;
-            if (maxatom>1 && atomNum>=maxatom)
-            {
-                SplitNum++;
-                SplitChainNum_map[asym_id]=SplitNum;
-                atomNum=0;
-                res=key.substr(10,5);
-                for (it=key_map.begin(); it!=key_map.end(); it++)
-                {
-                    key=it->first;
-                    if (key.substr(10,5)==res)
-                        key_map[key]=SplitNum;
-                }
-            }
+            chain=chainID_vec[i];
+            if (maxatom>1 && chainAtomNum_vec[chain]<maxatom) continue;
+            chain_split[chain]=1;
         }
-
-        SplitChain_map[asym_id]=key_map;
-        map<string,int>().swap(key_map);
-        for (it=SplitChain_map[asym_id].begin();
-            it!=SplitChain_map[asym_id].end();it++)
+        vector<size_t> atom_vec(atom_table.flag_vec.size());
+        vector<int> atom_key_vec(atom_table.flag_vec.size());
+        for (l=0;l<atom_table.flag_vec.size();l++)
         {
-            res=(it->first).substr(10,5);
-            SplitNum=it->second;
-            key_map[res]=SplitNum;
+            atom_vec[l]=l;
+            chain=atom_table.chain_vec[l];
+            atom_key_vec[l]=(chain_split[chain] && atom_table.model_vec[l]==0
+                && (atom_table.flag_vec[l]&ATOM_KIND)==ATOM_POLYMER)?chain:-1;
         }
-        SplitChainRes_map[asym_id]=key_map;
+        vector<size_t> split_atom_vec;
+        vector<size_t> split_start_vec;
+        counting_sort(atom_vec,atom_key_vec,chain_split.size(),
+            split_atom_vec,split_start_vec);
+        vector<size_t>().swap(atom_vec);
+        vector<int>().swap(atom_key_vec);
+
+        /* residues are ordered by atom names: atom names start with
+         * columns 13-20 of the PDB line */
+        vector<pair<string_view,int> > name_vec;
+        for (j=0;j<atom_table.name.str_vec.size();j++)
+            name_vec.push_back(make_pair(atom_table.name.str_vec[j],j));
+        sort(name_vec.begin(),name_vec.end());
+        vector<int> name_rank(name_vec.size());
+        for (j=0;j<name_vec.size();j++) name_rank[name_vec[j].second]=j;
+        vector<pair<string_view,int> >().swap(name_vec);
 
-        /* clean up */
-        map<string,int>().swap(key_map);
-        res.clear();
+        for (i=0;i<chainID_vec.size();i++)
+        {
+            chain=chainID_vec[i];
+            if (!chain_split[chain]) continue;
+            SplitChainNum_vec[chain]=split_chain(atom_table,split_atom_vec,
+                split_start_vec[chain],split_start_vec[chain+1],maxatom,
+                name_rank,SplitChainRes_mat[chain],SplitChainTail_vec[chain]);
+        }
     }
     
     /* parse ATOM HETATM */
-    map<string,char> chainID_map;
-    map<string,int> bundleID_map;
+    vector<char> chainNewID_vec(chainNum,0); // chain => new chain ID
+    vector<int> bundleID_vec(chainNum,0);    // chain => first bundle
     atomNum=0;
     int bundleNum=1;
     int chainIdx=0;
@@ -3903,25 +4813,22 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
     if (outfmt==2) chainID_list=" ";
     for (i=0;i<chainID_vec.size();i++)
     {
-        asym_id=chainID_vec[i];
-        chainAtomNum_map[asym_id]++; // for TER
-        if ((maxatom>1 && chainAtomNum_map[asym_id]+atomNum>=maxatom)
+        chain=chainID_vec[i];
+        chainAtomNum_vec[chain]++; // for TER
+        if ((maxatom>1 && chainAtomNum_vec[chain]+atomNum>=maxatom)
             || chainIdx>=chainID_list.size())
         {
             chainIdx=0;
             if (outfmt!=3)
             {
                 atomNum=0;
-                if (SplitChainNum_map.count(asym_id))
+                if (SplitChainNum_vec[chain]>=0)
                 {
                     if (i) bundleNum++;
-                    map<string,int>::iterator it;
-                    SplitNum=SplitChainNum_map[asym_id];
-                    for (it=SplitChain_map[asym_id].begin(); 
-                        it!=SplitChain_map[asym_id].end(); it++)
-                        atomNum+=(SplitNum==(it->second));
-                    chainID_map[asym_id]='A';
-                    bundleID_map[asym_id]=bundleNum;
+                    SplitNum=SplitChainNum_vec[chain];
+                    atomNum+=SplitChainTail_vec[chain];
+                    chainNewID_vec[chain]='A';
+                    bundleID_vec[chain]=bundleNum;
                     bundleNum+=SplitNum;
                     chainIdx++;
                     continue;
@@ -3930,58 +4837,55 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
                 bundleNum++;
             }
         }
-        atomNum+=chainAtomNum_map[asym_id];
-        chainID_map[asym_id]=chainID_list[chainIdx];
-        bundleID_map[asym_id]=bundleNum;
+        atomNum+=chainAtomNum_vec[chain];
+        chainNewID_vec[chain]=chainID_list[chainIdx];
+        bundleID_vec[chain]=bundleNum;
         chainIdx++;
     }
 
-    bool remap_chainID=false;
-    for (j=1;j<=bundleNum;j++)
+    /* keep original chain IDs in bundles where they are all one letter
+     * and no chain is split */
+    vector<int> remap_vec(bundleNum+1,0);
+    for (i=0;i<chainID_vec.size();i++)
     {
-        remap_chainID=false;
-        for (i=0;i<chainID_vec.size();i++)
-        {
-            asym_id=chainID_vec[i];
-            if (bundleID_map[asym_id]!=j) continue;
-            if (asym_id.size()>1 || SplitChain_map.count(asym_id))
-            {
-                remap_chainID=true;
-                break;
-            }
-        }
-        if (remap_chainID==false)
-        {
-            for (i=0;i<chainID_vec.size();i++)
-            {
-                asym_id=chainID_vec[i];
-                if (bundleID_map[asym_id]!=j) continue;
-                chainID_map[asym_id]=asym_id[0];
-            }
-        }
+        chain=chainID_vec[i];
+        if (atom_table.chain.str_vec[chain].size()>1 || 
+            SplitChainNum_vec[chain]>=0) remap_vec[bundleID_vec[chain]]=1;
+    }
+    for (i=0;i<chainID_vec.size();i++)
+    {
+        chain=chainID_vec[i];
+        if (remap_vec[bundleID_vec[chain]]==0)
+            chainNewID_vec[chain]=atom_table.chain.str_vec[chain][0];
     }
+    bool remap_chainID=remap_vec[bundleNum];
+    vector<int>().swap(remap_vec);
 
     bool writebundle=(bundleNum>1 || remap_chainID);
     if (outfmt) writebundle=true;
     if (outfmt==3) writebundle=false;
     
     bundleNum=0;
-    ofstream fout;
+    string fout;   // text of the PDB file being written
+    PdbLine pdbline;
+    stringstream mapping_buf;
+    string tar; // in-memory pdb-bundle archive
+    bool do_tar=(do_gzip && writebundle && outfmt!=2);
     string filename=pdbid+"-chain-id-mapping.txt";
     if (idmap=="tsv") filename=pdbid+"-chain-id-mapping.tsv";
     vector<string>filename_vec;
     map<string,int> filename_app_map;
     if (writebundle && outfmt<=1)
     {
-        fout.open(filename.c_str());
-        if (idmap=="tsv") fout<<"#pdb-bundle\tNew_chain_ID\tOriginal_chain_ID\n";
-        else fout<<"    New chain ID            Original chain ID\n";
+        if (idmap=="tsv") mapping_buf<<"#pdb-bundle\tNew_chain_ID\tOriginal_chain_ID\n";
+        else mapping_buf<<"    New chain ID            Original chain ID\n";
         for (i=0;i<chainID_vec.size();i++)
         {
-            asym_id=chainID_vec[i];
-            if (SplitChainNum_map.count(asym_id))
+            chain=chainID_vec[i];
+            asym_id=atom_table.chain.str_vec[chain];
+            if (SplitChainNum_vec[chain]>=0)
             {
-                SplitNum=SplitChainNum_map[asym_id];
+                SplitNum=SplitChainNum_vec[chain];
                 for (j=0;j<=SplitNum;j++)
                 {
                     bundleNum++;
@@ -3989,40 +4893,39 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
                     filename=buf.str();
                     buf.str(string());
                     filename_vec.push_back(filename);
-                    if (idmap=="tsv") fout<<Basename(filename)<<'\t'
-                        <<chainID_map[asym_id]<<'\t'<<asym_id<<'\n';
-                    else fout<<'\n'<<Basename(filename)<<":\n           "
-                        <<chainID_map[asym_id]<<setw(26)<<right<<asym_id<<'\n';
+                    if (idmap=="tsv") mapping_buf<<Basename(filename)<<'\t'
+                        <<chainNewID_vec[chain]<<'\t'<<asym_id<<'\n';
+                    else mapping_buf<<'\n'<<Basename(filename)<<":\n           "
+                        <<chainNewID_vec[chain]<<setw(26)<<right<<asym_id<<'\n';
                 }
                 continue;
             }
-            if (bundleID_map[asym_id]!=bundleNum)
+            if (bundleID_vec[chain]!=bundleNum)
             {
                 bundleNum++;
                 buf<<pdbid<<"-pdb-bundle"<<bundleNum<<".pdb"<<flush;
                 filename=buf.str();
                 buf.str(string());
                 filename_vec.push_back(filename);
-                if (idmap!="tsv") fout<<'\n'<<Basename(filename)<<":\n";
+                if (idmap!="tsv") mapping_buf<<'\n'<<Basename(filename)<<":\n";
             }
-            if (idmap=="tsv") fout<<Basename(filename)<<'\t'
-                <<chainID_map[asym_id]<<'\t'<<asym_id<<'\n';
-            else fout<<"           "<<chainID_map[asym_id]
+            if (idmap=="tsv") mapping_buf<<Basename(filename)<<'\t'
+                <<chainNewID_vec[chain]<<'\t'<<asym_id<<'\n';
+            else mapping_buf<<"           "<<chainNewID_vec[chain]
                 <<setw(26)<<right<<asym_id<<'\n';
         }
-        fout<<flush;
-        fout.close();
     }
     else if (outfmt==2)
     {
         for (i=0;i<chainID_vec.size();i++)
         {
-            asym_id=chainID_vec[i];
-            filename=pdbid+chainID_vec[i]+".pdb";
+            chain=chainID_vec[i];
+            asym_id=atom_table.chain.str_vec[chain];
+            filename=pdbid+asym_id+".pdb";
             filename_vec.push_back(filename);
-            if (SplitChainNum_map.count(asym_id))
+            if (SplitChainNum_vec[chain]>=0)
             {
-                SplitNum=SplitChainNum_map[asym_id];
+                SplitNum=SplitChainNum_vec[chain];
                 for (j=1;j<=SplitNum;j++)
                 {
                     bundleNum++;
@@ -4043,90 +4946,67 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
     bundleNum=0;
     char chainID=' ';
     string chainStr="  ";
-    map<string,string> chain_atm_map;
-    map<string,string> chain_lig_map;
-    map<string,string> chain_hoh_map;
-    string atm_txt;
-    string lig_txt;
-    string hoh_txt;
-    for (l=0;l<=atomLine_vec.size();l++)
-    {
-        if (l && (l==atomLine_vec.size() || asym_id!=atomLine_vec[l].second ||
-            pdbx_PDB_model_num!=atomLine_vec[l].first.substr(7,4)))
-        {
-            buf<<"TER   "<<line.substr(6,5)<<"      "<<line.substr(17,3)
-                <<chainStr<<setw(58)<<left<<line.substr(22,5)<<'\n';
-            chain_atm_map[asym_id]+=atm_txt+buf.str();
-            buf.str(string());
-            atm_txt.clear();
-        }
-        if (l==atomLine_vec.size()) continue;
-        line=atomLine_vec[l].first;
-        asym_id=atomLine_vec[l].second;
-        pdbx_PDB_model_num=line.substr(7,4);
-
-        chainID=chainID_map[asym_id];
-        if (outfmt!=3) chainStr=chainID;
-        else chainStr=asym_id.substr(0,2);
-        if (chainStr.size()<=1) chainStr=" "+chainStr;
-        atm_txt+=line.substr(0,20)+chainStr+line.substr(22)+'\n';
-        if (anisou_map.size())
-        {
-            key=line.substr(12,15)+'\t'+asym_id;
-            if (anisou_map.count(key)) atm_txt+="ANISOU"+line.substr(6,14)+
-                chainStr+line.substr(22,6)+anisou_map[key]+line.substr(70)+'\n';
-        }
+    size_t a; // atom index in atom_table
+    size_t last_atom=0; // last atom of the last kind, whose chainID is
+                        // the initial chainID of DBREF
+    for (a=0;a<atom_table.flag_vec.size();a++)
+        if ((atom_table.flag_vec[a]&ATOM_KIND)>=
+            (atom_table.flag_vec[last_atom]&ATOM_KIND)) last_atom=a;
+    if (atom_table.flag_vec.size())
+        chainID=chainNewID_vec[atom_table.chain_vec[last_atom]];
+
+    /* order atoms by output file, model, kind and chain, so that each model
+     * of each file is written from one range of file_atom_vec. chains are
+     * ordered as in chainID_vec; chains not in chainID_vec are not output */
+    size_t fileNum=filename_vec.size()-1;
+    vector<int> file_terNum(fileNum,0);
+    vector<int> file_hydrNum(fileNum,0);
+    vector<int> chain_pos(chainNum,-1);
+    vector<int> chain_polymer(chainNum,0);
+    for (j=0;j<chainID_vec.size();j++) chain_pos[chainID_vec[j]]=j;
+    vector<size_t> kind_atom_vec(atom_table.flag_vec.size());
+    vector<int> atom_key_vec(atom_table.flag_vec.size());
+    for (a=0;a<atom_table.flag_vec.size();a++)
+    {
+        kind_atom_vec[a]=a;
+        kind=atom_table.flag_vec[a]&ATOM_KIND;
+        chain=atom_table.chain_vec[a];
+        chain_polymer[chain]|=(kind==ATOM_POLYMER);
+        atom_key_vec[a]=(chain_pos[chain]<0)?-1:
+            (kind*chainID_vec.size()+chain_pos[chain]);
     }
-    vector<pair<string,string> >().swap(atomLine_vec);
-    for (l=0;l<=ligLine_vec.size();l++)
+    for (j=0;j<chainID_vec.size();j++)
     {
-        if (l && (l==ligLine_vec.size() || asym_id!=ligLine_vec[l].second))
-        {
-            chain_lig_map[asym_id]+=lig_txt;
-            lig_txt.clear();
-        }
-        if (l==ligLine_vec.size()) continue;
-        line=ligLine_vec[l].first;
-        asym_id=ligLine_vec[l].second;
-
-        chainID=chainID_map[asym_id];
-        if (outfmt!=3) chainStr=chainID;
-        else chainStr=asym_id.substr(0,2);
-        if (chainStr.size()<=1) chainStr=" "+chainStr;
-        lig_txt+=line.substr(0,20)+chainStr+line.substr(22)+'\n';
-        if (anisou_map.size())
+        chain=chainID_vec[j];
+        SplitNum=bundleID_vec[chain]-1;
+        if (chain_polymer[chain] && SplitChainNum_vec[chain]<0 &&
+            0<=SplitNum && SplitNum<fileNum)
         {
-            key=line.substr(12,15)+'\t'+asym_id;
-            if (anisou_map.count(key)) lig_txt+="ANISOU"+line.substr(6,14)+
-                chainStr+line.substr(22,6)+anisou_map[key]+line.substr(70)+'\n';
+            file_terNum[SplitNum]++;
+            file_hydrNum[SplitNum]+=chainHydrNum_vec[chain];
         }
     }
-    vector<pair<string,string> >().swap(ligLine_vec);
-    for (l=0;l<=hohLine_vec.size();l++)
+    vector<size_t> file_atom_vec;
+    vector<size_t> file_start_vec;
+    counting_sort(kind_atom_vec,atom_key_vec,3*chainID_vec.size(),
+        file_atom_vec,file_start_vec);
+    kind_atom_vec.swap(file_atom_vec);
+    for (l=0;l<kind_atom_vec.size();l++)
     {
-        if (l && (l==hohLine_vec.size() || asym_id!=hohLine_vec[l].second))
-        {
-            chain_hoh_map[asym_id]+=hoh_txt;
-            hoh_txt.clear();
-        }
-        if (l==hohLine_vec.size()) continue;
-        line=hohLine_vec[l].first;
-        asym_id=hohLine_vec[l].second;
-
-        chainID=chainID_map[asym_id];
-        if (outfmt!=3) chainStr=chainID;
-        else chainStr=asym_id.substr(0,2);
-        if (chainStr.size()<=1) chainStr=" "+chainStr;
-        hoh_txt+=line.substr(0,21)+chainID+line.substr(22)+'\n';
-        if (anisou_map.size())
-        {
-            key=line.substr(12,15)+'\t'+asym_id;
-            if (anisou_map.count(key)) hoh_txt+="ANISOU"+line.substr(6,14)+
-                chainStr+line.substr(22,6)+anisou_map[key]+line.substr(70)+'\n';
-        }
+        a=kind_atom_vec[l];
+        chain=atom_table.chain_vec[a];
+        SplitNum=bundleID_vec[chain]-1;
+        if (atom_table.res_vec[a]<SplitChainRes_mat[chain].size())
+            SplitNum+=SplitChainRes_mat[chain][atom_table.res_vec[a]];
+        atom_key_vec[a]=(SplitNum<0 || SplitNum>=fileNum)?-1:
+            (SplitNum*model_num_vec.size()+atom_table.model_vec[a]);
     }
-    vector<pair<string,string> >().swap(hohLine_vec);
-    key.clear();
+    counting_sort(kind_atom_vec,atom_key_vec,fileNum*model_num_vec.size(),
+        file_atom_vec,file_start_vec);
+    vector<size_t>().swap(kind_atom_vec);
+    vector<int>().swap(atom_key_vec);
+    vector<int>().swap(chain_pos);
+    vector<int>().swap(chain_polymer);
 
     map<string,int> chain2entity_map;
     if (entity2strand.size())
@@ -4141,396 +5021,107 @@ COLUMNS       DATA  TYPE    FIELD          DEFINITION
         }
     }
     
-    int terNum=0;
-    int hydrNum=0;
-    int m=0;
-    int seqresCount=0;
-    int seqresWrap=0;
-    int entity=0;
+    /* entity of the SEQRES records of each chain */
+    vector<int> chain_entity_vec(chainNum,-1);
+    map<string,int>::iterator entity_it;
+    if (read_seqres && seqres_mat.size() && entity2strand.size())
+    {
+        for (j=0;j<chainID_vec.size();j++)
+        {
+            chain=chainID_vec[j];
+            entity_it=chain2entity_map.find(
+                string(atom_table.chain.str_vec[chain]));
+            if (entity_it!=chain2entity_map.end() &&
+                seqres_mat.count(entity_it->second))
+                chain_entity_vec[chain]=entity_it->second;
+        }
+    }
     if ((do_upper && !writebundle) || do_upper==2)
     {
         header1=Upper(header1);
         header2=Upper(header2);
     }
-    for (i=0;i<filename_vec.size()-1;i++)
+
+    /* PDB files are formatted and written by a pool of threads. each file
+     * only reads the data above, except that the chain ID of DBREF is that
+     * of the last chain with SEQRES in the files before it */
+    PdbFileJob job;
+    job.table            =&atom_table;
+    job.filename_vec     =&filename_vec;
+    job.header1          =&header1;
+    job.header2          =&header2;
+    job.read_dbref       =(read_dbref && dbref_mat.size());
+    job.outfmt           =outfmt;
+    job.do_gzip          =do_gzip;
+    job.do_tar           =do_tar;
+    job.writer           =writer;
+    job.pool             =pool;
+    job.dbref_mat        =&dbref_mat;
+    job.accession2db_name=&accession2db_name;
+    job.accession2db_code=&accession2db_code;
+    job.seqres_mat       =&seqres_mat;
+    job.chain_entity_vec =&chain_entity_vec;
+    job.chainID_vec      =&chainID_vec;
+    job.bundleID_vec     =&bundleID_vec;
+    job.chainNewID_vec   =&chainNewID_vec;
+    job.file_atom_vec    =&file_atom_vec;
+    job.file_start_vec   =&file_start_vec;
+    job.model_num_vec    =&model_num_vec;
+    job.file_terNum      =&file_terNum;
+    job.file_hydrNum     =&file_hydrNum;
+    job.next=0;
+    job.text_vec.resize(fileNum);
+    for (i=0;i<fileNum;i++)
     {
-        filename=filename_vec[i];
-        cout<<filename<<endl;
-        fout.open(filename.c_str());
-        fout<<header1;
-        if (read_dbref && dbref_mat.size())
-        {
-            for (l=0;l<dbref_mat.size();l++)
-            {
-                asym_id=dbref_mat[l][1];
-                if (bundleID_map[asym_id]!=i+1) continue;
-                for (j=0;j<dbref_vec.size();j++)
-                    dbref_vec[j]=dbref_mat[l][j];
-                if (accession2db_name.count(dbref_vec[7]))
-                    dbref_vec[6]=accession2db_name[dbref_vec[7]];
-                if (accession2db_code.count(dbref_vec[7]))
-                    dbref_vec[8]=accession2db_code[dbref_vec[7]];
-                    /*
-COLUMNS       DATA TYPE     FIELD              DEFINITION
------------------------------------------------------------------------------------
- 1 -  6       Record name   "DBREF "
- 8 - 11       IDcode        idCode             ID code of this entry.
-13            Character     chainID            Chain  identifier.
-15 - 18       Integer       seqBegin           Initial sequence number of the
-                                               PDB sequence segment.
-19            AChar         insertBegin        Initial  insertion code of the
-                                               PDB  sequence segment.
-21 - 24       Integer       seqEnd             Ending sequence number of the
-                                               PDB  sequence segment.
-25            AChar         insertEnd          Ending insertion code of the
-                                               PDB  sequence segment.
-27 - 32       LString       database           Sequence database name.
-34 - 41       LString       dbAccession        Sequence database accession code.
-43 - 54       LString       dbIdCode           Sequence  database identification code.
-56 - 60       Integer       dbseqBegin         Initial sequence number of the
-                                               database seqment.
-61            AChar         idbnsBeg           Insertion code of initial residue of the
-                                               segment, if PDB is the reference.
-63 - 67       Integer       dbseqEnd           Ending sequence number of the
-                                               database segment.
-68            AChar         dbinsEnd           Insertion code of the ending residue of
-                                               the segment, if PDB is the reference.
-                     */
-                if (outfmt!=3) chainStr=chainID;
-                else chainStr=asym_id.substr(0,2);
-                if (chainStr.size()<=1) chainStr=" "+chainStr;
-                buf<<"DBREF  "<<right<<setw(4)<<dbref_vec[0]
-                   <<setw(2)<<chainStr<<' '
-                   <<setw(4)<<dbref_vec[2]<<dbref_vec[3]<<' '
-                   <<setw(4)<<dbref_vec[4]<<dbref_vec[5]<<' '
-                   <<setw(6)<<left<<dbref_vec[6]<<' '
-                   <<setw(8)<<left<<dbref_vec[7]<<' '
-                   <<setw(12)<<left<<dbref_vec[8]<<' '
-                   <<setw(5)<<right<<dbref_vec[9]<<dbref_vec[10]<<' '
-                   <<setw(5)<<dbref_vec[11]<<dbref_vec[12]<<flush;
-                fout<<left<<setw(80)<<buf.str()<<endl;
-                buf.str(string());
-                
-            }
-        }
-        if (read_seqres && seqres_mat.size() && entity2strand.size())
-        {
-            for (j=0;j<chainID_vec.size();j++)
-            {
-                asym_id=chainID_vec[j];
-                if (chain2entity_map.count(asym_id)==0 ||
-                    bundleID_map[asym_id]!=i+1) continue;
-                entity=chain2entity_map[asym_id];
-                if (seqres_mat.count(entity)==0) continue;
-
-                seqresCount=0;
-                chainID=chainID_map[asym_id];
-                if (outfmt!=3) chainStr=chainID;
-                else chainStr=asym_id.substr(0,2);
-                if (chainStr.size()<=1) chainStr=" "+chainStr;
-                seqresWrap=0;
-                for (m=0;m<seqres_mat[entity].size();m++)
-                {
-                    if (seqresWrap==0)
-                    {
-                        seqresCount++;
-                        buf<<"SEQRES"<<right<<setw(4)<<seqresCount<<setw(2)
-                            <<chainStr<<setw(5)<<seqres_mat[entity].size()<<" ";
-                    }
-                    buf<<" "<<seqres_mat[entity][m];
-                    seqresWrap++;
-                    if (seqresWrap==13 || m+1==seqres_mat[entity].size())
-                    {
-                        fout<<left<<setw(80)<<buf.str()<<'\n';
-                        seqresWrap=0;
-                        buf.str(string());
-                    }
-                }
-            }
-        }
-        fout<<header2;
-        for (m=0;m<model_num_vec.size();m++)
+        job.dbref_chainID_vec.push_back(chainID);
+        for (j=0;j<chainID_vec.size();j++)
         {
-            pdbx_PDB_model_num=model_num_vec[m];
-            if (model_num_vec.size()>1)
-                fout<<left<<setw(80)<<"MODEL     "+pdbx_PDB_model_num<<'\n';
-            terNum=0;
-            hydrNum=0;
-            filename_app_map[filename]=0;
-            for (j=0;j<chainID_vec.size();j++)
-            {
-                asym_id=chainID_vec[j];
-                if (chain_atm_map[asym_id].size()==0 ||
-                   (SplitChainRes_map.count(asym_id)==0 &&
-                    bundleID_map[asym_id]!=i+1)) continue;
-                if (SplitChainRes_map.count(asym_id)==0)
-                {
-                    terNum++;
-                    hydrNum+=chainHydrNum_map[asym_id];
-                }
-
-                Split(chain_atm_map[asym_id],lines,'\n',true);
-                for (l=0;l<lines.size();l++)
-                {
-                    line=lines[l];
-                    if (pdbx_PDB_model_num!=line.substr(7,4)) continue;
-                    if (SplitChainRes_map.count(asym_id))
-                    {
-                        res=line.substr(22,5);
-                        if (SplitChainRes_map[asym_id][res]+
-                            bundleID_map[asym_id]!=i+1)
-                            continue;
-                    }
-                    if (StartsWith(line,"ANISOU")) fout<<"ANISOU"
-                        <<setw(5)<<right<<atomNum%100000<<line.substr(11)<<'\n';
-                    else
-                    {
-                        atomNum=(++filename_app_map[filename]);
-                        fout<<line.substr(0,6)<<setw(5)<<right<<atomNum%100000
-                            <<line.substr(11)<<'\n';
-                    }
-                    lines[l].clear();
-                }
-                lines.clear();
-            }
-            for (j=0;j<chainID_vec.size();j++)
-            {
-                asym_id=chainID_vec[j];
-                if (chain_lig_map[asym_id].size()==0||
-                   (SplitChainRes_map.count(asym_id)==0 &&
-                    bundleID_map[asym_id]!=i+1)) continue;
-                Split(chain_lig_map[asym_id],lines,'\n',true);
-                for (l=0;l<lines.size();l++)
-                {
-                    line=lines[l];
-                    if (pdbx_PDB_model_num!=line.substr(7,4)) continue;
-                    if (SplitChainRes_map.count(asym_id))
-                    {
-                        res=line.substr(22,5);
-                        if (SplitChainRes_map[asym_id][res]+
-                            bundleID_map[asym_id]!=i+1)
-                            continue;
-                    }
-                    if (StartsWith(line,"ANISOU")) fout<<"ANISOU"
-                        <<setw(5)<<right<<atomNum%100000<<line.substr(11)<<'\n';
-                    else
-                    {
-                        atomNum=(++filename_app_map[filename]);
-                        fout<<line.substr(0,6)<<setw(5)<<right<<atomNum%100000
-                            <<line.substr(11)<<'\n';
-                    }
-                    lines[l].clear();
-                }
-                lines.clear();
-            }
-            for (j=0;j<chainID_vec.size();j++)
-            {
-                asym_id=chainID_vec[j];
-                if (chain_hoh_map[asym_id].size()==0||
-                   (SplitChainRes_map.count(asym_id)==0 &&
-                    bundleID_map[asym_id]!=i+1)) continue;
-                Split(chain_hoh_map[asym_id],lines,'\n',true);
-                for (l=0;l<lines.size();l++)
-                {
-                    line=lines[l];
-                    if (pdbx_PDB_model_num!=line.substr(7,4)) continue;
-                    if (SplitChainRes_map.count(asym_id))
-                    {
-                        res=line.substr(22,5);
-                        if (SplitChainRes_map[asym_id][res]+
-                            bundleID_map[asym_id]!=i+1)
-                            continue;
-                    }
-                    if (StartsWith(line,"ANISOU")) fout<<"ANISOU"
-                        <<setw(5)<<right<<atomNum%100000<<line.substr(11)<<'\n';
-                    else
-                    {
-                        atomNum=(++filename_app_map[filename]);
-                        fout<<line.substr(0,6)<<setw(5)<<right<<atomNum%100000
-                            <<line.substr(11)<<'\n';
-                    }
-                    lines[l].clear();
-                }
-                lines.clear();
-            }
-            if (model_num_vec.size()>1) fout<<left<<setw(80)<<"ENDMDL"<<'\n';
+            chain=chainID_vec[j];
+            if (chain_entity_vec[chain]>=0 && bundleID_vec[chain]==i+1)
+                chainID=chainNewID_vec[chain];
         }
-    /*
-COLUMNS         DATA TYPE     FIELD          DEFINITION
-----------------------------------------------------------------------------------
- 1 -  6         Record name   "MASTER"
-11 - 15         Integer       numRemark      Number of REMARK records
-16 - 20         Integer       "0"
-21 - 25         Integer       numHet         Number of HET records
-26 - 30         Integer       numHelix       Number of HELIX records
-31 - 35         Integer       numSheet       Number of SHEET records
-36 - 40         Integer       numTurn        deprecated
-41 - 45         Integer       numSite        Number of SITE records
-46 - 50         Integer       numXform       Number of coordinate transformation
-                                             records  (ORIGX+SCALE+MTRIX)
-51 - 55         Integer       numCoord       Number of atomic coordinate records
-                                             records (ATOM+HETATM)
-56 - 60         Integer       numTer         Number of TER records
-61 - 65         Integer       numConect      Number of CONECT records
-66 - 70         Integer       numSeq         Number of SEQRES records
-    */
-
-        fout<<"MASTER        0    0    0    0    0    0    0    3"
-            <<setw(5)<<right<<filename_app_map[filename]-terNum-hydrNum
-            <<setw(5)<<right<<terNum<<"    0    0          \n"
-            <<setw(80)<<left<<"END"<<endl;
-        fout.close();
     }
-    if (writebundle && outfmt<=1) cout<<filename_vec.back()<<endl;
+    int file_thread=min((size_t)max(thread_num,1),fileNum);
+    job.thread_num=(file_thread>1)?1:thread_num;
+    run_parallel(pdb_file_worker,&job,file_thread,pool);
+    for (i=0;i<fileNum;i++)
+    {
+        listing<<filename_vec[i]<<endl;
+        if (do_tar) tar_append(tar,filename_vec[i],job.text_vec[i]);
+        string().swap(job.text_vec[i]);
+    }
+    if (writebundle && outfmt<=1)
+    {
+        filename=filename_vec.back();
+        fout=mapping_buf.str();
+        mapping_buf.str(string());
+        if (do_tar) tar_append(tar,filename,fout);
+        else output_file(writer,filename,fout);
+        fout.clear();
+        listing<<filename<<endl;
+    }
     if (outfmt<=3 && ccd5_vec.size())
     {
         filename=pdbid+"-ligand-id-mapping.tsv";
-        fout.open(filename.c_str());
-        fout<<"#New_ligand_ID\tOriginal_ligand_ID\n";
+        fout+="#New_ligand_ID\tOriginal_ligand_ID\n";
         for (l=0;l<ccd5_vec.size();l++)
-            fout<<ccd5_map[ccd5_vec[l]]<<'\t'<<ccd5_vec[l]<<'\n';
-        fout<<flush;
-        fout.close();
+            fout+=ccd5_map[ccd5_vec[l]]+'\t'+ccd5_vec[l]+'\n';
+        if (do_tar) tar_append(tar,filename,fout);
+        else output_file(writer,filename,fout);
+        fout.clear();
         filename_vec.push_back(filename);
-        cout<<filename<<endl;
+        listing<<filename<<endl;
     }
-
-    /* clean up */
-    vector<string> ().swap(ccd5_vec);
-    map<string,string> ().swap(ccd5_map);
-
-    string ().swap(pdbx_keywords);
-    string ().swap(recvd_initial_deposition_date);
-    string ().swap(revision_date);
-
-    map<string,int> ().swap(_audit_author);
-    map<string,int> ().swap(_citation_author);
-    map<string,int> ().swap(_citation);
-    map<string,int> ().swap(_cell);
-    map<string,int> ().swap(fract_transf_);
-    map<string,int> ().swap(_atom_site);
-    map<string,int> ().swap(_symmetry);
-    map<string,int> ().swap(_pdbx_database_status);
-    map<string,int> ().swap(_pdbx_audit_revision_history);
-    map<string,int> ().swap(_struct_keywords);
-    map<string,int> ().swap(_entity_poly_seq);
-    map<string,int> ().swap(_entity_poly);
-    map<string,int> ().swap(_struct_ref);
-    map<string,int> ().swap(_struct_ref_seq);
-    
-    map<string,char>().swap(chainID_map);
-    map<string,int> ().swap(bundleID_map);
-    map<string,int> ().swap(filename_app_map);
-    map<string,string>().swap(chain_atm_map);
-    map<string,string>().swap(chain_lig_map);
-    map<string,string>().swap(chain_hoh_map);
-    string ().swap(chainID_list);
-    string ().swap(filename);
-    string ().swap(atm_txt);
-    string ().swap(lig_txt);
-    string ().swap(hoh_txt);
-
-    vector<string>().swap(author_vec);
-    vector<string>().swap(citation_author_vec);
-    vector<string>().swap(cryst1_vec);
-    vector<string>().swap(scale_vec);
-    vector<vector<string> >().swap(scale_mat);
-    vector<string>().swap(lines);
-    vector<string>().swap(line_vec);
-    vector<string>().swap(line_append_vec);
-    string ().swap(header1);
-    string ().swap(header2);
-    _citation_title.clear();
-    _citation_pdbx_database_id_PubMed.clear();
-    _citation_pdbx_database_id_DOI.clear();
-    _citation_journal_abbrev.clear();
-    _citation_journal_volume.clear();
-    _citation_page_first.clear();
-    _citation_year.clear();
-    _citation_journal_id_ASTM.clear();
-    _citation_country.clear();
-    _citation_journal_id_ISSN.clear();
-
-    group_PDB.clear();
-    type_symbol.clear();
-    atom_id.clear();
-    alt_id.clear();
-    comp_id.clear();
-    asym_id.clear();
-    seq_id.clear();
-    pdbx_PDB_ins_code.clear();
-    Cartn_x.clear();
-    Cartn_y.clear();
-    Cartn_z.clear();
-    occupancy.clear();
-    B_iso_or_equiv.clear();
-    pdbx_formal_charge.clear();
-    pdbx_PDB_model_num.clear();
-    vector <string>().swap(model_num_vec);
-    U11.clear();
-    U12.clear();
-    U13.clear();
-    U22.clear();
-    U23.clear();
-    U33.clear();
-    map<string,string>().swap(anisou_map);
-    map<string,size_t>().swap(chainAtomNum_map);
-    map<string,size_t>().swap(chainHydrNum_map);
-    vector<string> ().swap(chainID_vec);
-    vector<string> ().swap(seqres_vec);
-    map<int,vector<string> > ().swap(seqres_mat);
-    vector<string> ().swap(entity2strand);
-    map<string,int> ().swap(chain2entity_map);
-    
-    map<string,map<string,int> >().swap(SplitChain_map);
-    map<string,map<string,int> >().swap(SplitChainRes_map);
-    map<string,int>().swap(SplitChainNum_map);
-    res.clear();
-    
-    map<string,string>().swap(accession2db_name);
-    map<string,string>().swap(accession2db_code);
-    vector<vector<string> >().swap(dbref_mat);
-    vector<string>().swap(dbref_vec);
-    
-    /* compression */
-    if (do_gzip)
+    if (do_tar)
     {
-        if (outfmt==2)
-        {
-            for (i=0;i<filename_vec.size()-1;i++)
-            {
-                line="gzip -f "+filename_vec[i];
-                j=system(line.c_str());
-            }
-        }
-        else
-        {
-            if (writebundle)
-            {
-                line="tar -czf "+pdbid+"-pdb-bundle.tar.gz";
-                for (i=0;i<filename_vec.size();i++) line+=" "+filename_vec[i];
-            }
-            else line="gzip -f "+filename_vec[0];
-            i=system(line.c_str());
-            if (writebundle)
-            {
-                line=pdbid+"-pdb-bundle.tar.gz";
-                ifstream fp(line.c_str());
-                if (fp.good())
-                {
-                    line="del ";
-#if defined(REDI_PSTREAM_H_SEEN)
-                    line="rm ";
-#endif
-                    for (i=0;i<filename_vec.size();i++) line+=" "+filename_vec[i];
-                    i=system(line.c_str());
-                }
-                fp.close();
-            }
-        }
+        tar_finish(tar);
+        output_file(writer,pdbid+"-pdb-bundle.tar",tar,do_gzip);
     }
-    line.clear();
-    vector<string>  ().swap(filename_vec);
+
+    /* other data of the entry is freed as it goes out of scope; atoms
+     * are cleared here so that the table keeps only the capacity of
+     * columns up to COLUMN_KEEP bytes */
+    clear_atom_table(atom_table);
     return bundleNum;
 }
 
@@ -4614,39 +5205,24 @@ inline char aa3to1(const string resn)
 }
 
 int cif2fasta(const string &infile, string &pdbid, const int do_upper,
-    const int do_gzip, const vector<string> &outputChain_vec)
+    const int do_gzip, const vector<string> &outputChain_vec,
+    ostream &listing=cout, InputFile *prefetch=NULL,
+    const WriteStage *writer=NULL)
 {
 
     stringstream buf;
-    if (infile=="-") buf<<cin.rdbuf();
-#if defined(REDI_PSTREAM_H_SEEN)
-    else if (EndsWith(infile,".gz"))
-    {
-        redi::ipstream fp_gz; // if file is compressed
-        fp_gz.open("gunzip -c "+infile);
-        buf<<fp_gz.rdbuf();
-        fp_gz.close();
-    }
-#endif
-    else
-    {
-        ifstream fp;
-        fp.open(infile.c_str(),ios::in); //ifstream fp(filename,ios::in);
-        buf<<fp.rdbuf();
-        fp.close();
-    }
-    vector<string> lines;
-    Split(buf.str(),lines,'\n',true); 
-    buf.str(string());
-    if (lines.size()<=1)
+    InputFile own_input; // input file, unless prefetch is already read
+    InputFile &input=(prefetch==NULL)?own_input:*prefetch;
+    if (prefetch==NULL) open_input(infile,input);
+    if (CountLines(string_view(input.data,input.size),2)<=1)
     {
         cerr<<"ERROR! Empty structure "<<infile<<endl;
-        vector<string>().swap(lines);
-        return 0;
+        return -1;
     }
 
     /* parse ATOM/HETATM */
     map<string,int> _atom_site;
+    AtomSiteColumns atom_col;
     string comp_id    ="UNK";   // auth_comp_id, label_comp_id (residue name)
     string asym_prev  ="";
     string asym_id    =" ";     // auth_asym_id, label_asym_id (chain ID)
@@ -4664,103 +5240,70 @@ int cif2fasta(const string &infile, string &pdbid, const int do_upper,
     size_t l;
     int i,j;
     string line;
-    vector<string> line_vec;
-    for (l=0;l<lines.size();l++)
+    CifReader reader;
+    cif_open(reader,string_view(input.data,input.size));
+    vector<string_view> item_vec;
+    int record;
+    while ((record=cif_record(reader,item_vec))!=CIF_END)
     {
-        line=lines[l];
-        Split(line,line_vec,' ',true);
-        if (line_vec.size()==0) continue;
-        else if (line_vec.size() && line_vec[0]=="#")
+        if (record==CIF_STOP)
             _atom_site.clear();
-        else if (pdbid.size()==0 && l==0 && StartsWith(line,"data_"))
-            pdbid=Lower(line.substr(5));
-        else if (pdbid.size()==0 && line_vec.size()>1 && line_vec[0]=="_entry.id")
-            pdbid=Lower(line_vec[1]);
-        else if (StartsWith(line,"_atom_site."))
+        else if (record==CIF_DATA)
         {
-            line=line_vec[0];
-            clear_line_vec(line_vec);
-            Split(line,line_vec,'.');
-            if (line_vec.size()>1)
+            if (pdbid.size()==0) pdbid=Lower(string(item_vec[0]));
+        }
+        else if (record==CIF_PAIR)
+        {
+            if (pdbid.size()==0 && item_vec[0]=="_entry.id")
+                pdbid=Lower(string(item_vec[1]));
+        }
+        else if (record==CIF_NAME)
+        {
+            if (cif_category(item_vec[0])=="_atom_site")
             {
-                line=line_vec[1];
-                j=_atom_site.size();
+                line=item_vec[0].substr(11);
+                j=reader.ncol-1;
                 _atom_site[line]=j;
+                compile_atom_site(_atom_site,atom_col);
             }
         }
         else if (_atom_site.size())
         {
-            if (_atom_site.count("pdbx_PDB_model_num"))
+            if (atom_col.pdbx_PDB_model_num>=0)
             {
-                pdbx_PDB_model_num=line_vec[_atom_site["pdbx_PDB_model_num"]];
+                pdbx_PDB_model_num=item_vec[atom_col.pdbx_PDB_model_num];
                 if (pdbx_PDB_model_num!="." &&
                     pdbx_PDB_model_num=="?" && pdbx_PDB_model_num!="1")
-                {
-                    clear_line_vec(line_vec);
                     continue;
-                }
             }
-            if (_atom_site.count("label_seq_id") && 
-                line_vec[_atom_site["label_seq_id"]]==".")
-            {                
-                clear_line_vec(line_vec);
+            if (atom_col.label_seq_id>=0 && 
+                item_vec[atom_col.label_seq_id]==".")
                 continue;
-            }
             
-            if (_atom_site.count("auth_asym_id"))
-                asym_id=line_vec[_atom_site["auth_asym_id"]];
-            else if (_atom_site.count("label_asym_id"))
-                asym_id=line_vec[_atom_site["label_asym_id"]];
-            else if (_atom_site.count("pdbx_auth_asym_id"))
-                asym_id=line_vec[_atom_site["pdbx_auth_asym_id"]];
-            else if (_atom_site.count("pdbx_label_asym_id"))
-                asym_id=line_vec[_atom_site["pdbx_label_asym_id"]];
+            if (atom_col.asym_id>=0) asym_id=item_vec[atom_col.asym_id];
             if (asym_id=="." || asym_id=="?") asym_id="_";
             if (outputChain_vec.size() && find(outputChain_vec.begin(),
                 outputChain_vec.end(), asym_id)==outputChain_vec.end())
-            {
-                clear_line_vec(line_vec);
                 continue;
-            }
 
-            if (_atom_site.count("auth_seq_id"))
-                seq_id=line_vec[_atom_site["auth_seq_id"]];
-            else if (_atom_site.count("label_seq_id"))
-                seq_id=line_vec[_atom_site["label_seq_id"]];
-            else if (_atom_site.count("pdbx_auth_seq_id"))
-                seq_id=line_vec[_atom_site["pdbx_auth_seq_id"]];
-            else if (_atom_site.count("pdbx_label_seq_id"))
-                seq_id=line_vec[_atom_site["pdbx_label_seq_id"]];
+            if (atom_col.seq_id>=0) seq_id=item_vec[atom_col.seq_id];
 
-            if (_atom_site.count("pdbx_PDB_ins_code"))
+            if (atom_col.pdbx_PDB_ins_code>=0)
             {
-                pdbx_PDB_ins_code=line_vec[_atom_site["pdbx_PDB_ins_code"]];
+                pdbx_PDB_ins_code=item_vec[atom_col.pdbx_PDB_ins_code];
                 if (pdbx_PDB_ins_code!="." && pdbx_PDB_ins_code!="?")
                     seq_id+=pdbx_PDB_ins_code;
             }
 
             if (asym_prev==asym_id && seq_prev==seq_id)
-            {
-                clear_line_vec(line_vec);
                 continue;
-            }
             
-            if (_atom_site.count("auth_comp_id"))
-            {
-                comp_id=line_vec[_atom_site["auth_comp_id"]];
-                if (comp_id.size()>3 && _atom_site.count("label_comp_id"))
-                    comp_id=line_vec[_atom_site["label_comp_id"]];
-            }
-            else if (_atom_site.count("label_comp_id"))
-                comp_id=line_vec[_atom_site["label_comp_id"]];
-            else if (_atom_site.count("pdbx_auth_comp_id"))
+            if (atom_col.comp_id>=0)
             {
-                comp_id=line_vec[_atom_site["pdbx_auth_comp_id"]];
-                if (comp_id.size()>3 && _atom_site.count("pdbx_label_comp_id"))
-                    comp_id=line_vec[_atom_site["pdbx_label_comp_id"]];
+                comp_id=item_vec[atom_col.comp_id];
+                if (comp_id.size()>3 && atom_col.comp_id_long>=0)
+                    comp_id=item_vec[atom_col.comp_id_long];
             }
-            else if (_atom_site.count("pdbx_label_comp_id"))
-                comp_id=line_vec[_atom_site["pdbx_label_comp_id"]];
             while (comp_id.size()<3) comp_id=' '+comp_id;
 
             if (asym_prev!=asym_id)
@@ -4785,12 +5328,8 @@ int cif2fasta(const string &infile, string &pdbid, const int do_upper,
             }
             seq_prev=seq_id;
         }
-
-        /* clean up */
-        clear_line_vec(line_vec);
-        lines[l].clear();
     }
-    lines.clear();
+    close_input(input);
     if (sequence.size())
     {
         chainID_vec.push_back(asym_prev);
@@ -4834,19 +5373,11 @@ int cif2fasta(const string &infile, string &pdbid, const int do_upper,
     }
     buf<<flush;
     
-    ofstream fout;
     string filename=pdbid+".fasta";
-    fout.open(filename.c_str());
-    fout<<buf.str()<<flush;
+    string text=buf.str();
     buf.str(string());
-    fout.close();
-    cout<<filename<<endl;
-    
-    if (do_gzip)
-    {
-        line="gzip -f "+filename;
-        j=system(line.c_str());
-    }
+    output_file(writer,filename,text,do_gzip);
+    listing<<filename<<endl;
 
     /* clean up */
     map<string,int> ().swap(_atom_site);
@@ -4857,8 +5388,7 @@ int cif2fasta(const string &infile, string &pdbid, const int do_upper,
     vector<size_t>().swap(mol_type_vec);
     vector<vector<size_t> >().swap(mol_type_mat);
 
-    vector<string>().swap(lines);
-    vector<string>().swap(line_vec);
+    vector<string_view>().swap(item_vec);
     
     comp_id.clear();
     asym_prev.clear();
@@ -4871,18 +5401,738 @@ int cif2fasta(const string &infile, string &pdbid, const int do_upper,
     return seqNum;
 }
 
+/* batch mode START */
+
+bool IsDir(const string &path)
+{
+    struct stat st;
+    return stat(path.c_str(),&st)==0 && S_ISDIR(st.st_mode);
+}
+
+/* read list of input files, one per line. empty lines and lines starting
+ * with '#' are ignored */
+void read_batch_list(const string &listfile, vector<string> &infile_vec)
+{
+    ifstream fp;
+    fp.open(listfile.c_str(),ios::in);
+    if (!fp.good())
+    {
+        cerr<<"ERROR: cannot read list "<<listfile<<endl;
+        return;
+    }
+    string line;
+    while (getline(fp,line))
+    {
+        line=Trim(line);
+        if (line.size()==0 || line[0]=='#') continue;
+        infile_vec.push_back(line);
+    }
+    fp.close();
+    line.clear();
+}
+
+/* recursively search folder for *.cif and *.cif.gz */
+void read_batch_dir(const string &folder, vector<string> &infile_vec)
+{
+    DIR *dp=opendir(folder.c_str());
+    if (dp==NULL)
+    {
+        cerr<<"ERROR: cannot open folder "<<folder<<endl;
+        return;
+    }
+    vector<string> name_vec;
+    struct dirent *ep;
+    while ((ep=readdir(dp))!=NULL)
+    {
+        string name=ep->d_name;
+        if (name!="." && name!="..") name_vec.push_back(name);
+    }
+    closedir(dp);
+    sort(name_vec.begin(),name_vec.end());
+
+    string path;
+    for (size_t i=0;i<name_vec.size();i++)
+    {
+        if (EndsWith(folder,"/")) path=folder+name_vec[i];
+        else path=folder+'/'+name_vec[i];
+        if (IsDir(path)) read_batch_dir(path,infile_vec);
+        else if (EndsWith(name_vec[i],".cif") || EndsWith(name_vec[i],".cif.gz"))
+            infile_vec.push_back(path);
+    }
+    vector<string>().swap(name_vec);
+    path.clear();
+}
+
+/* compressed mmCIF is about this many times smaller than the text */
+const size_t GZIP_RATIO=5;
+
+/* size of infile on disk, as listed in the manifest of a shard.
+ * 0 if infile cannot be found */
+size_t input_size(const string &infile)
+{
+    struct stat st;
+    if (stat(infile.c_str(),&st)!=0) return 0;
+    return st.st_size;
+}
+
+/* estimated text size of infile of size bytes on disk, used to schedule
+ * large inputs first and to estimate the memory of their conversion */
+size_t text_size(const string &infile, const size_t size)
+{
+    if (EndsWith(infile,".gz")) return size*GZIP_RATIO;
+    return size;
+}
+
+/* FNV-1a hash, which unlike std::hash is the same on every machine */
+unsigned long long stable_hash(const string_view text)
+{
+    unsigned long long hash=14695981039346656037ULL;
+    for (size_t i=0;i<text.size();i++)
+    {
+        hash^=(unsigned char)text[i];
+        hash*=1099511628211ULL;
+    }
+    return hash;
+}
+
+/* PDB ID of an input taken from its filename, e.g., 1abc for 1abc.cif.gz,
+ * and also for pdb1abc.ent.gz as named on the PDB mirror */
+string input_id(const string &infile)
+{
+    string id=Lower(Basename(infile));
+    size_t pos=id.find('.');
+    bool ent=(pos!=string::npos && id.compare(pos,4,".ent")==0);
+    id=id.substr(0,pos);
+    if (ent && id.size()>3 && StartsWith(id,"pdb")) id=id.substr(3);
+    return id;
+}
+
+/* parse i/N of -shard=i/N. return false unless 1<=i<=N */
+bool parse_shard(const string &text, int &shard, int &shardNum)
+{
+    size_t pos=text.find('/');
+    if (pos==string::npos) return false;
+    shard   =atoi(text.substr(0,pos).c_str());
+    shardNum=atoi(text.substr(pos+1).c_str());
+    return shardNum>=1 && shard>=1 && shard<=shardNum;
+}
+
+/* a shard may hold this many percent more than its share of the total
+ * size of the inputs on disk before inputs spill to other shards */
+const size_t SHARD_SLACK=10;
+
+/* rendezvous score of shard s for an input with PDB ID hash: the
+ * splitmix64 finalizer of the hash and the shard number */
+inline unsigned long long shard_score(const unsigned long long hash,
+    const int s)
+{
+    unsigned long long score=hash^((s+1)*0x9E3779B97F4A7C15ULL);
+    score=(score^(score>>30))*0xBF58476D1CE4E5B9ULL;
+    score=(score^(score>>27))*0x94D049BB133111EBULL;
+    return score^(score>>31);
+}
+
+/* keep in infile_vec only the inputs of shard i of shardNum, so that the
+ * shards hold about the same total size on disk and finish together.
+ * this is rendezvous hashing with bounded loads: from the largest input to
+ * the smallest, each input goes to the shard with the highest score of
+ * its PDB ID among the shards that are still below SHARD_SLACK percent
+ * over an equal share. an entry larger than a share still takes up only
+ * one shard, and later inputs go to the others.
+ *
+ * the shards depend on the PDB IDs and sizes on disk of all listed
+ * inputs, so every node must list the same files and see the same sizes,
+ * as copies of one mirror do; then the shards of all nodes are disjoint
+ * and cover every input. most inputs go to their first choice, which
+ * depends on nothing but the PDB ID and shardNum, so adding, removing or
+ * resizing inputs only moves the inputs that a full shard turns away
+ * before or after the change. cifte.cpp has a copy of input_id() and
+ * select_shard(), which must stay the same as these */
+void select_shard(vector<string> &infile_vec, const int shard,
+    const int shardNum)
+{
+    size_t f,k,cap,total=0;
+    int s,best;
+    unsigned long long score,best_score;
+    vector<size_t> size_vec(infile_vec.size());
+    vector<unsigned long long> hash_vec(infile_vec.size());
+    vector<size_t> order(infile_vec.size());
+    vector<size_t> load_vec(shardNum,0);
+    vector<bool> keep_vec(infile_vec.size(),false);
+    for (f=0;f<infile_vec.size();f++)
+    {
+        size_vec[f]=input_size(infile_vec[f]);
+        hash_vec[f]=stable_hash(input_id(infile_vec[f]));
+        total+=size_vec[f];
+        order[f]=f;
+    }
+
+    /* largest first, so that small inputs even out the shards in the end.
+     * ties are broken by ID hash and name, so every node has one order */
+    sort(order.begin(),order.end(),[&](size_t a,size_t b)
+    {
+        if (size_vec[a]!=size_vec[b]) return size_vec[a]>size_vec[b];
+        if (hash_vec[a]!=hash_vec[b]) return hash_vec[a]<hash_vec[b];
+        return infile_vec[a]<infile_vec[b];
+    });
+
+    /* some shard is always below cap, as cap*shardNum>total */
+    cap=total*(100+SHARD_SLACK)/100/shardNum+1;
+    for (k=0;k<order.size();k++)
+    {
+        f=order[k];
+        best=-1;
+        best_score=0;
+        for (s=0;s<shardNum;s++)
+        {
+            if (load_vec[s]>=cap) continue;
+            score=shard_score(hash_vec[f],s);
+            if (best<0 || score>best_score)
+            {
+                best=s;
+                best_score=score;
+            }
+        }
+        load_vec[best]+=size_vec[f];
+        keep_vec[f]=(best==shard-1);
+    }
+    for (f=k=0;f<infile_vec.size();f++)
+        if (keep_vec[f]) infile_vec[k++]=infile_vec[f];
+    infile_vec.resize(k);
+}
+
+/* name of the manifest of shard i of shardNum */
+string shard_manifest(const string &program, const int shard,
+    const int shardNum)
+{
+    stringstream buf;
+    buf<<program<<"-shard-"<<shard<<"-of-"<<shardNum<<".tsv";
+    return buf.str();
+}
+
+/* line of the manifest of a shard for one input: the input, its size on disk,
+ * whether it was converted, and its output files */
+string manifest_line(const string &infile, const size_t size,
+    const bool success, const string &listing)
+{
+    string output=listing;
+    while (output.size() && output.back()=='\n') output.pop_back();
+    replace(output.begin(),output.end(),'\n',' ');
+    stringstream buf;
+    buf<<infile<<'\t'<<size<<'\t'<<(success?"ok":"failed")<<'\t'
+       <<output<<'\n';
+    return buf.str();
+}
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+/* peak memory of a conversion: a fixed part, plus this many bytes per
+ * byte of input text for the text itself, the atom table and the output */
+const size_t MEM_BASE    =8<<20;
+const size_t MEM_PER_BYTE=3;
+
+/* states of a ReadTask */
+enum TaskState
+{
+    TASK_WAIT,  // not read yet
+    TASK_READ,  // being read by the reader thread
+    TASK_READY, // read by the reader thread
+    TASK_TAKEN  // taken by a worker before the reader thread reached it
+};
+
+/* input file, which is read ahead of its conversion by the reader thread
+ * unless a worker takes it first */
+struct ReadTask
+{
+    size_t disk_size; // size on disk, by input_size()
+    size_t size;      // estimated text size, by text_size()
+    size_t memory;    // estimated peak memory of the conversion
+    atomic<int> state{TASK_WAIT};
+    InputFile file;
+};
+
+/* inputs waiting for one worker, largest first. the worker takes inputs
+ * from the front; other workers with nothing left steal from the back */
+struct TaskDeque
+{
+    mutex lock;
+    deque<size_t> input_deque;
+    size_t load;  // total size of inputs in input_deque
+};
+
+/* state shared by all threads of one batch. inputs go through three
+ * stages: a reader thread reads and inflates them, worker threads convert
+ * them, and a writer thread writes the output files. inputs are dealt to
+ * the workers largest first, and a worker with nothing left steals inputs
+ * from the others, then helps with the parallel loops of large inputs
+ * still being converted, see run_parallel() */
+struct BatchJob
+{
+    const vector<string> *infile_vec;
+    int read_seqres;
+    int read_dbref;
+    int do_gzip;
+    int do_upper;
+    long int maxatom;
+    int outfmt;
+    string idmap;
+    const vector<string> *ccd3_vec;
+    const vector<string> *outputChain_vec;
+    int thread_num;
+
+    vector<ReadTask> *task_vec;    // one per input
+    vector<size_t> order_vec;      // inputs, largest first
+    vector<TaskDeque> *deque_vec;  // one per worker
+    atomic<size_t> taken;          // number of inputs taken by workers
+    atomic<size_t> done;           // number of inputs converted or skipped
+    HelpPool pool;
+
+    size_t mem_limit;     // bytes, 0 for no limit
+    mutex mem_mutex;      // guard the fields below
+    size_t mem_running;   // memory of inputs being converted
+    size_t mem_ahead;     // memory of inputs read ahead but not started
+    int alone_num;        // inputs larger than the limit waiting or running
+
+    BoundedQueue<WriteTask *> *write_queue; // NULL ends the writer
+    mutex print_mutex;          // guard the fields below
+    vector<string> listing_vec; // output filenames of each input
+    vector<int> status_vec;     // 0 - running, 1 - done, -1 - failed
+    vector<bool> failed_vec;    // an output file of the input failed
+    size_t printed;             // inputs before this are already listed
+    bool do_manifest;
+    string manifest_text;       // lines of the manifest of a shard
+    Uring ring;                 // used by the writer if set up
+};
+
+/* number of pages touched at a time by prefetch_input() */
+const size_t PREFETCH_PAGE=4096;
+
+/* fault in the pages of a memory mapped input, so that the disk is read
+ * by the reader thread rather than the worker that parses the input */
+void prefetch_input(const InputFile &input)
+{
+    if (input.map_addr==NULL) return;
+    volatile char sum=0;
+    for (size_t i=0;i<input.size;i+=PREFETCH_PAGE) sum^=input.data[i];
+}
+
+/* reserve memory for reading input ahead, if it fits in the limit
+ * together with all inputs being converted or already read ahead, and no
+ * input larger than the limit is waiting or running */
+bool admit_ahead(BatchJob *job, const size_t memory)
+{
+    lock_guard<mutex> lock(job->mem_mutex);
+    if (job->mem_limit && (job->alone_num ||
+        job->mem_running+job->mem_ahead+memory>job->mem_limit)) return false;
+    job->mem_ahead+=memory;
+    return true;
+}
+
+/* reserve memory for converting an input, waiting while it does not fit
+ * in the limit. an input is always admitted when nothing else is being
+ * converted. an input larger than the limit waits for that, and while it
+ * waits or runs, no other input is admitted or read ahead, so that it is
+ * converted alone. an input already read ahead only waits for those, as
+ * its text is already in memory. the waiting worker helps the
+ * conversions that are running */
+void admit_running(BatchJob *job, const size_t memory, const bool ahead)
+{
+    bool alone=(job->mem_limit && memory>job->mem_limit);
+    if (alone)
+    {
+        lock_guard<mutex> lock(job->mem_mutex);
+        job->alone_num++;
+    }
+    for (int wait=0;;wait++)
+    {
+        {
+            lock_guard<mutex> lock(job->mem_mutex);
+            bool admit;
+            if (job->mem_limit==0) admit=true;
+            else if (alone) admit=(job->mem_running==0);
+            else if (job->alone_num) admit=false;
+            else admit=(ahead || job->mem_running==0 ||
+                job->mem_running+job->mem_ahead+memory<=job->mem_limit);
+            if (admit)
+            {
+                if (ahead) job->mem_ahead-=memory;
+                job->mem_running+=memory;
+                return;
+            }
+        }
+        if (help_pool(job->pool)) wait=0;
+        else BoundedQueue<int>::queue_wait(wait);
+    }
+}
+
+/* release the memory of a finished conversion. under a limit, memory
+ * freed by the conversion is also returned to the system, as otherwise
+ * the malloc arena of each worker keeps the peak of its largest input */
+void release_running(BatchJob *job, const size_t memory)
+{
+#if defined(__GLIBC__)
+    if (job->mem_limit) malloc_trim(0);
+#endif
+    lock_guard<mutex> lock(job->mem_mutex);
+    job->mem_running-=memory;
+    if (job->mem_limit && memory>job->mem_limit) job->alone_num--;
+}
+
+/* read inputs largest first, at most 2 inputs per worker ahead of the
+ * workers and within the memory limit. inputs already taken by a worker
+ * are skipped */
+void BeEM_reader(BatchJob *job)
+{
+    const vector<string> &infile_vec=*(job->infile_vec);
+    size_t k,f;
+    int wait,state;
+    bool admitted;
+    for (k=0;k<job->order_vec.size();k++)
+    {
+        for (wait=0;k>=job->taken+2*job->thread_num;wait++)
+            BoundedQueue<int>::queue_wait(wait);
+        f=job->order_vec[k];
+        ReadTask &task=(*(job->task_vec))[f];
+        admitted=false;
+        for (wait=0;task.state.load()==TASK_WAIT;wait++)
+        {
+            if ((admitted=admit_ahead(job,task.memory))) break;
+            BoundedQueue<int>::queue_wait(wait);
+        }
+        if (!admitted) continue;
+        state=TASK_WAIT;
+        if (!task.state.compare_exchange_strong(state,TASK_READ))
+        {
+            lock_guard<mutex> lock(job->mem_mutex);
+            job->mem_ahead-=task.memory;
+            continue;
+        }
+        open_input(infile_vec[f],task.file);
+        prefetch_input(task.file);
+        task.state.store(TASK_READY,memory_order_release);
+    }
+}
+
+/* take the next input of worker t into f, or steal one from the worker
+ * with the largest load left. return false if no input is left */
+bool take_task(BatchJob *job, const int t, size_t &f)
+{
+    vector<TaskDeque> &deque_vec=*(job->deque_vec);
+    const vector<ReadTask> &task_vec=*(job->task_vec);
+    while (true)
+    {
+        {
+            lock_guard<mutex> lock(deque_vec[t].lock);
+            if (deque_vec[t].input_deque.size())
+            {
+                f=deque_vec[t].input_deque.front();
+                deque_vec[t].input_deque.pop_front();
+                deque_vec[t].load-=task_vec[f].size;
+                return true;
+            }
+        }
+        int victim=-1;
+        size_t load=0;
+        for (int v=0;v<deque_vec.size();v++)
+        {
+            lock_guard<mutex> lock(deque_vec[v].lock);
+            if (deque_vec[v].input_deque.size()==0) continue;
+            if (victim<0 || deque_vec[v].load>load)
+            {
+                victim=v;
+                load=deque_vec[v].load;
+            }
+        }
+        if (victim<0) return false;
+        lock_guard<mutex> lock(deque_vec[victim].lock);
+        if (deque_vec[victim].input_deque.size()==0) continue;
+        f=deque_vec[victim].input_deque.back();
+        deque_vec[victim].input_deque.pop_back();
+        deque_vec[victim].load-=task_vec[f].size;
+        return true;
+    }
+    return false;
+}
+
+void BeEM_worker(BatchJob *job, const int t)
+{
+    const vector<string> &infile_vec=*(job->infile_vec);
+    size_t f;
+    int wait=0;
+    while (job->done<infile_vec.size())
+    {
+        if (!take_task(job,t,f))
+        {
+            /* stay to help the inputs that are still being converted */
+            if (help_pool(job->pool)) wait=0;
+            else BoundedQueue<int>::queue_wait(wait++);
+            continue;
+        }
+        wait=0;
+        job->taken++;
+        ReadTask &task=(*(job->task_vec))[f];
+        int state=TASK_WAIT;
+        bool ahead=!task.state.compare_exchange_strong(state,TASK_TAKEN);
+        admit_running(job,task.memory,ahead);
+        if (!ahead) open_input(infile_vec[f],task.file);
+        else for (int w=0;task.state.load(memory_order_acquire)!=TASK_READY;
+            w++) BoundedQueue<int>::queue_wait(w);
+
+        /* an input larger than the limit runs with one thread, as the
+         * parallel loops of a conversion need extra memory */
+        bool low_memory=(job->mem_limit && task.memory>job->mem_limit);
+
+        WriteStage writer;
+        writer.queue=job->write_queue;
+        writer.input=f;
+        string pdbid="";
+        stringstream listing;
+        int status=-1;
+        try
+        {
+            if (job->outfmt==4) status=cif2fasta(infile_vec[f], pdbid,
+                job->do_upper, job->do_gzip, *(job->outputChain_vec), listing,
+                &task.file, &writer);
+            else status=BeEM(infile_vec[f], pdbid, job->read_seqres,
+                job->read_dbref, job->do_gzip, job->do_upper, job->maxatom,
+                job->outfmt, job->idmap, *(job->ccd3_vec),
+                *(job->outputChain_vec), listing,
+                low_memory?1:job->thread_num, &task.file, &writer,
+                low_memory?NULL:&job->pool);
+        }
+        catch (exception &e)
+        {
+            lock_guard<mutex> lock(job->print_mutex);
+            cerr<<"ERROR: cannot convert "<<infile_vec[f]<<": "
+                <<e.what()<<endl;
+            status=-1;
+        }
+        close_input(task.file);
+        {
+            lock_guard<mutex> lock(job->print_mutex);
+            job->listing_vec[f]=listing.str();
+        }
+
+        /* the input is done once the writer reaches this marker */
+        WriteTask *marker=new WriteTask;
+        marker->input=f;
+        marker->status=status;
+        job->write_queue->push(marker);
+        job->done++;
+    }
+}
+
+/* write the output files taken from the write queue, through the ring of
+ * job if it is set up */
+void write_queued(BatchJob *job, vector<WriteTask *> &file_vec)
+{
+    if (file_vec.size()==0) return;
+    vector<bool> success_vec;
+    size_t i;
+    write_files(job->ring,file_vec,success_vec);
+    {
+        lock_guard<mutex> lock(job->print_mutex);
+        for (i=0;i<file_vec.size();i++)
+            if (!success_vec[i]) job->failed_vec[file_vec[i]->input]=true;
+    }
+    for (i=0;i<file_vec.size();i++) delete file_vec[i];
+    file_vec.clear();
+}
+
+/* all output files of the input of marker are written */
+void finish_input(BatchJob *job, WriteTask *marker)
+{
+    const vector<string> &infile_vec=*(job->infile_vec);
+    size_t f=marker->input;
+
+    /* the output of the input is part of its memory */
+    release_running(job,(*(job->task_vec))[f].memory);
+
+    /* list output files in the same order as input */
+    lock_guard<mutex> lock(job->print_mutex);
+    job->status_vec[f]=(marker->status<0 || job->failed_vec[f])?-1:1;
+    delete marker;
+    while (job->printed<infile_vec.size() && job->status_vec[job->printed])
+    {
+        f=job->printed;
+        cout<<job->listing_vec[f]<<flush;
+        if (job->do_manifest) job->manifest_text+=manifest_line(
+            infile_vec[f],(*(job->task_vec))[f].disk_size,
+            job->status_vec[f]>0,job->listing_vec[f]);
+        string().swap(job->listing_vec[f]);
+        job->printed++;
+    }
+}
+
+/* write output files in batches of up to URING_BATCH files that are
+ * already queued, so that a batch needs few system calls with io_uring */
+void BeEM_writer(BatchJob *job)
+{
+    vector<WriteTask *> file_vec;
+    WriteTask *task;
+    bool done=false;
+    while (!done)
+    {
+        task=job->write_queue->pop();
+        do
+        {
+            if (task==NULL) done=true;
+            else if (task->filename.size()) file_vec.push_back(task);
+            else
+            {
+                write_queued(job,file_vec);
+                finish_input(job,task);
+            }
+        } while (!done && file_vec.size()<URING_BATCH &&
+            job->write_queue->try_pop(task));
+        write_queued(job,file_vec);
+    }
+}
+
+/* convert many input files with a pool of threads. return the number of
+ * failed inputs */
+int BeEM_batch(const vector<string> &infile_vec, int thread_num,
+    const int read_seqres, const int read_dbref, const int do_gzip,
+    const int do_upper, const long int maxatom, const int outfmt,
+    const string &idmap, const vector<string>&ccd3_vec,
+    const vector<string>&outputChain_vec, const size_t mem_limit=0,
+    const string &manifest="", const int use_uring=0)
+{
+    if (thread_num<=0) thread_num=thread::hardware_concurrency();
+    if (thread_num<=0) thread_num=1;
+
+    /* the writer is at most 64 output files behind */
+    BoundedQueue<WriteTask *> write_queue(64);
+    vector<ReadTask> task_vec(infile_vec.size());
+    vector<TaskDeque> deque_vec(thread_num);
+    BatchJob job;
+    job.infile_vec     =&infile_vec;
+    job.read_seqres    =read_seqres;
+    job.read_dbref     =read_dbref;
+    job.do_gzip        =do_gzip;
+    job.do_upper       =do_upper;
+    job.maxatom        =maxatom;
+    job.outfmt         =outfmt;
+    job.idmap          =idmap;
+    job.ccd3_vec       =&ccd3_vec;
+    job.outputChain_vec=&outputChain_vec;
+    job.thread_num     =thread_num;
+    job.task_vec       =&task_vec;
+    job.deque_vec      =&deque_vec;
+    job.taken          =0;
+    job.done           =0;
+    job.mem_limit      =mem_limit;
+    job.mem_running    =0;
+    job.mem_ahead      =0;
+    job.alone_num      =0;
+    job.write_queue    =&write_queue;
+    job.listing_vec.assign(infile_vec.size(),"");
+    job.status_vec.assign(infile_vec.size(),0);
+    job.failed_vec.assign(infile_vec.size(),false);
+    job.printed=0;
+    job.do_manifest=(manifest.size()>0);
+    job.ring.fd=-1;
+    if (use_uring && !uring_setup(job.ring,2*URING_BATCH)) cerr<<
+        "WARNING! io_uring is not available; write files synchronously"<<endl;
+
+    /* inputs with the same PDB ID, e.g., 1abc.cif and 1abc.cif.gz, would
+     * be converted at the same time into the same output files, so only
+     * the first of them is converted and the others fail */
+    size_t f;
+    map<string,size_t> id_map;
+    for (f=0;f<infile_vec.size();f++)
+    {
+        auto it=id_map.insert(make_pair(input_id(infile_vec[f]),f)).first;
+        if (it->second==f) continue;
+        cerr<<"ERROR! "<<infile_vec[f]<<" has the same PDB ID as "
+            <<infile_vec[it->second]<<"; skip it"<<endl;
+        job.status_vec[f]=-1;
+        job.done++;
+    }
+    map<string,size_t>().swap(id_map);
+
+    /* deal inputs largest first, each to the worker with the least load */
+    int t,w;
+    for (f=0;f<infile_vec.size();f++)
+    {
+        task_vec[f].disk_size=input_size(infile_vec[f]);
+        task_vec[f].size=text_size(infile_vec[f],task_vec[f].disk_size);
+        task_vec[f].memory=MEM_BASE+MEM_PER_BYTE*task_vec[f].size;
+        if (job.status_vec[f]==0) job.order_vec.push_back(f);
+    }
+    stable_sort(job.order_vec.begin(),job.order_vec.end(),
+        [&task_vec](const size_t a, const size_t b)
+        { return task_vec[a].size>task_vec[b].size; });
+    for (t=0;t<thread_num;t++) deque_vec[t].load=0;
+    for (size_t k=0;k<job.order_vec.size();k++)
+    {
+        f=job.order_vec[k];
+        for (w=t=0;t<thread_num;t++)
+            if (deque_vec[t].load<deque_vec[w].load) w=t;
+        deque_vec[w].input_deque.push_back(f);
+        deque_vec[w].load+=task_vec[f].size;
+    }
+
+    thread reader(BeEM_reader,&job);
+    thread writer(BeEM_writer,&job);
+    vector<thread> thread_vec;
+    for (t=1;t<thread_num;t++)
+        thread_vec.push_back(thread(BeEM_worker,&job,t));
+    BeEM_worker(&job,0);
+    for (t=0;t<thread_vec.size();t++) thread_vec[t].join();
+    reader.join();
+    write_queue.push(NULL);
+    writer.join();
+    uring_exit(job.ring);
+
+    int failNum=0;
+    for (f=0;f<infile_vec.size();f++) failNum+=(job.status_vec[f]<0);
+    if (failNum)
+    {
+        cerr<<"ERROR: "<<failNum<<" of "<<infile_vec.size()
+            <<" input files failed:"<<endl;
+        for (f=0;f<infile_vec.size();f++)
+            if (job.status_vec[f]<0) cerr<<infile_vec[f]<<endl;
+    }
+
+    /* a shard without its manifest cannot be merged, so it fails too */
+    if (job.do_manifest)
+    {
+        job.manifest_text="#input\tsize\tstatus\toutput\n"+job.manifest_text;
+        if (write_file(manifest,job.manifest_text)) cout<<manifest<<endl;
+        else if (failNum==0) failNum=1;
+    }
+
+    /* clean up */
+    vector<thread>().swap(thread_vec);
+    vector<string>().swap(job.listing_vec);
+    vector<int>().swap(job.status_vec);
+    string().swap(job.manifest_text);
+    return failNum;
+}
+
+/* batch mode END */
+
 int main(int argc,char **argv)
 {
     string infile ="";
     string pdbid  ="";
     string idmap  ="txt";
     string ccd5   ="map";
+    string listfile="";
     int read_seqres=0;
     int read_dbref =0;
     int do_gzip    =0;
     int do_upper   =1;
     long int maxatom=99999;
     int outfmt     =0;
+    int thread_num =0;
+    size_t mem_limit=0;
+    int shard      =0;
+    int shardNum   =0;
+    int use_uring  =0;
     int a,b;
     vector<string> outputChain_vec;
 
@@ -4908,12 +6158,30 @@ int main(int argc,char **argv)
             ccd5=((string)(argv[a])).substr(6);
         else if (StartsWith(argv[a],"-chain="))
             Split(((string)(argv[a])).substr(7),outputChain_vec,',');
+        else if (StartsWith(argv[a],"-list="))
+            listfile=((string)(argv[a])).substr(6);
+        else if (StartsWith(argv[a],"-thread="))
+            thread_num=atoi((((string)(argv[a])).substr(8)).c_str());
+        else if (StartsWith(argv[a],"-mem-limit="))
+            mem_limit=(size_t)atol((((string)(argv[a])).substr(11)).c_str())<<20;
+        else if (StartsWith(argv[a],"-shard="))
+        {
+            if (!parse_shard(((string)(argv[a])).substr(7),shard,shardNum))
+            {
+                cerr<<"ERROR: -shard=i/N requires 1<=i<=N"<<endl;
+                return 1;
+            }
+        }
+        else if (StartsWith(argv[a],"-uring="))
+            use_uring=atoi((((string)(argv[a])).substr(7)).c_str());
         else if ((string)(argv[a])=="-seqres")
             read_seqres=1;
         else if ((string)(argv[a])=="-dbref")
             read_dbref=1;
         else if ((string)(argv[a])=="-gzip")
             do_gzip=1;
+        else if ((string)(argv[a])=="-uring")
+            use_uring=1;
         else if ((string)(argv[a])=="-upper")
             do_upper=2;
         else if ((string)(argv[a])=="-maxatom")
@@ -4933,12 +6201,35 @@ int main(int argc,char **argv)
         }
     }
 
-    if (infile.size()==0)
+    if (infile.size()==0 && listfile.size()==0)
     {
         cerr<<docstring;
         return 1;
     }
 
+    vector<string> infile_vec;
+    bool batch=(listfile.size() || (infile!="-" && IsDir(infile)));
+    if (batch)
+    {
+        if (listfile.size()) read_batch_list(listfile,infile_vec);
+        if (infile.size())
+        {
+            if (IsDir(infile)) read_batch_dir(infile,infile_vec);
+            else infile_vec.push_back(infile);
+        }
+        if (pdbid.size())
+        {
+            cerr<<"ERROR: -p=xxxx cannot be used in batch mode"<<endl;
+            return 1;
+        }
+        if (shardNum) select_shard(infile_vec,shard,shardNum);
+    }
+    else if (shardNum)
+    {
+        cerr<<"ERROR: -shard=i/N can only be used in batch mode"<<endl;
+        return 1;
+    }
+
     vector<string> ccd3_vec; // 01 - 99, DRG, INH, LIG 
     if (ccd5=="map")
     {
@@ -4960,19 +6251,28 @@ int main(int argc,char **argv)
         ccd3_vec.push_back("LIG");
     }
 
-    if (outfmt==4)
+    int failNum=0;
+    if (batch)
+        failNum=BeEM_batch(infile_vec,thread_num,read_seqres,read_dbref,
+            do_gzip,do_upper,maxatom,outfmt,idmap,ccd3_vec,outputChain_vec,
+            mem_limit,shardNum?shard_manifest("BeEM",shard,shardNum):"",
+            use_uring);
+    else if (outfmt==4)
         cif2fasta(infile,pdbid,do_upper,do_gzip,outputChain_vec);
     else BeEM(infile,pdbid,read_seqres,read_dbref,do_gzip,do_upper,maxatom,
-        outfmt,idmap,ccd3_vec,outputChain_vec);
+        outfmt,idmap,ccd3_vec,outputChain_vec,cout,(thread_num>0)?thread_num:
+        thread::hardware_concurrency());
 
     /* clean up */
     string ().swap(infile);
+    string ().swap(listfile);
+    vector<string> ().swap(infile_vec);
     string ().swap(pdbid);
     string ().swap(idmap);
     string ().swap(ccd5);
     vector<string> ().swap(ccd3_vec);
     vector<string> ().swap(outputChain_vec);
-    return 0;
+    return (failNum>0);
 }
 
 /* main END */
@@ -11,9 +11,18 @@ const char* docstring=""
 "    -p=xxxx          PDB ID, default is the PDB ID read from the input\n"
 "    -gzip={0,1}      whether to perform gzip compression\n"
 "                     0 - (default) do not perform compression\n"
-"                     1 - perform compression if gzip is available\n"
+"                     1 - perform compression\n"
 "   -chain=A,B        comma seperated list of chains to output\n"
 "                     default is to output all chains\n"
+"    -list=list.txt   list of input files for batch mode, where the output\n"
+"                     of input xxxx.pdb is written to xxxx.cif\n"
+"    -shard=i/N       only convert shard i of N (1<=i<=N) of the inputs of\n"
+"                     batch mode. inputs are assigned to shards by a hash of\n"
+"                     the PDB ID in the filename, bounded so that shards\n"
+"                     hold about the same total file size. all nodes must\n"
+"                     list the same files of the same size. a manifest of\n"
+"                     the inputs and output files of the shard is written\n"
+"                     to cifte-shard-i-of-N.tsv\n"
 ;
 
 #include <vector>
@@ -27,6 +36,10 @@ const char* docstring=""
 #include <iomanip>
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <sys/stat.h>
 using namespace std;
 
 /* StringTools START */
@@ -58,7 +71,7 @@ string Join(const string sep, const vector<string>& string_vec,
  * line          - input string
  * line_vec      - output vector 
  * delimiter     - delimiter */
-void Split(const string &line, vector<string> &line_vec,const char delimiter=' ')
+void Split(const string_view line, vector<string> &line_vec,const char delimiter=' ')
 {
     bool within_word = false;
     bool within_quotation = false;
@@ -131,13 +144,15 @@ string rstrip(const string &inputString,const string &char_list=" \n\r\t")
     return result;
 }
 
-inline bool StartsWith(const string &longString, const string &shortString)
+inline bool StartsWith(const string_view longString,
+    const string_view shortString)
 {
     return (longString.size()>=shortString.size() &&
             longString.substr(0,shortString.size())==shortString);
 }
 
-inline bool EndsWith(const string &longString, const string &shortString)
+inline bool EndsWith(const string_view longString,
+    const string_view shortString)
 {
     return (longString.size()>=shortString.size() &&
             longString.substr(longString.size()-shortString.size(),
@@ -200,2201 +215,1050 @@ inline string formatString(const string &inputString,const int width=8,
 }
 
 /* StringTools END */
-/* pstream START */
+/* inflate START */
 
-// PStreams - POSIX Process I/O for C++
+/* gzip decompression (RFC 1951 and RFC 1952) without external gunzip */
 
-//        Copyright (C) 2001 - 2017 Jonathan Wakely
-// Distributed under the Boost Software License, Version 1.0.
-//    (See accompanying file LICENSE_1_0.txt or copy at
-//          http://www.boost.org/LICENSE_1_0.txt)
-//
-
-/* do not compile on windows, which does not have cygwin */
-#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__) && !defined(__CYGWIN__)
-#define NO_PSTREAM
-#else
-
-#ifndef REDI_PSTREAM_H_SEEN
-#define REDI_PSTREAM_H_SEEN
-
-#include <ios>
-#include <streambuf>
-#include <istream>
-#include <ostream>
-#include <string>
-#include <vector>
-#include <algorithm>    // for min()
-#include <cerrno>       // for errno
-#include <cstddef>      // for size_t, NULL
-#include <cstdlib>      // for exit()
-#include <sys/types.h>  // for pid_t
-#include <sys/wait.h>   // for waitpid()
-#include <sys/ioctl.h>  // for ioctl() and FIONREAD
-#if defined(__sun)
-# include <sys/filio.h> // for FIONREAD on Solaris 2.5
-#endif
-#include <unistd.h>     // for pipe() fork() exec() and filedes functions
-#include <signal.h>     // for kill()
-#include <fcntl.h>      // for fcntl()
-#if REDI_EVISCERATE_PSTREAMS
-# include <stdio.h>     // for FILE, fdopen()
-#endif
-
-
-/// The library version.
-#define PSTREAMS_VERSION 0x0101   // 1.0.1
-
-/**
- *  @namespace redi
- *  @brief  All PStreams classes are declared in namespace redi.
- *
- *  Like the standard iostreams, PStreams is a set of class templates,
- *  taking a character type and traits type. As with the standard streams
- *  they are most likely to be used with @c char and the default
- *  traits type, so typedefs for this most common case are provided.
- *
- *  The @c pstream_common class template is not intended to be used directly,
- *  it is used internally to provide the common functionality for the
- *  other stream classes.
- */
-namespace redi
+struct CRC32Table
 {
-  /// Common base class providing constants and typenames.
-  struct pstreams
-  {
-    /// Type used to specify how to connect to the process.
-    typedef std::ios_base::openmode           pmode;
-
-    /// Type used to hold the arguments for a command.
-    typedef std::vector<std::string>          argv_type;
-
-    /// Type used for file descriptors.
-    typedef int                               fd_type;
-
-    static const pmode pstdin  = std::ios_base::out; ///< Write to stdin
-    static const pmode pstdout = std::ios_base::in;  ///< Read from stdout
-    static const pmode pstderr = std::ios_base::app; ///< Read from stderr
-
-    /// Create a new process group for the child process.
-    static const pmode newpg   = std::ios_base::trunc;
-
-  protected:
-    enum { bufsz = 32 };  ///< Size of pstreambuf buffers.
-    enum { pbsz  = 2 };   ///< Number of putback characters kept.
-  };
-
-  /// Class template for stream buffer.
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_pstreambuf
-    : public std::basic_streambuf<CharT, Traits>
-    , public pstreams
-    {
-    public:
-      // Type definitions for dependent types
-      typedef CharT                             char_type;
-      typedef Traits                            traits_type;
-      typedef typename traits_type::int_type    int_type;
-      typedef typename traits_type::off_type    off_type;
-      typedef typename traits_type::pos_type    pos_type;
-      /** @deprecated use pstreams::fd_type instead. */
-      typedef fd_type                           fd_t;
-
-      /// Default constructor.
-      basic_pstreambuf();
-
-      /// Constructor that initialises the buffer with @a cmd.
-      basic_pstreambuf(const std::string& cmd, pmode mode);
-
-      /// Constructor that initialises the buffer with @a file and @a argv.
-      basic_pstreambuf( const std::string& file,
-                        const argv_type& argv,
-                        pmode mode );
-
-      /// Destructor.
-      ~basic_pstreambuf();
-
-      /// Initialise the stream buffer with @a cmd.
-      basic_pstreambuf*
-      open(const std::string& cmd, pmode mode);
-
-      /// Initialise the stream buffer with @a file and @a argv.
-      basic_pstreambuf*
-      open(const std::string& file, const argv_type& argv, pmode mode);
-
-      /// Close the stream buffer and wait for the process to exit.
-      basic_pstreambuf*
-      close();
-
-      /// Send a signal to the process.
-      basic_pstreambuf*
-      kill(int signal = SIGTERM);
-
-      /// Send a signal to the process' process group.
-      basic_pstreambuf*
-      killpg(int signal = SIGTERM);
-
-      /// Close the pipe connected to the process' stdin.
-      void
-      peof();
-
-      /// Change active input source.
-      bool
-      read_err(bool readerr = true);
-
-      /// Report whether the stream buffer has been initialised.
-      bool
-      is_open() const;
-
-      /// Report whether the process has exited.
-      bool
-      exited();
-
-#if REDI_EVISCERATE_PSTREAMS
-      /// Obtain FILE pointers for each of the process' standard streams.
-      std::size_t
-      fopen(FILE*& in, FILE*& out, FILE*& err);
-#endif
-
-      /// Return the exit status of the process.
-      int
-      status() const;
-
-      /// Return the error number (errno) for the most recent failed operation.
-      int
-      error() const;
-
-    protected:
-      /// Transfer characters to the pipe when character buffer overflows.
-      int_type
-      overflow(int_type c);
-
-      /// Transfer characters from the pipe when the character buffer is empty.
-      int_type
-      underflow();
-
-      /// Make a character available to be returned by the next extraction.
-      int_type
-      pbackfail(int_type c = traits_type::eof());
-
-      /// Write any buffered characters to the stream.
-      int
-      sync();
-
-      /// Insert multiple characters into the pipe.
-      std::streamsize
-      xsputn(const char_type* s, std::streamsize n);
-
-      /// Insert a sequence of characters into the pipe.
-      std::streamsize
-      write(const char_type* s, std::streamsize n);
-
-      /// Extract a sequence of characters from the pipe.
-      std::streamsize
-      read(char_type* s, std::streamsize n);
-
-      /// Report how many characters can be read from active input without blocking.
-      std::streamsize
-      showmanyc();
-
-    protected:
-      /// Enumerated type to indicate whether stdout or stderr is to be read.
-      enum buf_read_src { rsrc_out = 0, rsrc_err = 1 };
-
-      /// Initialise pipes and fork process.
-      pid_t
-      fork(pmode mode);
-
-      /// Wait for the child process to exit.
-      int
-      wait(bool nohang = false);
-
-      /// Return the file descriptor for the output pipe.
-      fd_type&
-      wpipe();
-
-      /// Return the file descriptor for the active input pipe.
-      fd_type&
-      rpipe();
-
-      /// Return the file descriptor for the specified input pipe.
-      fd_type&
-      rpipe(buf_read_src which);
-
-      void
-      create_buffers(pmode mode);
-
-      void
-      destroy_buffers(pmode mode);
-
-      /// Writes buffered characters to the process' stdin pipe.
-      bool
-      empty_buffer();
-
-      bool
-      fill_buffer(bool non_blocking = false);
-
-      /// Return the active input buffer.
-      char_type*
-      rbuffer();
-
-      buf_read_src
-      switch_read_buffer(buf_read_src);
-
-    private:
-      basic_pstreambuf(const basic_pstreambuf&);
-      basic_pstreambuf& operator=(const basic_pstreambuf&);
-
-      void
-      init_rbuffers();
-
-      pid_t         ppid_;        // pid of process
-      fd_type       wpipe_;       // pipe used to write to process' stdin
-      fd_type       rpipe_[2];    // two pipes to read from, stdout and stderr
-      char_type*    wbuffer_;
-      char_type*    rbuffer_[2];
-      char_type*    rbufstate_[3];
-      /// Index into rpipe_[] to indicate active source for read operations.
-      buf_read_src  rsrc_;
-      int           status_;      // hold exit status of child process
-      int           error_;       // hold errno if fork() or exec() fails
-    };
-
-  /// Class template for common base class.
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class pstream_common
-    : virtual public std::basic_ios<CharT, Traits>
-    , virtual public pstreams
-    {
-    protected:
-      typedef basic_pstreambuf<CharT, Traits>       streambuf_type;
-
-      typedef pstreams::pmode                       pmode;
-      typedef pstreams::argv_type                   argv_type;
-
-      /// Default constructor.
-      pstream_common();
-
-      /// Constructor that initialises the stream by starting a process.
-      pstream_common(const std::string& cmd, pmode mode);
-
-      /// Constructor that initialises the stream by starting a process.
-      pstream_common(const std::string& file, const argv_type& argv, pmode mode);
-
-      /// Pure virtual destructor.
-      virtual
-      ~pstream_common() = 0;
-
-      /// Start a process.
-      void
-      do_open(const std::string& cmd, pmode mode);
-
-      /// Start a process.
-      void
-      do_open(const std::string& file, const argv_type& argv, pmode mode);
-
-    public:
-      /// Close the pipe.
-      void
-      close();
-
-      /// Report whether the stream's buffer has been initialised.
-      bool
-      is_open() const;
-
-      /// Return the command used to initialise the stream.
-      const std::string&
-      command() const;
-
-      /// Return a pointer to the stream buffer.
-      streambuf_type*
-      rdbuf() const;
-
-#if REDI_EVISCERATE_PSTREAMS
-      /// Obtain FILE pointers for each of the process' standard streams.
-      std::size_t
-      fopen(FILE*& in, FILE*& out, FILE*& err);
-#endif
-
-    protected:
-      std::string       command_; ///< The command used to start the process.
-      streambuf_type    buf_;     ///< The stream buffer.
-    };
-
-
-  /**
-   * @class basic_ipstream
-   * @brief Class template for Input PStreams.
-   *
-   * Reading from an ipstream reads the command's standard output and/or
-   * standard error (depending on how the ipstream is opened)
-   * and the command's standard input is the same as that of the process
-   * that created the object, unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_ipstream
-    : public std::basic_istream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_istream<CharT, Traits>     istream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-      // Ensure a basic_ipstream will read from at least one pipe
-      pmode readable(pmode mode)
-      {
-        if (!(mode & (pstdout|pstderr)))
-          mode |= pstdout;
-        return mode;
-      }
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_ipstream()
-      : istream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_ipstream(const std::string& cmd, pmode mode = pstdout)
-      : istream_type(NULL), pbase_type(cmd, readable(mode))
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_ipstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdout )
-      : istream_type(NULL), pbase_type(file, argv, readable(mode))
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode|pstdout)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_ipstream(const argv_type& argv, pmode mode = pstdout)
-      : istream_type(NULL), pbase_type(argv.at(0), argv, readable(mode))
-      { }
-
-#if __cplusplus >= 201103L
-      template<typename T>
-        explicit
-        basic_ipstream(std::initializer_list<T> args, pmode mode = pstdout)
-        : basic_ipstream(argv_type(args.begin(), args.end()), mode)
-        { }
-#endif
-
-      /**
-       * @brief Destructor.
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_ipstream()
-      { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode|pstdout ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout)
-      {
-        this->do_open(cmd, readable(mode));
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode|pstdout ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout )
-      {
-        this->do_open(file, argv, readable(mode));
-      }
-
-      /**
-       * @brief Set streambuf to read from process' @c stdout.
-       * @return  @c *this
-       */
-      basic_ipstream&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
-
-    };
-
-
-  /**
-   * @class basic_opstream
-   * @brief Class template for Output PStreams.
-   *
-   * Writing to an open opstream writes to the standard input of the command;
-   * the command's standard output is the same as that of the process that
-   * created the pstream object, unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_opstream
-    : public std::basic_ostream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_ostream<CharT, Traits>     ostream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_opstream()
-      : ostream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_opstream(const std::string& cmd, pmode mode = pstdin)
-      : ostream_type(NULL), pbase_type(cmd, mode|pstdin)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_opstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdin )
-      : ostream_type(NULL), pbase_type(file, argv, mode|pstdin)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode|pstdin)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_opstream(const argv_type& argv, pmode mode = pstdin)
-      : ostream_type(NULL), pbase_type(argv.at(0), argv, mode|pstdin)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param args  a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_opstream(std::initializer_list<T> args, pmode mode = pstdin)
-        : basic_opstream(argv_type(args.begin(), args.end()), mode)
-        { }
-#endif
-
-      /**
-       * @brief Destructor
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_opstream() { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode|pstdin ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdin)
-      {
-        this->do_open(cmd, mode|pstdin);
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode|pstdin ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdin)
-      {
-        this->do_open(file, argv, mode|pstdin);
-      }
-    };
-
-
-  /**
-   * @class basic_pstream
-   * @brief Class template for Bidirectional PStreams.
-   *
-   * Writing to a pstream opened with @c pmode @c pstdin writes to the
-   * standard input of the command.
-   * Reading from a pstream opened with @c pmode @c pstdout and/or @c pstderr
-   * reads the command's standard output and/or standard error.
-   * Any of the process' @c stdin, @c stdout or @c stderr that is not
-   * connected to the pstream (as specified by the @c pmode)
-   * will be the same as the process that created the pstream object,
-   * unless altered by the command itself.
-   */
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_pstream
-    : public std::basic_iostream<CharT, Traits>
-    , public pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_iostream<CharT, Traits>    iostream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_pstream()
-      : iostream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_pstream(const std::string& cmd, pmode mode = pstdout|pstdin)
-      : iostream_type(NULL), pbase_type(cmd, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_pstream( const std::string& file,
-                     const argv_type& argv,
-                     pmode mode = pstdout|pstdin )
-      : iostream_type(NULL), pbase_type(file, argv, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_pstream(const argv_type& argv, pmode mode = pstdout|pstdin)
-      : iostream_type(NULL), pbase_type(argv.at(0), argv, mode)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param l     a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_pstream(std::initializer_list<T> l, pmode mode = pstdout|pstdin)
-        : basic_pstream(argv_type(l.begin(), l.end()), mode)
-        { }
-#endif
-
-      /**
-       * @brief Destructor
-       *
-       * Closes the stream and waits for the child to exit.
-       */
-      ~basic_pstream() { }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a cnd , @a mode ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout|pstdin)
-      {
-        this->do_open(cmd, mode);
-      }
-
-      /**
-       * @brief Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode ).
-       *
-       * @param file  a string containing the pathname of a program to execute.
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout|pstdin )
-      {
-        this->do_open(file, argv, mode);
-      }
-
-      /**
-       * @brief Set streambuf to read from process' @c stdout.
-       * @return  @c *this
-       */
-      basic_pstream&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
-    };
-
-
-  /**
-   * @class basic_rpstream
-   * @brief Class template for Restricted PStreams.
-   *
-   * Writing to an rpstream opened with @c pmode @c pstdin writes to the
-   * standard input of the command.
-   * It is not possible to read directly from an rpstream object, to use
-   * an rpstream as in istream you must call either basic_rpstream::out()
-   * or basic_rpstream::err(). This is to prevent accidental reads from
-   * the wrong input source. If the rpstream was not opened with @c pmode
-   * @c pstderr then the class cannot read the process' @c stderr, and
-   * basic_rpstream::err() will return an istream that reads from the
-   * process' @c stdout, and vice versa.
-   * Reading from an rpstream opened with @c pmode @c pstdout and/or
-   * @c pstderr reads the command's standard output and/or standard error.
-   * Any of the process' @c stdin, @c stdout or @c stderr that is not
-   * connected to the pstream (as specified by the @c pmode)
-   * will be the same as the process that created the pstream object,
-   * unless altered by the command itself.
-   */
-
-  template <typename CharT, typename Traits = std::char_traits<CharT> >
-    class basic_rpstream
-    : public std::basic_ostream<CharT, Traits>
-    , private std::basic_istream<CharT, Traits>
-    , private pstream_common<CharT, Traits>
-    , virtual public pstreams
-    {
-      typedef std::basic_ostream<CharT, Traits>     ostream_type;
-      typedef std::basic_istream<CharT, Traits>     istream_type;
-      typedef pstream_common<CharT, Traits>         pbase_type;
-
-      using pbase_type::buf_;  // declare name in this scope
-
-    public:
-      /// Type used to specify how to connect to the process.
-      typedef typename pbase_type::pmode            pmode;
-
-      /// Type used to hold the arguments for a command.
-      typedef typename pbase_type::argv_type        argv_type;
-
-      /// Default constructor, creates an uninitialised stream.
-      basic_rpstream()
-      : ostream_type(NULL), istream_type(NULL), pbase_type()
-      { }
-
-      /**
-       * @brief  Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      explicit
-      basic_rpstream(const std::string& cmd, pmode mode = pstdout|pstdin)
-      : ostream_type(NULL) , istream_type(NULL) , pbase_type(cmd, mode)
-      { }
-
-      /**
-       * @brief  Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling do_open() with the supplied
-       * arguments.
-       *
-       * @param file a string containing the pathname of a program to execute.
-       * @param argv a vector of argument strings passed to the new program.
-       * @param mode the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      basic_rpstream( const std::string& file,
-                      const argv_type& argv,
-                      pmode mode = pstdout|pstdin )
-      : ostream_type(NULL), istream_type(NULL), pbase_type(file, argv, mode)
-      { }
-
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * Initialises the stream buffer by calling
-       * @c do_open(argv[0],argv,mode)
-       *
-       * @param argv  a vector of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      explicit
-      basic_rpstream(const argv_type& argv, pmode mode = pstdout|pstdin)
-      : ostream_type(NULL), istream_type(NULL),
-        pbase_type(argv.at(0), argv, mode)
-      { }
-
-#if __cplusplus >= 201103L
-      /**
-       * @brief Constructor that initialises the stream by starting a process.
-       *
-       * @param l     a list of argument strings passed to the new program.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      template<typename T>
-        explicit
-        basic_rpstream(std::initializer_list<T> l, pmode mode = pstdout|pstdin)
-        : basic_rpstream(argv_type(l.begin(), l.end()), mode)
-        { }
-#endif
+    unsigned int t[4][256];
+    CRC32Table()
+    {
+        unsigned int c;
+        int n,k;
+        for (n=0;n<256;n++)
+        {
+            c=n;
+            for (k=0;k<8;k++) c=(c&1)?(0xedb88320U^(c>>1)):(c>>1);
+            t[0][n]=c;
+        }
+        for (n=0;n<256;n++) for (k=1;k<4;k++)
+            t[k][n]=(t[k-1][n]>>8)^t[0][t[k-1][n]&0xff];
+    }
+};
 
-      /// Destructor
-      ~basic_rpstream() { }
-
-      /**
-       * @brief  Start a process.
-       *
-       * Calls do_open( @a cmd , @a mode ).
-       *
-       * @param cmd   a string containing a shell command.
-       * @param mode  the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, pmode)
-       */
-      void
-      open(const std::string& cmd, pmode mode = pstdout|pstdin)
-      {
-        this->do_open(cmd, mode);
-      }
-
-      /**
-       * @brief  Start a process.
-       *
-       * Calls do_open( @a file , @a argv , @a mode ).
-       *
-       * @param file a string containing the pathname of a program to execute.
-       * @param argv a vector of argument strings passed to the new program.
-       * @param mode the I/O mode to use when opening the pipe.
-       * @see   do_open(const std::string&, const argv_type&, pmode)
-       */
-      void
-      open( const std::string& file,
-            const argv_type& argv,
-            pmode mode = pstdout|pstdin )
-      {
-        this->do_open(file, argv, mode);
-      }
-
-      /**
-       * @brief  Obtain a reference to the istream that reads
-       *         the process' @c stdout.
-       * @return @c *this
-       */
-      istream_type&
-      out()
-      {
-        this->buf_.read_err(false);
-        return *this;
-      }
-    };
-
-
-  /// Type definition for common template specialisation.
-  typedef basic_pstreambuf<char> pstreambuf;
-  /// Type definition for common template specialisation.
-  typedef basic_ipstream<char> ipstream;
-  /// Type definition for common template specialisation.
-  typedef basic_opstream<char> opstream;
-  /// Type definition for common template specialisation.
-  typedef basic_pstream<char> pstream;
-  /// Type definition for common template specialisation.
-  typedef basic_rpstream<char> rpstream;
-
-
-  /**
-   * When inserted into an output pstream the manipulator calls
-   * basic_pstreambuf<C,T>::peof() to close the output pipe,
-   * causing the child process to receive the end-of-file indicator
-   * on subsequent reads from its @c stdin stream.
-   *
-   * @brief   Manipulator to close the pipe connected to the process' stdin.
-   * @param   s  An output PStream class.
-   * @return  The stream object the manipulator was invoked on.
-   * @see     basic_pstreambuf<C,T>::peof()
-   * @relates basic_opstream basic_pstream basic_rpstream
-   */
-  template <typename C, typename T>
-    inline std::basic_ostream<C,T>&
-    peof(std::basic_ostream<C,T>& s)
-    {
-      typedef basic_pstreambuf<C,T> pstreambuf_type;
-      if (pstreambuf_type* p = dynamic_cast<pstreambuf_type*>(s.rdbuf()))
-        p->peof();
-      return s;
+unsigned int crc32_update(unsigned int crc, const unsigned char *buf,
+    size_t len)
+{
+    static const CRC32Table table;
+    const unsigned int (*t)[256]=table.t;
+    crc=~crc;
+    while (len>=4)
+    {
+        crc^=buf[0]|(buf[1]<<8)|(buf[2]<<16)|((unsigned int)buf[3]<<24);
+        crc=t[3][crc&0xff]^t[2][(crc>>8)&0xff]^
+            t[1][(crc>>16)&0xff]^t[0][crc>>24];
+        buf+=4;
+        len-=4;
     }
+    while (len--) crc=t[0][(crc^*buf++)&0xff]^(crc>>8);
+    return ~crc;
+}
 
+const int INFLATE_FAST_BITS=10;
 
-  /*
-   * member definitions for pstreambuf
-   */
+/* canonical Huffman code. codes up to INFLATE_FAST_BITS long are decoded
+ * by a single lookup of (length<<9|symbol); longer codes are decoded bit
+ * by bit from count[] and symbol[] */
+struct InflateHuffman
+{
+    unsigned short fast[1<<INFLATE_FAST_BITS];
+    unsigned short count[16];
+    unsigned short symbol[288];
+};
 
+struct InflateState
+{
+    const unsigned char *in;
+    size_t inpos;
+    size_t insize;
+    unsigned long long bitbuf;
+    int bitcnt;
+    size_t pad;     // number of zero bytes fed after the end of input
+    string *out;
+    size_t outpos;
+};
+
+bool inflate_build(InflateHuffman &h, const unsigned char *length, int n)
+{
+    int len,sym,i;
+    unsigned short offs[16];
+    unsigned int next_code[16];
+    unsigned int code,r;
+    int left=1;
+
+    memset(h.count,0,sizeof(h.count));
+    for (sym=0;sym<n;sym++) h.count[length[sym]]++;
+    h.count[0]=0;
+    for (len=1;len<16;len++)
+    {
+        left<<=1;
+        left-=h.count[len];
+        if (left<0) return false; // over-subscribed
+    }
 
-  /**
-   * @class basic_pstreambuf
-   * Provides underlying streambuf functionality for the PStreams classes.
-   */
+    offs[1]=0;
+    for (len=1;len<15;len++) offs[len+1]=offs[len]+h.count[len];
+    for (sym=0;sym<n;sym++)
+        if (length[sym]) h.symbol[offs[length[sym]]++]=sym;
 
-  /** Creates an uninitialised stream buffer. */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf()
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
+    memset(h.fast,0,sizeof(h.fast));
+    code=0;
+    next_code[0]=0;
+    for (len=1;len<16;len++)
     {
-      init_rbuffers();
+        code=(code+h.count[len-1])<<1;
+        next_code[len]=code;
     }
-
-  /**
-   * Initialises the stream buffer by calling open() with the supplied
-   * arguments.
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   open()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf(const std::string& cmd, pmode mode)
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
-    {
-      init_rbuffers();
-      open(cmd, mode);
+    for (sym=0;sym<n;sym++)
+    {
+        len=length[sym];
+        if (len==0) continue;
+        code=next_code[len]++;
+        if (len>INFLATE_FAST_BITS) continue;
+        for (r=0,i=0;i<len;i++) r=(r<<1)|((code>>i)&1);
+        for (;r<(1U<<INFLATE_FAST_BITS);r+=(1U<<len))
+            h.fast[r]=(len<<9)|sym;
     }
+    return true;
+}
 
-  /**
-   * Initialises the stream buffer by calling open() with the supplied
-   * arguments.
-   *
-   * @param file  a string containing the name of a program to execute.
-   * @param argv  a vector of argument strings passsed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   open()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::basic_pstreambuf( const std::string& file,
-                                             const argv_type& argv,
-                                             pmode mode )
-    : ppid_(-1)   // initialise to -1 to indicate no process run yet.
-    , wpipe_(-1)
-    , wbuffer_(NULL)
-    , rsrc_(rsrc_out)
-    , status_(-1)
-    , error_(0)
-    {
-      init_rbuffers();
-      open(file, argv, mode);
+inline void inflate_refill(InflateState &s)
+{
+    while (s.bitcnt<=56)
+    {
+        if (s.inpos<s.insize)
+            s.bitbuf|=(unsigned long long)s.in[s.inpos++]<<s.bitcnt;
+        else s.pad++;
+        s.bitcnt+=8;
     }
+}
+
+inline unsigned int inflate_bits(InflateState &s, int need)
+{
+    if (s.bitcnt<need) inflate_refill(s);
+    unsigned int val=s.bitbuf&((1ULL<<need)-1);
+    s.bitbuf>>=need;
+    s.bitcnt-=need;
+    return val;
+}
 
-  /**
-   * Closes the stream by calling close().
-   * @see close()
-   */
-  template <typename C, typename T>
-    inline
-    basic_pstreambuf<C,T>::~basic_pstreambuf()
+/* decode one symbol. return -1 for invalid code */
+inline int inflate_decode(InflateState &s, const InflateHuffman &h)
+{
+    if (s.bitcnt<15) inflate_refill(s);
+    unsigned short entry=h.fast[s.bitbuf&((1<<INFLATE_FAST_BITS)-1)];
+    if (entry)
     {
-      close();
+        s.bitbuf>>=(entry>>9);
+        s.bitcnt-=(entry>>9);
+        return entry&511;
     }
-
-  /**
-   * Starts a new process by passing @a command to the shell (/bin/sh)
-   * and opens pipes to the process with the specified @a mode.
-   *
-   * If @a mode contains @c pstdout the initial read source will be
-   * the child process' stdout, otherwise if @a mode  contains @c pstderr
-   * the initial read source will be the child's stderr.
-   *
-   * Will duplicate the actions of  the  shell  in searching for an
-   * executable file if the specified file name does not contain a slash (/)
-   * character.
-   *
-   * @warning
-   * There is no way to tell whether the shell command succeeded, this
-   * function will always succeed unless resource limits (such as
-   * memory usage, or number of processes or open files) are exceeded.
-   * This means is_open() will return true even if @a command cannot
-   * be executed.
-   * Use pstreambuf::open(const std::string&, const argv_type&, pmode)
-   * if you need to know whether the command failed to execute.
-   *
-   * @param   command  a string containing a shell command.
-   * @param   mode     a bitwise OR of one or more of @c out, @c in, @c err.
-   * @return  NULL if the shell could not be started or the
-   *          pipes could not be opened, @c this otherwise.
-   * @see     <b>execl</b>(3)
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::open(const std::string& command, pmode mode)
-    {
-      const char * shell_path = "/bin/sh";
-#if 0
-      const std::string argv[] = { "sh", "-c", command };
-      return this->open(shell_path, argv_type(argv, argv+3), mode);
-#else
-      basic_pstreambuf<C,T>* ret = NULL;
-
-      if (!is_open())
-      {
-        switch(fork(mode))
+    int code=0,first=0,index=0,count,len;
+    for (len=1;len<16;len++)
+    {
+        code|=(s.bitbuf>>(len-1))&1;
+        count=h.count[len];
+        if (code-count<first)
         {
-        case 0 :
-          // this is the new process, exec command
-          ::execl(shell_path, "sh", "-c", command.c_str(), (char*)NULL);
-
-          // can only reach this point if exec() failed
+            s.bitbuf>>=len;
+            s.bitcnt-=len;
+            return h.symbol[index+(code-first)];
+        }
+        index+=count;
+        first+=count;
+        first<<=1;
+        code<<=1;
+    }
+    return -1;
+}
 
-          // parent can get exit code from waitpid()
-          ::_exit(errno);
-          // using std::exit() would make static dtors run twice
+/* discard bits up to the next byte boundary and return unused whole bytes
+ * in bitbuf to the input. return false if more bits were consumed than
+ * available in the input */
+bool inflate_align(InflateState &s)
+{
+    s.bitbuf>>=(s.bitcnt&7);
+    s.bitcnt-=(s.bitcnt&7);
+    size_t bytes=s.bitcnt/8;
+    if (bytes<s.pad) return false;
+    s.inpos-=bytes-s.pad;
+    s.bitbuf=0;
+    s.bitcnt=0;
+    s.pad=0;
+    return true;
+}
 
-        case -1 :
-          // couldn't fork, error already handled in pstreambuf::fork()
-          break;
+inline void inflate_reserve(InflateState &s, size_t need)
+{
+    if (s.outpos+need<=s.out->size()) return;
+    size_t newsize=s.out->size()*2;
+    if (newsize<s.outpos+need) newsize=s.outpos+need+65536;
+    s.out->resize(newsize);
+}
 
-        default :
-          // this is the parent process
-          // activate buffers
-          create_buffers(mode);
-          ret = this;
+bool inflate_codes(InflateState &s, const InflateHuffman &lencode,
+    const InflateHuffman &distcode)
+{
+    static const unsigned short len_base[29]={3,4,5,6,7,8,9,10,11,13,15,
+        17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+    static const unsigned char len_extra[29]={0,0,0,0,0,0,0,0,1,1,1,1,2,2,
+        2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+    static const unsigned short dist_base[30]={1,2,3,4,5,7,9,13,17,25,33,
+        49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,
+        8193,12289,16385,24577};
+    static const unsigned char dist_extra[30]={0,0,0,0,1,1,2,2,3,3,4,4,5,5,
+        6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+    int sym;
+    size_t len,dist;
+    char *p;
+    while (true)
+    {
+        sym=inflate_decode(s,lencode);
+        if (sym<0 || s.pad*8>s.bitcnt) return false; // truncated input
+        if (sym<256)
+        {
+            inflate_reserve(s,1);
+            (*s.out)[s.outpos++]=sym;
+            continue;
         }
-      }
-      return ret;
-#endif
+        if (sym==256) return s.pad<=s.bitcnt/8;
+        sym-=257;
+        if (sym>=29) return false;
+        len=len_base[sym]+inflate_bits(s,len_extra[sym]);
+        sym=inflate_decode(s,distcode);
+        if (sym<0 || sym>=30) return false;
+        dist=dist_base[sym]+inflate_bits(s,dist_extra[sym]);
+        if (dist>s.outpos) return false;
+        inflate_reserve(s,len);
+        p=&(*s.out)[s.outpos];
+        s.outpos+=len;
+        if (dist>=len) memcpy(p,p-dist,len);
+        else for (;len;len--,p++) *p=*(p-dist);
     }
+    return true;
+}
 
-  /**
-   * @brief  Helper function to close a file descriptor.
-   *
-   * Inspects @a fd and calls <b>close</b>(3) if it has a non-negative value.
-   *
-   * @param   fd  a file descriptor.
-   * @relates basic_pstreambuf
-   */
-  inline void
-  close_fd(pstreams::fd_type& fd)
-  {
-    if (fd >= 0 && ::close(fd) == 0)
-      fd = -1;
-  }
-
-  /**
-   * @brief  Helper function to close an array of file descriptors.
-   *
-   * Calls @c close_fd() on each member of the array.
-   * The length of the array is determined automatically by
-   * template argument deduction to avoid errors.
-   *
-   * @param   fds  an array of file descriptors.
-   * @relates basic_pstreambuf
-   */
-  template <int N>
-    inline void
-    close_fd_array(pstreams::fd_type (&fds)[N])
-    {
-      for (std::size_t i = 0; i < N; ++i)
-        close_fd(fds[i]);
+/* fixed Huffman codes of block type 1 */
+struct InflateFixed
+{
+    InflateHuffman lencode;
+    InflateHuffman distcode;
+    InflateFixed()
+    {
+        unsigned char length[288];
+        int sym;
+        for (sym=0;sym<144;sym++) length[sym]=8;
+        for (;sym<256;sym++)      length[sym]=9;
+        for (;sym<280;sym++)      length[sym]=7;
+        for (;sym<288;sym++)      length[sym]=8;
+        inflate_build(lencode,length,288);
+        for (sym=0;sym<30;sym++)  length[sym]=5;
+        inflate_build(distcode,length,30);
     }
+};
 
-  /**
-   * Starts a new process by executing @a file with the arguments in
-   * @a argv and opens pipes to the process with the specified @a mode.
-   *
-   * By convention @c argv[0] should be the file name of the file being
-   * executed.
-   *
-   * If @a mode contains @c pstdout the initial read source will be
-   * the child process' stdout, otherwise if @a mode  contains @c pstderr
-   * the initial read source will be the child's stderr.
-   *
-   * Will duplicate the actions of  the  shell  in searching for an
-   * executable file if the specified file name does not contain a slash (/)
-   * character.
-   *
-   * Iff @a file is successfully executed then is_open() will return true.
-   * Otherwise, pstreambuf::error() can be used to obtain the value of
-   * @c errno that was set by <b>execvp</b>(3) in the child process.
-   *
-   * The exit status of the new process will be returned by
-   * pstreambuf::status() after pstreambuf::exited() returns true.
-   *
-   * @param   file  a string containing the pathname of a program to execute.
-   * @param   argv  a vector of argument strings passed to the new program.
-   * @param   mode  a bitwise OR of one or more of @c out, @c in and @c err.
-   * @return  NULL if a pipe could not be opened or if the program could
-   *          not be executed, @c this otherwise.
-   * @see     <b>execvp</b>(3)
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::open( const std::string& file,
-                                 const argv_type& argv,
-                                 pmode mode )
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-
-      if (!is_open())
-      {
-        // constants for read/write ends of pipe
-        enum { RD, WR };
-
-        // open another pipe and set close-on-exec
-        fd_type ck_exec[] = { -1, -1 };
-        if (-1 == ::pipe(ck_exec)
-            || -1 == ::fcntl(ck_exec[RD], F_SETFD, FD_CLOEXEC)
-            || -1 == ::fcntl(ck_exec[WR], F_SETFD, FD_CLOEXEC))
+/* decompress one raw deflate stream starting at s.inpos */
+bool inflate_raw(InflateState &s)
+{
+    static const unsigned char order[19]={16,17,18,0,8,7,9,6,10,5,11,4,
+        12,3,13,2,14,1,15};
+    InflateHuffman lencode;
+    InflateHuffman distcode;
+    unsigned char length[320];
+    int last,type,nlen,ndist,ncode,index,sym,i;
+    unsigned int len;
+
+    s.bitbuf=0;
+    s.bitcnt=0;
+    s.pad=0;
+    do
+    {
+        last=inflate_bits(s,1);
+        type=inflate_bits(s,2);
+        if (type==0) // stored block
         {
-          error_ = errno;
-          close_fd_array(ck_exec);
+            if (!inflate_align(s) || s.inpos+4>s.insize) return false;
+            len=s.in[s.inpos]|(s.in[s.inpos+1]<<8);
+            if ((s.in[s.inpos+2]|(s.in[s.inpos+3]<<8))!=(~len&0xffff))
+                return false;
+            s.inpos+=4;
+            if (s.inpos+len>s.insize) return false;
+            inflate_reserve(s,len);
+            memcpy(&(*s.out)[s.outpos],s.in+s.inpos,len);
+            s.outpos+=len;
+            s.inpos+=len;
         }
-        else
+        else if (type==1) // fixed Huffman codes
+        {
+            static const InflateFixed fixed;
+            if (!inflate_codes(s,fixed.lencode,fixed.distcode)) return false;
+        }
+        else if (type==2) // dynamic Huffman codes
         {
-          switch(fork(mode))
-          {
-          case 0 :
-            // this is the new process, exec command
+            nlen =inflate_bits(s,5)+257;
+            ndist=inflate_bits(s,5)+1;
+            ncode=inflate_bits(s,4)+4;
+            if (nlen>286 || ndist>30) return false;
+            for (index=0;index<ncode;index++)
+                length[order[index]]=inflate_bits(s,3);
+            for (;index<19;index++) length[order[index]]=0;
+            if (!inflate_build(lencode,length,19)) return false;
+
+            index=0;
+            while (index<nlen+ndist)
             {
-              char** arg_v = new char*[argv.size()+1];
-              for (std::size_t i = 0; i < argv.size(); ++i)
-              {
-                const std::string& src = argv[i];
-                char*& dest = arg_v[i];
-                dest = new char[src.size()+1];
-                dest[ src.copy(dest, src.size()) ] = '\0';
-              }
-              arg_v[argv.size()] = NULL;
+                sym=inflate_decode(s,lencode);
+                if (sym<0) return false;
+                if (sym<16) length[index++]=sym;
+                else
+                {
+                    len=0;
+                    if (sym==16)
+                    {
+                        if (index==0) return false;
+                        len=length[index-1];
+                        sym=3+inflate_bits(s,2);
+                    }
+                    else if (sym==17) sym=3+inflate_bits(s,3);
+                    else sym=11+inflate_bits(s,7);
+                    if (index+sym>nlen+ndist) return false;
+                    for (i=0;i<sym;i++) length[index++]=len;
+                }
+            }
+            if (length[256]==0) return false;
+            if (!inflate_build(lencode,length,nlen) ||
+                !inflate_build(distcode,length+nlen,ndist)) return false;
+            if (!inflate_codes(s,lencode,distcode)) return false;
+        }
+        else return false;
+    } while (!last);
+    return inflate_align(s);
+}
 
-              ::execvp(file.c_str(), arg_v);
+inline bool IsGzip(const char *data, size_t size)
+{
+    return size>=2 && (unsigned char)data[0]==0x1f &&
+                      (unsigned char)data[1]==0x8b;
+}
 
-              // can only reach this point if exec() failed
+/* decompress all gzip members in data[0:size] into out.
+ * return false for corrupted or truncated input. the whole text is
+ * inflated into one buffer rather than streamed, because the input lines
+ * are views into the text and must stay valid until it is converted */
+bool gunzip(const char *data, size_t size, string &out)
+{
+    const unsigned char *in=(const unsigned char *)data;
+    InflateState s;
+    s.in=in;
+    s.insize=size;
+    s.inpos=0;
+    s.out=&out;
+    s.outpos=0;
+    size_t isize_hint=0; // uncompressed size of the last member
+    if (size>=4) isize_hint=in[size-4]|(in[size-3]<<8)|(in[size-2]<<16)|
+        ((size_t)in[size-1]<<24);
+    if (isize_hint<=size*1032) out.resize(isize_hint); // max deflate ratio
+
+    size_t pos=0;
+    size_t start;
+    int flg;
+    unsigned int crc,isize;
+    while (IsGzip(data+pos,size-pos))
+    {
+        if (pos+10>size || in[pos+2]!=8) return false;
+        flg=in[pos+3];
+        pos+=10;
+        if (flg&4 && pos+2<=size) pos+=2+(in[pos]|(in[pos+1]<<8)); // FEXTRA
+        if (flg&8)  while (pos<size && in[pos++]);                // FNAME
+        if (flg&16) while (pos<size && in[pos++]);                // FCOMMENT
+        if (flg&2) pos+=2;                                         // FHCRC
+        if (pos>=size) return false;
+
+        start=s.outpos;
+        s.inpos=pos;
+        if (!inflate_raw(s) || s.inpos+8>size) return false;
+        pos=s.inpos;
+        crc  =in[pos]  |(in[pos+1]<<8)|(in[pos+2]<<16)|((unsigned int)in[pos+3]<<24);
+        isize=in[pos+4]|(in[pos+5]<<8)|(in[pos+6]<<16)|((unsigned int)in[pos+7]<<24);
+        pos+=8;
+        if (crc!=crc32_update(0,(const unsigned char *)out.data()+start,
+            s.outpos-start) || isize!=(unsigned int)(s.outpos-start))
+            return false;
+    }
+    out.resize(s.outpos);
+    return pos>0;
+}
 
-              // parent can get error code from ck_exec pipe
-              error_ = errno;
+/* inflate END */
+/* input START */
 
-              while (::write(ck_exec[WR], &error_, sizeof(error_)) == -1
-                  && errno == EINTR)
-              { }
+/* POSIX file I/O is not available on windows, which does not have cygwin */
+#if !(defined(WIN32) || defined(_WIN32) || defined(__WIN32__) && !defined(__CYGWIN__))
+#define HAVE_POSIX
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
 
-              ::close(ck_exec[WR]);
-              ::close(ck_exec[RD]);
+/* read-only content of an input file. regular files are memory mapped so
+ * that the parser can walk lines as views into the file without copying.
+ * stdin and gzip compressed files are read into an owned buffer. */
+struct InputFile
+{
+    const char *data;
+    size_t size;
+    string owned;
+    void *map_addr;
+    size_t map_size;
 
-              ::_exit(error_);
-              // using std::exit() would make static dtors run twice
-            }
+    InputFile(): data(NULL), size(0), map_addr(NULL), map_size(0) {}
+    ~InputFile();
+};
 
-          case -1 :
-            // couldn't fork, error already handled in pstreambuf::fork()
-            close_fd_array(ck_exec);
-            break;
+void close_input(InputFile &input)
+{
+#if defined(HAVE_POSIX)
+    if (input.map_addr) munmap(input.map_addr,input.map_size);
+#endif
+    input.map_addr=NULL;
+    input.map_size=0;
+    string().swap(input.owned);
+    input.data=NULL;
+    input.size=0;
+}
 
-          default :
-            // this is the parent process
+InputFile::~InputFile()
+{
+    close_input(*this);
+}
 
-            // check child called exec() successfully
-            ::close(ck_exec[WR]);
-            switch (::read(ck_exec[RD], &error_, sizeof(error_)))
-            {
-            case 0:
-              // activate buffers
-              create_buffers(mode);
-              ret = this;
-              break;
-            case -1:
-              error_ = errno;
-              break;
-            default:
-              // error_ contains error code from child
-              // call wait() to clean up and set ppid_ to 0
-              this->wait();
-              break;
-            }
-            ::close(ck_exec[RD]);
-          }
-        }
-      }
-      return ret;
-    }
+void read_stream(istream &fp, string &owned)
+{
+    char chunk[65536];
+    while (fp.read(chunk,sizeof(chunk)) || fp.gcount())
+        owned.append(chunk,fp.gcount());
+}
 
-  /**
-   * Creates pipes as specified by @a mode and calls @c fork() to create
-   * a new process. If the fork is successful the parent process stores
-   * the child's PID and the opened pipes and the child process replaces
-   * its standard streams with the opened pipes.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c pipe() or @c fork().
-   * See your system's documentation for these error codes.
-   *
-   * @param   mode  an OR of pmodes specifying which of the child's
-   *                standard streams to connect to.
-   * @return  On success the PID of the child is returned in the parent's
-   *          context and zero is returned in the child's context.
-   *          On error -1 is returned and the error code is set appropriately.
-   */
-  template <typename C, typename T>
-    pid_t
-    basic_pstreambuf<C,T>::fork(pmode mode)
-    {
-      pid_t pid = -1;
-
-      // Three pairs of file descriptors, for pipes connected to the
-      // process' stdin, stdout and stderr
-      // (stored in a single array so close_fd_array() can close all at once)
-      fd_type fd[] = { -1, -1, -1, -1, -1, -1 };
-      fd_type* const pin = fd;
-      fd_type* const pout = fd+2;
-      fd_type* const perr = fd+4;
-
-      // constants for read/write ends of pipe
-      enum { RD, WR };
-
-      // N.B.
-      // For the pstreambuf pin is an output stream and
-      // pout and perr are input streams.
-
-      if (!error_ && mode&pstdin && ::pipe(pin))
-        error_ = errno;
-
-      if (!error_ && mode&pstdout && ::pipe(pout))
-        error_ = errno;
-
-      if (!error_ && mode&pstderr && ::pipe(perr))
-        error_ = errno;
-
-      if (!error_)
-      {
-        pid = ::fork();
-        switch (pid)
+/* read infile ("-" for stdin) into input. gzip compression is detected
+ * by the magic number rather than the filename */
+bool open_input(const string &infile, InputFile &input)
+{
+    close_input(input);
+    if (infile=="-") read_stream(cin,input.owned);
+    else
+    {
+#if defined(HAVE_POSIX)
+        int fd=open(infile.c_str(),O_RDONLY);
+        if (fd<0) return false;
+        struct stat st;
+        if (fstat(fd,&st)==0 && S_ISREG(st.st_mode) && st.st_size>0)
         {
-          case 0 :
-          {
-            // this is the new process
-
-            // for each open pipe close one end and redirect the
-            // respective standard stream to the other end
-
-            if (*pin >= 0)
+            void *addr=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+            if (addr!=MAP_FAILED)
             {
-              ::close(pin[WR]);
-              ::dup2(pin[RD], STDIN_FILENO);
-              ::close(pin[RD]);
+                madvise(addr,st.st_size,MADV_SEQUENTIAL);
+                input.map_addr=addr;
+                input.map_size=st.st_size;
             }
-            if (*pout >= 0)
-            {
-              ::close(pout[RD]);
-              ::dup2(pout[WR], STDOUT_FILENO);
-              ::close(pout[WR]);
-            }
-            if (*perr >= 0)
-            {
-              ::close(perr[RD]);
-              ::dup2(perr[WR], STDERR_FILENO);
-              ::close(perr[WR]);
-            }
-
-#ifdef _POSIX_JOB_CONTROL
-            if (mode&newpg)
-              ::setpgid(0, 0); // Change to a new process group
+        }
+        close(fd);
 #endif
-
-            break;
-          }
-          case -1 :
-          {
-            // couldn't fork for some reason
-            error_ = errno;
-            // close any open pipes
-            close_fd_array(fd);
-            break;
-          }
-          default :
-          {
-            // this is the parent process, store process' pid
-            ppid_ = pid;
-
-            // store one end of open pipes and close other end
-            if (*pin >= 0)
-            {
-              wpipe_ = pin[WR];
-              ::close(pin[RD]);
-            }
-            if (*pout >= 0)
-            {
-              rpipe_[rsrc_out] = pout[RD];
-              ::close(pout[WR]);
-            }
-            if (*perr >= 0)
-            {
-              rpipe_[rsrc_err] = perr[RD];
-              ::close(perr[WR]);
-            }
-          }
+        if (input.map_addr==NULL)
+        {
+            ifstream fp;
+            fp.open(infile.c_str(),ios::in|ios::binary);
+            read_stream(fp,input.owned);
+            fp.close();
         }
-      }
-      else
-      {
-        // close any pipes we opened before failure
-        close_fd_array(fd);
-      }
-      return pid;
     }
-
-  /**
-   * Closes all pipes and calls wait() to wait for the process to finish.
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c waitpid().
-   * See your system's documentation for these errors.
-   *
-   * @return  @c this on successful close or @c NULL if there is no
-   *          process to close or if an error occurs.
-   */
-  template <typename C, typename T>
-    basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::close()
+    if (input.map_addr)
     {
-      const bool running = is_open();
-
-      sync(); // this might call wait() and reap the child process
-
-      // rather than trying to work out whether or not we need to clean up
-      // just do it anyway, all cleanup functions are safe to call twice.
-
-      destroy_buffers(pstdin|pstdout|pstderr);
-
-      // close pipes before wait() so child gets EOF/SIGPIPE
-      close_fd(wpipe_);
-      close_fd_array(rpipe_);
-
-      do
-      {
-        error_ = 0;
-      } while (wait() == -1 && error() == EINTR);
-
-      return running ? this : NULL;
+        input.data=(const char *)input.map_addr;
+        input.size=input.map_size;
     }
-
-  /**
-   *  Called on construction to initialise the arrays used for reading.
-   */
-  template <typename C, typename T>
-    inline void
-    basic_pstreambuf<C,T>::init_rbuffers()
+    else
     {
-      rpipe_[rsrc_out] = rpipe_[rsrc_err] = -1;
-      rbuffer_[rsrc_out] = rbuffer_[rsrc_err] = NULL;
-      rbufstate_[0] = rbufstate_[1] = rbufstate_[2] = NULL;
+        input.data=input.owned.data();
+        input.size=input.owned.size();
     }
 
-  template <typename C, typename T>
-    void
-    basic_pstreambuf<C,T>::create_buffers(pmode mode)
-    {
-      if (mode & pstdin)
-      {
-        delete[] wbuffer_;
-        wbuffer_ = new char_type[bufsz];
-        this->setp(wbuffer_, wbuffer_ + bufsz);
-      }
-      if (mode & pstdout)
-      {
-        delete[] rbuffer_[rsrc_out];
-        rbuffer_[rsrc_out] = new char_type[bufsz];
-        rsrc_ = rsrc_out;
-        this->setg(rbuffer_[rsrc_out] + pbsz, rbuffer_[rsrc_out] + pbsz,
-            rbuffer_[rsrc_out] + pbsz);
-      }
-      if (mode & pstderr)
-      {
-        delete[] rbuffer_[rsrc_err];
-        rbuffer_[rsrc_err] = new char_type[bufsz];
-        if (!(mode & pstdout))
+    if (IsGzip(input.data,input.size))
+    {
+        string text;
+        bool success=gunzip(input.data,input.size,text);
+        close_input(input);
+        if (!success)
         {
-          rsrc_ = rsrc_err;
-          this->setg(rbuffer_[rsrc_err] + pbsz, rbuffer_[rsrc_err] + pbsz,
-              rbuffer_[rsrc_err] + pbsz);
+            cerr<<"ERROR! Corrupted gzip file "<<infile<<endl;
+            return false;
         }
-      }
+        input.owned.swap(text);
+        input.data=input.owned.data();
+        input.size=input.owned.size();
     }
+    return input.size>0;
+}
 
-  template <typename C, typename T>
-    void
-    basic_pstreambuf<C,T>::destroy_buffers(pmode mode)
-    {
-      if (mode & pstdin)
-      {
-        this->setp(NULL, NULL);
-        delete[] wbuffer_;
-        wbuffer_ = NULL;
-      }
-      if (mode & pstdout)
-      {
-        if (rsrc_ == rsrc_out)
-          this->setg(NULL, NULL, NULL);
-        delete[] rbuffer_[rsrc_out];
-        rbuffer_[rsrc_out] = NULL;
-      }
-      if (mode & pstderr)
-      {
-        if (rsrc_ == rsrc_err)
-          this->setg(NULL, NULL, NULL);
-        delete[] rbuffer_[rsrc_err];
-        rbuffer_[rsrc_err] = NULL;
-      }
+/* split text into non-empty lines without copying */
+void SplitLines(const string_view text, vector<string_view> &lines)
+{
+    const char *p=text.data();
+    const char *end=p+text.size();
+    const char *q;
+    while (p<end)
+    {
+        q=(const char *)memchr(p,'\n',end-p);
+        if (q==NULL) q=end;
+        if (q>p) lines.push_back(string_view(p,q-p));
+        p=q+1;
     }
+}
 
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::buf_read_src
-    basic_pstreambuf<C,T>::switch_read_buffer(buf_read_src src)
-    {
-      if (rsrc_ != src)
-      {
-        char_type* tmpbufstate[] = {this->eback(), this->gptr(), this->egptr()};
-        this->setg(rbufstate_[0], rbufstate_[1], rbufstate_[2]);
-        for (std::size_t i = 0; i < 3; ++i)
-          rbufstate_[i] = tmpbufstate[i];
-        rsrc_ = src;
-      }
-      return rsrc_;
-    }
+/* input END */
+/* deflate START */
 
-  /**
-   * Suspends execution and waits for the associated process to exit, or
-   * until a signal is delivered whose action is to terminate the current
-   * process or to call a signal handling function. If the process has
-   * already exited (i.e. it is a "zombie" process) then wait() returns
-   * immediately.  Waiting for the child process causes all its system
-   * resources to be freed.
-   *
-   * error() will return EINTR if wait() is interrupted by a signal.
-   *
-   * @param   nohang  true to return immediately if the process has not exited.
-   * @return  1 if the process has exited and wait() has not yet been called.
-   *          0 if @a nohang is true and the process has not exited yet.
-   *          -1 if no process has been started or if an error occurs,
-   *          in which case the error can be found using error().
-   */
-  template <typename C, typename T>
-    int
-    basic_pstreambuf<C,T>::wait(bool nohang)
-    {
-      int child_exited = -1;
-      if (is_open())
-      {
-        int exit_status;
-        switch(::waitpid(ppid_, &exit_status, nohang ? WNOHANG : 0))
-        {
-          case 0 :
-            // nohang was true and process has not exited
-            child_exited = 0;
-            break;
-          case -1 :
-            error_ = errno;
-            break;
-          default :
-            // process has exited
-            ppid_ = 0;
-            status_ = exit_status;
-            child_exited = 1;
-            // Close wpipe, would get SIGPIPE if we used it.
-            destroy_buffers(pstdin);
-            close_fd(wpipe_);
-            // Must free read buffers and pipes on destruction
-            // or next call to open()/close()
-            break;
-        }
-      }
-      return child_exited;
-    }
+/* gzip compression (RFC 1951 and RFC 1952) without external gzip or tar */
 
-  /**
-   * Sends the specified signal to the process.  A signal can be used to
-   * terminate a child process that would not exit otherwise.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c kill().  See your system's documentation for these errors.
-   *
-   * @param   signal  A signal to send to the child process.
-   * @return  @c this or @c NULL if @c kill() fails.
-   */
-  template <typename C, typename T>
-    inline basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::kill(int signal)
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-      if (is_open())
-      {
-        if (::kill(ppid_, signal))
-          error_ = errno;
-        else
-        {
-#if 0
-          // TODO call exited() to check for exit and clean up? leave to user?
-          if (signal==SIGTERM || signal==SIGKILL)
-            this->exited();
-#endif
-          ret = this;
-        }
-      }
-      return ret;
-    }
+const int DEFLATE_WSIZE    =32768; // sliding window
+const int DEFLATE_HASH_BITS=15;
+const int DEFLATE_MAX_CHAIN=32;    // match candidates tried per position
+const int DEFLATE_LAZY_LEN =32;    // try a longer match at next position
+const int DEFLATE_NICE_LEN =128;   // stop searching at this match length
+const int DEFLATE_BLOCK    =65536; // symbols per block
 
-  /**
-   * Sends the specified signal to the process group of the child process.
-   * A signal can be used to terminate a child process that would not exit
-   * otherwise, or to kill the process and its own children.
-   *
-   * If an error occurs the error code will be set to one of the possible
-   * errors for @c getpgid() or @c kill().  See your system's documentation
-   * for these errors. If the child is in the current process group then
-   * NULL will be returned and the error code set to EPERM.
-   *
-   * @param   signal  A signal to send to the child process.
-   * @return  @c this on success or @c NULL on failure.
-   */
-  template <typename C, typename T>
-    inline basic_pstreambuf<C,T>*
-    basic_pstreambuf<C,T>::killpg(int signal)
-    {
-      basic_pstreambuf<C,T>* ret = NULL;
-#ifdef _POSIX_JOB_CONTROL
-      if (is_open())
-      {
-        pid_t pgid = ::getpgid(ppid_);
-        if (pgid == -1)
-          error_ = errno;
-        else if (pgid == ::getpgrp())
-          error_ = EPERM;  // Don't commit suicide
-        else if (::killpg(pgid, signal))
-          error_ = errno;
-        else
-          ret = this;
-      }
-#else
-      error_ = ENOTSUP;
-#endif
-      return ret;
-    }
+struct DeflateWriter
+{
+    string *out;
+    unsigned long long bitbuf;
+    int bitcnt;
+};
 
-  /**
-   *  This function can call pstreambuf::wait() and so may change the
-   *  object's state if the child process has already exited.
-   *
-   *  @return  True if the associated process has exited, false otherwise.
-   *  @see     basic_pstreambuf<C,T>::wait()
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::exited()
-    {
-      return ppid_ == 0 || wait(true)==1;
+inline void deflate_put(DeflateWriter &w, unsigned int val, int n)
+{
+    w.bitbuf|=(unsigned long long)val<<w.bitcnt;
+    w.bitcnt+=n;
+    if (w.bitcnt>=32)
+    {
+        char b[4]={(char)w.bitbuf,(char)(w.bitbuf>>8),
+                   (char)(w.bitbuf>>16),(char)(w.bitbuf>>24)};
+        w.out->append(b,4);
+        w.bitbuf>>=32;
+        w.bitcnt-=32;
     }
+}
 
-  /**
-   *  @return  The error code of the most recently failed operation, or zero.
-   */
-  template <typename C, typename T>
-    inline int
-    basic_pstreambuf<C,T>::error() const
+/* pad with zero bits to the next byte boundary */
+void deflate_align(DeflateWriter &w)
+{
+    while (w.bitcnt>0)
     {
-      return error_;
-    }
-
-  /**
-   *  Closes the output pipe, causing the child process to receive the
-   *  end-of-file indicator on subsequent reads from its @c stdin stream.
-   */
-  template <typename C, typename T>
-    inline void
-    basic_pstreambuf<C,T>::peof()
-    {
-      sync();
-      destroy_buffers(pstdin);
-      close_fd(wpipe_);
-    }
-
-  /**
-   * Unlike pstreambuf::exited(), this function will not call wait() and
-   * so will not change the object's state.  This means that once a child
-   * process is executed successfully this function will continue to
-   * return true even after the process exits (until wait() is called.)
-   *
-   * @return  true if a previous call to open() succeeded and wait() has
-   *          not been called and determined that the process has exited,
-   *          false otherwise.
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::is_open() const
-    {
-      return ppid_ > 0;
-    }
-
-  /**
-   * Toggle the stream used for reading. If @a readerr is @c true then the
-   * process' @c stderr output will be used for subsequent extractions, if
-   * @a readerr is false the the process' stdout will be used.
-   * @param   readerr  @c true to read @c stderr, @c false to read @c stdout.
-   * @return  @c true if the requested stream is open and will be used for
-   *          subsequent extractions, @c false otherwise.
-   */
-  template <typename C, typename T>
-    inline bool
-    basic_pstreambuf<C,T>::read_err(bool readerr)
-    {
-      buf_read_src src = readerr ? rsrc_err : rsrc_out;
-      if (rpipe_[src]>=0)
-      {
-        switch_read_buffer(src);
-        return true;
-      }
-      return false;
+        w.out->push_back((char)(w.bitbuf&0xff));
+        w.bitbuf>>=8;
+        w.bitcnt-=8;
     }
+    w.bitbuf=0;
+    w.bitcnt=0;
+}
 
-  /**
-   * Called when the internal character buffer is not present or is full,
-   * to transfer the buffer contents to the pipe.
-   *
-   * @param   c  a character to be written to the pipe.
-   * @return  @c traits_type::eof() if an error occurs, otherwise if @a c
-   *          is not equal to @c traits_type::eof() it will be buffered and
-   *          a value other than @c traits_type::eof() returned to indicate
-   *          success.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::overflow(int_type c)
-    {
-      if (!empty_buffer())
-        return traits_type::eof();
-      else if (!traits_type::eq_int_type(c, traits_type::eof()))
-        return this->sputc(c);
-      else
-        return traits_type::not_eof(c);
+/* lengths of Huffman codes no longer than max_len for freq[0:n]. at least
+ * two codes are assigned so that the code is complete */
+void deflate_lengths(const unsigned int *freq, const int n,
+    const int max_len, unsigned char *length)
+{
+    vector<unsigned int> weight(freq,freq+n);
+    vector<int> parent(2*n);
+    vector<int> depth(2*n);
+    vector<pair<unsigned int,int> > heap;
+    int sym,node,used,max_depth;
+    pair<unsigned int,int> a,b;
+
+    memset(length,0,n);
+    used=0;
+    for (sym=0;sym<n;sym++) used+=(freq[sym]>0);
+    if (used<2)
+    {
+        for (sym=0;sym<n && used<2;sym++)
+            if (weight[sym]==0) weight[sym]=1,used++;
     }
 
-
-  template <typename C, typename T>
-    int
-    basic_pstreambuf<C,T>::sync()
+    while (true)
     {
-      return !exited() && empty_buffer() ? 0 : -1;
-    }
-
-  /**
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters written.
-   */
-  template <typename C, typename T>
-    std::streamsize
-    basic_pstreambuf<C,T>::xsputn(const char_type* s, std::streamsize n)
-    {
-      std::streamsize done = 0;
-      while (done < n)
-      {
-        if (std::streamsize nbuf = this->epptr() - this->pptr())
+        heap.clear();
+        for (sym=0;sym<n;sym++)
+            if (weight[sym]) heap.push_back(make_pair(~weight[sym],sym));
+        make_heap(heap.begin(),heap.end());
+        node=n;
+        while (heap.size()>1)
         {
-          nbuf = std::min(nbuf, n - done);
-          traits_type::copy(this->pptr(), s + done, nbuf);
-          this->pbump(nbuf);
-          done += nbuf;
+            pop_heap(heap.begin(),heap.end());
+            a=heap.back();
+            heap.pop_back();
+            pop_heap(heap.begin(),heap.end());
+            b=heap.back();
+            heap.pop_back();
+            parent[a.second]=parent[b.second]=node;
+            heap.push_back(make_pair(~(~a.first+~b.first),node++));
+            push_heap(heap.begin(),heap.end());
         }
-        else if (!empty_buffer())
-          break;
-      }
-      return done;
-    }
-
-  /**
-   * @return  true if the buffer was emptied, false otherwise.
-   */
-  template <typename C, typename T>
-    bool
-    basic_pstreambuf<C,T>::empty_buffer()
-    {
-      const std::streamsize count = this->pptr() - this->pbase();
-      if (count > 0)
-      {
-        const std::streamsize written = this->write(this->wbuffer_, count);
-        if (written > 0)
+        depth[node-1]=0;
+        max_depth=0;
+        for (sym=node-2;sym>=0;sym--)
         {
-          if (const std::streamsize unwritten = count - written)
-            traits_type::move(this->pbase(), this->pbase()+written, unwritten);
-          this->pbump(-written);
-          return true;
+            if (sym<n && weight[sym]==0) continue;
+            depth[sym]=depth[parent[sym]]+1;
+            if (sym<n && depth[sym]>max_depth) max_depth=depth[sym];
         }
-      }
-      return false;
-    }
+        if (max_depth<=max_len) break;
 
-  /**
-   * Called when the internal character buffer is is empty, to re-fill it
-   * from the pipe.
-   *
-   * @return The first available character in the buffer,
-   * or @c traits_type::eof() in case of failure.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::underflow()
-    {
-      if (this->gptr() < this->egptr() || fill_buffer())
-        return traits_type::to_int_type(*this->gptr());
-      else
-        return traits_type::eof();
+        /* flatten the frequency distribution until the tree is short enough */
+        for (sym=0;sym<n;sym++)
+            if (weight[sym]) weight[sym]=(weight[sym]>>1)|1;
     }
+    for (sym=0;sym<n;sym++) if (weight[sym]) length[sym]=depth[sym];
+}
 
-  /**
-   * Attempts to make @a c available as the next character to be read by
-   * @c sgetc().
-   *
-   * @param   c   a character to make available for extraction.
-   * @return  @a c if the character can be made available,
-   *          @c traits_type::eof() otherwise.
-   */
-  template <typename C, typename T>
-    typename basic_pstreambuf<C,T>::int_type
-    basic_pstreambuf<C,T>::pbackfail(int_type c)
-    {
-      if (this->gptr() != this->eback())
-      {
-        this->gbump(-1);
-        if (!traits_type::eq_int_type(c, traits_type::eof()))
-          *this->gptr() = traits_type::to_char_type(c);
-        return traits_type::not_eof(c);
-      }
-      else
-         return traits_type::eof();
+/* bit-reversed canonical Huffman codes for the given code lengths */
+void deflate_codes(const unsigned char *length, const int n,
+    unsigned short *code)
+{
+    unsigned short count[16];
+    unsigned int next_code[16];
+    unsigned int c,r;
+    int sym,len,i;
+    memset(count,0,sizeof(count));
+    for (sym=0;sym<n;sym++) count[length[sym]]++;
+    count[0]=0;
+    c=0;
+    for (len=1;len<16;len++)
+    {
+        c=(c+count[len-1])<<1;
+        next_code[len]=c;
     }
-
-  template <typename C, typename T>
-    std::streamsize
-    basic_pstreambuf<C,T>::showmanyc()
-    {
-      int avail = 0;
-      if (sizeof(char_type) == 1)
-        avail = fill_buffer(true) ? this->egptr() - this->gptr() : -1;
-#ifdef FIONREAD
-      else
-      {
-        if (::ioctl(rpipe(), FIONREAD, &avail) == -1)
-          avail = -1;
-        else if (avail)
-          avail /= sizeof(char_type);
-      }
-#endif
-      return std::streamsize(avail);
+    for (sym=0;sym<n;sym++)
+    {
+        len=length[sym];
+        code[sym]=0;
+        if (len==0) continue;
+        c=next_code[len]++;
+        for (r=0,i=0;i<len;i++) r=(r<<1)|((c>>i)&1);
+        code[sym]=r;
     }
+}
 
-  /**
-   * @return  true if the buffer was filled, false otherwise.
-   */
-  template <typename C, typename T>
-    bool
-    basic_pstreambuf<C,T>::fill_buffer(bool non_blocking)
-    {
-      const std::streamsize pb1 = this->gptr() - this->eback();
-      const std::streamsize pb2 = pbsz;
-      const std::streamsize npb = std::min(pb1, pb2);
-
-      char_type* const rbuf = rbuffer();
-
-      if (npb)
-        traits_type::move(rbuf + pbsz - npb, this->gptr() - npb, npb);
-
-      std::streamsize rc = -1;
-
-      if (non_blocking)
-      {
-        const int flags = ::fcntl(rpipe(), F_GETFL);
-        if (flags != -1)
+static const unsigned short deflate_len_base[29]={3,4,5,6,7,8,9,10,11,13,
+    15,17,19,23,27,31,35,43,51,59,67,83,99,115,131,163,195,227,258};
+static const unsigned char deflate_len_extra[29]={0,0,0,0,0,0,0,0,1,1,1,1,
+    2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const unsigned short deflate_dist_base[30]={1,2,3,4,5,7,9,13,17,25,
+    33,49,65,97,129,193,257,385,513,769,1025,1537,2049,3073,4097,6145,8193,
+    12289,16385,24577};
+static const unsigned char deflate_dist_extra[30]={0,0,0,0,1,1,2,2,3,3,4,4,
+    5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
+
+/* length (3..258) and distance (1..32768) to deflate symbol */
+struct DeflateSymbolTable
+{
+    unsigned char len_code[259];
+    unsigned char dist_code[512];
+    DeflateSymbolTable()
+    {
+        int code,i;
+        for (code=0;code<29;code++)
+            for (i=deflate_len_base[code];i<259 && (code==28 ||
+                i<deflate_len_base[code+1]);i++) len_code[i]=code;
+        for (code=0;code<30;code++)
         {
-          const bool blocking = !(flags & O_NONBLOCK);
-          if (blocking)
-            ::fcntl(rpipe(), F_SETFL, flags | O_NONBLOCK);  // set non-blocking
-
-          error_ = 0;
-          rc = read(rbuf + pbsz, bufsz - pbsz);
-
-          if (rc == -1 && error_ == EAGAIN)  // nothing available
-            rc = 0;
-          else if (rc == 0)  // EOF
-            rc = -1;
-
-          if (blocking)
-            ::fcntl(rpipe(), F_SETFL, flags); // restore
+            for (i=deflate_dist_base[code];i<=256 && (code==29 ||
+                i<deflate_dist_base[code+1]);i++) dist_code[i-1]=code;
+            if (deflate_dist_base[code]<=256) continue;
+            for (i=((deflate_dist_base[code]-1)>>7);i<256 && (code==29 ||
+                (i<<7)<deflate_dist_base[code+1]-1);i++) dist_code[256+i]=code;
         }
-      }
-      else
-        rc = read(rbuf + pbsz, bufsz - pbsz);
-
-      if (rc > 0 || (rc == 0 && non_blocking))
-      {
-        this->setg( rbuf + pbsz - npb,
-                    rbuf + pbsz,
-                    rbuf + pbsz + rc );
-        return true;
-      }
-      else
-      {
-        this->setg(NULL, NULL, NULL);
-        return false;
-      }
     }
-
-  /**
-   * Writes up to @a n characters to the pipe from the buffer @a s.
-   *
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters written.
-   */
-  template <typename C, typename T>
-    inline std::streamsize
-    basic_pstreambuf<C,T>::write(const char_type* s, std::streamsize n)
-    {
-      std::streamsize nwritten = 0;
-      if (wpipe() >= 0)
-      {
-        nwritten = ::write(wpipe(), s, n * sizeof(char_type));
-        if (nwritten == -1)
-          error_ = errno;
-        else
-          nwritten /= sizeof(char_type);
-      }
-      return nwritten;
-    }
-
-  /**
-   * Reads up to @a n characters from the pipe to the buffer @a s.
-   *
-   * @param   s  character buffer.
-   * @param   n  buffer length.
-   * @return  the number of characters read.
-   */
-  template <typename C, typename T>
-    inline std::streamsize
-    basic_pstreambuf<C,T>::read(char_type* s, std::streamsize n)
-    {
-      std::streamsize nread = 0;
-      if (rpipe() >= 0)
-      {
-        nread = ::read(rpipe(), s, n * sizeof(char_type));
-        if (nread == -1)
-          error_ = errno;
-        else
-          nread /= sizeof(char_type);
-      }
-      return nread;
-    }
-
-  /** @return a reference to the output file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::wpipe()
+    inline int dcode(const int dist) const
     {
-      return wpipe_;
+        return (dist<=256)?dist_code[dist-1]:dist_code[256+((dist-1)>>7)];
     }
-
-  /** @return a reference to the active input file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::rpipe()
-    {
-      return rpipe_[rsrc_];
-    }
-
-  /** @return a reference to the specified input file descriptor */
-  template <typename C, typename T>
-    inline pstreams::fd_type&
-    basic_pstreambuf<C,T>::rpipe(buf_read_src which)
-    {
-      return rpipe_[which];
+};
+
+/* emit symbols litlen_vec/dist_vec covering raw[0:raw_size] as one dynamic
+ * Huffman block, or as stored blocks if that is smaller. a literal has
+ * dist 0; a match stores its length in litlen */
+void deflate_block(DeflateWriter &w, const vector<unsigned short> &litlen_vec,
+    const vector<unsigned short> &dist_vec, const char *raw,
+    const size_t raw_size, const bool last)
+{
+    static const DeflateSymbolTable table;
+    static const unsigned char order[19]={16,17,18,0,8,7,9,6,10,5,11,4,
+        12,3,13,2,14,1,15};
+    unsigned int ll_freq[286],d_freq[30],cl_freq[19];
+    unsigned char ll_len[286],d_len[30],cl_len[19],all_len[316];
+    unsigned short ll_code[286],d_code[30],cl_code[19];
+    vector<unsigned char> cl_sym;
+    vector<unsigned char> cl_extra;
+    size_t i,s;
+    int hlit,hdist,hclen,code,n,run,r;
+
+    if (raw_size==0) // empty fixed Huffman block
+    {
+        deflate_put(w,last,1);
+        deflate_put(w,1,2);
+        deflate_put(w,0,7);
+        return;
     }
 
-  /** @return a pointer to the start of the active input buffer area. */
-  template <typename C, typename T>
-    inline typename basic_pstreambuf<C,T>::char_type*
-    basic_pstreambuf<C,T>::rbuffer()
+    memset(ll_freq,0,sizeof(ll_freq));
+    memset(d_freq,0,sizeof(d_freq));
+    for (s=0;s<litlen_vec.size();s++)
     {
-      return rbuffer_[rsrc_];
+        if (dist_vec[s]==0) ll_freq[litlen_vec[s]]++;
+        else
+        {
+            ll_freq[257+table.len_code[litlen_vec[s]]]++;
+            d_freq[table.dcode(dist_vec[s])]++;
+        }
     }
-
-
-  /*
-   * member definitions for pstream_common
-   */
-
-  /**
-   * @class pstream_common
-   * Abstract Base Class providing common functionality for basic_ipstream,
-   * basic_opstream and basic_pstream.
-   * pstream_common manages the basic_pstreambuf stream buffer that is used
-   * by the derived classes to initialise an iostream class.
-   */
-
-  /** Creates an uninitialised stream. */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common()
-    : std::basic_ios<C,T>(NULL)
-    , command_()
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
+    ll_freq[256]=1;
+    deflate_lengths(ll_freq,286,15,ll_len);
+    deflate_lengths(d_freq,30,15,d_len);
+    for (hlit=286;hlit>257 && ll_len[hlit-1]==0;hlit--);
+    for (hdist=30;hdist>1 && d_len[hdist-1]==0;hdist--);
+
+    /* run length encoding of code lengths */
+    memcpy(all_len,ll_len,hlit);
+    memcpy(all_len+hlit,d_len,hdist);
+    n=hlit+hdist;
+    for (i=0;i<n;i+=run)
+    {
+        for (run=1;i+run<n && all_len[i+run]==all_len[i];run++);
+        r=run;
+        if (all_len[i]==0)
+        {
+            for (;r>=11;r-=min(r,138))
+            {
+                cl_sym.push_back(18);
+                cl_extra.push_back(min(r,138)-11);
+            }
+            if (r>=3)
+            {
+                cl_sym.push_back(17);
+                cl_extra.push_back(r-3);
+                r=0;
+            }
+        }
+        else
+        {
+            cl_sym.push_back(all_len[i]);
+            cl_extra.push_back(0);
+            for (r--;r>=3;r-=min(r,6))
+            {
+                cl_sym.push_back(16);
+                cl_extra.push_back(min(r,6)-3);
+            }
+        }
+        for (;r>0;r--)
+        {
+            cl_sym.push_back(all_len[i]);
+            cl_extra.push_back(0);
+        }
     }
-
-  /**
-   * Initialises the stream buffer by calling
-   * do_open( @a command , @a mode )
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   do_open(const std::string&, pmode)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common(const std::string& cmd, pmode mode)
-    : std::basic_ios<C,T>(NULL)
-    , command_(cmd)
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
-      do_open(cmd, mode);
+    memset(cl_freq,0,sizeof(cl_freq));
+    for (s=0;s<cl_sym.size();s++) cl_freq[cl_sym[s]]++;
+    deflate_lengths(cl_freq,19,7,cl_len);
+    for (hclen=19;hclen>4 && cl_len[order[hclen-1]]==0;hclen--);
+
+    /* compare with the size of stored blocks */
+    size_t dynamic_bits=17+3*hclen;
+    for (s=0;s<cl_sym.size();s++) dynamic_bits+=cl_len[cl_sym[s]]+
+        (cl_sym[s]==16?2:(cl_sym[s]==17?3:(cl_sym[s]==18?7:0)));
+    for (code=0;code<286;code++) dynamic_bits+=(size_t)ll_freq[code]*
+        (ll_len[code]+(code>=257?deflate_len_extra[code-257]:0));
+    for (code=0;code<30;code++) dynamic_bits+=(size_t)d_freq[code]*
+        (d_len[code]+deflate_dist_extra[code]);
+    if (dynamic_bits>raw_size*8+(raw_size/65535+1)*40)
+    {
+        for (i=0;i<raw_size;i+=n)
+        {
+            n=min(raw_size-i,(size_t)65535);
+            deflate_put(w,last && i+n==raw_size,1);
+            deflate_put(w,0,2);
+            deflate_align(w);
+            deflate_put(w,n,16);
+            deflate_put(w,~n&0xffff,16);
+            deflate_align(w);
+            w.out->append(raw+i,n);
+        }
+        return;
     }
 
-  /**
-   * Initialises the stream buffer by calling
-   * do_open( @a file , @a argv , @a mode )
-   *
-   * @param file  a string containing the pathname of a program to execute.
-   * @param argv  a vector of argument strings passed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see do_open(const std::string&, const argv_type&, pmode)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::pstream_common( const std::string& file,
-                                         const argv_type& argv,
-                                         pmode mode )
-    : std::basic_ios<C,T>(NULL)
-    , command_(file)
-    , buf_()
-    {
-      this->std::basic_ios<C,T>::rdbuf(&buf_);
-      do_open(file, argv, mode);
+    deflate_codes(ll_len,286,ll_code);
+    deflate_codes(d_len,30,d_code);
+    deflate_codes(cl_len,19,cl_code);
+    deflate_put(w,last,1);
+    deflate_put(w,2,2);
+    deflate_put(w,hlit-257,5);
+    deflate_put(w,hdist-1,5);
+    deflate_put(w,hclen-4,4);
+    for (code=0;code<hclen;code++) deflate_put(w,cl_len[order[code]],3);
+    for (s=0;s<cl_sym.size();s++)
+    {
+        deflate_put(w,cl_code[cl_sym[s]],cl_len[cl_sym[s]]);
+        if      (cl_sym[s]==16) deflate_put(w,cl_extra[s],2);
+        else if (cl_sym[s]==17) deflate_put(w,cl_extra[s],3);
+        else if (cl_sym[s]==18) deflate_put(w,cl_extra[s],7);
     }
-
-  /**
-   * This is a pure virtual function to make @c pstream_common abstract.
-   * Because it is the destructor it will be called by derived classes
-   * and so must be defined.  It is also protected, to discourage use of
-   * the PStreams classes through pointers or references to the base class.
-   *
-   * @sa If defining a pure virtual seems odd you should read
-   * http://www.gotw.ca/gotw/031.htm (and the rest of the site as well!)
-   */
-  template <typename C, typename T>
-    inline
-    pstream_common<C,T>::~pstream_common()
+    for (s=0;s<litlen_vec.size();s++)
     {
+        if (dist_vec[s]==0)
+        {
+            deflate_put(w,ll_code[litlen_vec[s]],ll_len[litlen_vec[s]]);
+            continue;
+        }
+        code=table.len_code[litlen_vec[s]];
+        deflate_put(w,ll_code[257+code],ll_len[257+code]);
+        deflate_put(w,litlen_vec[s]-deflate_len_base[code],
+            deflate_len_extra[code]);
+        code=table.dcode(dist_vec[s]);
+        deflate_put(w,d_code[code],d_len[code]);
+        deflate_put(w,dist_vec[s]-deflate_dist_base[code],
+            deflate_dist_extra[code]);
     }
+    deflate_put(w,ll_code[256],ll_len[256]);
+}
 
-  /**
-   * Calls rdbuf()->open( @a command , @a mode )
-   * and sets @c failbit on error.
-   *
-   * @param cmd   a string containing a shell command.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   basic_pstreambuf::open(const std::string&, pmode)
-   */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::do_open(const std::string& cmd, pmode mode)
-    {
-      if (!buf_.open((command_=cmd), mode))
-        this->setstate(std::ios_base::failbit);
-    }
-
-  /**
-   * Calls rdbuf()->open( @a file, @a  argv, @a mode )
-   * and sets @c failbit on error.
-   *
-   * @param file  a string containing the pathname of a program to execute.
-   * @param argv  a vector of argument strings passed to the new program.
-   * @param mode  the I/O mode to use when opening the pipe.
-   * @see   basic_pstreambuf::open(const std::string&, const argv_type&, pmode)
-   */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::do_open( const std::string& file,
-                                  const argv_type& argv,
-                                  pmode mode )
-    {
-      if (!buf_.open((command_=file), argv, mode))
-        this->setstate(std::ios_base::failbit);
-    }
+/* LZ77 matcher with hash chains over the whole input buffer */
+struct DeflateMatcher
+{
+    const unsigned char *data;
+    size_t size;
+    vector<size_t> head; // last position+1 with the same hash
+    vector<size_t> prev; // previous position+1 in the chain, by pos%WSIZE
 
-  /** Calls rdbuf->close() and sets @c failbit on error. */
-  template <typename C, typename T>
-    inline void
-    pstream_common<C,T>::close()
+    inline unsigned int hash(const size_t pos) const
     {
-      if (!buf_.close())
-        this->setstate(std::ios_base::failbit);
+        unsigned int v=data[pos]|(data[pos+1]<<8)|(data[pos+2]<<16);
+        return (v*2654435761U)>>(32-DEFLATE_HASH_BITS);
     }
 
-  /**
-   * @return  rdbuf()->is_open().
-   * @see     basic_pstreambuf::is_open()
-   */
-  template <typename C, typename T>
-    inline bool
-    pstream_common<C,T>::is_open() const
+    inline void insert(const size_t pos)
     {
-      return buf_.is_open();
+        if (pos+3>size) return;
+        unsigned int h=hash(pos);
+        prev[pos&(DEFLATE_WSIZE-1)]=head[h];
+        head[h]=pos+1;
     }
 
-  /** @return a pointer to the private stream buffer member. */
-  // TODO  document behaviour if buffer replaced.
-  template <typename C, typename T>
-    inline typename pstream_common<C,T>::streambuf_type*
-    pstream_common<C,T>::rdbuf() const
-    {
-      return const_cast<streambuf_type*>(&buf_);
+    /* insert pos and return the longest earlier match at pos */
+    inline int find(const size_t pos, int &best_dist)
+    {
+        if (pos+3>size) return 0;
+        unsigned int h=hash(pos);
+        size_t cand=head[h];
+        prev[pos&(DEFLATE_WSIZE-1)]=cand;
+        head[h]=pos+1;
+
+        int max_len=min(size-pos,(size_t)258);
+        int best_len=0,len,chain;
+        size_t p;
+        const unsigned char *a,*b;
+        unsigned long long x,y;
+        for (chain=DEFLATE_MAX_CHAIN;cand && chain>0;chain--)
+        {
+            p=cand-1;
+            if (pos-p>DEFLATE_WSIZE) break;
+            a=data+p;
+            b=data+pos;
+            if (a[best_len]==b[best_len] && a[0]==b[0] && a[1]==b[1])
+            {
+                len=2;
+                while (len+8<=max_len)
+                {
+                    memcpy(&x,a+len,8);
+                    memcpy(&y,b+len,8);
+                    if (x!=y) break;
+                    len+=8;
+                }
+                while (len<max_len && a[len]==b[len]) len++;
+                if (len>best_len)
+                {
+                    best_len=len;
+                    best_dist=pos-p;
+                    if (len>=DEFLATE_NICE_LEN || len==max_len) break;
+                }
+            }
+            cand=prev[p&(DEFLATE_WSIZE-1)];
+            if (cand>p) break; // overwritten by a newer position
+        }
+        return (best_len>=3)?best_len:0;
     }
+};
 
-
-#if REDI_EVISCERATE_PSTREAMS
-  /**
-   * @def REDI_EVISCERATE_PSTREAMS
-   * If this macro has a non-zero value then certain internals of the
-   * @c basic_pstreambuf template class are exposed. In general this is
-   * a Bad Thing, as the internal implementation is largely undocumented
-   * and may be subject to change at any time, so this feature is only
-   * provided because it might make PStreams useful in situations where
-   * it is necessary to do Bad Things.
-   */
-
-  /**
-   * @warning  This function exposes the internals of the stream buffer and
-   *           should be used with caution. It is the caller's responsibility
-   *           to flush streams etc. in order to clear any buffered data.
-   *           The POSIX.1 function <b>fdopen</b>(3) is used to obtain the
-   *           @c FILE pointers from the streambuf's private file descriptor
-   *           members so consult your system's documentation for
-   *           <b>fdopen</b>(3).
-   *
-   * @param   in    A FILE* that will refer to the process' stdin.
-   * @param   out   A FILE* that will refer to the process' stdout.
-   * @param   err   A FILE* that will refer to the process' stderr.
-   * @return  An OR of zero or more of @c pstdin, @c pstdout, @c pstderr.
-   *
-   * For each open stream shared with the child process a @c FILE* is
-   * obtained and assigned to the corresponding parameter. For closed
-   * streams @c NULL is assigned to the parameter.
-   * The return value can be tested to see which parameters should be
-   * @c !NULL by masking with the corresponding @c pmode value.
-   *
-   * @see <b>fdopen</b>(3)
-   */
-  template <typename C, typename T>
-    std::size_t
-    basic_pstreambuf<C,T>::fopen(FILE*& in, FILE*& out, FILE*& err)
-    {
-      in = out = err = NULL;
-      std::size_t open_files = 0;
-      if (wpipe() > -1)
-      {
-        if ((in = ::fdopen(wpipe(), "w")))
+/* append raw deflate stream of data[0:size] to out */
+void deflate_compress(const char *data, const size_t size, string &out)
+{
+    DeflateWriter w;
+    w.out=&out;
+    w.bitbuf=0;
+    w.bitcnt=0;
+
+    DeflateMatcher m;
+    m.data=(const unsigned char *)data;
+    m.size=size;
+    m.head.assign(1<<DEFLATE_HASH_BITS,0);
+    m.prev.assign(DEFLATE_WSIZE,0);
+
+    vector<unsigned short> litlen_vec;
+    vector<unsigned short> dist_vec;
+    litlen_vec.reserve(DEFLATE_BLOCK);
+    dist_vec.reserve(DEFLATE_BLOCK);
+
+    size_t pos=0;
+    size_t block_start=0;
+    size_t k;
+    int len,dist=0,next_len,next_dist=0;
+    len=m.find(pos,dist);
+    while (pos<size)
+    {
+        if (len && len<DEFLATE_LAZY_LEN && pos+1<size)
+        {
+            next_len=m.find(pos+1,next_dist);
+            if (next_len>len)
+            {
+                litlen_vec.push_back((unsigned char)data[pos]);
+                dist_vec.push_back(0);
+                pos++;
+                len=next_len;
+                dist=next_dist;
+            }
+            else
+            {
+                litlen_vec.push_back(len);
+                dist_vec.push_back(dist);
+                for (k=pos+2;k<pos+len;k++) m.insert(k);
+                pos+=len;
+                len=m.find(pos,dist);
+            }
+        }
+        else if (len)
         {
-            open_files |= pstdin;
+            litlen_vec.push_back(len);
+            dist_vec.push_back(dist);
+            for (k=pos+1;k<pos+len;k++) m.insert(k);
+            pos+=len;
+            len=m.find(pos,dist);
         }
-      }
-      if (rpipe(rsrc_out) > -1)
-      {
-        if ((out = ::fdopen(rpipe(rsrc_out), "r")))
+        else
         {
-            open_files |= pstdout;
+            litlen_vec.push_back((unsigned char)data[pos]);
+            dist_vec.push_back(0);
+            pos++;
+            len=m.find(pos,dist);
         }
-      }
-      if (rpipe(rsrc_err) > -1)
-      {
-        if ((err = ::fdopen(rpipe(rsrc_err), "r")))
+        if (litlen_vec.size()>=DEFLATE_BLOCK)
         {
-            open_files |= pstderr;
+            deflate_block(w,litlen_vec,dist_vec,data+block_start,
+                pos-block_start,false);
+            litlen_vec.clear();
+            dist_vec.clear();
+            block_start=pos;
         }
-      }
-      return open_files;
-    }
-
-  /**
-   *  @warning This function exposes the internals of the stream buffer and
-   *  should be used with caution.
-   *
-   *  @param  in   A FILE* that will refer to the process' stdin.
-   *  @param  out  A FILE* that will refer to the process' stdout.
-   *  @param  err  A FILE* that will refer to the process' stderr.
-   *  @return A bitwise-or of zero or more of @c pstdin, @c pstdout, @c pstderr.
-   *  @see    basic_pstreambuf::fopen()
-   */
-  template <typename C, typename T>
-    inline std::size_t
-    pstream_common<C,T>::fopen(FILE*& fin, FILE*& fout, FILE*& ferr)
-    {
-      return buf_.fopen(fin, fout, ferr);
     }
+    deflate_block(w,litlen_vec,dist_vec,data+block_start,
+        pos-block_start,true);
+    deflate_align(w);
+}
 
-#endif // REDI_EVISCERATE_PSTREAMS
+/* gzip file content of data[0:size] */
+void gzip_compress(const char *data, const size_t size, string &out)
+{
+    static const char header[10]={0x1f,(char)0x8b,8,0,0,0,0,0,0,3};
+    out.reserve(out.size()+size/4+64);
+    out.append(header,10);
+    deflate_compress(data,size,out);
+    unsigned int crc=crc32_update(0,(const unsigned char *)data,size);
+    unsigned int isize=size;
+    char trailer[8]={(char)crc,(char)(crc>>8),(char)(crc>>16),
+        (char)(crc>>24),(char)isize,(char)(isize>>8),(char)(isize>>16),
+        (char)(isize>>24)};
+    out.append(trailer,8);
+}
 
+/* deflate END */
+/* output START */
 
-} // namespace redi
+/* write text to filename, or gzip compressed text to filename.gz if do_gzip.
+ * return false if the file cannot be written */
+bool write_file(const string &filename, const string &text, const int do_gzip=0)
+{
+    ofstream fout;
+    if (do_gzip)
+    {
+        string gz;
+        gzip_compress(text.data(),text.size(),gz);
+        fout.open((filename+".gz").c_str(),ofstream::out|ofstream::binary);
+        fout.write(gz.data(),gz.size());
+    }
+    else
+    {
+        fout.open(filename.c_str(),ofstream::out);
+        fout.write(text.data(),text.size());
+    }
+    fout.close();
+    if (fout.fail())
+    {
+        cerr<<"ERROR! Cannot write "<<filename<<(do_gzip?".gz":"")<<endl;
+        return false;
+    }
+    return true;
+}
 
+/* append text as regular file filename to in-memory ustar archive */
+void tar_append(string &tar, const string &filename, const string &text)
+{
+    char header[512];
+    memset(header,0,512);
+    string name=filename;
+    while (name.size() && name[0]=='/') name=name.substr(1);
+    size_t split=string::npos;
+    if (name.size()>100)
+    {
+        /* ustar stores long names as prefix/name */
+        split=name.rfind('/',155);
+        if (split!=string::npos && name.size()-split-1>100)
+            split=string::npos;
+    }
+    if (split==string::npos) memcpy(header,name.data(),min(name.size(),(size_t)100));
+    else
+    {
+        memcpy(header,name.data()+split+1,name.size()-split-1);
+        memcpy(header+345,name.data(),split);
+    }
+    snprintf(header+100,8,"%07o",0644);
+    snprintf(header+108,8,"%07o",0);
+    snprintf(header+116,8,"%07o",0);
+    snprintf(header+124,12,"%011llo",(unsigned long long)text.size());
+    snprintf(header+136,12,"%011llo",(unsigned long long)time(NULL));
+    header[156]='0';
+    memcpy(header+257,"ustar",6);
+    memcpy(header+263,"00",2);
+    memset(header+148,' ',8);
+    unsigned int chksum=0;
+    for (int i=0;i<512;i++) chksum+=(unsigned char)header[i];
+    snprintf(header+148,7,"%06o",chksum);
+    tar.append(header,512);
+    tar+=text;
+    tar.append((512-text.size()%512)%512,'\0');
+}
 
-#endif  // REDI_PSTREAM_H_SEEN
-#endif  // WIN32
+/* end of archive: two zero blocks, padded to the default tar record size */
+void tar_finish(string &tar)
+{
+    tar.append(1024,'\0');
+    tar.append((10240-tar.size()%10240)%10240,'\0');
+}
 
-/* pstream END */
+/* output END */
 /* main START */
 
 inline string formatANISOU(const string &inputString)
@@ -2523,31 +1387,15 @@ int cifte(const string &infile, const string &outfile, string &pdbid,
 {
 
     stringstream buf;
-    if (infile=="-") buf<<cin.rdbuf();
-#if defined(REDI_PSTREAM_H_SEEN)
-    else if (EndsWith(infile,".gz"))
-    {
-        redi::ipstream fp_gz; // if file is compressed
-        fp_gz.open("gunzip -c "+infile);
-        buf<<fp_gz.rdbuf();
-        fp_gz.close();
-    }
-#endif
-    else
-    {
-        ifstream fp;
-        fp.open(infile.c_str(),ios::in); //ifstream fp(filename,ios::in);
-        buf<<fp.rdbuf();
-        fp.close();
-    }
-    vector<string> lines;
-    Split(buf.str(),lines,'\n'); 
-    buf.str(string());
+    InputFile input;
+    open_input(infile,input);
+    vector<string_view> lines;
+    SplitLines(string_view(input.data,input.size),lines);
     if (lines.size()<=1)
     {
         cerr<<"ERROR! Empty structure "<<infile<<endl;
-        vector<string>().swap(lines);
-        return 0;
+        close_input(input);
+        return -1;
     }
 
     /* parse PDB header */
@@ -2761,25 +1609,19 @@ COLUMNS        DATA  TYPE    FIELD        DEFINITION
     buf<<"# \n";
     
     /* output */
+    bool success=true;
     if (outfile=="" || outfile=="-")
         cout<<buf.str();
     else
     {
-        ofstream fout;
-        fout.open(outfile.c_str(),ofstream::out);
-        fout<<buf.str();
-        fout.close();
-        if (do_gzip)
-        {
-            line="gzip -f "+outfile;
-            i=system(line.c_str());
-            cout<<line<<endl;
-        }
+        success=write_file(outfile,buf.str(),do_gzip);
+        if (do_gzip) cout<<outfile<<".gz"<<endl;
     }
 
     /* clean up */
     buf.str(string());
-    vector<string>().swap(lines);
+    vector<string_view>().swap(lines);
+    close_input(input);
     string ().swap(group_PDB);
     string ().swap(atom_id);
     string ().swap(alt_id);
@@ -2795,9 +1637,211 @@ COLUMNS        DATA  TYPE    FIELD        DEFINITION
     string ().swap(type_symbol);
     string ().swap(pdbx_formal_charge);
     string ().swap(pdbx_PDB_model_num);
-    return 0;
+    return success?0:-1;
+}
+
+
+/* batch mode START */
+
+/* read list of input files, one per line. empty lines and lines starting
+ * with '#' are ignored */
+void read_batch_list(const string &listfile, vector<string> &infile_vec)
+{
+    ifstream fp;
+    fp.open(listfile.c_str(),ios::in);
+    if (!fp.good())
+    {
+        cerr<<"ERROR: cannot read list "<<listfile<<endl;
+        return;
+    }
+    string line;
+    while (getline(fp,line))
+    {
+        line=Trim(line);
+        if (line.size()==0 || line[0]=='#') continue;
+        infile_vec.push_back(line);
+    }
+    fp.close();
+    line.clear();
+}
+
+/* size of infile on disk, as listed in the manifest of a shard, as in
+ * BeEM.cpp. 0 if infile cannot be found */
+size_t input_size(const string &infile)
+{
+    struct stat st;
+    if (stat(infile.c_str(),&st)!=0) return 0;
+    return st.st_size;
+}
+
+/* FNV-1a hash, as in BeEM.cpp */
+unsigned long long stable_hash(const string_view text)
+{
+    unsigned long long hash=14695981039346656037ULL;
+    for (size_t i=0;i<text.size();i++)
+    {
+        hash^=(unsigned char)text[i];
+        hash*=1099511628211ULL;
+    }
+    return hash;
+}
+
+/* PDB ID of an input taken from its filename, as in BeEM.cpp */
+string input_id(const string &infile)
+{
+    string id=Lower(Basename(infile));
+    size_t pos=id.find('.');
+    bool ent=(pos!=string::npos && id.compare(pos,4,".ent")==0);
+    id=id.substr(0,pos);
+    if (ent && id.size()>3 && StartsWith(id,"pdb")) id=id.substr(3);
+    return id;
+}
+
+/* parse i/N of -shard=i/N, as in BeEM.cpp */
+bool parse_shard(const string &text, int &shard, int &shardNum)
+{
+    size_t pos=text.find('/');
+    if (pos==string::npos) return false;
+    shard   =atoi(text.substr(0,pos).c_str());
+    shardNum=atoi(text.substr(pos+1).c_str());
+    return shardNum>=1 && shard>=1 && shard<=shardNum;
+}
+
+/* slack of the loads of shards, as in BeEM.cpp */
+const size_t SHARD_SLACK=10;
+
+/* rendezvous score of shard s, as in BeEM.cpp */
+inline unsigned long long shard_score(const unsigned long long hash,
+    const int s)
+{
+    unsigned long long score=hash^((s+1)*0x9E3779B97F4A7C15ULL);
+    score=(score^(score>>30))*0xBF58476D1CE4E5B9ULL;
+    score=(score^(score>>27))*0x94D049BB133111EBULL;
+    return score^(score>>31);
+}
+
+/* keep in infile_vec only the inputs of shard i of shardNum. the inputs
+ * are assigned as in BeEM.cpp, see there for how it works, so that an
+ * entry has the same first choice of shard in both programs */
+void select_shard(vector<string> &infile_vec, const int shard,
+    const int shardNum)
+{
+    size_t f,k,cap,total=0;
+    int s,best;
+    unsigned long long score,best_score;
+    vector<size_t> size_vec(infile_vec.size());
+    vector<unsigned long long> hash_vec(infile_vec.size());
+    vector<size_t> order(infile_vec.size());
+    vector<size_t> load_vec(shardNum,0);
+    vector<bool> keep_vec(infile_vec.size(),false);
+    for (f=0;f<infile_vec.size();f++)
+    {
+        size_vec[f]=input_size(infile_vec[f]);
+        hash_vec[f]=stable_hash(input_id(infile_vec[f]));
+        total+=size_vec[f];
+        order[f]=f;
+    }
+
+    /* largest first */
+    sort(order.begin(),order.end(),[&](size_t a,size_t b)
+    {
+        if (size_vec[a]!=size_vec[b]) return size_vec[a]>size_vec[b];
+        if (hash_vec[a]!=hash_vec[b]) return hash_vec[a]<hash_vec[b];
+        return infile_vec[a]<infile_vec[b];
+    });
+
+    cap=total*(100+SHARD_SLACK)/100/shardNum+1;
+    for (k=0;k<order.size();k++)
+    {
+        f=order[k];
+        best=-1;
+        best_score=0;
+        for (s=0;s<shardNum;s++)
+        {
+            if (load_vec[s]>=cap) continue;
+            score=shard_score(hash_vec[f],s);
+            if (best<0 || score>best_score)
+            {
+                best=s;
+                best_score=score;
+            }
+        }
+        load_vec[best]+=size_vec[f];
+        keep_vec[f]=(best==shard-1);
+    }
+    for (f=k=0;f<infile_vec.size();f++)
+        if (keep_vec[f]) infile_vec[k++]=infile_vec[f];
+    infile_vec.resize(k);
+}
+
+/* name of the manifest of shard i of shardNum, as in BeEM.cpp */
+string shard_manifest(const string &program, const int shard,
+    const int shardNum)
+{
+    stringstream buf;
+    buf<<program<<"-shard-"<<shard<<"-of-"<<shardNum<<".tsv";
+    return buf.str();
+}
+
+/* line of the manifest of a shard for one input, as in BeEM.cpp */
+string manifest_line(const string &infile, const size_t size,
+    const bool success, const string &listing)
+{
+    string output=listing;
+    while (output.size() && output.back()=='\n') output.pop_back();
+    replace(output.begin(),output.end(),'\n',' ');
+    stringstream buf;
+    buf<<infile<<'\t'<<size<<'\t'<<(success?"ok":"failed")<<'\t'
+       <<output<<'\n';
+    return buf.str();
+}
+
+/* convert many input files one after another, writing input xxxx.pdb to
+ * xxxx.cif. return the number of failed inputs */
+int cifte_batch(const vector<string> &infile_vec, const int read_seqres,
+    const int read_dbref, const int do_gzip,
+    const vector<string>&outputChain_vec, const string &manifest="")
+{
+    string manifest_text;
+    string outfile,pdbid;
+    int failNum=0;
+    int status;
+    size_t f;
+    for (f=0;f<infile_vec.size();f++)
+    {
+        outfile=input_id(infile_vec[f])+".cif";
+        pdbid="";
+        status=cifte(infile_vec[f],outfile,pdbid,read_seqres,read_dbref,
+            do_gzip,outputChain_vec);
+        if (do_gzip) outfile+=".gz";
+        else if (status>=0) cout<<outfile<<endl;
+        if (status<0)
+        {
+            failNum++;
+            cerr<<"ERROR: cannot convert "<<infile_vec[f]<<endl;
+        }
+        if (manifest.size()) manifest_text+=manifest_line(infile_vec[f],
+            input_size(infile_vec[f]),status>=0,(status<0)?"":outfile);
+    }
+    if (failNum) cerr<<"ERROR: "<<failNum<<" of "<<infile_vec.size()
+        <<" input files failed"<<endl;
+
+    /* a shard without its manifest cannot be merged, so it fails too */
+    if (manifest.size())
+    {
+        manifest_text="#input\tsize\tstatus\toutput\n"+manifest_text;
+        if (write_file(manifest,manifest_text)) cout<<manifest<<endl;
+        else if (failNum==0) failNum=1;
+    }
+
+    /* clean up */
+    string().swap(manifest_text);
+    string().swap(outfile);
+    string().swap(pdbid);
+    return failNum;
 }
 
+/* batch mode END */
 
 int main(int argc,char **argv)
 {
@@ -2807,6 +1851,9 @@ int main(int argc,char **argv)
     int read_seqres=0;
     int read_dbref =0;
     int do_gzip    =0;
+    string listfile="";
+    int shard      =0;
+    int shardNum   =0;
     int a,b;
     vector<string> outputChain_vec;
 
@@ -2822,6 +1869,16 @@ int main(int argc,char **argv)
             do_gzip=atoi((((string)(argv[a])).substr(6)).c_str());
         else if (StartsWith(argv[a],"-chain="))
             Split(((string)(argv[a])).substr(7),outputChain_vec,',');
+        else if (StartsWith(argv[a],"-list="))
+            listfile=((string)(argv[a])).substr(6);
+        else if (StartsWith(argv[a],"-shard="))
+        {
+            if (!parse_shard(((string)(argv[a])).substr(7),shard,shardNum))
+            {
+                cerr<<"ERROR: -shard=i/N requires 1<=i<=N"<<endl;
+                return 1;
+            }
+        }
         else if ((string)(argv[a])=="-seqres")
             read_seqres=1;
         else if ((string)(argv[a])=="-dbref")
@@ -2839,20 +1896,47 @@ int main(int argc,char **argv)
         }
     }
 
-    if (infile.size()==0)
+    if (infile.size()==0 && listfile.size()==0)
     {
         cerr<<docstring;
         return 1;
     }
-    if (outfile.size()==0) outfile="-";
 
-    cifte(infile,outfile,pdbid,read_seqres,read_dbref,do_gzip,outputChain_vec);
+    int failNum=0;
+    if (listfile.size())
+    {
+        if (outfile.size() || pdbid.size())
+        {
+            cerr<<"ERROR: output.cif and -p=xxxx cannot be used in batch mode"
+                <<endl;
+            return 1;
+        }
+        vector<string> infile_vec;
+        read_batch_list(listfile,infile_vec);
+        if (infile.size()) infile_vec.push_back(infile);
+        if (shardNum) select_shard(infile_vec,shard,shardNum);
+        failNum=cifte_batch(infile_vec,read_seqres,read_dbref,do_gzip,
+            outputChain_vec,shardNum?shard_manifest("cifte",shard,shardNum):"");
+        vector<string> ().swap(infile_vec);
+    }
+    else if (shardNum)
+    {
+        cerr<<"ERROR: -shard=i/N can only be used in batch mode"<<endl;
+        return 1;
+    }
+    else
+    {
+        if (outfile.size()==0) outfile="-";
+        cifte(infile,outfile,pdbid,read_seqres,read_dbref,do_gzip,
+            outputChain_vec);
+    }
 
     /* clean up */
     string ().swap(infile);
     string ().swap(outfile);
+    string ().swap(listfile);
     vector<string> ().swap(outputChain_vec);
-    return 0;
+    return (failNum>0);
 }
 
 /* main END */